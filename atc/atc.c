@@ -5,6 +5,8 @@
 #include "../../cnc.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 #include "../file_system.h"
 
 #ifndef ATC_FS_DRIVE
@@ -18,6 +20,7 @@
 static fs_file_t *atc_file;
 static grbl_stream_t *prev_stream;
 static bool atc_running;
+static uint8_t atc_current_tool;
 
 static void atc_close()
 {
@@ -87,6 +90,341 @@ static void atc_open(uint8_t index, bool mount, uint8_t *status)
     } while (cnc_dotasks() && atc_running);
 }
 
+/**
+ * Tool setter
+ * Measures the mounted tool on a fixed tool setter wired to the probe input
+ * The tool approaches the setter at a fast feed, retracts and then latches the switch again at a slow feed
+ * The tool length offset is the difference between the trip height of the tool and the trip height of the reference tool and is applied with G43.1
+ * The measured lengths are kept per tool and optionally compared against the last measurement to detect a broken tool
+ */
+// measures the tool automatically after each mount
+#if defined(ATC_TOOL_SETTER_AUTO) && !defined(ATC_TOOL_SETTER)
+#define ATC_TOOL_SETTER
+#endif
+
+#ifdef ATC_TOOL_SETTER
+// tool setter position in machine coordinates
+#if !defined(ATC_TOOL_SETTER_X) || !defined(ATC_TOOL_SETTER_Y)
+#error "ATC_TOOL_SETTER_X and ATC_TOOL_SETTER_Y must be defined to use the tool setter"
+#endif
+// machine Z where the probing starts
+#ifndef ATC_TOOL_SETTER_Z
+#define ATC_TOOL_SETTER_Z 0
+#endif
+// machine Z used to travel to and from the tool setter
+#ifndef ATC_TOOL_SETTER_SAFE_Z
+#define ATC_TOOL_SETTER_SAFE_Z ATC_TOOL_SETTER_Z
+#endif
+// maximum probing distance (mm)
+#ifndef ATC_TOOL_SETTER_DISTANCE
+#define ATC_TOOL_SETTER_DISTANCE 50
+#endif
+// fast approach feed (mm/min)
+#ifndef ATC_TOOL_SETTER_FAST_FEED
+#define ATC_TOOL_SETTER_FAST_FEED 300
+#endif
+// slow latch feed (mm/min)
+#ifndef ATC_TOOL_SETTER_SLOW_FEED
+#define ATC_TOOL_SETTER_SLOW_FEED 25
+#endif
+// retract distance between the fast and the slow probe (mm)
+#ifndef ATC_TOOL_SETTER_RETRACT
+#define ATC_TOOL_SETTER_RETRACT 2
+#endif
+// tool whose length is the zero offset
+#ifndef ATC_TOOL_SETTER_REFERENCE_TOOL
+#define ATC_TOOL_SETTER_REFERENCE_TOOL 1
+#endif
+// maximum length difference to the last measurement before the tool is considered broken (mm)
+// #define ATC_TOOL_SETTER_BREAK_TOLERANCE 0.1
+
+#if (TOOL_COUNT > 32)
+#error "The tool setter supports up to 32 tools"
+#endif
+
+typedef struct
+{
+    uint32_t measured;
+    float length[TOOL_COUNT];
+} atc_tool_setter_t;
+
+static atc_tool_setter_t atc_tool_setter;
+
+#ifdef ENABLE_SETTINGS_MODULES
+static uint16_t atc_tool_setter_address;
+
+bool atc_tool_setter_settings_load(void *args)
+{
+    // a failed read (unwritten or corrupted memory) clears the tool lengths like a settings reset
+    // no tool is marked as measured so the reference tool must be measured again
+    if (settings_load(atc_tool_setter_address, &atc_tool_setter, sizeof(atc_tool_setter_t)) != STATUS_OK)
+    {
+        memset(&atc_tool_setter, 0, sizeof(atc_tool_setter_t));
+    }
+    return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(settings_extended_load, atc_tool_setter_settings_load);
+
+bool atc_tool_setter_settings_save(void *args)
+{
+    settings_save(atc_tool_setter_address, &atc_tool_setter, sizeof(atc_tool_setter_t));
+    return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(settings_extended_save, atc_tool_setter_settings_save);
+
+bool atc_tool_setter_settings_erase(void *args)
+{
+    settings_args_t *set = (settings_args_t *)args;
+    // resetting the main settings clears the tool lengths
+    if (set->address == SETTINGS_ADDRESS_OFFSET)
+    {
+        memset(&atc_tool_setter, 0, sizeof(atc_tool_setter_t));
+    }
+
+    return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(settings_extended_erase, atc_tool_setter_settings_erase);
+#endif
+
+// runs a single generated GCode line the same way the ATC scripts are run
+static const char *atc_line;
+
+static uint8_t atc_line_getc(void)
+{
+    char c = *atc_line;
+    if (c)
+    {
+        atc_line++;
+        return (uint8_t)c;
+    }
+    return EOL;
+}
+
+DECL_GRBL_STREAM(atc_line_stream, atc_line_getc, NULL, NULL, NULL, NULL);
+
+static uint8_t atc_run_line(const char *line)
+{
+    atc_line = line;
+#ifdef ENABLE_ATC_VERBOSE
+    grbl_stream_t *stream = grbl_stream_readonly(atc_line_getc, NULL, NULL);
+#else
+    grbl_stream_t *stream = grbl_stream_change(&atc_line_stream);
+#endif
+    uint8_t error = cnc_parse_cmd();
+    grbl_stream_change(stream); // restores the previous stream
+    return error;
+}
+
+// probes the tool on the tool setter and returns the trip height in machine coordinates
+static uint8_t atc_tool_setter_cycle(float *trip)
+{
+    char line[48];
+    uint8_t error;
+    int32_t steps[STEPPER_COUNT];
+    float pos[MAX(AXIS_COUNT, 3)];
+
+    // travel to the setter (all the cycle values are in mm)
+    str_sprintf(line, "G21G90G53G0Z%f", (float)ATC_TOOL_SETTER_SAFE_Z);
+    if ((error = atc_run_line(line)))
+    {
+        return error;
+    }
+    str_sprintf(line, "G53G0X%fY%f", (float)ATC_TOOL_SETTER_X, (float)ATC_TOOL_SETTER_Y);
+    if ((error = atc_run_line(line)))
+    {
+        return error;
+    }
+    str_sprintf(line, "G53G0Z%f", (float)ATC_TOOL_SETTER_Z);
+    if ((error = atc_run_line(line)))
+    {
+        return error;
+    }
+
+    // fast approach
+    str_sprintf(line, "G91G38.2Z-%fF%f", (float)ATC_TOOL_SETTER_DISTANCE, (float)ATC_TOOL_SETTER_FAST_FEED);
+    if ((error = atc_run_line(line)))
+    {
+        return error;
+    }
+    str_sprintf(line, "G0Z%f", (float)ATC_TOOL_SETTER_RETRACT);
+    if ((error = atc_run_line(line)))
+    {
+        return error;
+    }
+
+    // slow latch
+    str_sprintf(line, "G38.2Z-%fF%f", (float)(2 * ATC_TOOL_SETTER_RETRACT), (float)ATC_TOOL_SETTER_SLOW_FEED);
+    if ((error = atc_run_line(line)))
+    {
+        return error;
+    }
+    // the position is latched when the probe trips (the same reported by [PRB:])
+    // the motion only stops after decelerating
+    parser_get_probe(steps);
+    kinematics_steps_to_coordinates(steps, pos);
+    *trip = pos[AXIS_Z];
+
+    str_sprintf(line, "G90G53G0Z%f", (float)ATC_TOOL_SETTER_SAFE_Z);
+    return atc_run_line(line);
+}
+
+#ifndef MAX_MODAL_GROUPS
+#define MAX_MODAL_GROUPS 14
+#endif
+
+// runs the tool setter cycle and restores the motion mode, distance mode, units and feed of the job on every exit
+static uint8_t atc_tool_setter_probe(float *trip)
+{
+    uint8_t modes[MAX_MODAL_GROUPS];
+    uint16_t feed, spindle;
+    char line[48];
+    char motion[8];
+
+    parser_get_modes(modes, &feed, &spindle);
+    uint8_t error = atc_tool_setter_cycle(trip);
+
+    // the feed is stored in mm/min
+    float f = (modes[4] == 20) ? ((float)feed / 25.4f) : (float)feed;
+    if (modes[12])
+    {
+        str_sprintf(motion, "G%d.%d", modes[0], modes[12]);
+    }
+    else
+    {
+        str_sprintf(motion, "G%d", modes[0]);
+    }
+
+    if (feed)
+    {
+        str_sprintf(line, "G%dG%dF%f", modes[2], modes[4], f);
+    }
+    else
+    {
+        str_sprintf(line, "G%dG%d", modes[2], modes[4]);
+    }
+
+    // the motion modes that can't be set without a target (extended motions) are left in G0
+    uint8_t restore = atc_run_line(motion);
+    if (restore)
+    {
+        proto_info("MSG:Motion mode G%d not restored", modes[0]);
+    }
+    restore = atc_run_line(line);
+    return (error) ? error : restore;
+}
+
+static uint8_t atc_tool_measure(uint8_t tool)
+{
+    if (!tool || tool > TOOL_COUNT)
+    {
+        return STATUS_INVALID_TOOL;
+    }
+
+    float trip;
+    uint8_t error = atc_tool_setter_probe(&trip);
+    if (error)
+    {
+        return error;
+    }
+
+    uint32_t mask = (1UL << (tool - 1));
+#ifdef ATC_TOOL_SETTER_BREAK_TOLERANCE
+    if ((atc_tool_setter.measured & mask) && fabsf(trip - atc_tool_setter.length[tool - 1]) > ATC_TOOL_SETTER_BREAK_TOLERANCE)
+    {
+        proto_info("MSG:Tool %d length changed by %f", tool, trip - atc_tool_setter.length[tool - 1]);
+        return STATUS_INVALID_TOOL;
+    }
+#endif
+
+    atc_tool_setter.length[tool - 1] = trip;
+    atc_tool_setter.measured |= mask;
+#ifdef ENABLE_SETTINGS_MODULES
+    settings_save(atc_tool_setter_address, &atc_tool_setter, sizeof(atc_tool_setter_t));
+#endif
+
+    const uint32_t reference = (1UL << (ATC_TOOL_SETTER_REFERENCE_TOOL - 1));
+    if (!(atc_tool_setter.measured & reference))
+    {
+        proto_info("MSG:Reference tool not measured");
+        return STATUS_INVALID_TOOL;
+    }
+
+    // a longer tool trips the setter higher
+    // the lengths are in mm and the offset is set in the units of the job
+    uint8_t modes[MAX_MODAL_GROUPS];
+    uint16_t feed, spindle;
+    parser_get_modes(modes, &feed, &spindle);
+    float offset = trip - atc_tool_setter.length[ATC_TOOL_SETTER_REFERENCE_TOOL - 1];
+    if (modes[4] == 20)
+    {
+        offset /= 25.4f;
+    }
+
+    char line[32];
+    str_sprintf(line, "G43.1Z%f", offset);
+    return atc_run_line(line);
+}
+
+#ifdef ENABLE_PARSER_MODULES
+// $TLM measures the current tool and $TLM<tool> measures the given tool
+// $TLC clears all the stored tool lengths
+bool atc_tool_setter_cmd(void *args)
+{
+    grbl_cmd_args_t *ptr = (grbl_cmd_args_t *)args;
+    strupr((char *)ptr->cmd);
+
+    if (ptr->cmd[0] != 'T' || ptr->cmd[1] != 'L')
+    {
+        return EVENT_CONTINUE;
+    }
+
+    if (!strcmp((char *)&ptr->cmd[2], "C"))
+    {
+        memset(&atc_tool_setter, 0, sizeof(atc_tool_setter_t));
+#ifdef ENABLE_SETTINGS_MODULES
+        settings_save(atc_tool_setter_address, &atc_tool_setter, sizeof(atc_tool_setter_t));
+#endif
+        *(ptr->error) = STATUS_OK;
+        return EVENT_HANDLED;
+    }
+
+    if (ptr->cmd[2] != 'M')
+    {
+        return EVENT_CONTINUE;
+    }
+
+    uint8_t tool = atc_current_tool;
+    if (ptr->cmd[3])
+    {
+        uint16_t value = 0;
+        for (unsigned char *c = &ptr->cmd[3]; *c; c++)
+        {
+            if (*c < '0' || *c > '9')
+            {
+                return EVENT_CONTINUE;
+            }
+            value = value * 10 + (*c - '0');
+            // checked on each digit so the value never wraps
+            if (value > TOOL_COUNT)
+            {
+                *(ptr->error) = STATUS_INVALID_TOOL;
+                return EVENT_HANDLED;
+            }
+        }
+        tool = (uint8_t)value;
+    }
+
+    *(ptr->error) = atc_tool_measure(tool);
+    return EVENT_HANDLED;
+}
+
+CREATE_EVENT_LISTENER(grbl_cmd, atc_tool_setter_cmd);
+#endif
+#endif
+
 void atc_tool_unmount(uint8_t tool, uint8_t *status)
 {
 #ifdef ENABLE_MAIN_LOOP_MODULES
@@ -110,6 +448,16 @@ void atc_tool_mount(uint8_t tool, uint8_t *status)
     }
 
     atc_open(tool, true, status);
+    if (*status)
+    {
+        return;
+    }
+
+    atc_current_tool = tool;
+#ifdef ATC_TOOL_SETTER_AUTO
+    // measures the tool after a successful mount
+    *status = atc_tool_measure(tool);
+#endif
 #endif
 }
 
@@ -119,6 +467,17 @@ DECL_MODULE(atc)
     HOOK_ATTACH_CALLBACK(tool_atc_unmount, atc_tool_unmount);
     HOOK_ATTACH_CALLBACK(tool_atc_mount, atc_tool_mount);
 #endif
+#ifdef ATC_TOOL_SETTER
+#ifdef ENABLE_SETTINGS_MODULES
+    atc_tool_setter_address = settings_register_external_setting(sizeof(atc_tool_setter_t));
+    ADD_EVENT_LISTENER(settings_extended_load, atc_tool_setter_settings_load);
+    ADD_EVENT_LISTENER(settings_extended_save, atc_tool_setter_settings_save);
+    ADD_EVENT_LISTENER(settings_extended_erase, atc_tool_setter_settings_erase);
+#endif
+#ifdef ENABLE_PARSER_MODULES
+    ADD_EVENT_LISTENER(grbl_cmd, atc_tool_setter_cmd);
+#endif
+#endif
 #ifndef ENABLE_MAIN_LOOP_MODULES
 // just a warning in case you disabled the MAIN_LOOP option on build
 #warning "Main loop extensions are not enabled. Your module will not work."
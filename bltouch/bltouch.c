@@ -30,7 +30,10 @@
 #define BLTOUCH_PROBE_SERVO SERVO0
 #endif
 
+// time (ms) the probe takes to deploy or stow
+#ifndef BLTOUCH_DELAY
 #define BLTOUCH_DELAY 500
+#endif
 // tunned values with scope
 #define BLTOUCH_DEPLOY (23)             // 10º
 #define BLTOUCH_ALARM_REL_TOUCH_SW (85) // 60º
@@ -38,6 +41,34 @@
 #define BLTOUCH_SELF_TEST (165)         // 120º
 #define BLTOUCH_ALARM_REL_PUSH_UP (216) // 160º
 
+// the servo moves while the machine keeps running
+// the probe only waits for the remaining deploy time when probing starts
+static uint32_t bltouch_ready_time;
+static bool bltouch_deployed;
+// M401 keeps the probe deployed between probing cycles until M402
+static bool bltouch_stay_deployed;
+
+static void bltouch_wait(void)
+{
+    while ((int32_t)(bltouch_ready_time - mcu_millis()) > 0)
+    {
+        if (!cnc_dotasks())
+        {
+            return;
+        }
+    }
+}
+
+static void bltouch_set(bool deploy)
+{
+    if (bltouch_deployed != deploy)
+    {
+        bltouch_deployed = deploy;
+        mcu_set_servo(BLTOUCH_PROBE_SERVO, (deploy) ? BLTOUCH_DEPLOY : BLTOUCH_STOW);
+        bltouch_ready_time = mcu_millis() + BLTOUCH_DELAY;
+    }
+}
+
 bool bltouch_deploy(void *args);
 bool bltouch_stow(void *args);
 
@@ -46,18 +77,114 @@ CREATE_EVENT_LISTENER(probe_disable, bltouch_stow);
 
 bool bltouch_deploy(void *args)
 {
-    mcu_set_servo(BLTOUCH_PROBE_SERVO, BLTOUCH_DEPLOY);
-    cnc_delay_ms(BLTOUCH_DELAY);
+    // in M401 mode the probe was already re-extended when the previous probing ended
+    // this only waits for the remaining deploy time
+    bltouch_set(true);
+    bltouch_wait();
     return EVENT_CONTINUE;
 }
 
 bool bltouch_stow(void *args)
 {
-    mcu_set_servo(BLTOUCH_PROBE_SERVO, BLTOUCH_STOW);
-    cnc_delay_ms(BLTOUCH_DELAY);
+    if (bltouch_stay_deployed)
+    {
+        // the pin was pushed up (latched) by the touch
+        // the deploy command is sent again right away so the re-extension overlaps the travel to the next point
+        mcu_set_servo(BLTOUCH_PROBE_SERVO, BLTOUCH_DEPLOY);
+        bltouch_deployed = true;
+        bltouch_ready_time = mcu_millis() + BLTOUCH_DELAY;
+        return EVENT_CONTINUE;
+    }
+
+    bltouch_set(false);
+    bltouch_wait();
     return EVENT_CONTINUE;
 }
 
+#ifdef ENABLE_PARSER_MODULES
+// this ID must be unique for each code
+#define M401 EXTENDED_MCODE(401)
+#define M402 EXTENDED_MCODE(402)
+
+bool bltouch_parse(void *args);
+bool bltouch_exec(void *args);
+
+CREATE_EVENT_LISTENER(gcode_parse, bltouch_parse);
+CREATE_EVENT_LISTENER(gcode_exec, bltouch_exec);
+
+// this just parses and acceps the code
+bool bltouch_parse(void *args)
+{
+    gcode_parse_args_t *ptr = (gcode_parse_args_t *)args;
+    if (ptr->word == 'M' && (ptr->code == 401 || ptr->code == 402))
+    {
+        if (ptr->cmd->group_extended != 0)
+        {
+            // there is a collision of custom gcode commands (only one per line can be processed)
+            *(ptr->error) = STATUS_GCODE_MODAL_GROUP_VIOLATION;
+            return EVENT_HANDLED;
+        }
+        // tells the gcode validation and execution functions this is custom code M401/M402 (ID must be unique)
+        ptr->cmd->group_extended = (ptr->code == 401) ? M401 : M402;
+        *(ptr->error) = STATUS_OK;
+        return EVENT_HANDLED;
+    }
+
+    // if this is not catched by this parser, just send back the error so other extenders can process it
+    return EVENT_CONTINUE;
+}
+
+// this actually performs 2 steps in 1 (validation and execution)
+bool bltouch_exec(void *args)
+{
+    gcode_exec_args_t *ptr = (gcode_exec_args_t *)args;
+    switch (ptr->cmd->group_extended)
+    {
+    case M401:
+    case M402:
+        // the probe only moves after the previous moves end
+        if (itp_sync() != STATUS_OK)
+        {
+            *(ptr->error) = STATUS_CRITICAL_FAIL;
+            return EVENT_HANDLED;
+        }
+        break;
+    default:
+        return EVENT_CONTINUE;
+    }
+
+    switch (ptr->cmd->group_extended)
+    {
+    case M401:
+        // deploys without waiting (the deploy time overlaps the next moves) and keeps the probe deployed
+        bltouch_stay_deployed = true;
+        bltouch_set(true);
+        break;
+    case M402:
+        // stows without waiting
+        bltouch_stay_deployed = false;
+        bltouch_set(false);
+        break;
+    }
+
+    *(ptr->error) = STATUS_OK;
+    return EVENT_HANDLED;
+}
+#endif
+
+#ifdef ENABLE_MAIN_LOOP_MODULES
+// the servo position is unknown after a reset
+bool bltouch_reset(void *args)
+{
+    bltouch_stay_deployed = false;
+    bltouch_deployed = true;
+    bltouch_set(false);
+    return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(cnc_reset, bltouch_reset);
+#endif
+
 #endif
 
 DECL_MODULE(bltouch)
@@ -65,6 +192,13 @@ DECL_MODULE(bltouch)
 #ifdef ENABLE_IO_MODULES
     ADD_EVENT_LISTENER(probe_enable, bltouch_deploy);
     ADD_EVENT_LISTENER(probe_disable, bltouch_stow);
+#ifdef ENABLE_PARSER_MODULES
+    ADD_EVENT_LISTENER(gcode_parse, bltouch_parse);
+    ADD_EVENT_LISTENER(gcode_exec, bltouch_exec);
+#endif
+#ifdef ENABLE_MAIN_LOOP_MODULES
+    ADD_EVENT_LISTENER(cnc_reset, bltouch_reset);
+#endif
 #else
 #warning "IO extensions are not enabled. BLTouch will not work."
 #endif
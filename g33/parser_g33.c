@@ -41,44 +41,202 @@
 #error "G33 requires to have an assigned encoder"
 #endif
 
-// enable this to use the encoder pulse as the feedback loop marker/trigger
-//  #define G33_FEEDBACK_LOOP_USE_ENC_PULSE
+// the synched steps are counted by the itp_rt_stepbits callback during the threading motion
+// the single axis homing only attaches it while homing but the modules below keep it attached from startup
+#if defined(M62_M65_SYNC_OUTPUTS) || defined(M67_M68_SYNC_OUTPUTS) || defined(S_CLUSTER_RT_SYNC) || defined(ENABLE_LASER_RASTER)
+#error "G33 can't be used with other modules that use the itp_rt_stepbits hook"
+#endif
+
+// the spindle position and speed are tracked by an alpha-beta filter
+// the index pulses set the absolute spindle phase and the encoder counts give the position in between index pulses
+// the encoder is sampled every G33_ESTIMATOR_PERIOD (in us)
+// if the encoder resolution is 1 (index only) the filter is updated on each index pulse
+#ifndef G33_ESTIMATOR_PERIOD
+#define G33_ESTIMATOR_PERIOD 5000
+#endif
+// filter gains for the encoder samples
+#ifndef G33_ESTIMATOR_ALPHA
+#define G33_ESTIMATOR_ALPHA 0.5f
+#endif
+#ifndef G33_ESTIMATOR_BETA
+#define G33_ESTIMATOR_BETA 0.15f
+#endif
+// position error correction gain (step rate added per step of error)
+#ifndef G33_SYNC_GAIN
+#define G33_SYNC_GAIN 10.0f
+#endif
+
+// G33.1 rigid tapping
+// the tap follows the spindle past the programmed depth while the spindle stops (up to this amount of revolutions)
+#ifndef G33_1_OVERTRAVEL
+#define G33_1_OVERTRAVEL 2.0f
+#endif
+// spindle speed bellow which the spindle is considered to be reversing
+#ifndef G33_1_REVERSAL_RPM
+#define G33_1_REVERSAL_RPM 10.0f
+#endif
 
 // uncomment to allow data verbose of sync constants
 // the message output is
-// [MSG:<spindle index counter>:<expected_step_position>:<current_step_position>:<error>:<encoder_rpm>]
+// [MSG:<spindle position>:<expected_step_position>:<current_step_position>:<error>:<estimated_rpm>]
 // #define G33_DEBUG
 
+// uncomment to record a synchronization trace without printing while synched
+// the trace is a ring buffer with the last G33_TRACE_SIZE records since the last G33/G33.1/G76 started
+// it's filled by the index and step callbacks and the sync loop and is printed after the cut with the $G33T command
+// each record is printed as [G33T:<hex>] where hex are 18 bytes (little endian)
+// <type:u8><status:u8><time us:u32><step counter:i32><value:i32><rate:i32>
+// type 0 (index pulse) value is the index count
+// type 1 (step) is recorded every 2^G33_TRACE_STEP_SHIFT synched steps
+// type 2 (correction) value is the position error in steps and rate is the new step rate in steps/s
+// #define G33_TRACE
+#ifdef G33_TRACE
+#ifndef G33_TRACE_SIZE
+#define G33_TRACE_SIZE 128
+#endif
+#ifndef G33_TRACE_STEP_SHIFT
+#define G33_TRACE_STEP_SHIFT 5
+#endif
+#endif
+
 #define SYNC_DISABLED 0
 #define SYNC_READY 1
 #define SYNC_STARTING 2
 #define SYNC_RUNNING 4
-#define SYNC_UPDATED 8
 
 static volatile int32_t itp_sync_step_counter;		// step distance counter for synched motions
 static volatile uint8_t synched_motion_status;		// synched motion status/phase
 static volatile int32_t spindle_index_counter;		// spindle index pulse counter
-static int32_t spindle_index_counter_start;			// spindle index pulse initial offset when motion starts
+static int32_t spindle_index_lag;					// spindle revolutions the motion lags behind the spindle after the acceleration
+static volatile int32_t spindle_index_origin;		// spindle index count that matches the motion start (plus the lag)
 static volatile int32_t spindle_index_step_counter; // step distance counter when the spindle index pulses
-static volatile int32_t spindle_index_time;			// index pulse timestamp in us
-static volatile int32_t spindle_index_last_time;	// index pulse previous timestamp in us
-static uint32_t steps_per_index;					// motion steps per index pulse
-#ifdef G33_FEEDBACK_LOOP_USE_ENC_PULSE
-static uint32_t update_loop_index_counter; // keeps the last update loop index counter
-#endif
+static volatile uint32_t spindle_index_time;		// index pulse timestamp in us
+static volatile bool spindle_index_updated;			// new index pulse
+static float steps_per_rev;							// motion steps per spindle revolution
+static float spindle_sync_offset;					// spindle revolutions offset of the synched motion origin (used by the rigid tapping return)
+static volatile bool spindle_index_realign;			// the index pulse realigns the encoder counter
+static volatile bool spindle_sync_follow;			// the motion follows the spindle even outside the constant speed phase
+static volatile uint32_t spindle_reverse_steps;		// step count at which the spindle is reversed (0 disables)
+static volatile int16_t spindle_reverse_speed;		// reversed tool speed
 static uint32_t motion_total_steps;
 static float motion_total_distance;
 static int32_t current_error;
 static float rpm_to_stepfeed_constant;
 static uint32_t enc_res;
 
+#ifdef G33_TRACE
+#define G33_TRACE_INDEX 0
+#define G33_TRACE_STEP 1
+#define G33_TRACE_CORRECTION 2
+
+typedef struct
+{
+	uint32_t time;
+	int32_t steps;
+	int32_t value;
+	int32_t rate;
+	uint8_t type;
+	uint8_t status;
+} g33_trace_t;
+
+static g33_trace_t g33_trace[G33_TRACE_SIZE];
+static volatile uint16_t g33_trace_head;
+static volatile uint16_t g33_trace_count;
+
+// can be called from the ISR's and the main loop
+static void g33_trace_add(uint8_t type, uint32_t time, int32_t steps, int32_t value, int32_t rate)
+{
+	ATOMIC_CODEBLOCK
+	{
+		uint16_t head = g33_trace_head;
+		g33_trace_t *record = &g33_trace[head];
+		record->time = time;
+		record->steps = steps;
+		record->value = value;
+		record->rate = rate;
+		record->type = type;
+		record->status = synched_motion_status;
+		if (++head == G33_TRACE_SIZE)
+		{
+			head = 0;
+		}
+		g33_trace_head = head;
+		if (g33_trace_count < G33_TRACE_SIZE)
+		{
+			g33_trace_count++;
+		}
+	}
+}
+#endif
+
+typedef struct
+{
+	float position;		  // spindle position in revolutions
+	float speed;		  // spindle speed in revolutions per second
+	uint32_t time;		  // last sample timestamp in us
+	int32_t travel_last;  // last encoder count (travel mode)
+	int32_t travel_count; // encoder counts travelled in any direction (travel mode)
+	uint8_t samples;
+	bool travel; // the position is the travelled distance (the spindle can reverse)
+	bool enabled;
+} spindle_estimator_t;
+
+static spindle_estimator_t spindle_estimator;
+
+static void spindle_estimator_update(uint32_t time, float position, float alpha, float beta)
+{
+	float dt = (float)(time - spindle_estimator.time) * 0.000001f;
+	switch (spindle_estimator.samples)
+	{
+	case 0:
+		spindle_estimator.position = position;
+		spindle_estimator.samples = 1;
+		break;
+	case 1:
+		// the first speed is taken from the first two samples
+		if (dt <= 0)
+		{
+			return;
+		}
+		spindle_estimator.speed = (position - spindle_estimator.position) / dt;
+		spindle_estimator.position = position;
+		spindle_estimator.samples = 2;
+		break;
+	default:
+		if (dt <= 0)
+		{
+			return;
+		}
+		// predicts the position at the sample time and corrects both position and speed with the residue
+		float predicted = spindle_estimator.position + spindle_estimator.speed * dt;
+		float residue = position - predicted;
+		spindle_estimator.position = predicted + alpha * residue;
+		spindle_estimator.speed += beta * residue / dt;
+		break;
+	}
+
+	spindle_estimator.time = time;
+}
+
 #if (MCU == MCU_VIRTUAL_WIN)
 // used with the virtual emulator to simulate pulses
+// enable this to simulate a spindle load disturbance
+// the spindle slows down up to 10% during the first second of every 4 seconds
+// #define G33_SIMULATE_LOAD
 void mcu_stimul_inputs(volatile VIRTUAL_MAP *virtualmap, uint64_t micros)
 {
 	static uint64_t last_stim = 0, last_stimsync = 0;
-	uint64_t next_stim = last_stim + 120000;			 // 120RPM
-	uint64_t next_stimsync = last_stimsync + 120000 / 4; // 120RPM
+	uint64_t period = 120000; // 120RPM
+#ifdef G33_SIMULATE_LOAD
+	uint32_t load = (uint32_t)(micros % 4000000);
+	if (load < 1000000)
+	{
+		load = (load < 500000) ? load : (1000000 - load);
+		period += (period * load) / 5000000;
+	}
+#endif
+	uint64_t next_stim = last_stim + period;
+	uint64_t next_stimsync = last_stimsync + period / 4;
 
 	if (micros >= next_stimsync)
 	{
@@ -100,7 +258,7 @@ void itp_rt_stepcount_cb_handler(uint8_t stepbits, uint8_t itp_flags)
 {
 	if (itp_flags & ITP_SYNC)
 	{
-		if (itp_flags & ITP_CONST)
+		if ((itp_flags & ITP_CONST) || spindle_sync_follow)
 		{
 			synched_motion_status |= SYNC_RUNNING;
 		}
@@ -108,24 +266,30 @@ void itp_rt_stepcount_cb_handler(uint8_t stepbits, uint8_t itp_flags)
 		{
 			synched_motion_status &= ~SYNC_RUNNING;
 		}
-		itp_sync_step_counter++;
-	}
-}
-
-#ifdef G33_FEEDBACK_LOOP_USE_ENC_PULSE
-#define _g33_enc_pulse_(X) enc##X##_pulse(void)
-#define _g33_enc_pulse(X) _g33_enc_pulse_(X)
-#define g33_enc_pulse(X) _g33_enc_pulse(X)
+		uint32_t steps = ++itp_sync_step_counter;
+#ifdef G33_TRACE
+		if (!(steps & ((1UL << G33_TRACE_STEP_SHIFT) - 1)))
+		{
+			g33_trace_add(G33_TRACE_STEP, mcu_micros(), steps, 0, 0);
+		}
+#endif
 
-void g33_enc_pulse(G33_ENCODER)
-{
-	if (synched_motion_status >= SYNC_RUNNING)
+		// rigid tapping reached the programmed depth
+		if (spindle_reverse_steps && steps >= spindle_reverse_steps)
+		{
+			spindle_reverse_steps = 0;
+			tool_set_speed(spindle_reverse_speed);
+			// from here the motion follows the spindle until it reverses
+			spindle_index_realign = false;
+			spindle_sync_follow = true;
+		}
+	}
+	else
 	{
-		spindle_index_step_counter = itp_sync_step_counter;
-		synched_motion_status |= SYNC_UPDATED;
+		// motions queued after the synched motion
+		synched_motion_status &= ~SYNC_RUNNING;
 	}
 }
-#endif
 
 void spindle_index_cb_handler(void)
 {
@@ -133,34 +297,29 @@ void spindle_index_cb_handler(void)
 	// allow to measure RPM (using the index pin instead of the encoder)
 	uint32_t now = mcu_micros();
 	int32_t index = spindle_index_counter;
-	spindle_index_last_time = spindle_index_time;
-	spindle_index_time = now;
 	index++;
+	spindle_index_time = now;
+	// store the step position at the time the index pulse happens
+	spindle_index_step_counter = itp_sync_step_counter;
+	// syncs the pulse counter with the index counter
+	if (spindle_index_realign)
+	{
+		encoder_reset_position(G33_ENCODER, index * (int32_t)enc_res);
+	}
 
-	switch (synched_motion_status)
+	if (synched_motion_status == SYNC_READY)
 	{
-	case SYNC_READY:
 		// the spindle index starts synchronized motion
 		itp_start(false);
 		synched_motion_status = SYNC_STARTING;
-		index = spindle_index_counter_start;
-#ifdef G33_FEEDBACK_LOOP_USE_ENC_PULSE
-		encoder_reset_position(G33_ENCODER, index * enc_res); // syncs the pulse counter with the index counter
-#endif
-		break;
-	default:
-#ifndef G33_FEEDBACK_LOOP_USE_ENC_PULSE
-		if (index > 0 && synched_motion_status >= SYNC_RUNNING)
-		{
-			synched_motion_status |= SYNC_UPDATED;
-			// store the step position at the time the index pulse happens
-			spindle_index_step_counter = itp_sync_step_counter;
-		}
-#endif
-		break;
+		spindle_index_origin = index + spindle_index_lag;
 	}
 
 	spindle_index_counter = index;
+	spindle_index_updated = true;
+#ifdef G33_TRACE
+	g33_trace_add(G33_TRACE_INDEX, now, spindle_index_step_counter, index, 0);
+#endif
 }
 
 #ifdef G33_INDEX_PIN
@@ -170,12 +329,309 @@ CREATE_EVENT_LISTENER(input_change, spindle_index_cb_handler);
 // this ID must be unique for each code
 #define G33 33
 
+static void g33_release(void)
+{
+	synched_motion_status = SYNC_DISABLED;
+	spindle_estimator.enabled = false;
+	spindle_reverse_steps = 0;
+	spindle_sync_follow = false;
+// encoder_dettach_index_cb();
+#if (G33_ENCODER == ENC0)
+	HOOK_RELEASE(enc0_index);
+#elif (G33_ENCODER == ENC1)
+	HOOK_RELEASE(enc1_index);
+#elif (G33_ENCODER == ENC2)
+	HOOK_RELEASE(enc2_index);
+#elif (G33_ENCODER == ENC3)
+	HOOK_RELEASE(enc3_index);
+#elif (G33_ENCODER == ENC4)
+	HOOK_RELEASE(enc4_index);
+#elif (G33_ENCODER == ENC5)
+	HOOK_RELEASE(enc5_index);
+#elif (G33_ENCODER == ENC6)
+	HOOK_RELEASE(enc6_index);
+#elif (G33_ENCODER == ENC7)
+	HOOK_RELEASE(enc7_index);
+#endif
+	HOOK_RELEASE(itp_rt_stepbits);
+}
+
 bool g33_parse(void *args);
 bool g33_exec(void *args);
 
 CREATE_EVENT_LISTENER(gcode_parse, g33_parse);
 CREATE_EVENT_LISTENER(gcode_exec, g33_exec);
 
+// this ID must be unique for each code
+#define G76 76
+
+bool g76_parse(void *args);
+bool g76_exec(void *args);
+
+CREATE_EVENT_LISTENER(gcode_parse, g76_parse);
+CREATE_EVENT_LISTENER(gcode_exec, g76_exec);
+
+// attaches the spindle callbacks and waits for the estimator to lock on the spindle speed
+static uint8_t g33_spindle_lock(motion_data_t *block_data)
+{
+	// syncs motions and sets spindle
+	if (mc_update_tools(block_data) != STATUS_OK)
+	{
+		return STATUS_CRITICAL_FAIL;
+	}
+
+	enc_res = ((uint32_t)g_settings.encoders_resolution[G33_ENCODER]);
+
+	// resets the spindle estimator
+	ATOMIC_CODEBLOCK
+	{
+		spindle_index_counter = 0;
+		spindle_index_updated = false;
+		spindle_index_realign = true;
+		spindle_sync_follow = false;
+		spindle_reverse_steps = 0;
+		spindle_sync_offset = 0;
+		memset(&spindle_estimator, 0, sizeof(spindle_estimator_t));
+		spindle_estimator.enabled = true;
+#ifdef G33_TRACE
+		g33_trace_head = 0;
+		g33_trace_count = 0;
+#endif
+	}
+
+	// attach the index event callback
+#if (G33_ENCODER == ENC0)
+	HOOK_ATTACH_CALLBACK(enc0_index, spindle_index_cb_handler);
+#elif (G33_ENCODER == ENC1)
+	HOOK_ATTACH_CALLBACK(enc1_index, spindle_index_cb_handler);
+#elif (G33_ENCODER == ENC2)
+	HOOK_ATTACH_CALLBACK(enc2_index, spindle_index_cb_handler);
+#elif (G33_ENCODER == ENC3)
+	HOOK_ATTACH_CALLBACK(enc3_index, spindle_index_cb_handler);
+#elif (G33_ENCODER == ENC4)
+	HOOK_ATTACH_CALLBACK(enc4_index, spindle_index_cb_handler);
+#elif (G33_ENCODER == ENC5)
+	HOOK_ATTACH_CALLBACK(enc5_index, spindle_index_cb_handler);
+#elif (G33_ENCODER == ENC6)
+	HOOK_ATTACH_CALLBACK(enc6_index, spindle_index_cb_handler);
+#elif (G33_ENCODER == ENC7)
+	HOOK_ATTACH_CALLBACK(enc7_index, spindle_index_cb_handler);
+#endif
+
+	// this code can be removed as the initial reading of the G33 RPM ensures the spindle is running
+
+	// if (!block_data->motion_flags.bit.spindle_running)
+	// {
+	// 	*(ptr->error) = STATUS_SPINDLE_RPM_ERROR;
+	// 	return EVENT_HANDLED;
+	// }
+
+	// // update tool
+	// mc_update_tools(block_data);
+
+#ifdef TOOL_WAIT_FOR_SPEED
+	// wait for spindle to reach the desired speed
+	uint16_t programmed_speed = block_data->spindle;
+	uint16_t at_speed_threshold = lroundf(TOOL_WAIT_FOR_SPEED_MAX_ERROR * 0.01f * programmed_speed);
+
+	// wait for tool at speed
+	uint32_t start_spindle_time = mcu_millis();
+	while (ABS(programmed_speed - encoder_get_rpm(G33_ENCODER)) > at_speed_threshold)
+	{
+		if (!cnc_dotasks() || (mcu_millis() - start_spindle_time) > (DELAY_ON_RESUME_SPINDLE * 1000))
+		{
+			return STATUS_SPINDLE_RPM_ERROR;
+		}
+	}
+#endif
+	// waits for the estimator to get the spindle speed from two index pulses
+	while (spindle_estimator.samples < 2)
+	{
+		if (!cnc_dotasks())
+		{
+			return STATUS_CRITICAL_FAIL;
+		}
+	}
+
+	return STATUS_OK;
+}
+
+// queues a motion synchronized with the spindle (pitch is the distance per revolution)
+// the motion starts on the next index pulse
+// if follow is set the motion starts right away and follows the spindle from the current spindle position (the spindle can be starting)
+// if reverse_at is set the spindle is reversed to spindle_reverse_speed at that fraction of the motion (rigid tapping)
+static uint8_t g33_sync_line(float *target, motion_data_t *block_data, float pitch, bool follow, float reverse_at)
+{
+	float index_rpm = spindle_estimator.speed * 60.0f;
+
+	if (follow)
+	{
+		// the motion is planned for the programmed speed
+		index_rpm = (float)ABS(block_data->spindle);
+	}
+
+	// spindle speed ins not valid
+	if (index_rpm < 1)
+	{
+		return STATUS_SPINDLE_RPM_ERROR;
+	}
+
+	// gets the starting point
+	float prev_target[AXIS_COUNT];
+	mc_get_position(prev_target);
+	kinematics_apply_transform(prev_target);
+	int32_t prev_step_pos[STEPPER_COUNT];
+	kinematics_apply_inverse(prev_target, prev_step_pos);
+
+	// gets the exit point (copies to prevent modifying target vector)
+	float line_dist = 0;
+	float dir_vect[AXIS_COUNT];
+	memcpy(dir_vect, target, sizeof(dir_vect));
+	kinematics_apply_transform(dir_vect);
+	int32_t next_step_pos[STEPPER_COUNT];
+	kinematics_apply_inverse(dir_vect, next_step_pos);
+
+	// calculates amount of motion vector
+	for (uint8_t i = AXIS_COUNT; i != 0;)
+	{
+		i--;
+		dir_vect[i] -= prev_target[i];
+		line_dist += dir_vect[i] * dir_vect[i];
+	}
+
+	line_dist = sqrtf(line_dist);
+	motion_total_distance = line_dist;
+	float inv_dist = fast_flt_inv(line_dist);
+
+	// determines the normalized direction vector
+	// and the maximum acceleration
+	float max_feed = FLT_MAX;
+	float max_accel = FLT_MAX;
+
+	for (uint8_t i = 0; i < AXIS_DIR_VECTORS; i++)
+	{
+		float normal_vect = dir_vect[i] * inv_dist;
+		dir_vect[i] = normal_vect;
+		normal_vect = ABS(normal_vect);
+		// denormalize max feed rate for each axis
+		float denorm_param = fast_flt_div(g_settings.max_feed_rate[i], normal_vect);
+		max_feed = MIN(max_feed, denorm_param);
+		max_feed = MIN(max_feed, F_STEP_MAX);
+		denorm_param = fast_flt_div(g_settings.acceleration[i], normal_vect);
+		max_accel = MIN(max_accel, denorm_param);
+	}
+
+	// calculates the total number of steps in the motion
+	uint32_t total_steps = 0;
+	for (uint8_t i = AXIS_TO_STEPPERS; i != 0;)
+	{
+		i--;
+		int32_t steps = next_step_pos[i] - prev_step_pos[i];
+
+		steps = ABS(steps);
+		if (total_steps < (uint32_t)steps)
+		{
+			total_steps = steps;
+		}
+	}
+
+	motion_total_steps = total_steps;
+	// the reversal must be set before the motion can start
+	spindle_reverse_steps = (reverse_at > 0) ? (uint32_t)lroundf((float)total_steps * reverse_at) : 0;
+
+	// from this the factor to convert from RPM to step feed can be obtained
+	// step rate = rpm_to_stepfeed_constant * RPM
+	rpm_to_stepfeed_constant = pitch * total_steps * MIN_SEC_MULT / line_dist;
+
+	// calculates the feedrate based in the K factor and the programmed spindle RPM
+	// spindle is in Rev/min and K is in units(mm) per Rev Rev/min * mm/Rev = mm/min
+	float total_revs = line_dist / pitch;
+	float feed = pitch * index_rpm;
+	if (feed > max_feed)
+	{
+		return STATUS_MAX_STEP_RATE_EXCEEDED;
+	}
+
+	// calculates the expected number of steps per revolution
+	steps_per_rev = (float)total_steps / total_revs;
+
+	block_data->feed = feed;
+	block_data->motion_flags.bit.synched = 1;
+	block_data->max_accel = max_accel;
+
+	// convert feed to mm/s
+	feed *= MIN_SEC_MULT;
+
+	// The thread feed is given by:
+	// vf = (RPM / 60) * K
+	// and the thread position at any given time t(s) is expressed as
+	// x = vf * t
+	// on a linear acceleration the motion will ALWAYS stay behind because of the acceleration phase
+	// the real thread path is given by:
+	// xreal = (vf^2) / (2 * a) + vf * (t - tacc)
+	// we can also express this as the ideal position version minus the acceleration triangle area (valid for constant acceleration)
+	// xreal = vf * t - (vf^2) / (2 * a)
+	// the error is expressed as
+	// e = x - xreal = (vf^2) / (2 * a)
+	// the thread correct position is a multiple of pitch K
+	// the motion will always lag behind a bit. The acceleration can be tuned so that the lag is exctly P multiples of pitch K
+	// e = P * K
+	// replacing the value of error
+	// (vf^2) / (2 * a) = P * K
+	// solving this for acceleration we get
+	// a = (vf^2) / (2 * P * K)
+	// replacing vf from the first equation we get
+	// a = (K * RPM^2) / (7200 * P)
+
+	// resets the step counter
+	itp_sync_step_counter = 0;
+	current_error = 0;
+
+	if (follow)
+	{
+		spindle_index_lag = 0;
+		// the current spindle position is the origin of the motion
+		spindle_sync_offset = spindle_estimator.position - spindle_index_origin;
+		spindle_sync_follow = true;
+		if (mc_line(target, block_data) != STATUS_OK)
+		{
+			return STATUS_CRITICAL_FAIL;
+		}
+
+		HOOK_ATTACH_CALLBACK(itp_rt_stepbits, itp_rt_stepcount_cb_handler);
+		synched_motion_status = SYNC_STARTING;
+		itp_start(false);
+		return STATUS_OK;
+	}
+
+	// calculate the minimum acceleration time
+	float accel_time = feed / max_accel;
+	// calculate the time per revolution
+	float rev_time = 60 / index_rpm;
+
+	// calculate the minimum amount of revs needed to reach the target speed
+	float p_revs = ceilf(accel_time / rev_time);
+	// calculate the new acceleration given an additional revolution to compensate for the lag
+	float new_accel = pitch * index_rpm * index_rpm / (p_revs * 7200);
+	block_data->max_accel = new_accel;
+
+	spindle_index_lag = (int32_t)p_revs;
+	spindle_sync_offset = 0;
+
+	if (mc_line(target, block_data) != STATUS_OK)
+	{
+		return STATUS_CRITICAL_FAIL;
+	}
+
+	// attach the stepcounter callback
+	HOOK_ATTACH_CALLBACK(itp_rt_stepbits, itp_rt_stepcount_cb_handler);
+
+	// flag the spindle index callback that it can start the threading motion
+	synched_motion_status = SYNC_READY;
+
+	return STATUS_OK;
+}
+
 // this just parses and accepts the code
 bool g33_parse(void *args)
 {
@@ -189,18 +645,18 @@ bool g33_parse(void *args)
 			*(ptr->error) = STATUS_GCODE_MODAL_GROUP_VIOLATION;
 			return EVENT_HANDLED;
 		}
-		// checks if it's G5 or G5.1
+		// checks if it's G33 or G33.1
 		// check mantissa
 		uint8_t mantissa = (uint8_t)lroundf(((ptr->value - ptr->code) * 100.0f));
 
-		if (mantissa != 0)
+		if (mantissa != 0 && mantissa != 10)
 		{
 			*(ptr->error) = STATUS_GCODE_UNSUPPORTED_COMMAND;
 			return EVENT_HANDLED;
 		}
 
 		ptr->new_state->groups.motion = G33;
-		ptr->new_state->groups.motion_mantissa = 0;
+		ptr->new_state->groups.motion_mantissa = mantissa / 10;
 		SETFLAG(ptr->cmd->groups, GCODE_GROUP_MOTION);
 		ptr->cmd->group_extended = EXTENDED_MOTION_GCODE(33);
 		*(ptr->error) = STATUS_OK;
@@ -211,6 +667,124 @@ bool g33_parse(void *args)
 	return EVENT_CONTINUE;
 }
 
+// G33.1 rigid tapping
+// the tap goes in synched with the spindle like G33 and the spindle is reversed right at the programmed depth
+// the tap keeps following the spindle while it stops (up to G33_1_OVERTRAVEL revolutions past the depth)
+// as soon as the spindle reverses the remaining motion is discarded and the tap returns to the start point following the spindle
+// at the end the programmed spindle direction is restored
+static uint8_t g33_1_rigid_tap(gcode_exec_args_t *ptr)
+{
+	// the reversal can only be followed with the encoder counts
+	if (g_settings.encoders_resolution[G33_ENCODER] <= 1 || !ptr->block_data->spindle)
+	{
+		return STATUS_SPINDLE_RPM_ERROR;
+	}
+
+	float pitch = ptr->words->ijk[2];
+	float start[AXIS_COUNT];
+	float target[AXIS_COUNT];
+	mc_get_position(start);
+
+	// extends the motion past the programmed depth
+	float length = 0;
+	for (uint8_t i = AXIS_COUNT; i != 0;)
+	{
+		i--;
+		float d = ptr->target[i] - start[i];
+		length += d * d;
+	}
+	length = sqrtf(length);
+	if (length == 0)
+	{
+		return STATUS_INVALID_STATEMENT;
+	}
+
+	float overtravel = (length + G33_1_OVERTRAVEL * pitch) / length;
+	for (uint8_t i = AXIS_COUNT; i != 0;)
+	{
+		i--;
+		target[i] = start[i] + (ptr->target[i] - start[i]) * overtravel;
+	}
+
+	motion_data_t block_data;
+	memcpy(&block_data, ptr->block_data, sizeof(motion_data_t));
+
+	uint8_t error = g33_spindle_lock(ptr->block_data);
+	if (error == STATUS_OK)
+	{
+		// the spindle is reversed by the step counter callback right at the programmed depth
+		int16_t speed = tool_range_speed((float)ABS(ptr->block_data->spindle));
+		spindle_reverse_speed = (ptr->block_data->spindle > 0) ? -speed : speed;
+		error = g33_sync_line(target, &block_data, pitch, false, 1.0f / overtravel);
+	}
+
+	if (error != STATUS_OK)
+	{
+		g33_release();
+		return error;
+	}
+
+	// waits for the spindle to reverse
+	float min_rpm = FLT_MAX, start_rpm = 0;
+	for (;;)
+	{
+		if (!cnc_dotasks())
+		{
+			g33_release();
+			return STATUS_CRITICAL_FAIL;
+		}
+
+		if (spindle_reverse_steps)
+		{
+			// still going in
+			continue;
+		}
+
+		float rpm = spindle_estimator.speed * 60.0f;
+		if (!start_rpm)
+		{
+			start_rpm = rpm;
+		}
+		min_rpm = MIN(min_rpm, rpm);
+
+		// the spindle stopped or it's speeding up after slowing down
+		if (rpm < G33_1_REVERSAL_RPM || (min_rpm < (0.5f * start_rpm) && rpm > (min_rpm + G33_1_REVERSAL_RPM)))
+		{
+			break;
+		}
+	}
+
+	// discards the remaining motion and syncs the position at the reversal point
+	synched_motion_status = SYNC_DISABLED;
+	itp_stop();
+	itp_clear();
+	planner_clear();
+	mc_sync_position();
+
+	// returns to the start point following the spindle
+	memcpy(&block_data, ptr->block_data, sizeof(motion_data_t));
+	block_data.spindle = -block_data.spindle;
+	error = g33_sync_line(start, &block_data, pitch, true, 0);
+
+	// wait for the motion to end
+	if (error == STATUS_OK && itp_sync() != STATUS_OK)
+	{
+		error = STATUS_CRITICAL_FAIL;
+	}
+
+	g33_release();
+
+	if (error == STATUS_OK)
+	{
+		// restores the programmed spindle direction
+		error = mc_update_tools(ptr->block_data);
+		// the cycle ends at the start point
+		memcpy(ptr->target, start, sizeof(start));
+	}
+
+	return error;
+}
+
 // this actually performs 2 steps in 1 (validation and execution)
 bool g33_exec(void *args)
 {
@@ -231,264 +805,329 @@ bool g33_exec(void *args)
 			return EVENT_HANDLED;
 		}
 
-		// syncs motions and sets spindle
-		if (mc_update_tools(ptr->block_data) != STATUS_OK)
+		if (ptr->new_state->groups.motion_mantissa == 1)
 		{
-			*(ptr->error) = STATUS_CRITICAL_FAIL;
+			*(ptr->error) = g33_1_rigid_tap(ptr);
 			return EVENT_HANDLED;
 		}
 
-		enc_res = ((uint32_t)g_settings.encoders_resolution[G33_ENCODER]);
-
-		// attach the index event callback
-#if (G33_ENCODER == ENC0)
-		HOOK_ATTACH_CALLBACK(enc0_index, spindle_index_cb_handler);
-#elif (G33_ENCODER == ENC1)
-		HOOK_ATTACH_CALLBACK(enc1_index, spindle_index_cb_handler);
-#elif (G33_ENCODER == ENC2)
-		HOOK_ATTACH_CALLBACK(enc2_index, spindle_index_cb_handler);
-#elif (G33_ENCODER == ENC3)
-		HOOK_ATTACH_CALLBACK(enc3_index, spindle_index_cb_handler);
-#elif (G33_ENCODER == ENC4)
-		HOOK_ATTACH_CALLBACK(enc4_index, spindle_index_cb_handler);
-#elif (G33_ENCODER == ENC5)
-		HOOK_ATTACH_CALLBACK(enc5_index, spindle_index_cb_handler);
-#elif (G33_ENCODER == ENC6)
-		HOOK_ATTACH_CALLBACK(enc6_index, spindle_index_cb_handler);
-#elif (G33_ENCODER == ENC7)
-		HOOK_ATTACH_CALLBACK(enc7_index, spindle_index_cb_handler);
-#endif
+		uint8_t error = g33_spindle_lock(ptr->block_data);
+		if (error == STATUS_OK)
+		{
+			error = g33_sync_line(ptr->target, ptr->block_data, ptr->words->ijk[2], false, 0);
+		}
 
-		// this code can be removed as the initial reading of the G33 RPM ensures the spindle is running
+		// wait for the motion to end
+		if (error == STATUS_OK && itp_sync() != STATUS_OK)
+		{
+			error = STATUS_CRITICAL_FAIL;
+		}
 
-		// if (!ptr->block_data->motion_flags.bit.spindle_running)
-		// {
-		// 	*(ptr->error) = STATUS_SPINDLE_RPM_ERROR;
-		// 	return EVENT_HANDLED;
-		// }
+		g33_release();
 
-		// // update tool
-		// mc_update_tools(ptr->block_data);
+		*(ptr->error) = error;
+		return EVENT_HANDLED;
+	}
 
-#ifdef TOOL_WAIT_FOR_SPEED
-		// wait for spindle to reach the desired speed
-		uint16_t programmed_speed = ptr->block_data->spindle;
-		uint16_t at_speed_threshold = lroundf(TOOL_WAIT_FOR_SPEED_MAX_ERROR * 0.01f * programmed_speed);
+	return EVENT_CONTINUE;
+}
 
-		// wait for tool at speed
-		uint32_t start_spindle_time = mcu_millis();
-		while (ABS(programmed_speed - encoder_get_rpm(G33_ENCODER)) > at_speed_threshold)
+// G76 threading cycle
+// G76 Z<thread end> P<pitch> I<thread peak offset> J<first pass depth> K<thread depth> [R<depth degression>] [Q<compound angle>] [L<spring passes>] [E<chamfer out length>]
+// the drive line is the current X position
+// negative I values cut external threads and positive I values cut internal threads
+// the pass depths are J * n^(1/R) up to the full depth K followed by L spring passes at the full depth
+// each pass start is offset along the drive line by depth * tan(Q) in the cut direction
+// the passes end with a chamfer that reaches the thread peak at Z end (the slope is K/E, so the full depth chamfer is E long)
+// the spindle is locked once and each retract and return is queued behind the cut so the next pass starts on the next index pulse
+// the cycle ends at the drive line at Z end
+static float g76_chamfer;
+
+bool g76_parse(void *args)
+{
+	gcode_parse_args_t *ptr = (gcode_parse_args_t *)args;
+	if (ptr->word == 'G' && ptr->code == 76)
+	{
+		// stops event propagation
+		if (ptr->cmd->group_extended != 0 || CHECKFLAG(ptr->cmd->groups, GCODE_GROUP_MOTION))
 		{
-			if (!cnc_dotasks() || (mcu_millis() - start_spindle_time) > (DELAY_ON_RESUME_SPINDLE * 1000))
-			{
-				*(ptr->error) = STATUS_SPINDLE_RPM_ERROR;
-				return EVENT_HANDLED;
-			}
+			// there is a collision of custom gcode commands (only one per line can be processed)
+			*(ptr->error) = STATUS_GCODE_MODAL_GROUP_VIOLATION;
+			return EVENT_HANDLED;
 		}
-#endif
-		uint32_t t = 0, delta_t = 0;
+		// check mantissa
+		uint8_t mantissa = (uint8_t)lroundf(((ptr->value - ptr->code) * 100.0f));
 
-		for (;;)
+		if (mantissa != 0)
 		{
-			ATOMIC_CODEBLOCK
-			{
-				delta_t = spindle_index_time;
-				t = spindle_index_last_time;
-			}
-			if (t)
-			{
-				break;
-			}
-			cnc_dotasks();
+			*(ptr->error) = STATUS_GCODE_UNSUPPORTED_COMMAND;
+			return EVENT_HANDLED;
 		}
 
-		delta_t -= t;
-		float index_rpm = 1000000.0f / ((float)delta_t * MIN_SEC_MULT);
+		ptr->new_state->groups.motion = G76;
+		ptr->new_state->groups.motion_mantissa = 0;
+		SETFLAG(ptr->cmd->groups, GCODE_GROUP_MOTION);
+		ptr->cmd->group_extended = EXTENDED_MOTION_GCODE(76);
+		g76_chamfer = 0;
+		*(ptr->error) = STATUS_OK;
+		return EVENT_HANDLED;
+	}
 
-		// spindle speed ins not valid
-		if (index_rpm < 1)
+	// the chamfer out length word (must come after G76 in the same line)
+	if (ptr->word == 'E' && ptr->cmd->group_extended == EXTENDED_MOTION_GCODE(76))
+	{
+		if (ptr->value < 0)
 		{
-			*(ptr->error) = STATUS_SPINDLE_RPM_ERROR;
+			*(ptr->error) = STATUS_NEGATIVE_VALUE;
 			return EVENT_HANDLED;
 		}
+		g76_chamfer = ptr->value;
+		*(ptr->error) = STATUS_OK;
+		return EVENT_HANDLED;
+	}
 
-		// gets the starting point
-		float prev_target[AXIS_COUNT];
-		mc_get_position(prev_target);
-		kinematics_apply_transform(prev_target);
-		int32_t prev_step_pos[STEPPER_COUNT];
-		kinematics_apply_inverse(prev_target, prev_step_pos);
+	// if this is not catched by this parser, just send back the error so other extenders can process it
+	return EVENT_CONTINUE;
+}
 
-		// gets the exit point (copies to prevent modifying target vector)
-		float line_dist = 0;
-		float dir_vect[AXIS_COUNT];
-		memcpy(dir_vect, ptr->target, sizeof(dir_vect));
-		kinematics_apply_transform(dir_vect);
-		int32_t next_step_pos[STEPPER_COUNT];
-		kinematics_apply_inverse(dir_vect, next_step_pos);
+static uint8_t g76_rapid(float *target, motion_data_t *block_data)
+{
+	motion_data_t rapid_data;
+	memcpy(&rapid_data, block_data, sizeof(motion_data_t));
+	rapid_data.feed = FLT_MAX;
+	return mc_line(target, &rapid_data);
+}
 
-		// calculates amount of motion vector
-		for (uint8_t i = AXIS_COUNT; i != 0;)
+bool g76_exec(void *args)
+{
+	gcode_exec_args_t *ptr = (gcode_exec_args_t *)args;
+	if (ptr->cmd->group_extended == EXTENDED_MOTION_GCODE(76))
+	{
+		if (!CHECKFLAG(ptr->cmd->words, GCODE_WORD_Z))
 		{
-			i--;
-			dir_vect[i] -= prev_target[i];
-			line_dist += dir_vect[i] * dir_vect[i];
+			// it's an error no thread end is specified
+			*(ptr->error) = STATUS_GCODE_NO_AXIS_WORDS;
+			return EVENT_HANDLED;
 		}
 
-		line_dist = sqrtf(line_dist);
-		motion_total_distance = line_dist;
-		float inv_dist = fast_flt_inv(line_dist);
-
-		// determines the normalized direction vector
-		// and the maximum acceleration
-		float max_feed = FLT_MAX;
-		float max_accel = FLT_MAX;
-
-		for (uint8_t i = 0; i < AXIS_DIR_VECTORS; i++)
+		if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_X))
 		{
-			float normal_vect = dir_vect[i] * inv_dist;
-			dir_vect[i] = normal_vect;
-			normal_vect = ABS(normal_vect);
-			// denormalize max feed rate for each axis
-			float denorm_param = fast_flt_div(g_settings.max_feed_rate[i], normal_vect);
-			max_feed = MIN(max_feed, denorm_param);
-			max_feed = MIN(max_feed, F_STEP_MAX);
-			denorm_param = fast_flt_div(g_settings.acceleration[i], normal_vect);
-			max_accel = MIN(max_accel, denorm_param);
+			// the drive line is the current X position
+			*(ptr->error) = STATUS_GCODE_AXIS_COMMAND_CONFLICT;
+			return EVENT_HANDLED;
 		}
 
-		// calculates the total number of steps in the motion
-		uint32_t total_steps = 0;
-		for (uint8_t i = AXIS_TO_STEPPERS; i != 0;)
+		if ((ptr->cmd->words & (GCODE_WORD_P | GCODE_WORD_I | GCODE_WORD_J | GCODE_WORD_K)) != (GCODE_WORD_P | GCODE_WORD_I | GCODE_WORD_J | GCODE_WORD_K))
 		{
-			i--;
-			int32_t steps = next_step_pos[i] - prev_step_pos[i];
-
-			steps = ABS(steps);
-			if (total_steps < (uint32_t)steps)
-			{
-				total_steps = steps;
-			}
+			// it's an error all thread words must be specified
+			*(ptr->error) = STATUS_GCODE_VALUE_WORD_MISSING;
+			return EVENT_HANDLED;
 		}
 
-		motion_total_steps = total_steps;
+		float pitch = ptr->words->p;
+		float peak = ptr->words->ijk[0];
+		float first_depth = ptr->words->ijk[1];
+		float full_depth = ptr->words->ijk[2];
+		float degression = CHECKFLAG(ptr->cmd->words, GCODE_WORD_R) ? ptr->words->r : 1.0f;
+		float compound = CHECKFLAG(ptr->cmd->words, GCODE_WORD_Q) ? ptr->words->d : 0.0f;
+		int8_t spring_passes = CHECKFLAG(ptr->cmd->words, GCODE_WORD_L) ? ptr->words->l : 0;
 
-		// from this the factor to convert from RPM to step feed can be obtained
-		// step rate = rpm_to_stepfeed_constant * RPM
-		rpm_to_stepfeed_constant = ptr->words->ijk[2] * total_steps * MIN_SEC_MULT / line_dist;
-
-		// calculates the feedrate based in the K factor and the programmed spindle RPM
-		// spindle is in Rev/min and K is in units(mm) per Rev Rev/min * mm/Rev = mm/min
-		float total_revs = line_dist / ptr->words->ijk[2];
-		float feed = ptr->words->ijk[2] * index_rpm;
-		if (feed > max_feed)
+		if (pitch <= 0 || first_depth <= 0 || full_depth <= 0 || spring_passes < 0)
 		{
-			*(ptr->error) = STATUS_MAX_STEP_RATE_EXCEEDED;
+			*(ptr->error) = STATUS_NEGATIVE_VALUE;
 			return EVENT_HANDLED;
 		}
 
-		// calculates the expected number of steps per revolution
-		float steps_per_rev = (float)total_steps / total_revs;
-		steps_per_index = lroundf(steps_per_rev);
-
-		ptr->block_data->feed = feed;
-		ptr->block_data->motion_flags.bit.synched = 1;
-		ptr->block_data->max_accel = max_accel;
-
-		// convert feed to mm/s
-		feed *= MIN_SEC_MULT;
-
-		// The thread feed is given by:
-		// vf = (RPM / 60) * K
-		// and the thread position at any given time t(s) is expressed as
-		// x = vf * t
-		// on a linear acceleration the motion will ALWAYS stay behind because of the acceleration phase
-		// the real thread path is given by:
-		// xreal = (vf^2) / (2 * a) + vf * (t - tacc)
-		// we can also express this as the ideal position version minus the acceleration triangle area (valid for constant acceleration)
-		// xreal = vf * t - (vf^2) / (2 * a)
-		// the error is expressed as
-		// e = x - xreal = (vf^2) / (2 * a)
-		// the thread correct position is a multiple of pitch K
-		// the motion will always lag behind a bit. The acceleration can be tuned so that the lag is exctly P multiples of pitch K
-		// e = P * K
-		// replacing the value of error
-		// (vf^2) / (2 * a) = P * K
-		// solving this for acceleration we get
-		// a = (vf^2) / (2 * P * K)
-		// replacing vf from the first equation we get
-		// a = (K * RPM^2) / (7200 * P)
-
-		// calculate the minimum acceleration time
-		float accel_time = feed / max_accel;
-		// calculate the time per revolution
-		float rev_time = 60 / index_rpm;
-
-		// calculate the minimum amount of revs needed to reach the target speed
-		float p_revs = ceilf(accel_time / rev_time);
-		// calculate the new acceleration given an additional revolution to compensate for the lag
-		float new_accel = ptr->words->ijk[2] * index_rpm * index_rpm / (p_revs * 7200);
-		ptr->block_data->max_accel = new_accel;
-
-		spindle_index_counter_start = -(uint32_t)(p_revs);
-
-		// resets indexes
-		spindle_index_counter = 0;
-		itp_sync_step_counter = 0;
-
-// resets the correction loop
-#ifdef G33_FEEDBACK_LOOP_USE_ENC_PULSE
-		update_loop_index_counter = 0;
-#endif
+		// gets the starting point (on the drive line)
+		float pass[AXIS_COUNT];
+		mc_get_position(pass);
+		float drive_x = pass[AXIS_X];
+		float start_z = pass[AXIS_Z];
+		float end_z = ptr->target[AXIS_Z];
+		float length = end_z - start_z;
 
-		if (mc_line(ptr->target, ptr->block_data) != STATUS_OK)
+		if (peak == 0 || degression < 1 || compound < 0 || compound >= 90 || g76_chamfer >= ABS(length))
 		{
-			*(ptr->error) = STATUS_CRITICAL_FAIL;
+			*(ptr->error) = STATUS_INVALID_STATEMENT;
 			return EVENT_HANDLED;
 		}
 
-		// attach the stepcounter callback
-		HOOK_ATTACH_CALLBACK(itp_rt_stepbits, itp_rt_stepcount_cb_handler);
-
-		// flag the spindle index callback that it can start the threading motion
-		synched_motion_status = SYNC_READY;
+		float dir = (length > 0) ? 1.0f : -1.0f;
+		float depth_dir = (peak > 0) ? 1.0f : -1.0f;
+		float crest_x = drive_x + peak;
+		compound = tanf(compound * (float)M_PI / 180.0f);
+		degression = 1.0f / degression;
+
+		// keeps the parser block data for all the cycle motions
+		motion_data_t block_data;
+		memcpy(&block_data, ptr->block_data, sizeof(motion_data_t));
+		memcpy(pass, ptr->target, sizeof(pass));
+
+		uint8_t error = g33_spindle_lock(ptr->block_data);
+		uint16_t pass_count = 1;
+		float depth = first_depth;
+		if (depth > full_depth)
+		{
+			depth = full_depth;
+		}
 
-		// wait for the motion to end
-		if (itp_sync() != STATUS_OK)
+		// moves to the first pass start
+		if (error == STATUS_OK)
 		{
-			*(ptr->error) = STATUS_CRITICAL_FAIL;
-			return EVENT_HANDLED;
+			pass[AXIS_X] = drive_x;
+			pass[AXIS_Z] = start_z + dir * depth * compound;
+			error = g76_rapid(pass, &block_data);
+			pass[AXIS_X] = crest_x + depth_dir * depth;
+			if (error == STATUS_OK)
+			{
+				error = g76_rapid(pass, &block_data);
+			}
+			if (error == STATUS_OK && itp_sync() != STATUS_OK)
+			{
+				error = STATUS_CRITICAL_FAIL;
+			}
 		}
 
-		synched_motion_status = SYNC_DISABLED;
+		while (error == STATUS_OK)
+		{
+			// threading pass
+			// the chamfer starts where the pass meets the chamfer cone
+			pass[AXIS_Z] = end_z - dir * g76_chamfer * depth / full_depth;
+			motion_data_t cut_data;
+			memcpy(&cut_data, &block_data, sizeof(motion_data_t));
+			error = g33_sync_line(pass, &cut_data, pitch, false, 0);
+			if (error != STATUS_OK)
+			{
+				break;
+			}
 
-// encoder_dettach_index_cb();
-#if (G33_ENCODER == ENC0)
-		HOOK_RELEASE(enc0_index);
-#elif (G33_ENCODER == ENC1)
-		HOOK_RELEASE(enc1_index);
-#elif (G33_ENCODER == ENC2)
-		HOOK_RELEASE(enc2_index);
-#elif (G33_ENCODER == ENC3)
-		HOOK_RELEASE(enc3_index);
-#elif (G33_ENCODER == ENC4)
-		HOOK_RELEASE(enc4_index);
-#elif (G33_ENCODER == ENC5)
-		HOOK_RELEASE(enc5_index);
-#elif (G33_ENCODER == ENC6)
-		HOOK_RELEASE(enc6_index);
-#elif (G33_ENCODER == ENC7)
-		HOOK_RELEASE(enc7_index);
-#endif
-		HOOK_RELEASE(itp_rt_stepbits);
+			if (g76_chamfer > 0)
+			{
+				// the chamfer keeps the pitch feed along Z (not synched)
+				float dz = g76_chamfer * depth / full_depth;
+				memcpy(&cut_data, &block_data, sizeof(motion_data_t));
+				cut_data.feed = pitch * spindle_estimator.speed * 60.0f * sqrtf(dz * dz + depth * depth) / dz;
+				pass[AXIS_X] = crest_x;
+				pass[AXIS_Z] = end_z;
+				error = mc_line(pass, &cut_data);
+			}
 
-		*(ptr->error) = STATUS_OK;
+			// retracts to the drive line
+			pass[AXIS_X] = drive_x;
+			if (error == STATUS_OK)
+			{
+				error = g76_rapid(pass, &block_data);
+			}
+
+			// last pass done
+			if (depth >= full_depth && !spring_passes)
+			{
+				if (error == STATUS_OK && itp_sync() != STATUS_OK)
+				{
+					error = STATUS_CRITICAL_FAIL;
+				}
+				break;
+			}
+
+			// next pass depth
+			if (depth < full_depth)
+			{
+				depth = first_depth * powf((float)(++pass_count), degression);
+				if (depth > full_depth)
+				{
+					depth = full_depth;
+				}
+			}
+			else
+			{
+				spring_passes--;
+			}
+
+			// returns to the next pass start
+			pass[AXIS_Z] = start_z + dir * depth * compound;
+			if (error == STATUS_OK)
+			{
+				error = g76_rapid(pass, &block_data);
+			}
+			pass[AXIS_X] = crest_x + depth_dir * depth;
+			if (error == STATUS_OK)
+			{
+				error = g76_rapid(pass, &block_data);
+			}
+
+			// waits for the pass to end
+			if (error == STATUS_OK && itp_sync() != STATUS_OK)
+			{
+				error = STATUS_CRITICAL_FAIL;
+			}
+		}
+
+		g33_release();
+
+		*(ptr->error) = error;
 		return EVENT_HANDLED;
 	}
 
 	return EVENT_CONTINUE;
 }
 
+#ifdef G33_TRACE
+static void g33_trace_print_bytes(uint32_t value, uint8_t len)
+{
+	const char hex[] = "0123456789ABCDEF";
+	while (len--)
+	{
+		proto_putc(hex[(value >> 4) & 0x0F]);
+		proto_putc(hex[value & 0x0F]);
+		value >>= 8;
+	}
+}
+
+// $G33T prints the synchronization trace (oldest record first)
+bool g33_trace_cmd(void *args)
+{
+	grbl_cmd_args_t *ptr = (grbl_cmd_args_t *)args;
+	strupr((char *)ptr->cmd);
+
+	if (strcmp((char *)ptr->cmd, "G33T"))
+	{
+		return EVENT_CONTINUE;
+	}
+
+	// can't print while synched
+	if (synched_motion_status)
+	{
+		*(ptr->error) = STATUS_SYSTEM_GC_LOCK;
+		return EVENT_HANDLED;
+	}
+
+	uint16_t count = g33_trace_count;
+	uint16_t i = (g33_trace_head + G33_TRACE_SIZE - count) % G33_TRACE_SIZE;
+	while (count--)
+	{
+		g33_trace_t *record = &g33_trace[i];
+		proto_print("[G33T:");
+		g33_trace_print_bytes(record->type, 1);
+		g33_trace_print_bytes(record->status, 1);
+		g33_trace_print_bytes(record->time, 4);
+		g33_trace_print_bytes((uint32_t)record->steps, 4);
+		g33_trace_print_bytes((uint32_t)record->value, 4);
+		g33_trace_print_bytes((uint32_t)record->rate, 4);
+		proto_putc(']');
+		proto_putc('\n');
+		proto_putc('\r');
+		if (++i == G33_TRACE_SIZE)
+		{
+			i = 0;
+		}
+	}
+
+	*(ptr->error) = STATUS_OK;
+	return EVENT_HANDLED;
+}
+CREATE_EVENT_LISTENER(grbl_cmd, g33_trace_cmd);
+#endif
+
 #endif
 
 #ifdef ENABLE_MAIN_LOOP_MODULES
@@ -508,89 +1147,121 @@ bool g33_proto_status(void *args)
 }
 CREATE_EVENT_LISTENER(proto_status, g33_proto_status);
 
-bool spindle_sync_update_loop(void *ptr)
+// samples the spindle position and the step position at the same time and updates the estimator
+static bool spindle_sync_sample(int32_t *step_counter)
 {
-	if ((synched_motion_status & SYNC_UPDATED))
+	uint32_t time;
+	int32_t counts;
+
+	if (spindle_index_updated)
 	{
+		ATOMIC_CODEBLOCK
+		{
+			spindle_index_updated = false;
+			time = spindle_index_time;
+			counts = spindle_index_counter;
+			*step_counter = spindle_index_step_counter;
+		}
 
-		int32_t error, index_step_counter, index_counter;
-		uint32_t t = 0, delta_t = 0;
-		// gets a snapshot of the current spindle index position, and the step position at the time of the index pulse
+		// with an encoder the index pulse only starts the estimator
+		// after that it just realigns the encoder counter
+		if (enc_res <= 1 || spindle_estimator.samples < 2)
+		{
+			// the index pulse is an exact position sample (no filtering)
+			spindle_estimator_update(time, (float)counts, 1.0f, 1.0f);
+			return true;
+		}
+	}
+
+	if (enc_res > 1 && spindle_estimator.samples >= 2 && (mcu_micros() - spindle_estimator.time) >= G33_ESTIMATOR_PERIOD)
+	{
 		ATOMIC_CODEBLOCK
 		{
-#ifdef G33_FEEDBACK_LOOP_USE_ENC_PULSE
-			index_counter = encoder_get_position(G33_ENCODER);
-#else
-			index_counter = spindle_index_counter;
-#endif
-			synched_motion_status &= ~SYNC_UPDATED;
-			index_step_counter = spindle_index_step_counter;
-			delta_t = spindle_index_time;
-			t = spindle_index_last_time;
+			time = mcu_micros();
+			counts = encoder_get_position(G33_ENCODER);
+			*step_counter = itp_sync_step_counter;
 		}
 
-#ifdef G33_FEEDBACK_LOOP_USE_ENC_PULSE
-		delta_t = encoder_get_delta(G33_ENCODER) * g_settings.encoders_resolution[G33_ENCODER];
-#else
-		delta_t -= t;
-#endif
-		float index_rpm = 1000000.0f / ((float)delta_t * MIN_SEC_MULT);
-		if (index_rpm < 1)
+		float position = (float)counts / (float)enc_res;
+		if (!spindle_index_realign)
+		{
+			// the spindle can reverse so the position is the travelled distance
+			if (!spindle_estimator.travel)
+			{
+				spindle_estimator.travel = true;
+				spindle_estimator.travel_last = counts;
+				spindle_estimator.travel_count = counts;
+			}
+			int32_t delta = counts - spindle_estimator.travel_last;
+			spindle_estimator.travel_last = counts;
+			spindle_estimator.travel_count += ABS(delta);
+			position = (float)spindle_estimator.travel_count / (float)enc_res;
+		}
+
+		spindle_estimator_update(time, position, G33_ESTIMATOR_ALPHA, G33_ESTIMATOR_BETA);
+		return true;
+	}
+
+	return false;
+}
+
+bool spindle_sync_update_loop(void *ptr)
+{
+	if (!spindle_estimator.enabled)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	int32_t step_counter;
+	if (!spindle_sync_sample(&step_counter))
+	{
+		return EVENT_CONTINUE;
+	}
+
+	float index_rpm = spindle_estimator.speed * 60.0f;
+
+	if ((synched_motion_status >= SYNC_RUNNING))
+	{
+		// the motion stops with the spindle when following it
+		if (index_rpm < 1 && !spindle_sync_follow)
 		{
 			cnc_alarm(EXEC_ALARM_SPINDLE_SYNC_FAIL);
 			return STATUS_CRITICAL_FAIL;
 		}
 
 		// calculate the spindle position
-		int32_t expected_position = index_counter * steps_per_index;
-#ifdef G33_FEEDBACK_LOOP_USE_ENC_PULSE
-		expected_position /= g_settings.encoders_resolution[G33_ENCODER];
-#endif
+		int32_t expected_position = (int32_t)lroundf((spindle_estimator.position - spindle_index_origin - spindle_sync_offset) * steps_per_rev);
 
 		// if negative the axis are ahead of spindle and need to slow down
 		// if positive the axis are behind the spindle and need to speed up.
-		error = expected_position - index_step_counter;
+		int32_t error = expected_position - step_counter;
 		current_error = error;
 
-		// #ifdef G33_DEBUG
-		//  cnc_call_rt_command(CMD_CODE_REPORT);
-		// #endif
-
-		if (error)
+		// the feed follows the estimated spindle speed and the error is corrected in 1/G33_SYNC_GAIN seconds
+		float new_step_rate = rpm_to_stepfeed_constant * index_rpm + G33_SYNC_GAIN * error;
+		// the motion can't go backwards (just crawls if ahead of a stopped spindle)
+		if (new_step_rate < 1)
 		{
-			float new_step_rate = rpm_to_stepfeed_constant * index_rpm;
-#ifdef G33_FEEDBACK_LOOP_USE_ENC_PULSE
-			new_step_rate += error * g_settings.encoders_resolution[G33_ENCODER];
-#else
-			new_step_rate += error;
-#endif
-			// this updates the interpolator right on the next step and the current motion in the planner
-			itp_update_feed(new_step_rate);
+			new_step_rate = 1;
 		}
+		// this updates the interpolator right on the next step and the current motion in the planner
+		itp_update_feed(new_step_rate);
+#ifdef G33_TRACE
+		g33_trace_add(G33_TRACE_CORRECTION, spindle_estimator.time, step_counter, error, (int32_t)new_step_rate);
+#endif
 
 #ifdef G33_DEBUG
-		proto_info("MSG:Spindle turns %ld, expected pos %ld, real pos %ld, error: %ld, rpm %f", index_counter, expected_position, index_step_counter, error, index_rpm);
+		proto_info("MSG:Spindle pos %f, expected pos %ld, real pos %ld, error: %ld, rpm %f", spindle_estimator.position, expected_position, step_counter, error, index_rpm);
 #endif
 	}
-	else if (synched_motion_status)
+	else
 	{
 #ifdef G33_DEBUG
 		static uint32_t prev_print = 0;
 		uint32_t elapsed = mcu_millis() - prev_print;
 		if (elapsed > 1000)
 		{
-			uint32_t t = 0, delta_t = 0;
-			ATOMIC_CODEBLOCK
-			{
-				delta_t = spindle_index_time;
-				t = spindle_index_last_time;
-			}
-			delta_t -= t;
-			if (delta_t)
-			{
-				float index_rpm = 1000000.0f / ((float)delta_t * MIN_SEC_MULT);
-				proto_info("MSG:G33 TOOL RPM %f", index_rpm);
-			}
+			proto_info("MSG:G33 TOOL RPM %f", index_rpm);
 			prev_print = mcu_millis();
 		}
 #endif
@@ -608,6 +1279,11 @@ DECL_MODULE(g33)
 #ifdef ENABLE_PARSER_MODULES
 	ADD_EVENT_LISTENER(gcode_parse, g33_parse);
 	ADD_EVENT_LISTENER(gcode_exec, g33_exec);
+	ADD_EVENT_LISTENER(gcode_parse, g76_parse);
+	ADD_EVENT_LISTENER(gcode_exec, g76_exec);
+#ifdef G33_TRACE
+	ADD_EVENT_LISTENER(grbl_cmd, g33_trace_cmd);
+#endif
 #else
 #error "Parser extensions are not enabled. G33 code extension will not work."
 #endif
@@ -0,0 +1,176 @@
+/*
+	Minimal host replacement of the µCNC core API used by parser_g33.c
+	Only what the module needs to build on the host. The motion and the spindle are implemented by the simulation (test_spindle_load.c)
+*/
+
+#ifndef CNC_H
+#define CNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define UCNC_MODULE_VERSION 11600
+
+#define ENABLE_PARSER_MODULES
+#define ENABLE_MAIN_LOOP_MODULES
+#define ENABLE_RT_SYNC_MOTIONS
+
+#define MCU 0
+#define MCU_VIRTUAL_WIN 1
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define ABS(a) (((a) < 0) ? -(a) : (a))
+#define CHECKFLAG(a, b) ((a) & (b))
+#define SETFLAG(a, b) ((a) |= (b))
+#define FORCEINLINE inline
+#define ATOMIC_CODEBLOCK for (int __a = 1; __a; __a = 0)
+#define fast_flt_inv(x) (1.0f / (x))
+#define fast_flt_div(x, y) ((x) / (y))
+#define MIN_SEC_MULT 0.0166666667f
+#define F_STEP_MAX 30000
+
+#define AXIS_COUNT 3
+#define STEPPER_COUNT 3
+#define AXIS_TO_STEPPERS 3
+#define AXIS_X 0
+#define AXIS_Y 1
+#define AXIS_Z 2
+
+#define STATUS_OK 0
+#define STATUS_INVALID_STATEMENT 3
+#define STATUS_NEGATIVE_VALUE 4
+#define STATUS_SYSTEM_GC_LOCK 9
+#define STATUS_GCODE_UNSUPPORTED_COMMAND 20
+#define STATUS_GCODE_MODAL_GROUP_VIOLATION 21
+#define STATUS_GCODE_AXIS_COMMAND_CONFLICT 25
+#define STATUS_GCODE_NO_AXIS_WORDS 26
+#define STATUS_GCODE_VALUE_WORD_MISSING 31
+#define STATUS_SPINDLE_RPM_ERROR 48
+#define STATUS_MAX_STEP_RATE_EXCEEDED 49
+#define STATUS_CRITICAL_FAIL 254
+#define EXEC_ALARM_SPINDLE_SYNC_FAIL 14
+
+#define GCODE_GROUP_MOTION 1
+#define GCODE_WORD_X 1
+#define GCODE_WORD_Y 2
+#define GCODE_WORD_Z 4
+#define GCODE_XYZ_AXIS (GCODE_WORD_X | GCODE_WORD_Y | GCODE_WORD_Z)
+#define GCODE_WORD_I 8
+#define GCODE_WORD_J 16
+#define GCODE_WORD_K 32
+#define GCODE_WORD_P 64
+#define GCODE_WORD_Q 128
+#define GCODE_WORD_R 256
+#define GCODE_WORD_L 512
+#define EXTENDED_MOTION_GCODE(X) (2000 + X)
+
+#define ITP_CONST 1
+#define ITP_SYNC 2
+
+// events and hooks
+#define EVENT_CONTINUE false
+#define EVENT_HANDLED true
+#define CREATE_EVENT_LISTENER(event, handler) void *event##_##handler##_listener = (void *)&handler
+#define ADD_EVENT_LISTENER(event, handler) (void)event##_##handler##_listener
+#define DECL_MODULE(name) void mod_##name##_hook(void)
+#define DECL_HOOK(name, ...)                            \
+	typedef void (*name##_delegate_t)(__VA_ARGS__); \
+	extern name##_delegate_t name##_cb
+#define CREATE_HOOK(name) name##_delegate_t name##_cb
+#define HOOK_ATTACH_CALLBACK(name, cb) name##_cb = &cb
+#define HOOK_RELEASE(name) name##_cb = NULL
+
+DECL_HOOK(itp_rt_stepbits, uint8_t, uint8_t);
+
+typedef struct
+{
+	float step_per_mm[AXIS_COUNT];
+	float max_feed_rate[AXIS_COUNT];
+	float acceleration[AXIS_COUNT];
+	float encoders_resolution[1];
+	uint8_t status_report_mask;
+} settings_t;
+extern settings_t g_settings;
+
+typedef struct
+{
+	float feed;
+	float max_accel;
+	int16_t spindle;
+	union
+	{
+		uint8_t reg;
+		struct
+		{
+			uint8_t synched : 1;
+		} bit;
+	} motion_flags;
+} motion_data_t;
+
+typedef struct
+{
+	struct
+	{
+		uint8_t motion;
+		uint8_t motion_mantissa;
+	} groups;
+} parser_state_t;
+
+typedef struct
+{
+	float ijk[3];
+	float p;
+	float r;
+	float d;
+	uint8_t l;
+} parser_words_t;
+
+typedef struct
+{
+	uint16_t group_extended;
+	uint16_t groups;
+	uint16_t words;
+} parser_cmd_explicit_t;
+
+typedef struct
+{
+	unsigned char word;
+	uint8_t code;
+	float value;
+	uint8_t *error;
+	parser_state_t *new_state;
+	parser_cmd_explicit_t *cmd;
+} gcode_parse_args_t;
+
+typedef struct
+{
+	parser_state_t *new_state;
+	parser_words_t *words;
+	parser_cmd_explicit_t *cmd;
+	uint8_t *error;
+	float *target;
+	motion_data_t *block_data;
+} gcode_exec_args_t;
+
+uint32_t mcu_micros(void);
+uint32_t mcu_millis(void);
+bool cnc_dotasks(void);
+void cnc_alarm(int8_t code);
+void proto_printf(const char *fmt, ...);
+void tool_set_speed(int16_t value);
+int16_t tool_range_speed(float value);
+void kinematics_apply_transform(float *axis);
+void kinematics_apply_inverse(float *axis, int32_t *steps);
+uint8_t mc_line(float *target, motion_data_t *block_data);
+uint8_t mc_update_tools(motion_data_t *block_data);
+void mc_get_position(float *target);
+void mc_sync_position(void);
+void itp_start(bool is_synched);
+void itp_stop(void);
+void itp_clear(void);
+void itp_update_feed(float feed);
+uint8_t itp_sync(void);
+void planner_clear(void);
+
+#endif
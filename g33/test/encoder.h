@@ -0,0 +1,17 @@
+/*
+	Minimal host replacement of the encoder module API used by parser_g33.c
+	The encoder is implemented by the simulation (test_spindle_load.c)
+*/
+
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#define ENC0 0
+
+DECL_HOOK(enc0_index, void);
+
+int32_t encoder_get_position(uint8_t i);
+void encoder_reset_position(uint8_t i, int32_t position);
+uint16_t encoder_get_rpm(uint8_t i);
+
+#endif
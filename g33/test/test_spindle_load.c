@@ -0,0 +1,264 @@
+/*
+	Simulated loaded spindle test of the G33 spindle estimator
+
+	Runs G33 through the module with a simulated spindle and motion:
+		- the spindle runs at 600rpm and slows down to 540rpm (time constant 30ms) while a cutting load is applied for 1 second
+		- the encoder counts are quantized to the encoder resolution and the index pulses fire at each full revolution
+		- the simulated interpolator accelerates the synched motion and then steps at the rate set by the module (itp_update_feed)
+	The thread error is the distance between the axis and the position that matches the spindle phase at the motion start
+	The open loop error (the motion kept at the programmed feed) shows the size of the disturbance
+
+	Build and run with make (see Makefile)
+*/
+
+#include "build/src/cnc.h"
+#include "build/src/modules/encoder.h"
+#include <stdio.h>
+#include <math.h>
+
+#define SIM_DT 5e-6
+#define SIM_RPM 600.0
+#define SIM_LOAD_DROP 0.1
+#define SIM_LOAD_TAU 0.03
+#define SIM_LOAD_START 1.5
+#define SIM_LOAD_END 2.5
+#define SIM_STEPS_PER_MM 200.0f
+#define SIM_PITCH 1.5f
+#define SIM_LENGTH 60.0f
+
+settings_t g_settings;
+CREATE_HOOK(itp_rt_stepbits);
+CREATE_HOOK(enc0_index);
+
+bool g33_exec(void *args);
+bool spindle_sync_update_loop(void *ptr);
+void mod_g33_hook(void);
+
+// simulation state
+static double sim_time;
+static double sim_speed;	// spindle speed in revolutions per second
+static double sim_spindle; // spindle position in revolutions
+static int32_t sim_encoder_offset;
+static float sim_position[AXIS_COUNT];
+static bool sim_loaded;
+
+// the synched motion
+static bool sim_queued;
+static bool sim_running;
+static bool sim_const;
+static int32_t sim_steps;
+static int32_t sim_total_steps;
+static double sim_rate;
+static double sim_step_phase;
+static double sim_feed_rate;
+static double sim_accel;
+static double sim_start_spindle;
+
+// thread error while moving at constant speed
+static double sim_error_max;
+static double sim_open_loop;
+static double sim_open_loop_max;
+static bool sim_alarm;
+
+uint32_t mcu_micros(void) { return (uint32_t)(sim_time * 1e6); }
+uint32_t mcu_millis(void) { return (uint32_t)(sim_time * 1e3); }
+void cnc_alarm(int8_t code) { sim_alarm = true; }
+void proto_printf(const char *fmt, ...) {}
+void tool_set_speed(int16_t value) {}
+int16_t tool_range_speed(float value) { return (int16_t)value; }
+uint8_t mc_update_tools(motion_data_t *block_data) { return STATUS_OK; }
+void kinematics_apply_transform(float *axis) {}
+void mc_sync_position(void) {}
+void itp_stop(void) {}
+void itp_clear(void) {}
+void planner_clear(void) {}
+uint16_t encoder_get_rpm(uint8_t i) { return (uint16_t)(sim_speed * 60); }
+
+int32_t encoder_get_position(uint8_t i)
+{
+	return (int32_t)floor(sim_spindle * g_settings.encoders_resolution[0]) - sim_encoder_offset;
+}
+
+void encoder_reset_position(uint8_t i, int32_t position)
+{
+	sim_encoder_offset = (int32_t)floor(sim_spindle * g_settings.encoders_resolution[0]) - position;
+}
+
+void kinematics_apply_inverse(float *axis, int32_t *steps)
+{
+	for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+	{
+		steps[i] = (int32_t)lroundf(axis[i] * SIM_STEPS_PER_MM);
+	}
+}
+
+void mc_get_position(float *target)
+{
+	memcpy(target, sim_position, sizeof(sim_position));
+}
+
+// queues the synched motion along Z
+uint8_t mc_line(float *target, motion_data_t *block_data)
+{
+	sim_total_steps = (int32_t)lroundf(fabsf(target[AXIS_Z] - sim_position[AXIS_Z]) * SIM_STEPS_PER_MM);
+	sim_feed_rate = block_data->feed * MIN_SEC_MULT * SIM_STEPS_PER_MM;
+	sim_accel = block_data->max_accel * SIM_STEPS_PER_MM;
+	memcpy(sim_position, target, sizeof(sim_position));
+	sim_queued = true;
+	return STATUS_OK;
+}
+
+// the spindle index starts the motion
+void itp_start(bool is_synched)
+{
+	sim_running = true;
+	sim_const = false;
+	sim_steps = 0;
+	sim_rate = 0;
+	sim_step_phase = 0;
+	sim_start_spindle = sim_spindle;
+}
+
+void itp_update_feed(float feed)
+{
+	if (sim_const)
+	{
+		sim_rate = feed;
+	}
+}
+
+static void sim_advance(void)
+{
+	sim_time += SIM_DT;
+
+	// the spindle slows down while the load is applied
+	double t = sim_time - SIM_LOAD_START;
+	double target = SIM_RPM / 60.0;
+	if (sim_loaded && t >= 0 && t < (SIM_LOAD_END - SIM_LOAD_START))
+	{
+		target *= (1 - SIM_LOAD_DROP);
+	}
+	sim_speed += (target - sim_speed) * SIM_DT / SIM_LOAD_TAU;
+
+	double previous = sim_spindle;
+	sim_spindle += sim_speed * SIM_DT;
+	if (floor(sim_spindle) > floor(previous) && enc0_index_cb)
+	{
+		enc0_index_cb();
+	}
+
+	if (!sim_running)
+	{
+		return;
+	}
+
+	// accelerates up to the feed and then follows the module corrections
+	if (!sim_const)
+	{
+		sim_rate += sim_accel * SIM_DT;
+		if (sim_rate >= sim_feed_rate)
+		{
+			sim_rate = sim_feed_rate;
+			sim_const = true;
+		}
+	}
+
+	sim_step_phase += sim_rate * SIM_DT;
+	while (sim_step_phase >= 1 && sim_steps < sim_total_steps)
+	{
+		sim_step_phase -= 1;
+		sim_steps++;
+		if (itp_rt_stepbits_cb)
+		{
+			itp_rt_stepbits_cb(4, ITP_SYNC | (sim_const ? ITP_CONST : 0));
+		}
+	}
+
+	if (sim_steps >= sim_total_steps)
+	{
+		sim_running = false;
+		sim_queued = false;
+		return;
+	}
+
+	if (sim_const)
+	{
+		// the motion lags a whole number of revolutions after the acceleration
+		double turns = (sim_steps / SIM_STEPS_PER_MM) / SIM_PITCH - (sim_spindle - sim_start_spindle);
+		double error = fabs(remainder(turns, 1.0)) * SIM_PITCH;
+		sim_error_max = fmax(sim_error_max, error);
+		// the same motion at the programmed feed
+		sim_open_loop += (SIM_RPM / 60.0 - sim_speed) * SIM_DT;
+		sim_open_loop_max = fmax(sim_open_loop_max, fabs(sim_open_loop) * SIM_PITCH);
+	}
+}
+
+bool cnc_dotasks(void)
+{
+	sim_advance();
+	spindle_sync_update_loop(NULL);
+	return !sim_alarm;
+}
+
+uint8_t itp_sync(void)
+{
+	while (sim_queued)
+	{
+		if (!cnc_dotasks())
+		{
+			return STATUS_CRITICAL_FAIL;
+		}
+	}
+	return STATUS_OK;
+}
+
+// G33 Z-60 K1.5 at 600rpm from Z0
+static bool run(const char *name, float resolution, bool loaded, double tolerance)
+{
+	uint8_t error = 0xFF;
+	float target[AXIS_COUNT] = {0, 0, -SIM_LENGTH};
+	motion_data_t block_data = {.spindle = (int16_t)SIM_RPM};
+	parser_state_t state = {0};
+	parser_words_t words = {.ijk = {0, 0, SIM_PITCH}};
+	parser_cmd_explicit_t cmd = {.group_extended = EXTENDED_MOTION_GCODE(33), .words = GCODE_WORD_Z | GCODE_WORD_K};
+	gcode_exec_args_t args = {&state, &words, &cmd, &error, target, &block_data};
+
+	g_settings.encoders_resolution[0] = resolution;
+	memset(sim_position, 0, sizeof(sim_position));
+	sim_time = 0;
+	sim_speed = SIM_RPM / 60.0;
+	sim_spindle = 0.3;
+	sim_loaded = loaded;
+	sim_error_max = 0;
+	sim_open_loop = 0;
+	sim_open_loop_max = 0;
+	sim_alarm = false;
+
+	if (!g33_exec(&args) || error != STATUS_OK)
+	{
+		printf("%-28s G33 failed with error %d\n", name, error);
+		return false;
+	}
+
+	printf("%-28s max thread error %.4f mm (open loop %.4f mm)\n", name, sim_error_max, sim_open_loop_max);
+	return (sim_error_max < tolerance) && !itp_rt_stepbits_cb && !enc0_index_cb;
+}
+
+int main(void)
+{
+	bool ok = true;
+
+	g_settings.max_feed_rate[AXIS_Z] = 3000;
+	g_settings.acceleration[AXIS_Z] = 100;
+	g_settings.max_feed_rate[AXIS_X] = g_settings.max_feed_rate[AXIS_Y] = 3000;
+	g_settings.acceleration[AXIS_X] = g_settings.acceleration[AXIS_Y] = 100;
+	mod_g33_hook();
+
+	ok &= run("100 counts/rev, no load", 100, false, 0.01);
+	ok &= run("100 counts/rev, 10% drop", 100, true, 0.05);
+	ok &= run("index only, no load", 1, false, 0.01);
+	ok &= run("index only, 10% drop", 1, true, 0.12);
+
+	printf(ok ? "PASS\n" : "FAIL\n");
+	return ok ? 0 : 1;
+}
@@ -1,6 +1,6 @@
 /*
 	Name: parser_g5.c
-	Description: Implements a parser extension for LinuxCNC G5 and G5.1 for µCNC.
+	Description: Implements a parser extension for LinuxCNC G5, G5.1 and NURBS (G5.2 and G5.3) for µCNC.
 
 	Copyright: Copyright (c) João Martins
 	Author: João Martins
@@ -19,6 +19,8 @@
 #include "../../cnc.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <math.h>
 
 #ifdef ENABLE_PARSER_MODULES
 
@@ -26,8 +28,29 @@
 #error "This module is not compatible with the current version of µCNC"
 #endif
 
-#ifndef G5_MAX_SEGMENT_LENGTH
-#define G5_MAX_SEGMENT_LENGTH 1.0f
+// max chord error (mm) between the curve and the line segments
+#ifndef G5_CHORD_TOLERANCE
+#define G5_CHORD_TOLERANCE 0.01f
+#endif
+// optional max segment length (mm)
+// #define G5_MAX_SEGMENT_LENGTH 1.0f
+// segments are placed along the curve by curvature (each section of the curve gets the longest segments allowed by the tolerance)
+// the length and curvature of the curve are calculated in a table of G5_ARC_LENGTH_SAMPLES intervals
+// disable to use uniform t steps (less calculations per point but segment lengths vary with the control points spacing)
+// #define G5_DISABLE_ARC_LENGTH
+#ifndef G5_ARC_LENGTH_SAMPLES
+#define G5_ARC_LENGTH_SAMPLES 16
+#endif
+// NURBS (G5.2 and G5.3)
+// the max order of the curve (4 is a cubic NURBS) sets the memory used by the curve evaluation
+// #define G5_DISABLE_NURBS
+#ifndef G5_NURBS_MAX_ORDER
+#define G5_NURBS_MAX_ORDER 4
+#endif
+// number of points of each knot span used to estimate the number of segments of the span
+// (8 samples underestimate the segments of rational spans with uneven weights)
+#ifndef G5_NURBS_SPAN_SAMPLES
+#define G5_NURBS_SPAN_SAMPLES 16
 #endif
 
 // this ID must be unique for each code
@@ -42,53 +65,442 @@ CREATE_EVENT_LISTENER(gcode_exec, g5_exec);
 static bool is_chained_g5;
 static float next_x;
 static float next_y;
-// #define SPLINE_USE_CASTELJAUS
 
-#ifdef SPLINE_USE_CASTELJAUS
-// De Casteljau's algorithm
-#define spline_interpol(a, b, t) ((1 - t) * a + t * b)
+#ifdef G5_DISABLE_ARC_LENGTH
+// spline coordinates are evaluated by forward differencing (only additions per point)
+// P(t) = a*t^3 + b*t^2 + c*t + d
+typedef struct
+{
+	float p;
+	float d1;
+	float d2;
+	float d3;
+} spline_fwd_diff_t;
+
+static void spline_fwd_diff_init(spline_fwd_diff_t *s, const float a, const float b, const float c, const float d, const float h)
+{
+	float h2 = h * h;
+	float h3 = h2 * h;
+	s->p = d;
+	s->d1 = a * h3 + b * h2 + c * h;
+	s->d3 = 6.0f * a * h3;
+	s->d2 = s->d3 + fast_flt_mul2(b * h2);
+}
+
+static FORCEINLINE float spline_fwd_diff_next(spline_fwd_diff_t *s)
+{
+	s->p += s->d1;
+	s->d1 += s->d2;
+	s->d2 += s->d3;
+	return s->p;
+}
 #endif
 
-float quadratic_spline_interpol(const float a, const float b, const float c, const float t)
+// converts the bezier control points to the power basis coefficients (a, b, c) of each axis
+// for quadratic curves the a coefficient is 0
+static void spline_coeffs(const float p0, const float p1, const float p2, const float p3, bool quadratic, float *coeffs)
+{
+	if (quadratic)
+	{
+		coeffs[0] = 0;
+		coeffs[1] = p0 - fast_flt_mul2(p1) + p2;
+		coeffs[2] = fast_flt_mul2((p1 - p0));
+		return;
+	}
+
+	coeffs[0] = 3.0f * (p1 - p2) + p3 - p0;
+	coeffs[1] = 3.0f * (p0 - fast_flt_mul2(p1) + p2);
+	coeffs[2] = 3.0f * (p1 - p0);
+}
+
+#ifdef G5_DISABLE_ARC_LENGTH
+// number of segments needed to keep the chord error bellow the tolerance
+// the chord error of a segment with a t span of h is bound by |P''|max * h^2 / 8
+// P''(t) = 6a*t + 2b is linear so the max is at one of the ends of the curve
+static uint32_t spline_segments(const float *coeffs_x, const float *coeffs_y, float polygon_len)
 {
-#ifdef SPLINE_USE_CASTELJAUS
-	// 6 multiplications plus 6 additions
-	float k = spline_interpol(a, b, t);
-	float l = spline_interpol(b, c, t);
-	return spline_interpol(k, l, t);
+	float acc_0 = fast_flt_sqrt((fast_flt_pow2(fast_flt_mul2(coeffs_x[1])) + fast_flt_pow2(fast_flt_mul2(coeffs_y[1]))));
+	float acc_1 = fast_flt_sqrt((fast_flt_pow2((6.0f * coeffs_x[0] + fast_flt_mul2(coeffs_x[1]))) + fast_flt_pow2((6.0f * coeffs_y[0] + fast_flt_mul2(coeffs_y[1])))));
+	float segments = fast_flt_sqrt((MAX(acc_0, acc_1) / (8.0f * G5_CHORD_TOLERANCE)));
+#ifdef G5_MAX_SEGMENT_LENGTH
+	// the control polygon length is an upper bound of the curve length
+	segments = MAX(segments, polygon_len / G5_MAX_SEGMENT_LENGTH);
+#endif
+	return (uint32_t)ceilf(segments);
+}
 #else
-	// optimized version 6 multiplications plus 5 additions
-	float t_sqr = t * t;
-	float k = t_sqr;				 // t^2
-	float p = c * k;				 // P = P2 * (t^2)
-	k = fast_flt_mul2((t - k));		 // -2t^2 + 2t
-	p += b * k;						 // P = P2 * (t^2) + P1 * (-2t^2 + 2t)
-	k = fast_flt_div2((-k)) - t + 1; // t^2 - 2t + 1
-	return (p + k * a);				 // P = P2 * (t^2) + P1 * (-2t^2 + 2t) + P0 * (t^2 - 2t + 1)
+// P(t)
+static FORCEINLINE float spline_eval(const float *coeffs, const float d, const float t)
+{
+	return ((coeffs[0] * t + coeffs[1]) * t + coeffs[2]) * t + d;
+}
+
+// P'(t)
+static FORCEINLINE float spline_eval_d1(const float *coeffs, const float t)
+{
+	return (3.0f * coeffs[0] * t + fast_flt_mul2(coeffs[1])) * t + coeffs[2];
+}
+
+// P''(t)
+static FORCEINLINE float spline_eval_d2(const float *coeffs, const float t)
+{
+	return 6.0f * coeffs[0] * t + fast_flt_mul2(coeffs[1]);
+}
+
+static FORCEINLINE float spline_speed(const float *coeffs_x, const float *coeffs_y, const float t)
+{
+	return fast_flt_sqrt((fast_flt_pow2(spline_eval_d1(coeffs_x, t)) + fast_flt_pow2(spline_eval_d1(coeffs_y, t))));
+}
+
+static float spline_curvature(const float *coeffs_x, const float *coeffs_y, const float t)
+{
+	float dx = spline_eval_d1(coeffs_x, t);
+	float dy = spline_eval_d1(coeffs_y, t);
+	float speed_sqr = fast_flt_pow2(dx) + fast_flt_pow2(dy);
+	if (speed_sqr < 1e-6f)
+	{
+		// cusp (the curve length around this point is 0)
+		return 0;
+	}
+
+	return ABS(dx * spline_eval_d2(coeffs_y, t) - dy * spline_eval_d2(coeffs_x, t)) / (speed_sqr * fast_flt_sqrt(speed_sqr));
+}
+
+// fills the table with the cumulative number of segments at each table t and returns the total number of segments
+// a segment with length l has a chord error bound of k * l^2 / 8 where k is the curvature
+// so each interval gets len * sqrt(k / (8 * tolerance)) segments (the max length allowed by the interval max curvature)
+// the segments length follows the curvature (long segments on gentle sections and short ones on tight sections), it's not constant
+// but it doesn't depend on the control points spacing like the uniform t steps
+// the t of the segments is linear inside each interval so the interval length is taken at the interval max speed (|P'|)
+static uint32_t spline_arc_table(const float *coeffs_x, const float *coeffs_y, float *arc_table)
+{
+	const float h = 1.0f / G5_ARC_LENGTH_SAMPLES;
+	float speed_prev = spline_speed(coeffs_x, coeffs_y, 0);
+	float curvature_prev = spline_curvature(coeffs_x, coeffs_y, 0);
+	float count = 0;
+
+	arc_table[0] = 0;
+	for (uint8_t i = 1; i <= G5_ARC_LENGTH_SAMPLES; i++)
+	{
+		// the speed and curvature are sampled at the ends and quarters of the interval
+		float max_speed = speed_prev;
+		float max_curvature = curvature_prev;
+		for (uint8_t j = 1; j <= 4; j++)
+		{
+			float t = (i - 1 + 0.25f * j) * h;
+			speed_prev = spline_speed(coeffs_x, coeffs_y, t);
+			curvature_prev = spline_curvature(coeffs_x, coeffs_y, t);
+			max_speed = MAX(max_speed, speed_prev);
+			max_curvature = MAX(max_curvature, curvature_prev);
+		}
+
+		float len = h * max_speed;
+		float n = len * fast_flt_sqrt((max_curvature / (8.0f * G5_CHORD_TOLERANCE)));
+#ifdef G5_MAX_SEGMENT_LENGTH
+		n = MAX(n, len / G5_MAX_SEGMENT_LENGTH);
+#endif
+		count += n;
+		arc_table[i] = count;
+	}
+
+	return (uint32_t)ceilf(count);
+}
+
+// finds the t at a given (fractional) segment count (linear interpolation inside the table interval)
+static float spline_arc_t(const float *arc_table, uint8_t *index, const float count)
+{
+	uint8_t i = *index;
+	while (i < (G5_ARC_LENGTH_SAMPLES - 1) && arc_table[i + 1] < count)
+	{
+		i++;
+	}
+	*index = i;
+
+	float interval = arc_table[i + 1] - arc_table[i];
+	float frac = (interval > 0) ? ((count - arc_table[i]) / interval) : 0;
+	return (i + CLAMP(0, frac, 1)) * (1.0f / G5_ARC_LENGTH_SAMPLES);
+}
 #endif
+
+#ifndef G5_DISABLE_NURBS
+// the curve is evaluated while the control points are received
+// a knot span is output as soon as all the control points and knots it depends on are known
+// so only the last 2 * order - 1 control points are kept
+#define NURBS_BUFFER_SIZE (2 * G5_NURBS_MAX_ORDER - 1)
+#define NURBS_DEFAULT_ORDER 3
+
+typedef struct
+{
+	// weighted coordinates (homogeneous) and weight
+	float p[AXIS_COUNT + 1];
+	float knot;
+} nurbs_point_t;
+
+static nurbs_point_t nurbs_points[NURBS_BUFFER_SIZE];
+// number of control points of the current curve (0 means no curve in progress)
+static uint32_t nurbs_count;
+// next knot span to output
+static uint32_t nurbs_span;
+static uint8_t nurbs_order;
+static float nurbs_end_knot;
+
+#define NURBS_POINT(i) (&nurbs_points[(i) % NURBS_BUFFER_SIZE])
+
+// knot vector is clamped (order times the start and end knots)
+// the knot of each control point after the first (order) points is an interior knot
+static FORCEINLINE float nurbs_knot(uint32_t i)
+{
+	return (i < nurbs_count) ? NURBS_POINT(i)->knot : nurbs_end_knot;
+}
+
+// de Boor algorithm
+static void nurbs_eval(uint32_t span, float u, float *point)
+{
+	uint8_t p = nurbs_order - 1;
+	float d[G5_NURBS_MAX_ORDER][AXIS_COUNT + 1];
+
+	for (uint8_t r = 0; r <= p; r++)
+	{
+		memcpy(d[r], NURBS_POINT(span - p + r)->p, sizeof(d[r]));
+	}
+
+	for (uint8_t r = 1; r <= p; r++)
+	{
+		for (uint8_t i = p; i >= r; i--)
+		{
+			float k0 = nurbs_knot(span - p + i);
+			float k1 = nurbs_knot(span + 1 + i - r);
+			float alpha = (k1 > k0) ? ((u - k0) / (k1 - k0)) : 0;
+			for (uint8_t a = 0; a <= AXIS_COUNT; a++)
+			{
+				d[i][a] = d[i - 1][a] + alpha * (d[i][a] - d[i - 1][a]);
+			}
+		}
+	}
+
+	float w = fast_flt_inv(d[p][AXIS_COUNT]);
+	for (uint8_t a = 0; a < AXIS_COUNT; a++)
+	{
+		point[a] = d[p][a] * w;
+	}
 }
 
-float cubic_spline_interpol(const float a, const float b, const float c, const float d, const float t)
+// outputs a knot span as line segments
+// the span is sampled to find the max sagitta and the number of segments is chosen to keep the chord error bellow the tolerance
+// the last span does not output it's end point (the motion ends at the target)
+static uint8_t nurbs_output_span(uint32_t span, bool last, motion_data_t *block_data)
 {
-#ifdef SPLINE_USE_CASTELJAUS
-	// 12 multiplications plus 12 additions
-	float k = spline_interpol(a, b, t);
-	float l = spline_interpol(b, c, t);
-	float m = spline_interpol(c, d, t);
-	return quadratic_spline_interpol(k, l, m, t);
+	float u0 = nurbs_knot(span);
+	float u_span = nurbs_knot(span + 1) - u0;
+	if (u_span <= 0)
+	{
+		// repeated knot (empty span)
+		return STATUS_OK;
+	}
+
+	float samples[3][AXIS_COUNT];
+	float max_sagitta = 0;
+	float len = 0;
+	const float u_sample = u_span * (1.0f / G5_NURBS_SPAN_SAMPLES);
+	for (uint8_t i = 0; i <= G5_NURBS_SPAN_SAMPLES; i++)
+	{
+		float *curr = samples[i % 3];
+		nurbs_eval(span, u0 + u_sample * i, curr);
+		if (i > 1)
+		{
+			// distance of the middle sample to the chord of the 3 samples
+			float *mid = samples[(i + 2) % 3];
+			float *prev = samples[(i + 1) % 3];
+			float chord_sqr = 0, mid_sqr = 0, dot = 0;
+			for (uint8_t a = 0; a < AXIS_COUNT; a++)
+			{
+				float c = curr[a] - prev[a];
+				float m = mid[a] - prev[a];
+				chord_sqr += fast_flt_pow2(c);
+				mid_sqr += fast_flt_pow2(m);
+				dot += c * m;
+			}
+			float sagitta_sqr = (chord_sqr > 0) ? (mid_sqr - fast_flt_pow2(dot) / chord_sqr) : mid_sqr;
+			max_sagitta = MAX(max_sagitta, sagitta_sqr);
+			len += fast_flt_sqrt(mid_sqr);
+		}
+	}
+	max_sagitta = fast_flt_sqrt(max_sagitta);
+
+	// the sagitta grows with the square of the segment length
+	// a segment that is s samples long has a chord error of about sagitta * (s / 2)^2
+	// (with a 25% margin since the curvature between samples is not known)
+	float n = (0.625f * G5_NURBS_SPAN_SAMPLES) * fast_flt_sqrt((max_sagitta / G5_CHORD_TOLERANCE));
+#ifdef G5_MAX_SEGMENT_LENGTH
+	n = MAX(n, len / G5_MAX_SEGMENT_LENGTH);
 #else
-	// optimized version (9 multiplications plus 8 additions)
-	float t_sqr = t * t;							 // t^2
-	float k = t_sqr * t;							 // t^3
-	float p = d * k;								 // P = P3 * (t^3)
-	k = 3.0f * (t_sqr - k);							 // -3t^3 + 3t^2
-	p += k * c;										 // P = P3 * (t^3) + P2 * (-3t^3 + 3t^2)
-	k = -3.0f * (t_sqr - t) - k;					 // 3t^3 - 6t^2 + 3t
-	p += k * b;										 // P = P3 * (t^3) + P2 * (-3t^3 + 3t^2) + P1 * (3t^3 - 6t^2 + 3t)
-	k = ((-1.0f / 3.0f) * k) - fast_flt_mul2(t) + 1; // -t^3 + 3t^2 - 3t + 1
-	return (p + k * a);								 // P = P3 * (t^3) + P2 * (-3t^3 + 3t^2) + P1 * (3t^3 - 6t^2 + 3t) + P0 * (-t^3 + 3t^2 - 3t + 1)
+	(void)len;
 #endif
+	uint32_t segments = MAX((uint32_t)ceilf(n), 1);
+	float u_inc = u_span / (float)segments;
+
+	if (last)
+	{
+		segments--;
+	}
+
+	for (uint32_t i = 1; i <= segments; i++)
+	{
+		float next[AXIS_COUNT];
+		nurbs_eval(span, u0 + u_inc * i, next);
+		uint8_t error = mc_line(next, block_data);
+		if (error != STATUS_OK)
+		{
+			return error;
+		}
+	}
+
+	return STATUS_OK;
+}
+
+// G5.2 adds a control point (the current position is the first control point of the curve)
+// G5.3 ends the curve
+static uint8_t nurbs_exec(gcode_exec_args_t *ptr)
+{
+	uint8_t error = STATUS_OK;
+
+	if (ptr->new_state->groups.motion_mantissa == 2)
+	{
+		if (!nurbs_count)
+		{
+			// new curve
+			nurbs_order = NURBS_DEFAULT_ORDER;
+			if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_L))
+			{
+				if (ptr->words->l < 2 || ptr->words->l > G5_NURBS_MAX_ORDER)
+				{
+					return STATUS_GCODE_MAX_VALUE_EXCEEDED;
+				}
+				nurbs_order = ptr->words->l;
+			}
+
+			nurbs_point_t *start = NURBS_POINT(0);
+			mc_get_position(start->p);
+			start->p[AXIS_COUNT] = 1;
+			start->knot = 0;
+			nurbs_count = 1;
+			nurbs_span = nurbs_order - 1;
+		}
+		else if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_L))
+		{
+			// the order can only be set in the first control point
+			return STATUS_GCODE_UNUSED_WORDS;
+		}
+
+		float w = (CHECKFLAG(ptr->cmd->words, GCODE_WORD_P)) ? ptr->words->p : 1.0f;
+		if (w <= 0)
+		{
+			return STATUS_NEGATIVE_VALUE;
+		}
+
+		float knot = 0;
+		if (nurbs_count >= nurbs_order)
+		{
+			float prev_knot = NURBS_POINT(nurbs_count - 1)->knot;
+			knot = (CHECKFLAG(ptr->cmd->words, GCODE_WORD_K)) ? ptr->words->ijk[AXIS_Z] : (prev_knot + 1.0f);
+			if (knot < prev_knot)
+			{
+				return STATUS_NEGATIVE_VALUE;
+			}
+		}
+
+		nurbs_point_t *point = NURBS_POINT(nurbs_count);
+		for (uint8_t a = 0; a < AXIS_COUNT; a++)
+		{
+			point->p[a] = ptr->target[a] * w;
+		}
+		point->p[AXIS_COUNT] = w;
+		point->knot = knot;
+		nurbs_count++;
+
+		// the next span has all it's control points and knots
+		if (nurbs_count >= (nurbs_span + nurbs_order))
+		{
+			error = nurbs_output_span(nurbs_span++, false, ptr->block_data);
+		}
+	}
+	else
+	{
+		if (!nurbs_count)
+		{
+			return STATUS_GCODE_UNSUPPORTED_COMMAND;
+		}
+
+		if (CHECKFLAG(ptr->cmd->words, GCODE_ALL_AXIS))
+		{
+			nurbs_count = 0;
+			return STATUS_GCODE_AXIS_COMMAND_CONFLICT;
+		}
+
+		if (nurbs_count < nurbs_order)
+		{
+			// not enough control points
+			nurbs_count = 0;
+			return STATUS_GCODE_VALUE_WORD_MISSING;
+		}
+
+		float last_knot = NURBS_POINT(nurbs_count - 1)->knot;
+		nurbs_end_knot = (CHECKFLAG(ptr->cmd->words, GCODE_WORD_K)) ? ptr->words->ijk[AXIS_Z] : (last_knot + 1.0f);
+		if (nurbs_end_knot <= last_knot)
+		{
+			nurbs_count = 0;
+			return STATUS_NEGATIVE_VALUE;
+		}
+
+		// outputs the remaining spans with the end knots
+		while (nurbs_span < nurbs_count && error == STATUS_OK)
+		{
+			error = nurbs_output_span(nurbs_span, (nurbs_span == (nurbs_count - 1)), ptr->block_data);
+			nurbs_span++;
+		}
+
+		nurbs_count = 0;
+		if (error == STATUS_OK)
+		{
+			// ensure last motion to target (last control point)
+			error = mc_line(ptr->target, ptr->block_data);
+		}
+	}
+
+	if (error != STATUS_OK)
+	{
+		nurbs_count = 0;
+	}
+
+	return error;
+}
+
+// no other motion is allowed while a curve is open (it must be ended with G5.3)
+// the motion is rejected and the curve is discarded
+bool g5_nurbs_before_motion(void *args)
+{
+	gcode_exec_args_t *ptr = (gcode_exec_args_t *)args;
+	if (nurbs_count && ptr->cmd->group_extended != EXTENDED_MOTION_GCODE(5))
+	{
+		nurbs_count = 0;
+		*(ptr->error) = STATUS_GCODE_MODAL_GROUP_VIOLATION;
+		return EVENT_HANDLED;
+	}
+
+	return EVENT_CONTINUE;
+}
+CREATE_EVENT_LISTENER(gcode_before_motion, g5_nurbs_before_motion);
+
+#ifdef ENABLE_MAIN_LOOP_MODULES
+// discards any unfinished curve
+bool g5_nurbs_reset(void *args)
+{
+	nurbs_count = 0;
+	return EVENT_CONTINUE;
 }
+CREATE_EVENT_LISTENER(cnc_reset, g5_nurbs_reset);
+#endif
+#endif
 
 // this just parses and accepts the code
 bool g5_parse(void *args)
@@ -114,7 +526,11 @@ bool g5_parse(void *args)
 			mantissa /= 10;
 		}
 
+#ifndef G5_DISABLE_NURBS
+		if (mantissa > 3)
+#else
 		if (mantissa != 0 && mantissa != 1)
+#endif
 		{
 			// extendable
 			return EVENT_CONTINUE;
@@ -140,6 +556,22 @@ bool g5_exec(void *args)
 	gcode_exec_args_t *ptr = (gcode_exec_args_t *)args;
 	if (ptr->cmd->group_extended == EXTENDED_MOTION_GCODE(5))
 	{
+#ifndef G5_DISABLE_NURBS
+		if (ptr->new_state->groups.motion_mantissa >= 2) // G5.2 and G5.3
+		{
+			*(ptr->error) = nurbs_exec(ptr);
+			return EVENT_HANDLED;
+		}
+
+		if (nurbs_count)
+		{
+			// a NURBS curve must be ended with G5.3
+			nurbs_count = 0;
+			*(ptr->error) = STATUS_GCODE_MODAL_GROUP_VIOLATION;
+			return EVENT_HANDLED;
+		}
+#endif
+
 		if (CHECKFLAG(ptr->cmd->words, (GCODE_WORD_I | GCODE_WORD_J)) != (GCODE_WORD_I | GCODE_WORD_J))
 		{
 			// it's an error if both I and J are not explicitly defined or if they are omitted without a previous G5 command
@@ -196,25 +628,46 @@ bool g5_exec(void *args)
 		p2_y = p3_y = ptr->target[AXIS_Y];
 		p2_y += (!(ptr->new_state->groups.motion_mantissa)) ? (ptr->words->d) : 0; // d contains the value of q since d and q do not co-exist in any gcode
 
-		// determine t step by figuring the max straight distance between control points
-		// and then split them into a predefined fixed segment
-		// not sure if this strategy is reliable but I'll use it for now
-		float max_len = fast_flt_sqrt((fast_flt_pow2((p0_x - p1_x)) + fast_flt_pow2((p0_y - p1_y))));
-		max_len = MAX(max_len, fast_flt_sqrt((fast_flt_pow2((p1_x - p2_x)) + fast_flt_pow2((p1_y - p2_y)))));
-		if (!(ptr->new_state->groups.motion_mantissa)) // G5 second control point
+		bool quadratic = (ptr->new_state->groups.motion_mantissa != 0);
+		float coeffs_x[3], coeffs_y[3];
+		spline_coeffs(p0_x, p1_x, p2_x, p3_x, quadratic, coeffs_x);
+		spline_coeffs(p0_y, p1_y, p2_y, p3_y, quadratic, coeffs_y);
+
+		float polygon_len = fast_flt_sqrt((fast_flt_pow2((p0_x - p1_x)) + fast_flt_pow2((p0_y - p1_y))));
+		polygon_len += fast_flt_sqrt((fast_flt_pow2((p1_x - p2_x)) + fast_flt_pow2((p1_y - p2_y))));
+		if (!quadratic) // G5 second control point
 		{
-			max_len = MAX(max_len, fast_flt_sqrt((fast_flt_pow2((p2_x - p3_x)) + fast_flt_pow2((p2_y - p3_y)))));
+			polygon_len += fast_flt_sqrt((fast_flt_pow2((p2_x - p3_x)) + fast_flt_pow2((p2_y - p3_y))));
 		}
 
-		float t_inc = G5_MAX_SEGMENT_LENGTH / max_len;
 		float next[AXIS_COUNT];
+		memcpy(next, ptr->target, sizeof(next));
 
 		uint8_t error;
 
-		for (float t = t_inc; t < 1.0f; t += t_inc)
+#ifndef G5_DISABLE_ARC_LENGTH
+		float arc_table[G5_ARC_LENGTH_SAMPLES + 1];
+		uint32_t segments = MAX(spline_arc_table(coeffs_x, coeffs_y, arc_table), 1);
+		float count_inc = arc_table[G5_ARC_LENGTH_SAMPLES] / (float)segments;
+		uint8_t index = 0;
+
+		for (uint32_t i = 1; i < segments; i++)
 		{
-			next[AXIS_X] = (!(ptr->new_state->groups.motion_mantissa)) ? cubic_spline_interpol(p0_x, p1_x, p2_x, p3_x, t) : quadratic_spline_interpol(p0_x, p1_x, p2_x, t);
-			next[AXIS_Y] = (!(ptr->new_state->groups.motion_mantissa)) ? cubic_spline_interpol(p0_y, p1_y, p2_y, p3_y, t) : quadratic_spline_interpol(p0_y, p1_y, p2_y, t);
+			float t = spline_arc_t(arc_table, &index, count_inc * i);
+			next[AXIS_X] = spline_eval(coeffs_x, p0_x, t);
+			next[AXIS_Y] = spline_eval(coeffs_y, p0_y, t);
+#else
+		uint32_t segments = MAX(spline_segments(coeffs_x, coeffs_y, polygon_len), 1);
+		float t_inc = 1.0f / (float)segments;
+		spline_fwd_diff_t spline_x, spline_y;
+		spline_fwd_diff_init(&spline_x, coeffs_x[0], coeffs_x[1], coeffs_x[2], p0_x, t_inc);
+		spline_fwd_diff_init(&spline_y, coeffs_y[0], coeffs_y[1], coeffs_y[2], p0_y, t_inc);
+
+		for (uint32_t i = 1; i < segments; i++)
+		{
+			next[AXIS_X] = spline_fwd_diff_next(&spline_x);
+			next[AXIS_Y] = spline_fwd_diff_next(&spline_y);
+#endif
 
 			error = mc_line(next, ptr->block_data);
 			if (error != STATUS_OK)
@@ -239,6 +692,12 @@ DECL_MODULE(g5)
 #ifdef ENABLE_PARSER_MODULES
 	ADD_EVENT_LISTENER(gcode_parse, g5_parse);
 	ADD_EVENT_LISTENER(gcode_exec, g5_exec);
+#ifndef G5_DISABLE_NURBS
+	ADD_EVENT_LISTENER(gcode_before_motion, g5_nurbs_before_motion);
+#ifdef ENABLE_MAIN_LOOP_MODULES
+	ADD_EVENT_LISTENER(cnc_reset, g5_nurbs_reset);
+#endif
+#endif
 #else
 #warning "Parser extensions are not enabled. G5 and G5.1 code extension will not work."
 #endif
@@ -0,0 +1,125 @@
+/*
+	Minimal host replacement of the µCNC core API used by parser_g5.c
+	Only what the module needs to build on the host. The motion functions are implemented by the tests
+*/
+
+#ifndef CNC_H
+#define CNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#define UCNC_MODULE_VERSION 11600
+
+#define ENABLE_PARSER_MODULES
+#define ENABLE_MAIN_LOOP_MODULES
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define ABS(a) (((a) < 0) ? -(a) : (a))
+#define CLAMP(a, b, c) (MIN((c), MAX((a), (b))))
+#define CHECKFLAG(a, b) ((a) & (b))
+#define SETFLAG(a, b) ((a) |= (b))
+#define FORCEINLINE inline
+#define fast_flt_sqrt(x) (sqrtf(x))
+#define fast_flt_pow2(x) ((x) * (x))
+#define fast_flt_mul2(x) ((x) * 2.0f)
+#define fast_flt_inv(x) (1.0f / (x))
+
+#define AXIS_COUNT 3
+#define AXIS_X 0
+#define AXIS_Y 1
+#define AXIS_Z 2
+
+#define G17 0
+
+#define STATUS_OK 0
+#define STATUS_NEGATIVE_VALUE 4
+#define STATUS_GCODE_UNSUPPORTED_COMMAND 20
+#define STATUS_GCODE_MODAL_GROUP_VIOLATION 21
+#define STATUS_GCODE_AXIS_COMMAND_CONFLICT 25
+#define STATUS_GCODE_VALUE_WORD_MISSING 31
+#define STATUS_GCODE_UNUSED_WORDS 36
+#define STATUS_GCODE_MAX_VALUE_EXCEEDED 38
+
+#define GCODE_GROUP_MOTION 1
+#define GCODE_WORD_X 1
+#define GCODE_WORD_Y 2
+#define GCODE_WORD_Z 4
+#define GCODE_WORD_A 8
+#define GCODE_WORD_B 16
+#define GCODE_WORD_C 32
+#define GCODE_ALL_AXIS (GCODE_WORD_X | GCODE_WORD_Y | GCODE_WORD_Z | GCODE_WORD_A | GCODE_WORD_B | GCODE_WORD_C)
+#define GCODE_WORD_I 64
+#define GCODE_WORD_J 128
+#define GCODE_WORD_K 256
+#define GCODE_WORD_P 512
+#define GCODE_WORD_Q 1024
+#define GCODE_WORD_L 2048
+#define EXTENDED_MOTION_GCODE(X) (2000 + X)
+
+// events
+#define EVENT_CONTINUE false
+#define EVENT_HANDLED true
+#define CREATE_EVENT_LISTENER(event, handler) void *event##_##handler##_listener = (void *)&handler
+#define ADD_EVENT_LISTENER(event, handler) (void)event##_##handler##_listener
+#define DECL_MODULE(name) void mod_##name##_hook(void)
+
+typedef struct
+{
+	float feed;
+} motion_data_t;
+
+typedef struct
+{
+	struct
+	{
+		uint8_t motion;
+		uint8_t motion_mantissa;
+		uint8_t plane;
+	} groups;
+} parser_state_t;
+
+typedef struct
+{
+	float xyzabc[6];
+	float ijk[3];
+	float p;
+	float d;
+	uint8_t l;
+} parser_words_t;
+
+typedef struct
+{
+	uint16_t group_extended;
+	uint16_t groups;
+	uint16_t words;
+} parser_cmd_explicit_t;
+
+typedef struct
+{
+	unsigned char word;
+	uint8_t code;
+	float value;
+	uint8_t *error;
+	parser_state_t *new_state;
+	parser_words_t *words;
+	parser_cmd_explicit_t *cmd;
+} gcode_parse_args_t;
+
+typedef struct
+{
+	parser_state_t *new_state;
+	parser_words_t *words;
+	parser_cmd_explicit_t *cmd;
+	uint8_t *error;
+	float *target;
+	motion_data_t *block_data;
+} gcode_exec_args_t;
+
+uint8_t mc_line(float *target, motion_data_t *block_data);
+void mc_get_position(float *target);
+
+#endif
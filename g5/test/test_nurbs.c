@@ -0,0 +1,394 @@
+/*
+	NURBS (G5.2 and G5.3) test against a reference evaluator
+
+	Runs several curves through the module and compares the line segments with the curve of a reference NURBS evaluator (Cox-de Boor basis functions in double precision):
+		- each segment end must be on the reference curve
+		- the distance between the reference curve and the segments must not exceed G5_CHORD_TOLERANCE
+		- the motion must end at the last control point
+	It also checks that no other motion is accepted while a curve is open and that the rejected curve is discarded
+
+	Build and run with make (see Makefile)
+*/
+
+#include "build/src/cnc.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef G5_CHORD_TOLERANCE
+#define G5_CHORD_TOLERANCE 0.01f
+#endif
+
+#define MAX_POINTS 64
+#define MAX_ORDER 4
+#define MAX_OUTPUT 20000
+#define SAMPLES 100000
+
+bool g5_parse(void *args);
+bool g5_exec(void *args);
+bool g5_nurbs_before_motion(void *args);
+void mod_g5_hook(void);
+
+typedef struct
+{
+	double p[AXIS_COUNT];
+	double w;
+	double knot;
+} ctrl_point_t;
+
+static float sim_position[AXIS_COUNT];
+// the target of the last line (lines without axis words keep it)
+static float parser_position[AXIS_COUNT];
+static double output[MAX_OUTPUT][AXIS_COUNT];
+static int output_count;
+static double samples[SAMPLES + 1][AXIS_COUNT];
+static uint32_t sim_rng = 1;
+
+// deterministic on every libc
+static double sim_rand(void)
+{
+	sim_rng = sim_rng * 1664525UL + 1013904223UL;
+	return (double)(sim_rng >> 8) / 16777216.0;
+}
+
+uint8_t mc_line(float *target, motion_data_t *block_data)
+{
+	if (output_count < MAX_OUTPUT)
+	{
+		for (int a = 0; a < AXIS_COUNT; a++)
+		{
+			output[output_count][a] = target[a];
+		}
+		output_count++;
+	}
+	memcpy(sim_position, target, sizeof(sim_position));
+	return STATUS_OK;
+}
+
+void mc_get_position(float *target)
+{
+	memcpy(target, sim_position, sizeof(sim_position));
+}
+
+// runs a G5 line (mantissa 0 to 3) through the module parser and executor
+static uint8_t g5_line(uint8_t mantissa, const float *target, uint16_t words, const parser_words_t *values)
+{
+	static parser_state_t state;
+	parser_cmd_explicit_t cmd = {0};
+	parser_words_t w = *values;
+	float line_target[AXIS_COUNT];
+	motion_data_t block_data = {0};
+	uint8_t error = 0xFF;
+
+	gcode_parse_args_t parse = {'G', 5, 5.0f + 0.1f * mantissa, &error, &state, &w, &cmd};
+	if (!g5_parse(&parse) || error != STATUS_OK)
+	{
+		return 0xFF;
+	}
+
+	cmd.words = words;
+	if (target)
+	{
+		memcpy(parser_position, target, sizeof(parser_position));
+	}
+	memcpy(line_target, parser_position, sizeof(line_target));
+	gcode_exec_args_t exec = {&state, &w, &cmd, &error, line_target, &block_data};
+	if (!g5_exec(&exec))
+	{
+		return 0xFF;
+	}
+
+	return error;
+}
+
+// a G1 line while a curve may be open (the before motion event is the only module code it runs)
+static uint8_t g1_line(void)
+{
+	parser_state_t state = {0};
+	parser_cmd_explicit_t cmd = {0};
+	parser_words_t w = {0};
+	float target[AXIS_COUNT] = {0};
+	motion_data_t block_data = {0};
+	uint8_t error = STATUS_OK;
+
+	state.groups.motion = 1;
+	cmd.groups = GCODE_GROUP_MOTION;
+	cmd.words = GCODE_WORD_X;
+	gcode_exec_args_t exec = {&state, &w, &cmd, &error, target, &block_data};
+	g5_nurbs_before_motion(&exec);
+	return error;
+}
+
+// reference rational B-spline point (The NURBS Book A2.2 basis functions)
+static void nurbs_reference(const ctrl_point_t *pts, int n, int order, const double *knots, double u, double *point)
+{
+	int p = order - 1;
+	int span = p;
+	while (span < (n - 1) && knots[span + 1] <= u)
+	{
+		span++;
+	}
+
+	double basis[MAX_ORDER], left[MAX_ORDER], right[MAX_ORDER];
+	basis[0] = 1;
+	for (int j = 1; j <= p; j++)
+	{
+		left[j] = u - knots[span + 1 - j];
+		right[j] = knots[span + j] - u;
+		double saved = 0;
+		for (int r = 0; r < j; r++)
+		{
+			double temp = basis[r] / (right[r + 1] + left[j - r]);
+			basis[r] = saved + right[r + 1] * temp;
+			saved = left[j - r] * temp;
+		}
+		basis[j] = saved;
+	}
+
+	double sum[AXIS_COUNT] = {0}, w = 0;
+	for (int j = 0; j <= p; j++)
+	{
+		const ctrl_point_t *c = &pts[span - p + j];
+		for (int a = 0; a < AXIS_COUNT; a++)
+		{
+			sum[a] += basis[j] * c->w * c->p[a];
+		}
+		w += basis[j] * c->w;
+	}
+
+	for (int a = 0; a < AXIS_COUNT; a++)
+	{
+		point[a] = sum[a] / w;
+	}
+}
+
+static double dist_to_segment(const double *p, const double *a, const double *b)
+{
+	double ab[AXIS_COUNT], ap[AXIS_COUNT], len2 = 0, dot = 0;
+	for (int i = 0; i < AXIS_COUNT; i++)
+	{
+		ab[i] = b[i] - a[i];
+		ap[i] = p[i] - a[i];
+		len2 += ab[i] * ab[i];
+		dot += ab[i] * ap[i];
+	}
+	double t = (len2 > 0) ? fmin(fmax(dot / len2, 0), 1) : 0;
+	double d2 = 0;
+	for (int i = 0; i < AXIS_COUNT; i++)
+	{
+		d2 += (ap[i] - t * ab[i]) * (ap[i] - t * ab[i]);
+	}
+	return sqrt(d2);
+}
+
+// runs a curve (pts[0] is the current position) and compares it with the reference curve
+// the knots of the first (order) points are ignored (clamped) and without explicit knots the knots are uniform
+static bool run_curve(const char *name, const ctrl_point_t *pts, int n, int order, double end_knot, bool explicit_knots)
+{
+	double knots[MAX_POINTS + MAX_ORDER];
+	if (!explicit_knots)
+	{
+		end_knot = n - order + 1;
+	}
+	for (int i = 0; i < n + order; i++)
+	{
+		double knot = (explicit_knots) ? pts[i].knot : (i - order + 1);
+		knots[i] = (i < order) ? 0 : ((i < n) ? knot : end_knot);
+	}
+
+	for (int a = 0; a < AXIS_COUNT; a++)
+	{
+		sim_position[a] = parser_position[a] = (float)pts[0].p[a];
+	}
+	output_count = 0;
+
+	for (int i = 1; i < n; i++)
+	{
+		float target[AXIS_COUNT];
+		parser_words_t w = {0};
+		uint16_t words = GCODE_WORD_X | GCODE_WORD_Y | GCODE_WORD_Z | GCODE_WORD_P;
+		for (int a = 0; a < AXIS_COUNT; a++)
+		{
+			target[a] = (float)pts[i].p[a];
+		}
+		w.p = (float)pts[i].w;
+		if (i == 1)
+		{
+			words |= GCODE_WORD_L;
+			w.l = order;
+		}
+		if (explicit_knots && i >= order)
+		{
+			words |= GCODE_WORD_K;
+			w.ijk[AXIS_Z] = (float)pts[i].knot;
+		}
+
+		uint8_t error = g5_line(2, target, words, &w);
+		if (error != STATUS_OK)
+		{
+			printf("%s: G5.2 error %d\n", name, error);
+			return false;
+		}
+	}
+
+	parser_words_t w = {0};
+	w.ijk[AXIS_Z] = (float)end_knot;
+	uint8_t error = g5_line(3, NULL, (explicit_knots) ? GCODE_WORD_K : 0, &w);
+	if (error != STATUS_OK)
+	{
+		printf("%s: G5.3 error %d\n", name, error);
+		return false;
+	}
+
+	for (int i = 0; i <= SAMPLES; i++)
+	{
+		nurbs_reference(pts, n, order, knots, end_knot * i / SAMPLES, samples[i]);
+	}
+
+	// each segment end is matched to the closest part of the reference curve (searching forward)
+	double max_vertex = 0, max_deviation = 0;
+	int prev_sample = 0;
+	const double *prev = samples[0];
+	for (int k = 0; k < output_count; k++)
+	{
+		int best = prev_sample;
+		double best_dist = 1e9;
+		for (int j = prev_sample; j < SAMPLES; j++)
+		{
+			double d = dist_to_segment(output[k], samples[j], samples[j + 1]);
+			if (d < best_dist)
+			{
+				best_dist = d;
+				best = j;
+			}
+		}
+		max_vertex = fmax(max_vertex, best_dist);
+
+		// the reference curve between the segment ends must be within the tolerance
+		for (int j = prev_sample + 1; j <= best; j++)
+		{
+			max_deviation = fmax(max_deviation, dist_to_segment(samples[j], prev, output[k]));
+		}
+
+		prev_sample = best;
+		prev = output[k];
+	}
+
+	double end_error = 0;
+	for (int a = 0; a < AXIS_COUNT; a++)
+	{
+		end_error = fmax(end_error, fabs(output[output_count - 1][a] - pts[n - 1].p[a]));
+	}
+
+	bool ok = (max_vertex < 1e-3) && (max_deviation <= (G5_CHORD_TOLERANCE + 1e-4)) && (end_error < 1e-4);
+	printf("%-28s order %d, %2d points, %4d segments, max deviation %5.2f um, segment ends %5.3f um %s\n", name, order, n, output_count, max_deviation * 1000.0, max_vertex * 1000.0, (ok) ? "" : "FAIL");
+	return ok;
+}
+
+static bool run_random(const char *name, int n, int order, double step, double amplitude, bool weights, bool explicit_knots)
+{
+	ctrl_point_t pts[MAX_POINTS];
+	double knot = 0;
+	int multiplicity = 0;
+	for (int i = 0; i < n; i++)
+	{
+		pts[i].p[AXIS_X] = (i) ? (pts[i - 1].p[AXIS_X] + step * (0.5 + sim_rand())) : 0;
+		pts[i].p[AXIS_Y] = amplitude * (sim_rand() - 0.5);
+		pts[i].p[AXIS_Z] = 0.2 * amplitude * (sim_rand() - 0.5);
+		pts[i].w = (i && weights) ? (0.5 + 2.5 * sim_rand()) : 1;
+		if (i >= order)
+		{
+			// non uniform knots with some repeated knots
+			// the multiplicity is kept bellow the order (the curve is continuous)
+			if (explicit_knots && i > order && multiplicity < (order - 1) && sim_rand() < 0.2)
+			{
+				multiplicity++;
+			}
+			else
+			{
+				knot += (explicit_knots) ? (0.2 + 2 * sim_rand()) : 1;
+				multiplicity = 1;
+			}
+		}
+		pts[i].knot = knot;
+	}
+
+	return run_curve(name, pts, n, order, knot + ((explicit_knots) ? 1.5 : 1), explicit_knots);
+}
+
+static bool run_rejects(void)
+{
+	const float p1[AXIS_COUNT] = {10, 10, 0};
+	const float p2[AXIS_COUNT] = {20, 0, 0};
+	parser_words_t w = {0};
+	bool ok = true;
+
+	memset(sim_position, 0, sizeof(sim_position));
+	memset(parser_position, 0, sizeof(parser_position));
+
+	// other motion while the curve is open is rejected and the curve is discarded
+	ok &= (g5_line(2, p1, GCODE_WORD_X | GCODE_WORD_Y, &w) == STATUS_OK);
+	ok &= (g1_line() == STATUS_GCODE_MODAL_GROUP_VIOLATION);
+	ok &= (g5_line(3, NULL, 0, &w) == STATUS_GCODE_UNSUPPORTED_COMMAND);
+
+	// same for G5 and G5.1
+	ok &= (g5_line(2, p1, GCODE_WORD_X | GCODE_WORD_Y, &w) == STATUS_OK);
+	w.ijk[AXIS_X] = w.ijk[AXIS_Y] = w.p = w.d = 1;
+	ok &= (g5_line(0, p2, GCODE_WORD_X | GCODE_WORD_Y | GCODE_WORD_I | GCODE_WORD_J | GCODE_WORD_P | GCODE_WORD_Q, &w) == STATUS_GCODE_MODAL_GROUP_VIOLATION);
+	ok &= (g5_line(3, NULL, 0, &w) == STATUS_GCODE_UNSUPPORTED_COMMAND);
+
+	// G5.2 lines and other motion without an open curve are accepted
+	memset(&w, 0, sizeof(w));
+	ok &= (g1_line() == STATUS_OK);
+	ok &= (g5_line(2, p1, GCODE_WORD_X | GCODE_WORD_Y, &w) == STATUS_OK);
+	ok &= (g5_line(2, p2, GCODE_WORD_X | GCODE_WORD_Y, &w) == STATUS_OK);
+	ok &= (g5_line(3, NULL, 0, &w) == STATUS_OK);
+	ok &= (g1_line() == STATUS_OK);
+
+	printf("%-28s %s\n", "motion while a curve is open", (ok) ? "rejected" : "FAIL");
+	return ok;
+}
+
+int main(void)
+{
+	bool ok = true;
+
+	mod_g5_hook();
+
+	// README example
+	const ctrl_point_t example[] = {
+		{{0, 0, 0}, 1, 0},
+		{{10, 10, 1}, 1, 0},
+		{{20, -10, 2}, 2, 0},
+		{{30, 10, 1}, 1, 0},
+		{{40, 0, 0}, 1, 0},
+	};
+	ok &= run_curve("README example", example, 5, 4, 2, false);
+
+	// the quadratic curve with 3 points is a parabola
+	const ctrl_point_t parabola[] = {
+		{{0, 0, 0}, 1, 0},
+		{{50, 100, 0}, 1, 0},
+		{{100, 0, 0}, 1, 0},
+	};
+	ok &= run_curve("parabola", parabola, 3, 3, 1, false);
+
+	// a 90 degree arc as a rational quadratic curve
+	const ctrl_point_t arc[] = {
+		{{10, 0, 0}, 1, 0},
+		{{10, 10, 0}, 0.70710678, 0},
+		{{0, 10, 0}, 1, 0},
+	};
+	ok &= run_curve("rational arc", arc, 3, 3, 1, false);
+
+	ok &= run_random("order 2 (control polygon)", 12, 2, 5, 10, false, false);
+	ok &= run_random("uniform", 40, 3, 8, 20, false, false);
+	ok &= run_random("uniform cubic", 40, 4, 8, 20, false, false);
+	ok &= run_random("weights and knots", 40, 4, 8, 20, true, true);
+	ok &= run_random("tight weights and knots", 40, 3, 0.5, 1, true, true);
+	ok &= run_random("long span", 10, 4, 100, 200, true, true);
+
+	ok &= run_rejects();
+
+	printf(ok ? "PASS\n" : "FAIL\n");
+	return ok ? 0 : 1;
+}
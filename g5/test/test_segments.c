@@ -0,0 +1,309 @@
+/*
+	G5 and G5.1 segmentation benchmark
+
+	Runs a set of G5 (cubic) and G5.1 (quadratic) curves through the module and measures the segments against the exact curve (double precision):
+		- number of segments and max distance between the curve and the segments (must not exceed G5_CHORD_TOLERANCE)
+		- each segment end must be on the curve (the forward differencing of G5_DISABLE_ARC_LENGTH accumulates rounding errors)
+		- the motion must end at the target
+	The same curves are also measured with the fixed 1mm step of the first version of the module for comparison
+	A corpus of random curves measures how the segments are placed:
+		- the mean deviation of each segment (relative to the tolerance) shows how much of the tolerance each segment uses
+		- the variation of the segment length (standard deviation / mean length of each curve) shows the segments are not constant length
+
+	The Makefile builds and runs it with the default (arc length table) and G5_DISABLE_ARC_LENGTH (forward differencing)
+*/
+
+#include "build/src/cnc.h"
+#include <stdio.h>
+
+#ifndef G5_CHORD_TOLERANCE
+#define G5_CHORD_TOLERANCE 0.01f
+#endif
+
+#define MAX_OUTPUT 20000
+#define SAMPLES 100000
+#define CORPUS_CURVES 200
+#define CORPUS_SAMPLES 20000
+
+bool g5_parse(void *args);
+bool g5_exec(void *args);
+void mod_g5_hook(void);
+
+typedef struct
+{
+	const char *name;
+	bool quadratic;
+	// control points (the curve starts at p[0])
+	double p[4][2];
+} curve_t;
+
+static float sim_position[AXIS_COUNT];
+static double output[MAX_OUTPUT][2];
+static int output_count;
+// max deviation of each segment (to the previous segment end)
+static double output_deviation[MAX_OUTPUT];
+static double samples[SAMPLES + 1][2];
+static int sample_count;
+static uint32_t sim_rng = 1;
+
+// deterministic on every libc
+static double sim_rand(void)
+{
+	sim_rng = sim_rng * 1664525UL + 1013904223UL;
+	return (double)(sim_rng >> 8) / 16777216.0;
+}
+
+uint8_t mc_line(float *target, motion_data_t *block_data)
+{
+	if (output_count < MAX_OUTPUT)
+	{
+		output[output_count][0] = target[AXIS_X];
+		output[output_count][1] = target[AXIS_Y];
+		output_count++;
+	}
+	memcpy(sim_position, target, sizeof(sim_position));
+	return STATUS_OK;
+}
+
+void mc_get_position(float *target)
+{
+	memcpy(target, sim_position, sizeof(sim_position));
+}
+
+static void bezier(const curve_t *c, double t, double *point)
+{
+	double s = 1 - t;
+	for (int a = 0; a < 2; a++)
+	{
+		point[a] = (c->quadratic) ? (s * s * c->p[0][a] + 2 * s * t * c->p[1][a] + t * t * c->p[2][a]) : (s * s * s * c->p[0][a] + 3 * s * s * t * c->p[1][a] + 3 * s * t * t * c->p[2][a] + t * t * t * c->p[3][a]);
+	}
+}
+
+// runs the curve as a G5 or G5.1 line
+static uint8_t g5_line(const curve_t *c)
+{
+	parser_state_t state = {0};
+	parser_cmd_explicit_t cmd = {0};
+	parser_words_t w = {0};
+	motion_data_t block_data = {0};
+	uint8_t error = 0xFF;
+	int end = (c->quadratic) ? 2 : 3;
+	float target[AXIS_COUNT] = {(float)c->p[end][0], (float)c->p[end][1], 0};
+
+	gcode_parse_args_t parse = {'G', 5, (c->quadratic) ? 5.1f : 5.0f, &error, &state, &w, &cmd};
+	if (!g5_parse(&parse) || error != STATUS_OK)
+	{
+		return 0xFF;
+	}
+
+	// I J is the offset of the first control point from the start and P Q the offset of the second control point from the end
+	cmd.words = GCODE_WORD_X | GCODE_WORD_Y | GCODE_WORD_I | GCODE_WORD_J;
+	w.ijk[AXIS_X] = (float)(c->p[1][0] - c->p[0][0]);
+	w.ijk[AXIS_Y] = (float)(c->p[1][1] - c->p[0][1]);
+	if (!c->quadratic)
+	{
+		cmd.words |= GCODE_WORD_P | GCODE_WORD_Q;
+		w.p = (float)(c->p[2][0] - c->p[3][0]);
+		w.d = (float)(c->p[2][1] - c->p[3][1]);
+	}
+
+	sim_position[AXIS_X] = (float)c->p[0][0];
+	sim_position[AXIS_Y] = (float)c->p[0][1];
+	sim_position[AXIS_Z] = 0;
+	output_count = 0;
+	gcode_exec_args_t exec = {&state, &w, &cmd, &error, target, &block_data};
+	if (!g5_exec(&exec))
+	{
+		return 0xFF;
+	}
+
+	return error;
+}
+
+// first version of the module (fixed t step of 1mm over the longest control polygon leg)
+static void fixed_step(const curve_t *c)
+{
+	int end = (c->quadratic) ? 2 : 3;
+	float max_len = 0;
+	for (int i = 0; i < end; i++)
+	{
+		max_len = fmaxf(max_len, (float)hypot(c->p[i + 1][0] - c->p[i][0], c->p[i + 1][1] - c->p[i][1]));
+	}
+
+	output_count = 0;
+	float t_inc = 1.0f / max_len;
+	for (float t = t_inc; t < 1.0f && output_count < MAX_OUTPUT; t += t_inc)
+	{
+		bezier(c, t, output[output_count++]);
+	}
+	output[output_count][0] = c->p[end][0];
+	output[output_count][1] = c->p[end][1];
+	output_count++;
+}
+
+static double dist_to_segment(const double *p, const double *a, const double *b)
+{
+	double ab[2] = {b[0] - a[0], b[1] - a[1]};
+	double ap[2] = {p[0] - a[0], p[1] - a[1]};
+	double len2 = ab[0] * ab[0] + ab[1] * ab[1];
+	double t = (len2 > 0) ? fmin(fmax((ab[0] * ap[0] + ab[1] * ap[1]) / len2, 0), 1) : 0;
+	return hypot(ap[0] - t * ab[0], ap[1] - t * ab[1]);
+}
+
+// compares the output segments with the curve
+// each segment end is matched to the closest part of the curve (searching forward)
+static void measure(const curve_t *c, double *max_deviation, double *max_vertex, double *end_error)
+{
+	int end = (c->quadratic) ? 2 : 3;
+	int prev_sample = 0;
+	const double *prev = samples[0];
+
+	*max_deviation = *max_vertex = 0;
+	for (int k = 0; k < output_count; k++)
+	{
+		int best = prev_sample;
+		double best_dist = 1e9;
+		for (int j = prev_sample; j < sample_count; j++)
+		{
+			double d = dist_to_segment(output[k], samples[j], samples[j + 1]);
+			if (d < best_dist)
+			{
+				best_dist = d;
+				best = j;
+			}
+		}
+		*max_vertex = fmax(*max_vertex, best_dist);
+
+		output_deviation[k] = 0;
+		for (int j = prev_sample + 1; j <= best; j++)
+		{
+			output_deviation[k] = fmax(output_deviation[k], dist_to_segment(samples[j], prev, output[k]));
+		}
+		*max_deviation = fmax(*max_deviation, output_deviation[k]);
+
+		prev_sample = best;
+		prev = output[k];
+	}
+
+	*end_error = hypot(output[output_count - 1][0] - c->p[end][0], output[output_count - 1][1] - c->p[end][1]);
+}
+
+static bool run(const curve_t *c)
+{
+	double deviation, vertex, end_error;
+
+	sample_count = SAMPLES;
+	for (int i = 0; i <= SAMPLES; i++)
+	{
+		bezier(c, (double)i / SAMPLES, samples[i]);
+	}
+
+	fixed_step(c);
+	measure(c, &deviation, &vertex, &end_error);
+	int fixed_count = output_count;
+	double fixed_deviation = deviation;
+
+	uint8_t error = g5_line(c);
+	if (error != STATUS_OK)
+	{
+		printf("%s: error %d\n", c->name, error);
+		return false;
+	}
+	measure(c, &deviation, &vertex, &end_error);
+
+	bool ok = (deviation <= (G5_CHORD_TOLERANCE + 1e-4)) && (vertex < 1e-3) && (end_error < 1e-4);
+	printf("%-26s %5d segments, max deviation %6.2f um, segment ends %5.3f um | fixed 1mm %5d segments, max deviation %7.2f um %s\n", c->name, output_count, deviation * 1000.0, vertex * 1000.0, fixed_count, fixed_deviation * 1000.0, (ok) ? "" : "FAIL");
+	return ok;
+}
+
+// random curves from 1mm to 200mm (the control points x is increasing so the curves don't loop)
+static bool run_corpus(void)
+{
+	long segments = 0;
+	double max_deviation = 0, usage = 0, variation = 0;
+	int variation_count = 0;
+
+	sample_count = CORPUS_SAMPLES;
+	for (int i = 0; i < CORPUS_CURVES; i++)
+	{
+		curve_t c = {"corpus", ((i % 4) == 3)};
+		int end = (c.quadratic) ? 2 : 3;
+		double size = pow(10, 2.3 * sim_rand());
+		for (int k = 0; k <= end; k++)
+		{
+			c.p[k][0] = size * (k + ((k && k < end) ? (0.8 * (sim_rand() - 0.5)) : 0)) / end;
+			c.p[k][1] = size * ((k && k < end) ? 0.6 : 0.2) * (sim_rand() - 0.5);
+		}
+		c.p[0][1] = 0;
+
+		for (int j = 0; j <= CORPUS_SAMPLES; j++)
+		{
+			bezier(&c, (double)j / CORPUS_SAMPLES, samples[j]);
+		}
+
+		double deviation, vertex, end_error;
+		if (g5_line(&c) != STATUS_OK)
+		{
+			printf("corpus: error\n");
+			return false;
+		}
+		measure(&c, &deviation, &vertex, &end_error);
+		max_deviation = fmax(max_deviation, deviation);
+		segments += output_count;
+
+		double sum = 0, sum2 = 0;
+		const double *prev = c.p[0];
+		for (int k = 0; k < output_count; k++)
+		{
+			double len = hypot(output[k][0] - prev[0], output[k][1] - prev[1]);
+			sum += len;
+			sum2 += len * len;
+			usage += output_deviation[k] / G5_CHORD_TOLERANCE;
+			prev = output[k];
+		}
+
+		if (output_count > 1)
+		{
+			double mean = sum / output_count;
+			variation += sqrt(fmax(sum2 / output_count - mean * mean, 0)) / mean;
+			variation_count++;
+		}
+	}
+
+	bool ok = (max_deviation <= (G5_CHORD_TOLERANCE + 1e-4));
+	printf("corpus of %d curves: %ld segments, max deviation %5.2f um, mean segment deviation %3.0f%% of the tolerance, segment length variation %3.0f%% %s\n", CORPUS_CURVES, segments, max_deviation * 1000.0, 100.0 * usage / segments, 100.0 * variation / variation_count, (ok) ? "" : "FAIL");
+	return ok;
+}
+
+static const curve_t curves[] = {
+	{"gentle 150mm S curve", false, {{0, 0}, {50, 20}, {100, -20}, {150, 0}}},
+	{"tight 5x5 loop", false, {{0, 0}, {5, 5}, {-2, 5}, {1, 0}}},
+	{"sharp peak", false, {{0, 0}, {20, 20}, {20, 20}, {40, 0}}},
+	{"uneven control points", false, {{0, 0}, {1, 1}, {99, 1}, {100, 0}}},
+	{"straight line", false, {{0, 0}, {10, 0}, {20, 0}, {30, 0}}},
+	{"far from origin", false, {{1000, 1000}, {1040, 1030}, {1060, 970}, {1100, 1000}}},
+	{"quadratic 20mm", true, {{0, 0}, {10, 10}, {20, 0}}},
+	{"quadratic 200mm flat", true, {{0, 0}, {100, 2}, {200, 0}}},
+	{"quadratic 2mm", true, {{0, 0}, {1, 1}, {2, 0}}},
+};
+
+int main(void)
+{
+	bool ok = true;
+
+	mod_g5_hook();
+#ifdef G5_DISABLE_ARC_LENGTH
+	printf("forward differencing (G5_DISABLE_ARC_LENGTH)\n");
+#else
+	printf("arc length table\n");
+#endif
+
+	for (unsigned i = 0; i < (sizeof(curves) / sizeof(curve_t)); i++)
+	{
+		ok &= run(&curves[i]);
+	}
+	ok &= run_corpus();
+
+	printf(ok ? "PASS\n" : "FAIL\n");
+	return ok ? 0 : 1;
+}
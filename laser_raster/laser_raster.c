@@ -0,0 +1,636 @@
+/*
+	Name: laser_raster.c
+	Description: Laser raster engine for µCNC.
+		Each G6 command defines a scan line (start, direction and pixel pitch) and carries the pixel intensities encoded in base64.
+		The scan line is executed as a single planner block and the step ISR updates the laser power at each pixel boundary.
+
+	Copyright: Copyright (c) João Martins
+	Author: João Martins
+	Date: 19-10-2026
+
+	µCNC is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version. Please see <http://www.gnu.org/licenses/>
+
+	µCNC is distributed WITHOUT ANY WARRANTY;
+	Also without the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the	GNU General Public License for more details.
+*/
+
+#include "../../cnc.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#if (UCNC_MODULE_VERSION < 10800 || UCNC_MODULE_VERSION > 99999)
+#error "This module is not compatible with the current version of µCNC"
+#endif
+
+// character that starts the base64 pixel data in the G6 line
+#ifndef LASER_RASTER_TOKEN
+#define LASER_RASTER_TOKEN '@'
+#endif
+// pixels buffer (max pixels in a line is LASER_RASTER_BUFFER_SIZE - 1)
+#ifndef LASER_RASTER_BUFFER_SIZE
+#define LASER_RASTER_BUFFER_SIZE 512
+#endif
+// default distance (mm) before the first and after the last pixel (should be enough to reach the scan feed)
+#ifndef LASER_RASTER_OVERSCAN
+#define LASER_RASTER_OVERSCAN 2.0f
+#endif
+// default pixel shift (mm) of lines scanned in the reverse direction (compensates the laser response delay in bidirectional scans)
+#ifndef LASER_RASTER_SCAN_OFFSET
+#define LASER_RASTER_SCAN_OFFSET 0.0f
+#endif
+// blocks in the planner plus the blocks being executed by the interpolator
+#ifndef LASER_RASTER_BLOCKS
+#define LASER_RASTER_BLOCKS (PLANNER_BUFFER_SIZE + INTERPOLATOR_BUFFER_SIZE)
+#endif
+
+// this ID must be unique for each code
+#define G6 6
+
+// the raster engine must be enabled with ENABLE_LASER_RASTER (in cnc_hal_overrides.h)
+#ifdef ENABLE_LASER_RASTER
+#if !defined(ENABLE_PARSER_MODULES) || !defined(ENABLE_MOTION_CONTROL_MODULES) || !defined(ENABLE_RT_SYNC_MOTIONS)
+#warning "Parser extensions, motion control extensions or realtime sync motions are not enabled. Laser raster module will not work."
+#undef ENABLE_LASER_RASTER
+#endif
+#endif
+
+#ifdef ENABLE_LASER_RASTER
+// the pixels are set by the step callback, attached from startup, so no other itp_rt_stepbits user can be enabled
+#if defined(M62_M65_SYNC_OUTPUTS) || defined(M67_M68_SYNC_OUTPUTS) || defined(S_CLUSTER_RT_SYNC) || defined(G33_ENCODER) || defined(SINGLE_AXIS_HOMING_EDGE_INTERPOLATION)
+#error "ENABLE_LASER_RASTER can't be used with other modules that use the itp_rt_stepbits hook"
+#endif
+
+// all blocks that go through the motion control are queued so that the ISR can follow the blocks by counting the main stepper steps
+// only the scan line blocks have pixels
+// a scan line split in several segments (kinematics or leveling) has a block per segment and each block has the pixels that start or continue in it
+typedef struct
+{
+	uint32_t steps;
+	// pixel boundaries in main stepper steps (24.8 fixed point)
+	// the first boundary is negative if the first pixel started in the previous segment
+	int32_t first;
+	uint32_t inc;
+	uint16_t pixel;
+	uint16_t count;
+	// tool speed of a full intensity pixel
+	int16_t power;
+	uint8_t main_stepper;
+	// block of a scan line
+	bool scan;
+	// last block of the scan line (turns the laser off and releases the scan line pixels)
+	bool end;
+	uint16_t release;
+} laser_raster_block_t;
+
+static laser_raster_block_t laser_raster_blocks[LASER_RASTER_BLOCKS];
+static volatile uint8_t laser_raster_blocks_head;
+static volatile uint8_t laser_raster_blocks_tail;
+static uint8_t laser_raster_pixels[LASER_RASTER_BUFFER_SIZE];
+static volatile uint16_t laser_raster_pixels_head;
+static volatile uint16_t laser_raster_pixels_tail;
+// ISR state of the current block
+static volatile uint32_t laser_raster_step;
+static volatile int32_t laser_raster_next_boundary;
+static volatile uint16_t laser_raster_next_pixel;
+
+// scan line being sent to the planner (distances in mm along the scan)
+typedef struct
+{
+	uint16_t count;
+	uint16_t pixel;
+	int16_t power;
+	float first;
+	float pitch;
+	float length;
+	// distance already sent to the planner
+	float position;
+} laser_raster_line_t;
+
+static laser_raster_line_t laser_raster_line;
+// decoded pixels of the line being parsed (not commited to the buffer yet)
+static uint16_t laser_raster_pending;
+
+static FORCEINLINE uint16_t laser_raster_pixels_free(void)
+{
+	uint16_t head = laser_raster_pixels_head;
+	uint16_t tail = laser_raster_pixels_tail;
+	return (LASER_RASTER_BUFFER_SIZE - 1) - ((head >= tail) ? (head - tail) : (LASER_RASTER_BUFFER_SIZE + head - tail));
+}
+
+static FORCEINLINE uint8_t laser_raster_blocks_free(void)
+{
+	uint8_t head = laser_raster_blocks_head;
+	uint8_t tail = laser_raster_blocks_tail;
+	return (LASER_RASTER_BLOCKS - 1) - ((head >= tail) ? (head - tail) : (LASER_RASTER_BLOCKS + head - tail));
+}
+
+static FORCEINLINE uint16_t laser_raster_wrap(uint16_t index)
+{
+	return (index < LASER_RASTER_BUFFER_SIZE) ? index : (index - LASER_RASTER_BUFFER_SIZE);
+}
+
+void laser_raster_step_cb(uint8_t stepbits, uint8_t itp_flags)
+{
+#ifdef ITP_BACKLASH
+	// backlash compensation blocks are not queued
+	if (itp_flags & ITP_BACKLASH)
+	{
+		return;
+	}
+#endif
+
+	uint8_t tail = laser_raster_blocks_tail;
+	if (tail == laser_raster_blocks_head)
+	{
+		return;
+	}
+
+	laser_raster_block_t *block = &laser_raster_blocks[tail];
+	if (!(stepbits & (1 << block->main_stepper)))
+	{
+		return;
+	}
+
+	uint32_t step = ++laser_raster_step;
+	if (step >= block->steps)
+	{
+		// block ended
+		if (block->end)
+		{
+			tool_set_speed(0);
+			laser_raster_pixels_tail = block->release;
+		}
+
+		if (++tail == LASER_RASTER_BLOCKS)
+		{
+			tail = 0;
+		}
+		laser_raster_blocks_tail = tail;
+		laser_raster_step = 0;
+		laser_raster_next_pixel = 0;
+		laser_raster_next_boundary = laser_raster_blocks[tail].first;
+		return;
+	}
+
+	if (!block->scan)
+	{
+		return;
+	}
+
+	// pixel boundaries crossed by this step (more than one if the pixel pitch is smaller than a step)
+	int32_t pos = (int32_t)(step << 8);
+	uint16_t i = laser_raster_next_pixel;
+	int32_t boundary = laser_raster_next_boundary;
+	if (!block->count || pos < boundary || i > block->count)
+	{
+		if (step == 1)
+		{
+			// the previous pixel ended in the previous segment
+			tool_set_speed(0);
+		}
+		return;
+	}
+
+	do
+	{
+		boundary += (int32_t)block->inc;
+		i++;
+	} while (pos >= boundary && i <= block->count);
+
+	laser_raster_next_pixel = i;
+	laser_raster_next_boundary = boundary;
+
+	if (i > block->count)
+	{
+		// after the last pixel
+		tool_set_speed(0);
+		return;
+	}
+
+	// scales 0-255 to 0-256 to avoid the division
+	uint16_t value = laser_raster_pixels[laser_raster_wrap(block->pixel + i - 1)];
+	tool_set_speed((int16_t)(((int32_t)block->power * (value + (value >> 7))) >> 8));
+}
+
+// the planner and the interpolator are empty (the step ISR is not following any block)
+static FORCEINLINE bool laser_raster_motion_idle(void)
+{
+	return planner_buffer_is_empty() && !cnc_get_exec_state(EXEC_RUN);
+}
+
+// restarts the queue while the motion is stopped
+// this also drops the blocks left by a planner clear without a reset (probe, jog cancel, homing...)
+static void laser_raster_resync(void)
+{
+	laser_raster_blocks_head = laser_raster_blocks_tail = 0;
+	// keeps the pixels of the scan line being sent to the planner (and the pixels being decoded after the head)
+	laser_raster_pixels_tail = (laser_raster_line.count) ? laser_raster_line.pixel : laser_raster_pixels_head;
+	laser_raster_step = 0;
+	laser_raster_next_pixel = 0;
+}
+
+// sets the pixels of the scan line segment [position, position + length[
+static void laser_raster_segment(laser_raster_block_t *block, uint32_t steps, float steps_per_mm)
+{
+	laser_raster_line_t *line = &laser_raster_line;
+	float start = line->position;
+	float remaining = line->length - start;
+	float length = (steps_per_mm > 0) ? (steps / steps_per_mm) : remaining;
+
+	// the last segment (less than a step left) takes the remaining length
+	if (steps_per_mm <= 0 || (remaining - length) * steps_per_mm < 1.0f)
+	{
+		length = remaining;
+		block->end = true;
+		block->release = laser_raster_wrap(line->pixel + line->count);
+	}
+
+	block->scan = true;
+	if (length <= 0)
+	{
+		return;
+	}
+
+	float end = start + length;
+	line->position = end;
+	steps_per_mm = 256.0f * steps / length;
+
+	// first pixel that ends after the segment start and pixels that start before the segment end
+	uint16_t first = 0;
+	if (start > line->first)
+	{
+		first = (uint16_t)MIN((start - line->first) / line->pitch, line->count);
+	}
+	uint16_t last = line->count;
+	if (!block->end)
+	{
+		last = (end > line->first) ? (uint16_t)MIN(ceilf((end - line->first) / line->pitch), line->count) : 0;
+	}
+
+	if (last <= first)
+	{
+		return;
+	}
+
+	// a pixel that started in the previous segment has a negative start (and is set on the first step)
+	block->first = (int32_t)floorf((line->first + first * line->pitch - start) * steps_per_mm);
+	block->inc = MAX((uint32_t)(line->pitch * steps_per_mm), 1);
+	block->count = last - first;
+	block->power = line->power;
+	block->pixel = laser_raster_wrap(line->pixel + first);
+}
+
+bool laser_raster_mc_line_segment(void *args)
+{
+	motion_data_t *block_data = (motion_data_t *)args;
+	uint32_t steps = block_data->steps[block_data->main_stepper];
+
+	if (!steps)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	if (laser_raster_motion_idle())
+	{
+		laser_raster_resync();
+	}
+
+	// waits for space in the queue (only happens if the blocks are very short)
+	while (!laser_raster_blocks_free())
+	{
+		if (laser_raster_motion_idle())
+		{
+			// the motion ended without the ISR releasing the queue
+			laser_raster_resync();
+			break;
+		}
+
+		if (!cnc_dotasks())
+		{
+			return EVENT_CONTINUE;
+		}
+	}
+
+	uint8_t head = laser_raster_blocks_head;
+	laser_raster_block_t *block = &laser_raster_blocks[head];
+	memset(block, 0, sizeof(laser_raster_block_t));
+	block->steps = steps;
+	block->main_stepper = block_data->main_stepper;
+
+	if (laser_raster_line.count)
+	{
+		// feed_conversion is the main stepper steps per mm of the segment
+		laser_raster_segment(block, steps, block_data->feed_conversion);
+		if (block->end)
+		{
+			// the remaining segments (if any) are not part of the scan line
+			laser_raster_line.count = 0;
+		}
+	}
+
+	// first block of an empty queue sets the ISR state
+	ATOMIC_CODEBLOCK
+	{
+		if (laser_raster_blocks_tail == head)
+		{
+			laser_raster_step = 0;
+			laser_raster_next_pixel = 0;
+			laser_raster_next_boundary = block->first;
+		}
+
+		if (++head == LASER_RASTER_BLOCKS)
+		{
+			head = 0;
+		}
+		laser_raster_blocks_head = head;
+	}
+
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(mc_line_segment, laser_raster_mc_line_segment);
+
+// ends the scan line if the last segment was not found by the distance (or the motion failed)
+static void laser_raster_close_line(void)
+{
+	if (!laser_raster_line.count)
+	{
+		return;
+	}
+
+	uint16_t release = laser_raster_wrap(laser_raster_line.pixel + laser_raster_line.count);
+	laser_raster_line.count = 0;
+	ATOMIC_CODEBLOCK
+	{
+		uint8_t head = laser_raster_blocks_head;
+		if (head != laser_raster_blocks_tail)
+		{
+			// the last block is still queued
+			head = (head) ? (head - 1) : (LASER_RASTER_BLOCKS - 1);
+			laser_raster_blocks[head].end = true;
+			laser_raster_blocks[head].release = release;
+		}
+		else
+		{
+			tool_set_speed(0);
+			laser_raster_pixels_tail = release;
+		}
+	}
+}
+
+static int8_t laser_raster_base64(unsigned char c)
+{
+	if (c >= 'A' && c <= 'Z')
+	{
+		return c - 'A';
+	}
+	if (c >= 'a' && c <= 'z')
+	{
+		return c - 'a' + 26;
+	}
+	if (c >= '0' && c <= '9')
+	{
+		return c - '0' + 52;
+	}
+	switch (c)
+	{
+	case '+':
+		return 62;
+	case '/':
+		return 63;
+	}
+
+	return -1;
+}
+
+// decodes the base64 pixel data directly to the pixels buffer
+// the pixels are only commited when the G6 command is executed
+bool laser_raster_parse_token(void *args)
+{
+	unsigned char c = *((unsigned char *)args);
+	if (c != LASER_RASTER_TOKEN)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	uint16_t count = 0;
+	uint16_t bits = 0;
+	uint8_t bit_count = 0;
+	uint16_t index = laser_raster_pixels_head;
+
+	for (;;)
+	{
+		c = serial_getc();
+		if (c == EOL)
+		{
+			break;
+		}
+
+		if (c == '=' || c == ' ')
+		{
+			// padding
+			continue;
+		}
+
+		int8_t val = laser_raster_base64(c);
+		if (val < 0 || count >= (LASER_RASTER_BUFFER_SIZE - 1))
+		{
+			// invalid data or line too long
+			laser_raster_pending = 0;
+			return EVENT_CONTINUE;
+		}
+
+		bits = (bits << 6) | val;
+		bit_count += 6;
+		if (bit_count >= 8)
+		{
+			bit_count -= 8;
+			// waits for the ISR to release the pixels of the previous lines
+			while (laser_raster_pixels_free() <= count)
+			{
+				if (laser_raster_motion_idle())
+				{
+					// the motion ended without the ISR releasing the pixels
+					laser_raster_resync();
+					continue;
+				}
+
+				if (!cnc_dotasks())
+				{
+					laser_raster_pending = 0;
+					return EVENT_CONTINUE;
+				}
+			}
+			laser_raster_pixels[index] = (uint8_t)(bits >> bit_count);
+			index = laser_raster_wrap(index + 1);
+			count++;
+		}
+	}
+
+	laser_raster_pending = count;
+	*((unsigned char *)args) = EOL;
+	return EVENT_HANDLED;
+}
+
+CREATE_EVENT_LISTENER(parse_token, laser_raster_parse_token);
+
+bool laser_raster_parse(void *args)
+{
+	gcode_parse_args_t *ptr = (gcode_parse_args_t *)args;
+	if (ptr->word == 'G' && ptr->code == G6)
+	{
+		if (ptr->cmd->group_extended != 0 || CHECKFLAG(ptr->cmd->groups, GCODE_GROUP_MOTION))
+		{
+			// there is a collision of custom gcode commands (only one per line can be processed)
+			*(ptr->error) = STATUS_GCODE_MODAL_GROUP_VIOLATION;
+			return EVENT_HANDLED;
+		}
+
+		if (ptr->value != ptr->code)
+		{
+			// extendable
+			return EVENT_CONTINUE;
+		}
+
+		ptr->new_state->groups.motion = G6;
+		ptr->new_state->groups.motion_mantissa = 0;
+		SETFLAG(ptr->cmd->groups, GCODE_GROUP_MOTION);
+		ptr->cmd->group_extended = EXTENDED_MOTION_GCODE(G6);
+		*(ptr->error) = STATUS_OK;
+		return EVENT_HANDLED;
+	}
+
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(gcode_parse, laser_raster_parse);
+
+// G6 X Y Z (first pixel start) I J K (direction) R (pixel pitch) P (overscan) D (reverse scan offset) @<base64 pixels>
+bool laser_raster_exec(void *args)
+{
+	gcode_exec_args_t *ptr = (gcode_exec_args_t *)args;
+	if (ptr->cmd->group_extended != EXTENDED_MOTION_GCODE(G6))
+	{
+		return EVENT_CONTINUE;
+	}
+
+	uint16_t count = laser_raster_pending;
+	laser_raster_pending = 0;
+
+	if (!count || !CHECKFLAG(ptr->cmd->words, GCODE_WORD_R) || !CHECKFLAG(ptr->cmd->words, (GCODE_WORD_I | GCODE_WORD_J | GCODE_WORD_K)))
+	{
+		*(ptr->error) = STATUS_GCODE_VALUE_WORD_MISSING;
+		return EVENT_HANDLED;
+	}
+
+	float pitch = ptr->words->r;
+	float overscan = (CHECKFLAG(ptr->cmd->words, GCODE_WORD_P)) ? ptr->words->p : LASER_RASTER_OVERSCAN;
+	float offset = (CHECKFLAG(ptr->cmd->words, GCODE_WORD_D)) ? ptr->words->d : LASER_RASTER_SCAN_OFFSET;
+	if (pitch <= 0 || overscan < 0)
+	{
+		*(ptr->error) = STATUS_NEGATIVE_VALUE;
+		return EVENT_HANDLED;
+	}
+
+	// scan direction
+	float dir[3];
+	float dir_len = 0;
+	uint8_t main_dir = 0;
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		dir[i] = ptr->words->ijk[i];
+		dir_len += fast_flt_pow2(dir[i]);
+		if (ABS(dir[i]) > ABS(dir[main_dir]))
+		{
+			main_dir = i;
+		}
+	}
+
+	if (dir_len == 0)
+	{
+		*(ptr->error) = STATUS_GCODE_INVALID_TARGET;
+		return EVENT_HANDLED;
+	}
+
+	dir_len = 1.0f / fast_flt_sqrt(dir_len);
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		dir[i] *= dir_len;
+	}
+
+	// the scan starts and ends with the overscan distance
+	float length = count * pitch;
+	float start[AXIS_COUNT];
+	memcpy(start, ptr->target, sizeof(start));
+	for (uint8_t i = 0; i < MIN(AXIS_COUNT, 3); i++)
+	{
+		start[i] -= dir[i] * overscan;
+		ptr->target[i] += dir[i] * (length + overscan);
+	}
+
+	// moves to the start of the scan with the laser off
+	motion_data_t block;
+	memcpy(&block, ptr->block_data, sizeof(motion_data_t));
+	block.spindle = 0;
+	uint8_t error = mc_line(start, &block);
+	if (error != STATUS_OK)
+	{
+		*(ptr->error) = error;
+		return EVENT_HANDLED;
+	}
+
+	// the laser power is set by the ISR at each pixel
+	// reverse scans shift the pixels by the scan offset
+	// the decoded pixels are commited to the buffer
+	laser_raster_line.first = MAX(0, overscan + ((dir[main_dir] < 0) ? offset : 0));
+	laser_raster_line.pitch = pitch;
+	laser_raster_line.length = length + fast_flt_mul2(overscan);
+	laser_raster_line.position = 0;
+	laser_raster_line.power = tool_range_speed(ptr->block_data->spindle);
+	laser_raster_line.pixel = laser_raster_pixels_head;
+	laser_raster_pixels_head = laser_raster_wrap(laser_raster_pixels_head + count);
+	laser_raster_line.count = count;
+	*(ptr->error) = mc_line(ptr->target, &block);
+	laser_raster_close_line();
+	return EVENT_HANDLED;
+}
+
+CREATE_EVENT_LISTENER(gcode_exec, laser_raster_exec);
+
+#ifdef ENABLE_MAIN_LOOP_MODULES
+// the planner is cleared on reset
+bool laser_raster_reset(void *args)
+{
+	laser_raster_pending = 0;
+	laser_raster_line.count = 0;
+	laser_raster_pixels_head = 0;
+	laser_raster_resync();
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(cnc_reset, laser_raster_reset);
+#endif
+
+#endif
+
+DECL_MODULE(laser_raster)
+{
+#ifdef ENABLE_LASER_RASTER
+	ADD_EVENT_LISTENER(parse_token, laser_raster_parse_token);
+	ADD_EVENT_LISTENER(gcode_parse, laser_raster_parse);
+	ADD_EVENT_LISTENER(gcode_exec, laser_raster_exec);
+	ADD_EVENT_LISTENER(mc_line_segment, laser_raster_mc_line_segment);
+	HOOK_ATTACH_CALLBACK(itp_rt_stepbits, laser_raster_step_cb);
+#ifdef ENABLE_MAIN_LOOP_MODULES
+	ADD_EVENT_LISTENER(cnc_reset, laser_raster_reset);
+#endif
+#else
+#warning "ENABLE_LASER_RASTER is not defined. Laser raster module will not work."
+#endif
+}
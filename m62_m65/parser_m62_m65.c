@@ -32,6 +32,270 @@
 #define M64 EXTENDED_MCODE(64)
 #define M65 EXTENDED_MCODE(65)
 
+// uncomment to attach the M62/M63 output changes to the next planner block (applied by the step ISR when that block starts)
+// the blocks are followed from the first M62/M63 until the motion stops so that the synchronized outputs don't stop the motion
+// #define M62_M65_SYNC_OUTPUTS
+
+#ifdef M62_M65_SYNC_OUTPUTS
+#if !defined(ENABLE_MOTION_CONTROL_MODULES) || !defined(ENABLE_RT_SYNC_MOTIONS)
+#warning "M62_M65_SYNC_OUTPUTS needs ENABLE_MOTION_CONTROL_MODULES and ENABLE_RT_SYNC_MOTIONS. M62/M63 will wait for the motion to stop."
+#undef M62_M65_SYNC_OUTPUTS
+#endif
+#endif
+
+#ifdef M62_M65_SYNC_OUTPUTS
+// the step callback that finds the block start is attached from startup, so no other itp_rt_stepbits user can be enabled
+#if defined(M67_M68_SYNC_OUTPUTS) || defined(S_CLUSTER_RT_SYNC) || defined(ENABLE_LASER_RASTER) || defined(G33_ENCODER) || defined(SINGLE_AXIS_HOMING_EDGE_INTERPOLATION)
+#error "M62_M65_SYNC_OUTPUTS can't be used with other modules that use the itp_rt_stepbits hook"
+#endif
+
+// blocks in the planner plus the blocks being executed by the interpolator
+#ifndef M62_M65_BLOCKS
+#define M62_M65_BLOCKS (PLANNER_BUFFER_SIZE + INTERPOLATOR_BUFFER_SIZE)
+#endif
+// output changes buffer shared by all the queued blocks
+#ifndef M62_M65_CHANGES
+#define M62_M65_CHANGES 32
+#endif
+// output changes waiting for the next motion
+#ifndef M62_M65_PENDING
+#define M62_M65_PENDING 8
+#endif
+
+// each change is the output number (bit 7 is the new state)
+#define M62_M65_CHANGE_ON 0x80
+
+typedef struct
+{
+	uint32_t steps;
+	uint8_t change;
+	uint8_t count;
+	uint8_t main_stepper;
+} m62_m65_block_t;
+
+static m62_m65_block_t m62_m65_blocks[M62_M65_BLOCKS];
+static uint8_t m62_m65_changes[M62_M65_CHANGES];
+static volatile uint8_t m62_m65_blocks_head;
+static volatile uint8_t m62_m65_blocks_tail;
+static volatile uint8_t m62_m65_changes_head;
+static volatile uint8_t m62_m65_changes_tail;
+// ISR step counter of the current block
+static volatile uint32_t m62_m65_step;
+static uint8_t m62_m65_pending[M62_M65_PENDING];
+static uint8_t m62_m65_pending_count;
+// all the blocks since the motion started are queued
+static bool m62_m65_tracking;
+
+static FORCEINLINE uint8_t m62_m65_blocks_free(void)
+{
+	uint8_t head = m62_m65_blocks_head;
+	uint8_t tail = m62_m65_blocks_tail;
+	return (M62_M65_BLOCKS - 1) - ((head >= tail) ? (head - tail) : (M62_M65_BLOCKS + head - tail));
+}
+
+static FORCEINLINE uint8_t m62_m65_changes_free(void)
+{
+	uint8_t head = m62_m65_changes_head;
+	uint8_t tail = m62_m65_changes_tail;
+	return (M62_M65_CHANGES - 1) - ((head >= tail) ? (head - tail) : (M62_M65_CHANGES + head - tail));
+}
+
+void m62_m65_step_cb(uint8_t stepbits, uint8_t itp_flags)
+{
+#ifdef ITP_BACKLASH
+	// backlash compensation blocks are not queued
+	if (itp_flags & ITP_BACKLASH)
+	{
+		return;
+	}
+#endif
+
+	uint8_t tail = m62_m65_blocks_tail;
+	if (tail == m62_m65_blocks_head)
+	{
+		return;
+	}
+
+	m62_m65_block_t *block = &m62_m65_blocks[tail];
+	if (!(stepbits & (1 << block->main_stepper)))
+	{
+		return;
+	}
+
+	uint32_t step = ++m62_m65_step;
+	if (step == 1 && block->count)
+	{
+		// block started
+		uint8_t change = block->change;
+		for (uint8_t i = block->count; i != 0; i--)
+		{
+			uint8_t output = m62_m65_changes[change];
+			io_set_pinvalue((output & ~M62_M65_CHANGE_ON) + DOUT_PINS_OFFSET, (output & M62_M65_CHANGE_ON));
+			if (++change == M62_M65_CHANGES)
+			{
+				change = 0;
+			}
+		}
+		m62_m65_changes_tail = change;
+	}
+
+	if (step >= block->steps)
+	{
+		// block ended
+		if (++tail == M62_M65_BLOCKS)
+		{
+			tail = 0;
+		}
+		m62_m65_blocks_tail = tail;
+		m62_m65_step = 0;
+	}
+}
+
+// the planner and the interpolator are empty (the step ISR is not following any block)
+static FORCEINLINE bool m62_m65_motion_idle(void)
+{
+	return planner_buffer_is_empty() && !cnc_get_exec_state(EXEC_RUN);
+}
+
+// restarts the queue while the motion is stopped
+// this also drops the blocks left by a planner clear without a reset (probe, jog cancel, homing...)
+static void m62_m65_resync(void)
+{
+	m62_m65_blocks_head = m62_m65_blocks_tail = 0;
+	m62_m65_changes_head = m62_m65_changes_tail = 0;
+	m62_m65_step = 0;
+	m62_m65_tracking = false;
+}
+
+bool m62_m65_mc_line_segment(void *args)
+{
+	motion_data_t *block_data = (motion_data_t *)args;
+
+	uint32_t steps = block_data->steps[block_data->main_stepper];
+	if (!steps)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	if (m62_m65_motion_idle())
+	{
+		m62_m65_resync();
+	}
+
+	uint8_t count = m62_m65_pending_count;
+	if (!m62_m65_tracking)
+	{
+		// no output change to follow
+		if (!count)
+		{
+			return EVENT_CONTINUE;
+		}
+
+		// the blocks already in the planner were not queued so the ISR can't tell where this block starts
+		// the motion stops once and all the following blocks are queued until the motion stops again
+		while (!m62_m65_motion_idle())
+		{
+			if (!cnc_dotasks())
+			{
+				return EVENT_CONTINUE;
+			}
+		}
+		m62_m65_resync();
+		m62_m65_tracking = true;
+	}
+
+	m62_m65_pending_count = 0;
+
+	// waits for space in the queue (only happens if the blocks are very short)
+	while (!m62_m65_blocks_free() || m62_m65_changes_free() < count)
+	{
+		if (m62_m65_motion_idle())
+		{
+			// the motion ended without the ISR releasing the queue
+			m62_m65_resync();
+			m62_m65_tracking = true;
+			break;
+		}
+
+		if (!cnc_dotasks())
+		{
+			return EVENT_CONTINUE;
+		}
+	}
+
+	uint8_t head = m62_m65_blocks_head;
+	m62_m65_block_t *block = &m62_m65_blocks[head];
+	block->steps = steps;
+	block->main_stepper = block_data->main_stepper;
+	block->count = count;
+	block->change = m62_m65_changes_head;
+
+	uint8_t change = m62_m65_changes_head;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		m62_m65_changes[change] = m62_m65_pending[i];
+		if (++change == M62_M65_CHANGES)
+		{
+			change = 0;
+		}
+	}
+	m62_m65_changes_head = change;
+
+	ATOMIC_CODEBLOCK
+	{
+		// first block of an empty queue
+		if (m62_m65_blocks_tail == head)
+		{
+			m62_m65_step = 0;
+		}
+
+		if (++head == M62_M65_BLOCKS)
+		{
+			head = 0;
+		}
+		m62_m65_blocks_head = head;
+	}
+
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(mc_line_segment, m62_m65_mc_line_segment);
+
+#ifdef ENABLE_MAIN_LOOP_MODULES
+// the planner is cleared on reset
+bool m62_m65_reset(void *args)
+{
+	m62_m65_pending_count = 0;
+	m62_m65_resync();
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(cnc_reset, m62_m65_reset);
+#endif
+
+// queues an output change for the next motion (replaces a previous change of the same output)
+static bool m62_m65_queue_output(uint8_t output, bool state)
+{
+	uint8_t change = output | ((state) ? M62_M65_CHANGE_ON : 0);
+	for (uint8_t i = 0; i < m62_m65_pending_count; i++)
+	{
+		if ((m62_m65_pending[i] & ~M62_M65_CHANGE_ON) == output)
+		{
+			m62_m65_pending[i] = change;
+			return true;
+		}
+	}
+
+	if (m62_m65_pending_count >= MIN(M62_M65_PENDING, (M62_M65_CHANGES - 1)))
+	{
+		return false;
+	}
+
+	m62_m65_pending[m62_m65_pending_count++] = change;
+	return true;
+}
+#endif
+
 bool m62_m65_parse(void *args);
 bool m62_m65_exec(void *args);
 
@@ -81,13 +345,14 @@ bool m62_m65_exec(void *args)
 		}
 
 		bool pinstate = false;
+		bool synched = false;
 
 		switch (ptr->cmd->group_extended)
 		{
 		case M62:
 			pinstate = true;
 		case M63:
-			itp_sync();
+			synched = true;
 			break;
 		case M64:
 			pinstate = true;
@@ -100,6 +365,22 @@ bool m62_m65_exec(void *args)
 
 		if (ptr->words->p < 50)
 		{
+			if (synched)
+			{
+#ifdef M62_M65_SYNC_OUTPUTS
+				// the output changes when the next motion starts
+				if (!m62_m65_queue_output((uint8_t)ptr->words->p, pinstate))
+				{
+					// too many different outputs waiting for the next motion
+					*(ptr->error) = STATUS_OVERFLOW;
+					return EVENT_HANDLED;
+				}
+				*(ptr->error) = STATUS_OK;
+				return EVENT_HANDLED;
+#else
+				itp_sync();
+#endif
+			}
 			io_set_pinvalue(ptr->words->p + DOUT_PINS_OFFSET, pinstate);
 			*(ptr->error) = STATUS_OK;
 		}
@@ -122,6 +403,13 @@ DECL_MODULE(m62_m65)
 #ifdef ENABLE_PARSER_MODULES
 	ADD_EVENT_LISTENER(gcode_parse, m62_m65_parse);
 	ADD_EVENT_LISTENER(gcode_exec, m62_m65_exec);
+#ifdef M62_M65_SYNC_OUTPUTS
+	ADD_EVENT_LISTENER(mc_line_segment, m62_m65_mc_line_segment);
+	HOOK_ATTACH_CALLBACK(itp_rt_stepbits, m62_m65_step_cb);
+#ifdef ENABLE_MAIN_LOOP_MODULES
+	ADD_EVENT_LISTENER(cnc_reset, m62_m65_reset);
+#endif
+#endif
 #else
 #warning "Parser extensions are not enabled. M62-M65 code extension will not work."
 #endif
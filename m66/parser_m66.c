@@ -35,6 +35,65 @@ bool m66_exec(void *args);
 CREATE_EVENT_LISTENER(gcode_parse, m66_parse);
 CREATE_EVENT_LISTENER(gcode_exec, m66_exec);
 
+#define M66_IMMEDIATE 0
+#define M66_RISE 1
+#define M66_FALL 2
+#define M66_HIGH 3
+#define M66_LOW 4
+
+// the analog inputs are considered high above this value
+#ifndef M66_ANALOG_THRESHOLD
+#define M66_ANALOG_THRESHOLD 512
+#endif
+
+// the wait state is shared with the input ISR
+// the ISR latches the event and its time (us) and the main loop only checks the latch
+static volatile uint8_t m66_mode;
+static volatile uint8_t m66_mask;
+static volatile bool m66_triggered;
+static volatile uint32_t m66_event_time;
+
+// checks if a new input state satisfies the wait mode (prev_state is only used for the edges)
+static bool m66_check_event(uint8_t mode, bool prev_state, bool state)
+{
+	switch (mode)
+	{
+	case M66_RISE:
+		return (!prev_state && state);
+	case M66_FALL:
+		return (prev_state && !state);
+	case M66_HIGH:
+		return state;
+	case M66_LOW:
+		return !state;
+	}
+
+	return true;
+}
+
+#ifdef ENABLE_IO_MODULES
+// DIN0 to DIN7 have input change interrupts
+// the edge is latched in the ISR so that even pulses shorter than the main loop are detected
+MCU_CALLBACK bool m66_input_change(void *args)
+{
+	uint8_t *inputs = (uint8_t *)args;
+	// inputs = {inputs, diff};
+	uint8_t mask = m66_mask;
+	if ((inputs[1] & mask) && !m66_triggered)
+	{
+		bool state = ((inputs[0] & mask) != 0);
+		if (m66_check_event(m66_mode, !state, state))
+		{
+			m66_event_time = mcu_micros();
+			m66_triggered = true;
+		}
+	}
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(input_change, m66_input_change);
+#endif
+
 // this just parses and acceps the code
 bool m66_parse(void *args)
 {
@@ -83,7 +142,7 @@ bool m66_exec(void *args)
 		}
 
 		// it's an error if both a digital and analog pin are selected
-		if (CHECKFLAG(ptr->cmd->words, (GCODE_WORD_A | GCODE_WORD_P) == (GCODE_WORD_A | GCODE_WORD_P)))
+		if (CHECKFLAG(ptr->cmd->words, (GCODE_WORD_A | GCODE_WORD_P)) == (GCODE_WORD_A | GCODE_WORD_P))
 		{
 			*(ptr->error) = STATUS_INVALID_STATEMENT;
 			return EVENT_HANDLED;
@@ -103,13 +162,6 @@ bool m66_exec(void *args)
 			return EVENT_HANDLED;
 		}
 
-		// L0 is the only one permitted for an analog input
-		if (!ptr->words->l && CHECKFLAG(ptr->cmd->words, GCODE_WORD_P))
-		{
-			*(ptr->error) = STATUS_INVALID_STATEMENT;
-			return EVENT_HANDLED;
-		}
-
 		uint8_t pin = 0;
 
 		// digital pin
@@ -124,62 +176,77 @@ bool m66_exec(void *args)
 			pin = ANALOG_PINS_OFFSET + (uint8_t)ptr->words->xyzabc[3];
 		}
 
+		bool analog = CHECKFLAG(ptr->cmd->words, GCODE_WORD_A);
+		uint8_t mode = (uint8_t)ptr->words->l;
+
 		// initial state
 		int16_t value = io_get_pinvalue(pin);
-		bool pin_state = (CHECKFLAG(ptr->cmd->words, GCODE_WORD_A) ? (value >= 512) : (value != 0));
-		uint32_t timeout = 0xffffffff;
+		bool pin_state = (analog ? (value >= M66_ANALOG_THRESHOLD) : (value != 0));
+
+		*(ptr->error) = STATUS_OK;
 
-		if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_Q))
+		// the levels may already be satisfied
+		if (mode == M66_IMMEDIATE || ((mode == M66_HIGH || mode == M66_LOW) && m66_check_event(mode, pin_state, pin_state)))
 		{
-			timeout = mcu_millis() + (uint32_t)(ptr->words->d * 1000);
+			return EVENT_HANDLED;
 		}
 
-		if (!ptr->words->l)
+		uint32_t start = mcu_micros();
+		uint32_t timeout = (CHECKFLAG(ptr->cmd->words, GCODE_WORD_Q)) ? (uint32_t)(ptr->words->d * 1000) : UINT32_MAX;
+		uint32_t start_ms = mcu_millis();
+
+		m66_triggered = false;
+		m66_mode = mode;
+#ifdef ENABLE_IO_MODULES
+		// interrupt driven inputs
+		if (!analog && ptr->words->p < 8)
 		{
-			timeout = 0;
+			m66_mask = (1 << (uint8_t)ptr->words->p);
 		}
+#endif
 
-		*(ptr->error) = STATUS_OK;
-
-		while (timeout > mcu_millis())
+		while (!m66_triggered)
 		{
+			// the input is always sampled by the main loop
+			// this is the only detection for inputs without interrupt (including DIN0-DIN7 on boards where the pin has no ISR)
+			// and catches levels that changed before the interrupt was armed
 			value = io_get_pinvalue(pin);
-			bool new_pin_state = (CHECKFLAG(ptr->cmd->words, GCODE_WORD_A) ? (value >= 512) : (value != 0));
-
-			switch (ptr->words->l)
+			bool new_pin_state = (analog ? (value >= M66_ANALOG_THRESHOLD) : (value != 0));
+			if (m66_check_event(mode, pin_state, new_pin_state))
 			{
-			case 1:
-				if (!pin_state && (pin_state != new_pin_state))
-				{
-					return EVENT_HANDLED;
-				}
-				pin_state = new_pin_state;
+				m66_event_time = mcu_micros();
+				m66_triggered = true;
 				break;
-			case 2:
-				if (pin_state && (pin_state != new_pin_state))
-				{
-					return EVENT_HANDLED;
-				}
-				pin_state = new_pin_state;
-				break;
-			case 3:
-				if (new_pin_state)
-				{
-					return EVENT_HANDLED;
-				}
+			}
+			pin_state = new_pin_state;
+
+			if ((mcu_millis() - start_ms) >= timeout)
+			{
 				break;
-			case 4:
-				if (!new_pin_state)
-				{
-					return EVENT_HANDLED;
-				}
+			}
+
+			// keeps the controller responsive while waiting (aborts on reset or alarm)
+			if (!cnc_dotasks())
+			{
+				*(ptr->error) = STATUS_CRITICAL_FAIL;
 				break;
-			default:
-				return EVENT_HANDLED;
 			}
+		}
+
+		m66_mask = 0;
 
-			cnc_dotasks();
+#ifdef M66_DEBUG
+		if (m66_triggered)
+		{
+			proto_info("MSG:M66 event after %lu us", m66_event_time - start);
+		}
+		else if (*(ptr->error) == STATUS_OK)
+		{
+			proto_info("MSG:M66 timeout");
 		}
+#else
+		(void)start;
+#endif
 
 		return EVENT_HANDLED;
 	}
@@ -194,6 +261,9 @@ DECL_MODULE(m66)
 #ifdef ENABLE_PARSER_MODULES
 	ADD_EVENT_LISTENER(gcode_parse, m66_parse);
 	ADD_EVENT_LISTENER(gcode_exec, m66_exec);
+#ifdef ENABLE_IO_MODULES
+	ADD_EVENT_LISTENER(input_change, m66_input_change);
+#endif
 #else
 #warning "Parser extensions are not enabled. M66 code extension will not work."
 #endif
@@ -30,6 +30,380 @@
 #define M67 EXTENDED_MCODE(67)
 #define M68 EXTENDED_MCODE(68)
 
+// uncomment to attach the M67 values to the next planner block (set by the step ISR along that block)
+// the value can ramp from Q (start) to R (end) along the block steps and optionally (P1) be scaled by the actual velocity
+// the blocks are followed from the first M67 until the motion stops so that the synchronized outputs don't stop the motion
+// #define M67_M68_SYNC_OUTPUTS
+
+#ifdef M67_M68_SYNC_OUTPUTS
+#if !defined(ENABLE_MOTION_CONTROL_MODULES) || !defined(ENABLE_RT_SYNC_MOTIONS)
+#warning "M67_M68_SYNC_OUTPUTS needs ENABLE_MOTION_CONTROL_MODULES and ENABLE_RT_SYNC_MOTIONS. M67 will wait for the motion to stop."
+#undef M67_M68_SYNC_OUTPUTS
+#endif
+#endif
+
+#ifdef M67_M68_SYNC_OUTPUTS
+// the ramp is stepped by the step callback, attached from startup, so no other itp_rt_stepbits user can be enabled
+#if defined(M62_M65_SYNC_OUTPUTS) || defined(S_CLUSTER_RT_SYNC) || defined(ENABLE_LASER_RASTER) || defined(G33_ENCODER) || defined(SINGLE_AXIS_HOMING_EDGE_INTERPOLATION)
+#error "M67_M68_SYNC_OUTPUTS can't be used with other modules that use the itp_rt_stepbits hook"
+#endif
+
+// blocks in the planner plus the blocks being executed by the interpolator
+#ifndef M67_M68_BLOCKS
+#define M67_M68_BLOCKS (PLANNER_BUFFER_SIZE + INTERPOLATOR_BUFFER_SIZE)
+#endif
+// ramps buffer shared by all the queued blocks
+#ifndef M67_M68_RAMPS
+#define M67_M68_RAMPS 16
+#endif
+// outputs that can wait for the next motion
+#ifndef M67_M68_PENDING
+#define M67_M68_PENDING 4
+#endif
+// main stepper steps between velocity measurements (must be a power of 2)
+#ifndef M67_M68_VELOCITY_STEPS
+#define M67_M68_VELOCITY_STEPS 16
+#endif
+
+#define M67_M68_RAMP_VELOCITY 1
+
+typedef struct
+{
+	uint8_t output;
+	uint8_t start;
+	uint8_t end;
+	uint8_t flags;
+} m67_m68_ramp_t;
+
+typedef struct
+{
+	uint32_t steps;
+	// expected time (us) of the velocity measurement steps at the programmed feed
+	uint32_t window;
+	uint8_t ramp;
+	uint8_t count;
+	uint8_t main_stepper;
+} m67_m68_block_t;
+
+static m67_m68_block_t m67_m68_blocks[M67_M68_BLOCKS];
+static m67_m68_ramp_t m67_m68_ramps[M67_M68_RAMPS];
+static volatile uint8_t m67_m68_blocks_head;
+static volatile uint8_t m67_m68_blocks_tail;
+static volatile uint8_t m67_m68_ramps_head;
+static volatile uint8_t m67_m68_ramps_tail;
+// ISR step counter, velocity scale (256 is the programmed velocity), ramp values and ramp errors of the current block
+static volatile uint32_t m67_m68_step;
+static uint32_t m67_m68_window_time;
+static volatile uint16_t m67_m68_scale;
+static uint8_t m67_m68_value[M67_M68_PENDING];
+static uint32_t m67_m68_error[M67_M68_PENDING];
+static m67_m68_ramp_t m67_m68_pending[M67_M68_PENDING];
+static uint8_t m67_m68_pending_count;
+// all the blocks since the motion started are queued
+static bool m67_m68_tracking;
+
+static FORCEINLINE uint8_t m67_m68_blocks_free(void)
+{
+	uint8_t head = m67_m68_blocks_head;
+	uint8_t tail = m67_m68_blocks_tail;
+	return (M67_M68_BLOCKS - 1) - ((head >= tail) ? (head - tail) : (M67_M68_BLOCKS + head - tail));
+}
+
+static FORCEINLINE uint8_t m67_m68_ramps_free(void)
+{
+	uint8_t head = m67_m68_ramps_head;
+	uint8_t tail = m67_m68_ramps_tail;
+	return (M67_M68_RAMPS - 1) - ((head >= tail) ? (head - tail) : (M67_M68_RAMPS + head - tail));
+}
+
+// ratio between the expected and the measured time of the velocity measurement steps (never above 256)
+static FORCEINLINE uint16_t m67_m68_velocity_scale(uint32_t window, uint32_t dt)
+{
+	if (!window || dt <= window)
+	{
+		return 256;
+	}
+
+	return (dt < 256) ? (uint16_t)((window << 8) / dt) : (uint16_t)MIN(window / (dt >> 8), 256);
+}
+
+void m67_m68_step_cb(uint8_t stepbits, uint8_t itp_flags)
+{
+#ifdef ITP_BACKLASH
+	// backlash compensation blocks are not queued
+	if (itp_flags & ITP_BACKLASH)
+	{
+		return;
+	}
+#endif
+
+	uint8_t tail = m67_m68_blocks_tail;
+	if (tail == m67_m68_blocks_head)
+	{
+		return;
+	}
+
+	m67_m68_block_t *block = &m67_m68_blocks[tail];
+	if (!(stepbits & (1 << block->main_stepper)))
+	{
+		return;
+	}
+
+	uint32_t step = ++m67_m68_step;
+	uint8_t count = block->count;
+	bool measure = false;
+
+	if (step == 1)
+	{
+		// block started
+		m67_m68_window_time = mcu_micros();
+	}
+	else if (!((step - 1) & (M67_M68_VELOCITY_STEPS - 1)))
+	{
+		uint32_t now = mcu_micros();
+		m67_m68_scale = m67_m68_velocity_scale(block->window, now - m67_m68_window_time);
+		m67_m68_window_time = now;
+		measure = true;
+	}
+
+	if (count)
+	{
+		uint8_t ramp = block->ramp;
+		for (uint8_t i = 0; i < count; i++)
+		{
+			m67_m68_ramp_t *r = &m67_m68_ramps[ramp];
+			uint8_t value = m67_m68_value[i];
+			bool changed = false;
+
+			if (step == 1)
+			{
+				value = r->start;
+				m67_m68_error[i] = 0;
+				changed = true;
+			}
+			else if (r->start != r->end)
+			{
+				// linear interpolation of the value along the block steps (no divisions)
+				uint32_t error = m67_m68_error[i] + ((r->end > r->start) ? (r->end - r->start) : (r->start - r->end));
+				while (error >= block->steps)
+				{
+					error -= block->steps;
+					value = (r->end > r->start) ? (value + 1) : (value - 1);
+					changed = true;
+				}
+				m67_m68_error[i] = error;
+			}
+			m67_m68_value[i] = value;
+
+			if (r->flags & M67_M68_RAMP_VELOCITY)
+			{
+				// scales the value by the ratio between the actual and the programmed velocity
+				// the block starts with the last measured velocity
+				if (changed || measure)
+				{
+					io_set_pinvalue(r->output, (uint8_t)(((uint16_t)value * m67_m68_scale) >> 8));
+				}
+			}
+			else if (changed)
+			{
+				io_set_pinvalue(r->output, value);
+			}
+
+			if (++ramp == M67_M68_RAMPS)
+			{
+				ramp = 0;
+			}
+		}
+	}
+
+	if (step >= block->steps)
+	{
+		// block ended (the outputs keep the end values)
+		if (count)
+		{
+			uint8_t ramp = block->ramp;
+			for (uint8_t i = count; i != 0; i--)
+			{
+				io_set_pinvalue(m67_m68_ramps[ramp].output, m67_m68_ramps[ramp].end);
+				if (++ramp == M67_M68_RAMPS)
+				{
+					ramp = 0;
+				}
+			}
+			m67_m68_ramps_tail = ramp;
+		}
+
+		if (++tail == M67_M68_BLOCKS)
+		{
+			tail = 0;
+		}
+		m67_m68_blocks_tail = tail;
+		m67_m68_step = 0;
+	}
+}
+
+// the planner and the interpolator are empty (the step ISR is not following any block)
+static FORCEINLINE bool m67_m68_motion_idle(void)
+{
+	return planner_buffer_is_empty() && !cnc_get_exec_state(EXEC_RUN);
+}
+
+// restarts the queue while the motion is stopped
+// this also drops the blocks left by a planner clear without a reset (probe, jog cancel, homing...)
+static void m67_m68_resync(void)
+{
+	m67_m68_blocks_head = m67_m68_blocks_tail = 0;
+	m67_m68_ramps_head = m67_m68_ramps_tail = 0;
+	m67_m68_step = 0;
+	// the motion starts from rest
+	m67_m68_scale = 0;
+	m67_m68_tracking = false;
+}
+
+bool m67_m68_mc_line_segment(void *args)
+{
+	motion_data_t *block_data = (motion_data_t *)args;
+
+	uint32_t steps = block_data->steps[block_data->main_stepper];
+	if (!steps)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	if (m67_m68_motion_idle())
+	{
+		m67_m68_resync();
+	}
+
+	uint8_t count = m67_m68_pending_count;
+	if (!m67_m68_tracking)
+	{
+		// no output to follow
+		if (!count)
+		{
+			return EVENT_CONTINUE;
+		}
+
+		// the blocks already in the planner were not queued so the ISR can't tell where this block starts
+		// the motion stops once and all the following blocks are queued until the motion stops again
+		while (!m67_m68_motion_idle())
+		{
+			if (!cnc_dotasks())
+			{
+				return EVENT_CONTINUE;
+			}
+		}
+		m67_m68_resync();
+		m67_m68_tracking = true;
+	}
+
+	m67_m68_pending_count = 0;
+
+	// waits for space in the queue (only happens if the blocks are very short)
+	while (!m67_m68_blocks_free() || m67_m68_ramps_free() < count)
+	{
+		if (m67_m68_motion_idle())
+		{
+			// the motion ended without the ISR releasing the queue
+			m67_m68_resync();
+			m67_m68_tracking = true;
+			break;
+		}
+
+		if (!cnc_dotasks())
+		{
+			return EVENT_CONTINUE;
+		}
+	}
+
+	uint8_t head = m67_m68_blocks_head;
+	m67_m68_block_t *block = &m67_m68_blocks[head];
+	block->steps = steps;
+	block->main_stepper = block_data->main_stepper;
+	block->count = count;
+	block->ramp = m67_m68_ramps_head;
+	block->window = 0;
+
+	// the velocity is measured in every block so that the next block starts with the actual velocity
+	// feed (mm/min) times feed_conversion (main stepper steps/mm) is the main stepper step rate per minute
+	float rate = MIN(block_data->feed, block_data->max_feed) * block_data->feed_conversion;
+	if (rate > 0)
+	{
+		block->window = (uint32_t)MIN((60000000.0f * M67_M68_VELOCITY_STEPS) / rate, (float)UINT32_MAX);
+	}
+
+	uint8_t ramp = m67_m68_ramps_head;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		m67_m68_ramps[ramp] = m67_m68_pending[i];
+		if (++ramp == M67_M68_RAMPS)
+		{
+			ramp = 0;
+		}
+	}
+	m67_m68_ramps_head = ramp;
+
+	ATOMIC_CODEBLOCK
+	{
+		// first block of an empty queue
+		if (m67_m68_blocks_tail == head)
+		{
+			m67_m68_step = 0;
+		}
+
+		if (++head == M67_M68_BLOCKS)
+		{
+			head = 0;
+		}
+		m67_m68_blocks_head = head;
+	}
+
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(mc_line_segment, m67_m68_mc_line_segment);
+
+#ifdef ENABLE_MAIN_LOOP_MODULES
+// the planner is cleared on reset
+bool m67_m68_reset(void *args)
+{
+	m67_m68_pending_count = 0;
+	m67_m68_resync();
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(cnc_reset, m67_m68_reset);
+#endif
+
+// queues an output ramp for the next motion (replaces a previous ramp of the same output)
+static bool m67_m68_queue_output(uint8_t output, uint8_t start, uint8_t end, uint8_t flags)
+{
+	uint8_t i = 0;
+	for (; i < m67_m68_pending_count; i++)
+	{
+		if (m67_m68_pending[i].output == output)
+		{
+			break;
+		}
+	}
+
+	if (i == m67_m68_pending_count)
+	{
+		if (m67_m68_pending_count >= MIN(M67_M68_PENDING, (M67_M68_RAMPS - 1)))
+		{
+			return false;
+		}
+		m67_m68_pending_count++;
+	}
+
+	m67_m68_pending[i].output = output;
+	m67_m68_pending[i].start = start;
+	m67_m68_pending[i].end = end;
+	m67_m68_pending[i].flags = flags;
+	return true;
+}
+#endif
+
 bool m67_m68_parse(void *args);
 bool m67_m68_exec(void *args);
 
@@ -89,12 +463,26 @@ bool m67_m68_exec(void *args)
 
 		if (ptr->cmd->group_extended == M67)
 		{
+#ifndef M67_M68_SYNC_OUTPUTS
 			itp_sync();
+#endif
 		}
 
 		if (analogoutput >= PWM_PINS_OFFSET && analogoutput < SERVO_PINS_OFFSET)
 		{
-			io_set_pinvalue(analogoutput, (uint8_t)CLAMP(0, ptr->words->d, 255));
+			uint8_t value = (uint8_t)CLAMP(0, ptr->words->d, 255);
+#ifdef M67_M68_SYNC_OUTPUTS
+			if (ptr->cmd->group_extended == M67)
+			{
+				// the value is set along the next motion
+				uint8_t end = (CHECKFLAG(ptr->cmd->words, GCODE_WORD_R)) ? (uint8_t)CLAMP(0, ptr->words->r, 255) : value;
+				uint8_t flags = (CHECKFLAG(ptr->cmd->words, GCODE_WORD_P) && ptr->words->p == 1) ? M67_M68_RAMP_VELOCITY : 0;
+				// too many different outputs waiting for the next motion
+				*(ptr->error) = (m67_m68_queue_output(analogoutput, value, end, flags)) ? STATUS_OK : STATUS_OVERFLOW;
+				return EVENT_HANDLED;
+			}
+#endif
+			io_set_pinvalue(analogoutput, value);
 			*(ptr->error) = STATUS_OK;
 		}
 		else
@@ -116,6 +504,13 @@ DECL_MODULE(m67_m68)
 #ifdef ENABLE_PARSER_MODULES
 	ADD_EVENT_LISTENER(gcode_parse, m67_m68_parse);
 	ADD_EVENT_LISTENER(gcode_exec, m67_m68_exec);
+#ifdef M67_M68_SYNC_OUTPUTS
+	ADD_EVENT_LISTENER(mc_line_segment, m67_m68_mc_line_segment);
+	HOOK_ATTACH_CALLBACK(itp_rt_stepbits, m67_m68_step_cb);
+#ifdef ENABLE_MAIN_LOOP_MODULES
+	ADD_EVENT_LISTENER(cnc_reset, m67_m68_reset);
+#endif
+#endif
 #else
 #warning "Parser extensions are not enabled. M67-M68 code extension will not work."
 #endif
@@ -0,0 +1,489 @@
+/*
+	Name: mesh_leveling.c
+	Description: Probed height map (mesh) compensation for µCNC.
+		G29 probes a grid of points and stores the height map in NVM.
+		The Z correction is interpolated (bilinear or bicubic) from the height map and applied in the kinematics transform.
+
+	Copyright: Copyright (c) João Martins
+	Author: João Martins
+	Date: 19-10-2026
+
+	µCNC is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version. Please see <http://www.gnu.org/licenses/>
+
+	µCNC is distributed WITHOUT ANY WARRANTY;
+	Also without the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the	GNU General Public License for more details.
+*/
+
+#include "../../cnc.h"
+#include "mesh_leveling.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <float.h>
+
+#if (UCNC_MODULE_VERSION < 10800 || UCNC_MODULE_VERSION > 99999)
+#error "This module is not compatible with the current version of µCNC"
+#endif
+
+// grid points in X and Y
+#ifndef MESH_LEVELING_POINTS_X
+#define MESH_LEVELING_POINTS_X 5
+#endif
+#ifndef MESH_LEVELING_POINTS_Y
+#define MESH_LEVELING_POINTS_Y 5
+#endif
+
+#if (MESH_LEVELING_POINTS_X < 2 || MESH_LEVELING_POINTS_Y < 2 || MESH_LEVELING_POINTS_X > 32 || MESH_LEVELING_POINTS_Y > 32)
+#error "The mesh must have between 2 and 32 points in each direction"
+#endif
+
+// bicubic (Catmull-Rom) interpolation instead of bilinear
+// #define MESH_LEVELING_BICUBIC
+
+// the height map as stored in NVM
+typedef struct
+{
+	uint8_t points_x;
+	uint8_t points_y;
+	uint8_t enabled;
+	float x0;
+	float y0;
+	float dx;
+	float dy;
+	float z[MESH_LEVELING_POINTS_Y][MESH_LEVELING_POINTS_X];
+} mesh_leveling_map_t;
+
+static mesh_leveling_map_t mesh_leveling_map;
+// the correction is only applied with a valid and enabled map
+static bool mesh_leveling_active;
+// grid steps inverse (no divisions when interpolating)
+static float mesh_leveling_inv_dx;
+static float mesh_leveling_inv_dy;
+
+#ifdef MESH_LEVELING_BICUBIC
+// Catmull-Rom weights of the 4 points around a position inside the cell (0 to 1)
+static FORCEINLINE void mesh_leveling_weights(float t, float *w)
+{
+	float t2 = t * t;
+	float t3 = t2 * t;
+	w[0] = 0.5f * (-t3 + 2 * t2 - t);
+	w[1] = 0.5f * (3 * t3 - 5 * t2 + 2);
+	w[2] = 0.5f * (-3 * t3 + 4 * t2 + t);
+	w[3] = 0.5f * (t3 - t2);
+}
+#endif
+
+static void mesh_leveling_update(void)
+{
+	mesh_leveling_active = false;
+	if (mesh_leveling_map.points_x != MESH_LEVELING_POINTS_X || mesh_leveling_map.points_y != MESH_LEVELING_POINTS_Y)
+	{
+		return;
+	}
+
+	// a zero, negative or invalid (NaN) grid step means there is no map
+	if (!(mesh_leveling_map.dx > 0) || !(mesh_leveling_map.dy > 0))
+	{
+		return;
+	}
+
+	mesh_leveling_inv_dx = 1.0f / mesh_leveling_map.dx;
+	mesh_leveling_inv_dy = 1.0f / mesh_leveling_map.dy;
+	mesh_leveling_active = (mesh_leveling_map.enabled != 0);
+}
+
+// converts a position to the cell index and the position inside the cell (0 to 1)
+// outside the grid the map holds the value of the border
+static FORCEINLINE uint8_t mesh_leveling_cell(float p, uint8_t points, float *t)
+{
+	if (p <= 0)
+	{
+		*t = 0;
+		return 0;
+	}
+
+	if (p >= (points - 1))
+	{
+		*t = 1;
+		return points - 2;
+	}
+
+	uint8_t i = (uint8_t)p;
+	*t = p - i;
+	return i;
+}
+
+static float mesh_leveling_get_z(float x, float y)
+{
+	float u, v;
+	uint8_t i = mesh_leveling_cell((x - mesh_leveling_map.x0) * mesh_leveling_inv_dx, MESH_LEVELING_POINTS_X, &u);
+	uint8_t j = mesh_leveling_cell((y - mesh_leveling_map.y0) * mesh_leveling_inv_dy, MESH_LEVELING_POINTS_Y, &v);
+
+#ifndef MESH_LEVELING_BICUBIC
+	float z0 = mesh_leveling_map.z[j][i] + (mesh_leveling_map.z[j][i + 1] - mesh_leveling_map.z[j][i]) * u;
+	float z1 = mesh_leveling_map.z[j + 1][i] + (mesh_leveling_map.z[j + 1][i + 1] - mesh_leveling_map.z[j + 1][i]) * u;
+	return z0 + (z1 - z0) * v;
+#else
+	float wu[4], wv[4];
+	mesh_leveling_weights(u, wu);
+	mesh_leveling_weights(v, wv);
+
+	// the rows around the point (the row outside the grid is extrapolated linearly from the border rows)
+	float rows[4];
+	for (int8_t r = -1; r < 3; r++)
+	{
+		int8_t k = j + r;
+		if (k < 0)
+		{
+			k = 0;
+		}
+		else if (k >= MESH_LEVELING_POINTS_Y)
+		{
+			k = MESH_LEVELING_POINTS_Y - 1;
+		}
+
+		// the column outside the grid is also extrapolated linearly from the border columns
+		const float *line = mesh_leveling_map.z[k];
+		float p0 = (i) ? line[i - 1] : (2 * line[0] - line[1]);
+		float p3 = (i + 2 < MESH_LEVELING_POINTS_X) ? line[i + 2] : (2 * line[i + 1] - line[i]);
+		rows[r + 1] = wu[0] * p0 + wu[1] * line[i] + wu[2] * line[i + 1] + wu[3] * p3;
+	}
+
+	if (!j)
+	{
+		rows[0] = 2 * rows[1] - rows[2];
+	}
+	if (j + 2 >= MESH_LEVELING_POINTS_Y)
+	{
+		rows[3] = 2 * rows[2] - rows[1];
+	}
+
+	float z = wv[0] * rows[0] + wv[1] * rows[1] + wv[2] * rows[2] + wv[3] * rows[3];
+	return z;
+#endif
+}
+
+void mesh_leveling_apply_transform(float *axis)
+{
+	if (mesh_leveling_active)
+	{
+		axis[AXIS_Z] += mesh_leveling_get_z(axis[AXIS_X], axis[AXIS_Y]);
+	}
+}
+
+void mesh_leveling_apply_reverse_transform(float *axis)
+{
+	if (mesh_leveling_active)
+	{
+		axis[AXIS_Z] -= mesh_leveling_get_z(axis[AXIS_X], axis[AXIS_Y]);
+	}
+}
+
+#ifdef ENABLE_SETTINGS_MODULES
+static uint16_t mesh_leveling_address;
+
+bool mesh_leveling_settings_load(void *args)
+{
+	// a failed read (unwritten or corrupted memory) clears the map like a settings reset
+	if (settings_load(mesh_leveling_address, &mesh_leveling_map, sizeof(mesh_leveling_map_t)) != STATUS_OK)
+	{
+		memset(&mesh_leveling_map, 0, sizeof(mesh_leveling_map_t));
+	}
+	mesh_leveling_update();
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(settings_extended_load, mesh_leveling_settings_load);
+
+bool mesh_leveling_settings_save(void *args)
+{
+	settings_save(mesh_leveling_address, &mesh_leveling_map, sizeof(mesh_leveling_map_t));
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(settings_extended_save, mesh_leveling_settings_save);
+
+bool mesh_leveling_settings_erase(void *args)
+{
+	settings_args_t *set = (settings_args_t *)args;
+	// resetting the main settings clears the height map
+	if (set->address == SETTINGS_ADDRESS_OFFSET)
+	{
+		memset(&mesh_leveling_map, 0, sizeof(mesh_leveling_map_t));
+		mesh_leveling_update();
+	}
+
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(settings_extended_erase, mesh_leveling_settings_erase);
+#endif
+
+#ifdef ENABLE_PARSER_MODULES
+
+// this ID must be unique for each code
+#define G29 EXTENDED_GCODE(29)
+#define M420 EXTENDED_MCODE(420)
+
+bool mesh_leveling_parse(void *args);
+bool mesh_leveling_exec(void *args);
+
+CREATE_EVENT_LISTENER(gcode_parse, mesh_leveling_parse);
+CREATE_EVENT_LISTENER(gcode_exec, mesh_leveling_exec);
+
+// this just parses and acceps the code
+bool mesh_leveling_parse(void *args)
+{
+	gcode_parse_args_t *ptr = (gcode_parse_args_t *)args;
+
+	if ((ptr->word == 'G' && ptr->code == 29) || (ptr->word == 'M' && ptr->code == 420))
+	{
+		if (ptr->cmd->group_extended != 0)
+		{
+			// there is a collision of custom gcode commands (only one per line can be processed)
+			*(ptr->error) = STATUS_GCODE_MODAL_GROUP_VIOLATION;
+			return EVENT_HANDLED;
+		}
+
+		// tells the gcode validation and execution functions this is custom code G29/M420 (ID must be unique)
+		ptr->cmd->group_extended = (ptr->word == 'G') ? G29 : M420;
+		*(ptr->error) = STATUS_OK;
+		return EVENT_HANDLED;
+	}
+
+	// if this is not catched by this parser, just send back the error so other extenders can process it
+	return EVENT_CONTINUE;
+}
+
+// switches the correction on or off
+// the correction changes the machine position so the motion is stopped first
+static uint8_t mesh_leveling_enable(uint8_t enabled)
+{
+	uint8_t error = (itp_sync() == STATUS_OK) ? STATUS_OK : STATUS_CRITICAL_FAIL;
+	mesh_leveling_map.enabled = enabled;
+	mesh_leveling_update();
+	// the machine doesn't move (the position is offset by the correction)
+	mc_sync_position();
+	return error;
+}
+
+// the grid is probed into this map and only replaces the current map if all the points are probed
+static mesh_leveling_map_t mesh_leveling_probed;
+
+// moves to a grid point at the current height and probes it
+static uint8_t mesh_leveling_probe_point(float *target, float safe_z, float probe_z, float feed, motion_data_t *block_data, float *z)
+{
+	motion_data_t rapid_data;
+	memcpy(&rapid_data, block_data, sizeof(motion_data_t));
+	rapid_data.feed = FLT_MAX;
+
+	target[AXIS_Z] = safe_z;
+	uint8_t error = mc_line(target, &rapid_data);
+	if (error != STATUS_OK)
+	{
+		return error;
+	}
+
+	motion_data_t probe_data;
+	memcpy(&probe_data, block_data, sizeof(motion_data_t));
+	probe_data.feed = feed;
+	target[AXIS_Z] = probe_z;
+	if (mc_probe(target, 0, &probe_data) != STATUS_PROBE_SUCCESS)
+	{
+		return STATUS_CRITICAL_FAIL;
+	}
+
+	float position[AXIS_COUNT];
+	mc_get_position(position);
+	*z = position[AXIS_Z];
+
+	// back to the safe height
+	target[AXIS_Z] = safe_z;
+	return mc_line(target, &rapid_data);
+}
+
+// probes the grid from the current position (without the correction) to X,Y
+static uint8_t mesh_leveling_probe_grid(gcode_exec_args_t *ptr, float feed)
+{
+	float start[AXIS_COUNT];
+	mc_get_position(start);
+
+	float safe_z = start[AXIS_Z];
+	float probe_z = ptr->target[AXIS_Z];
+	if (probe_z >= safe_z)
+	{
+		return STATUS_GCODE_INVALID_TARGET;
+	}
+
+	float dx = (ptr->target[AXIS_X] - start[AXIS_X]) / (MESH_LEVELING_POINTS_X - 1);
+	float dy = (ptr->target[AXIS_Y] - start[AXIS_Y]) / (MESH_LEVELING_POINTS_Y - 1);
+	if (dx == 0 || dy == 0)
+	{
+		return STATUS_GCODE_INVALID_TARGET;
+	}
+
+	float target[AXIS_COUNT];
+	memcpy(target, start, sizeof(target));
+	float z_ref = 0;
+
+	for (uint8_t j = 0; j < MESH_LEVELING_POINTS_Y; j++)
+	{
+		target[AXIS_Y] = start[AXIS_Y] + dy * j;
+		for (uint8_t k = 0; k < MESH_LEVELING_POINTS_X; k++)
+		{
+			// zigzag to reduce the travel between rows
+			uint8_t i = (j & 1) ? (MESH_LEVELING_POINTS_X - 1 - k) : k;
+			target[AXIS_X] = start[AXIS_X] + dx * i;
+
+			float z;
+			uint8_t error = mesh_leveling_probe_point(target, safe_z, probe_z, feed, ptr->block_data, &z);
+			if (error != STATUS_OK)
+			{
+				return error;
+			}
+
+			// heights are relative to the first point
+			if (!j && !k)
+			{
+				z_ref = z;
+			}
+			mesh_leveling_probed.z[j][i] = z - z_ref;
+		}
+	}
+
+	// the map is always stored with the grid increasing in X and Y
+	if (dx < 0)
+	{
+		for (uint8_t j = 0; j < MESH_LEVELING_POINTS_Y; j++)
+		{
+			for (uint8_t i = 0; i < (MESH_LEVELING_POINTS_X / 2); i++)
+			{
+				float z = mesh_leveling_probed.z[j][i];
+				mesh_leveling_probed.z[j][i] = mesh_leveling_probed.z[j][MESH_LEVELING_POINTS_X - 1 - i];
+				mesh_leveling_probed.z[j][MESH_LEVELING_POINTS_X - 1 - i] = z;
+			}
+		}
+	}
+
+	if (dy < 0)
+	{
+		for (uint8_t j = 0; j < (MESH_LEVELING_POINTS_Y / 2); j++)
+		{
+			for (uint8_t i = 0; i < MESH_LEVELING_POINTS_X; i++)
+			{
+				float z = mesh_leveling_probed.z[j][i];
+				mesh_leveling_probed.z[j][i] = mesh_leveling_probed.z[MESH_LEVELING_POINTS_Y - 1 - j][i];
+				mesh_leveling_probed.z[MESH_LEVELING_POINTS_Y - 1 - j][i] = z;
+			}
+		}
+	}
+
+	mesh_leveling_probed.points_x = MESH_LEVELING_POINTS_X;
+	mesh_leveling_probed.points_y = MESH_LEVELING_POINTS_Y;
+	mesh_leveling_probed.x0 = MIN(start[AXIS_X], ptr->target[AXIS_X]);
+	mesh_leveling_probed.y0 = MIN(start[AXIS_Y], ptr->target[AXIS_Y]);
+	mesh_leveling_probed.dx = ABS(dx);
+	mesh_leveling_probed.dy = ABS(dy);
+
+	return STATUS_OK;
+}
+
+// G29 X<opposite corner> Y<opposite corner> Z<probe limit> F<probe feed>
+// the grid goes from the current position to X,Y
+static uint8_t mesh_leveling_probe(gcode_exec_args_t *ptr)
+{
+	if (CHECKFLAG(ptr->cmd->words, (GCODE_WORD_X | GCODE_WORD_Y | GCODE_WORD_Z)) != (GCODE_WORD_X | GCODE_WORD_Y | GCODE_WORD_Z))
+	{
+		return STATUS_GCODE_VALUE_WORD_MISSING;
+	}
+
+	float feed = ptr->new_state->feedrate;
+	if (feed <= 0)
+	{
+		return STATUS_FEED_NOT_SET;
+	}
+
+	// the probing moves are done without the correction
+	uint8_t enabled = mesh_leveling_map.enabled;
+	uint8_t error = mesh_leveling_enable(0);
+	if (error == STATUS_OK)
+	{
+		error = mesh_leveling_probe_grid(ptr, feed);
+	}
+
+	if (error != STATUS_OK)
+	{
+		// the current map is kept
+		mesh_leveling_enable(enabled);
+		return error;
+	}
+
+	// the machine ends at the safe height of the last point
+	// with the correction enabled that position is offset by the height map at that point
+	memcpy(&mesh_leveling_map, &mesh_leveling_probed, sizeof(mesh_leveling_map_t));
+	error = mesh_leveling_enable(1);
+	mc_get_position(ptr->target);
+
+#ifdef ENABLE_SETTINGS_MODULES
+	settings_save(mesh_leveling_address, &mesh_leveling_map, sizeof(mesh_leveling_map_t));
+#endif
+
+	return error;
+}
+
+// this actually performs 2 steps in 1 (validation and execution)
+bool mesh_leveling_exec(void *args)
+{
+	gcode_exec_args_t *ptr = (gcode_exec_args_t *)args;
+
+	switch (ptr->cmd->group_extended)
+	{
+	case G29:
+		*(ptr->error) = mesh_leveling_probe(ptr);
+		return EVENT_HANDLED;
+	case M420:
+		// M420 S<0|1> disables or enables the correction
+		if (!CHECKFLAG(ptr->cmd->words, GCODE_WORD_S))
+		{
+			*(ptr->error) = STATUS_GCODE_VALUE_WORD_MISSING;
+			return EVENT_HANDLED;
+		}
+
+		*(ptr->error) = mesh_leveling_enable((ptr->words->s != 0) ? 1 : 0);
+		if (mesh_leveling_map.enabled && !mesh_leveling_active)
+		{
+			// no valid map
+			mesh_leveling_map.enabled = 0;
+			*(ptr->error) = STATUS_SETTING_DISABLED;
+			return EVENT_HANDLED;
+		}
+		mc_get_position(ptr->target);
+		return EVENT_HANDLED;
+	}
+
+	return EVENT_CONTINUE;
+}
+
+#endif
+
+DECL_MODULE(mesh_leveling)
+{
+#ifdef ENABLE_SETTINGS_MODULES
+	mesh_leveling_address = settings_register_external_setting(sizeof(mesh_leveling_map_t));
+	ADD_EVENT_LISTENER(settings_extended_load, mesh_leveling_settings_load);
+	ADD_EVENT_LISTENER(settings_extended_save, mesh_leveling_settings_save);
+	ADD_EVENT_LISTENER(settings_extended_erase, mesh_leveling_settings_erase);
+#else
+#warning "Settings extensions are not enabled. The height map will not be stored in NVM."
+#endif
+#ifdef ENABLE_PARSER_MODULES
+	ADD_EVENT_LISTENER(gcode_parse, mesh_leveling_parse);
+	ADD_EVENT_LISTENER(gcode_exec, mesh_leveling_exec);
+#else
+#warning "Parser extensions are not enabled. G29/M420 code extension will not work."
+#endif
+}
@@ -0,0 +1,36 @@
+/*
+	Name: mesh_leveling.h
+	Description: Probed height map (mesh) compensation for µCNC.
+
+	Copyright: Copyright (c) João Martins
+	Author: João Martins
+	Date: 19-10-2026
+
+	µCNC is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version. Please see <http://www.gnu.org/licenses/>
+
+	µCNC is distributed WITHOUT ANY WARRANTY;
+	Also without the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the	GNU General Public License for more details.
+*/
+
+#ifndef MESH_LEVELING_H
+#define MESH_LEVELING_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	// adds the height map correction to the Z of a machine position (call it from kinematics_apply_transform)
+	void mesh_leveling_apply_transform(float *axis);
+	// removes the height map correction from the Z of a machine position (call it from kinematics_apply_reverse_transform)
+	void mesh_leveling_apply_reverse_transform(float *axis);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,106 @@
+/*
+	Minimal host replacement of the µCNC core API used by mesh_leveling.c
+	Only what the module needs to build on the host. The motion functions are implemented by the simulation (test_mesh_leveling.c)
+*/
+
+#ifndef CNC_H
+#define CNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define UCNC_MODULE_VERSION 11600
+
+#define ENABLE_PARSER_MODULES
+#define ENABLE_SETTINGS_MODULES
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define ABS(a) (((a) < 0) ? -(a) : (a))
+#define CHECKFLAG(a, b) ((a) & (b))
+#define FORCEINLINE inline
+
+#define AXIS_COUNT 3
+#define AXIS_X 0
+#define AXIS_Y 1
+#define AXIS_Z 2
+
+#define STATUS_OK 0
+#define STATUS_SETTING_DISABLED 5
+#define STATUS_SETTING_READ_FAIL 7
+#define STATUS_FEED_NOT_SET 22
+#define STATUS_GCODE_MODAL_GROUP_VIOLATION 21
+#define STATUS_GCODE_VALUE_WORD_MISSING 31
+#define STATUS_GCODE_INVALID_TARGET 33
+#define STATUS_PROBE_SUCCESS 200
+#define STATUS_CRITICAL_FAIL 254
+
+#define GCODE_WORD_X 1
+#define GCODE_WORD_Y 2
+#define GCODE_WORD_Z 4
+#define GCODE_WORD_S 8
+#define EXTENDED_GCODE(X) (X)
+#define EXTENDED_MCODE(X) (1000 + X)
+#define SETTINGS_ADDRESS_OFFSET 1
+
+// events
+#define EVENT_CONTINUE false
+#define EVENT_HANDLED true
+#define CREATE_EVENT_LISTENER(event, handler) void *event##_##handler##_listener = (void *)&handler
+#define ADD_EVENT_LISTENER(event, handler) (void)event##_##handler##_listener
+#define DECL_MODULE(name) void mod_##name##_hook(void)
+
+typedef struct
+{
+	float feed;
+} motion_data_t;
+
+typedef struct
+{
+	uint16_t address;
+} settings_args_t;
+
+typedef struct
+{
+	uint16_t group_extended;
+	uint16_t words;
+} parser_cmd_explicit_t;
+
+typedef struct
+{
+	float s;
+} parser_words_t;
+
+typedef struct
+{
+	float feedrate;
+} parser_state_t;
+
+typedef struct
+{
+	unsigned char word;
+	uint8_t code;
+	uint8_t *error;
+	parser_cmd_explicit_t *cmd;
+} gcode_parse_args_t;
+
+typedef struct
+{
+	parser_state_t *new_state;
+	parser_words_t *words;
+	parser_cmd_explicit_t *cmd;
+	uint8_t *error;
+	float *target;
+	motion_data_t *block_data;
+} gcode_exec_args_t;
+
+uint16_t settings_register_external_setting(uint16_t size);
+uint8_t settings_load(uint16_t address, void *data, uint16_t size);
+void settings_save(uint16_t address, const void *data, uint16_t size);
+uint8_t itp_sync(void);
+uint8_t mc_line(float *target, motion_data_t *block_data);
+uint8_t mc_probe(float *target, uint8_t flags, motion_data_t *block_data);
+void mc_get_position(float *target);
+void mc_sync_position(void);
+
+#endif
@@ -0,0 +1,292 @@
+/*
+	Simulated probe test of the height map compensation
+
+	Probes synthetic surfaces with G29 through the module and checks the interpolated correction.
+	The simulated machine applies the kinematics transform of the module to every move:
+		- mc_line and mc_probe move the machine to the transformed target (the probe stops at the surface)
+		- mc_sync_position sets the planner position from the machine position with the reverse transform
+		- itp_sync waits for the queued moves (the planner must not be synced while the machine is moving)
+	The same test runs with bilinear and bicubic interpolation
+
+	Build and run with make (see Makefile)
+*/
+
+#include "build/src/cnc.h"
+#include "build/src/modules/mesh_leveling/mesh_leveling.h"
+#include <stdio.h>
+#include <math.h>
+
+#define CHECK(cond)                                              \
+	if (!(cond))                                                 \
+	{                                                            \
+		printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++;                                              \
+	}
+
+bool mesh_leveling_exec(void *args);
+bool mesh_leveling_settings_load(void *args);
+void mod_mesh_leveling_hook(void);
+
+static int failures;
+
+// simulation state
+static float sim_machine[AXIS_COUNT];
+static float sim_planner[AXIS_COUNT];
+static bool sim_moving;
+static bool sim_synced_moving;
+static int sim_probes;
+static int sim_probe_fail;
+static int sim_saves;
+static uint8_t sim_load_error;
+static int sim_lines;
+static float sim_first_travel_z;
+// the surface height at the first probed point
+static float ref_x;
+static float ref_y;
+static float (*sim_surface)(float x, float y);
+
+static float plane(float x, float y) { return 0.3f + 0.01f * x - 0.02f * y; }
+static float bowl(float x, float y) { return 0.0004f * ((x - 50) * (x - 50) + (y - 40) * (y - 40)); }
+
+uint16_t settings_register_external_setting(uint16_t size) { return 100; }
+// a failed read (bad checksum) leaves what was read in the buffer (here the map is kept as it was)
+uint8_t settings_load(uint16_t address, void *data, uint16_t size) { return sim_load_error; }
+void settings_save(uint16_t address, const void *data, uint16_t size) { sim_saves++; }
+
+uint8_t itp_sync(void)
+{
+	sim_moving = false;
+	return STATUS_OK;
+}
+
+void mc_get_position(float *target)
+{
+	memcpy(target, sim_planner, sizeof(sim_planner));
+}
+
+void mc_sync_position(void)
+{
+	sim_synced_moving |= sim_moving;
+	memcpy(sim_planner, sim_machine, sizeof(sim_planner));
+	mesh_leveling_apply_reverse_transform(sim_planner);
+}
+
+uint8_t mc_line(float *target, motion_data_t *block_data)
+{
+	memcpy(sim_planner, target, sizeof(sim_planner));
+	memcpy(sim_machine, target, sizeof(sim_machine));
+	mesh_leveling_apply_transform(sim_machine);
+	if (!sim_lines++)
+	{
+		sim_first_travel_z = sim_machine[AXIS_Z];
+	}
+	sim_moving = true;
+	return STATUS_OK;
+}
+
+// the probe moves down and stops at the surface (the planner is synced after probing)
+uint8_t mc_probe(float *target, uint8_t flags, motion_data_t *block_data)
+{
+	mc_line(target, block_data);
+	itp_sync();
+	if (++sim_probes == sim_probe_fail)
+	{
+		mc_sync_position();
+		return STATUS_CRITICAL_FAIL;
+	}
+
+	float surface = sim_surface(sim_machine[AXIS_X], sim_machine[AXIS_Y]);
+	if (surface < sim_machine[AXIS_Z])
+	{
+		return STATUS_CRITICAL_FAIL;
+	}
+	sim_machine[AXIS_Z] = surface;
+	mc_sync_position();
+	return STATUS_PROBE_SUCCESS;
+}
+
+static uint8_t gcode(uint16_t code, uint16_t words, float x, float y, float z, float s)
+{
+	uint8_t error = 0xFF;
+	float target[AXIS_COUNT] = {x, y, z};
+	motion_data_t block_data = {0};
+	parser_state_t state = {.feedrate = 100};
+	parser_words_t values = {.s = s};
+	parser_cmd_explicit_t cmd = {.group_extended = code, .words = words};
+	gcode_exec_args_t args = {&state, &values, &cmd, &error, target, &block_data};
+
+	sim_moving = false;
+	sim_synced_moving = false;
+	sim_lines = 0;
+	sim_probes = 0;
+	if (!mesh_leveling_exec(&args))
+	{
+		return 0xFF;
+	}
+
+	// the parser position is updated from the target
+	memcpy(sim_planner, target, sizeof(sim_planner));
+	return error;
+}
+
+// G29 from the current X Y at Z5 to the opposite corner
+static uint8_t g29(float *from, float *to, float (*surface)(float, float), int fail)
+{
+	float start[AXIS_COUNT] = {from[0], from[1], 5};
+	memcpy(sim_planner, start, sizeof(start));
+	memcpy(sim_machine, start, sizeof(start));
+	mesh_leveling_apply_transform(sim_machine);
+	sim_surface = surface;
+	sim_probe_fail = fail;
+	return gcode(EXTENDED_GCODE(29), GCODE_WORD_X | GCODE_WORD_Y | GCODE_WORD_Z, to[0], to[1], -5, 0);
+}
+
+static float correction(float x, float y)
+{
+	float axis[AXIS_COUNT] = {x, y, 0};
+	mesh_leveling_apply_transform(axis);
+	return axis[AXIS_Z];
+}
+
+// maximum error of the correction against the surface (relative to the first point) inside an area of the grid
+static float max_error_in(float (*surface)(float, float), float x0, float y0, float x1, float y1)
+{
+	float error = 0;
+	for (float y = y0; y <= y1; y += 0.5f)
+	{
+		for (float x = x0; x <= x1; x += 0.5f)
+		{
+			error = fmaxf(error, fabsf(correction(x, y) - (surface(x, y) - surface(ref_x, ref_y))));
+		}
+	}
+	return error;
+}
+
+static float max_error(float (*surface)(float, float), float x0, float y0)
+{
+	ref_x = x0;
+	ref_y = y0;
+	return max_error_in(surface, 0, 0, 100, 80);
+}
+
+// maximum slope between close positions (a stepped correction has jumps between positions)
+static float max_slope(void)
+{
+	const float h = 0.01f;
+	float slope = 0;
+	for (float y = 1; y <= 79; y += 3.7f)
+	{
+		float z = correction(0, y);
+		for (float x = h; x <= 100; x += h)
+		{
+			float next = correction(x, y);
+			slope = fmaxf(slope, fabsf(next - z) / h);
+			z = next;
+		}
+	}
+	return slope;
+}
+
+int main(void)
+{
+	float origin[2] = {0, 0};
+	float corner[2] = {100, 80};
+
+#ifdef MESH_LEVELING_BICUBIC
+	// Catmull-Rom is exact for a quadratic surface away from the border cells
+	const float bowl_tolerance = 0.07f;
+	const float inner_tolerance = 1e-3f;
+	printf("bicubic interpolation\n");
+#else
+	const float bowl_tolerance = 0.11f;
+	const float inner_tolerance = 0.11f;
+	printf("bilinear interpolation\n");
+#endif
+
+	mod_mesh_leveling_hook();
+
+	// a plane is reproduced exactly
+	CHECK(g29(origin, corner, plane, 0) == STATUS_OK);
+	CHECK(!sim_synced_moving);
+	CHECK(sim_saves == 1);
+	float error = max_error(plane, 0, 0);
+	printf("  plane: max error %.5f mm\n", error);
+	CHECK(error < 1e-4f);
+
+	// the grid points are exact and the correction between them is smooth
+	CHECK(g29(origin, corner, bowl, 0) == STATUS_OK);
+	float node_error = 0;
+	for (int j = 0; j < 5; j++)
+	{
+		for (int i = 0; i < 5; i++)
+		{
+			node_error = fmaxf(node_error, fabsf(correction(25 * i, 20 * j) - (bowl(25 * i, 20 * j) - bowl(0, 0))));
+		}
+	}
+	error = max_error(bowl, 0, 0);
+	float inner_error = max_error_in(bowl, 25, 20, 75, 60);
+	float slope = max_slope();
+	printf("  bowl: max error %.5f mm (%.5f mm inside the border cells), grid points error %.5f mm, max slope %.4f\n", error, inner_error, node_error, slope);
+	CHECK(node_error < 1e-4f);
+	CHECK(error < bowl_tolerance);
+	CHECK(inner_error < inner_tolerance);
+	// the surface slope is under 0.04 (a 0.001mm jump between positions would be 0.1)
+	CHECK(slope < 0.06f);
+
+	// the reverse transform removes the correction
+	float axis[AXIS_COUNT] = {37.3f, 11.9f, 2.5f};
+	mesh_leveling_apply_transform(axis);
+	mesh_leveling_apply_reverse_transform(axis);
+	CHECK(fabsf(axis[AXIS_Z] - 2.5f) < 1e-5f);
+
+	// probing in the opposite direction stores the same map (relative to the first probed point)
+	CHECK(g29(corner, origin, bowl, 0) == STATUS_OK);
+	error = max_error(bowl, 100, 80);
+	printf("  bowl probed from the opposite corner: max error %.5f mm\n", error);
+	CHECK(error < bowl_tolerance);
+
+	// with an active map the probing starts at the same machine height (the correction is removed first)
+	CHECK(g29(origin, corner, bowl, 0) == STATUS_OK);
+	sim_planner[AXIS_X] = 30;
+	sim_planner[AXIS_Y] = 70;
+	sim_planner[AXIS_Z] = 5;
+	memcpy(sim_machine, sim_planner, sizeof(sim_machine));
+	mesh_leveling_apply_transform(sim_machine);
+	float machine_z = sim_machine[AXIS_Z];
+	sim_surface = plane;
+	sim_probe_fail = 0;
+	CHECK(gcode(EXTENDED_GCODE(29), GCODE_WORD_X | GCODE_WORD_Y | GCODE_WORD_Z, 100, 80, -5, 0) == STATUS_OK);
+	printf("  start height %.4f mm, first travel height %.4f mm\n", machine_z, sim_first_travel_z);
+	CHECK(fabsf(sim_first_travel_z - machine_z) < 1e-4f);
+	CHECK(!sim_synced_moving);
+
+	// a failed probe keeps the current map
+	CHECK(g29(origin, corner, bowl, 0) == STATUS_OK);
+	int saves = sim_saves;
+	CHECK(g29(origin, corner, plane, 7) == STATUS_CRITICAL_FAIL);
+	error = max_error(bowl, 0, 0);
+	printf("  bowl after a failed probe: max error %.5f mm\n", error);
+	CHECK(error < bowl_tolerance);
+	CHECK(sim_saves == saves);
+	CHECK(!sim_synced_moving);
+
+	// M420 switches the correction without moving the machine
+	float before[AXIS_COUNT];
+	memcpy(before, sim_machine, sizeof(before));
+	CHECK(gcode(EXTENDED_MCODE(420), GCODE_WORD_S, 0, 0, 0, 0) == STATUS_OK);
+	CHECK(correction(0, 80) == 0);
+	CHECK(fabsf(sim_planner[AXIS_Z] - before[AXIS_Z]) < 1e-5f);
+	CHECK(gcode(EXTENDED_MCODE(420), GCODE_WORD_S, 0, 0, 0, 1) == STATUS_OK);
+	CHECK(fabsf(sim_planner[AXIS_Z] + correction(sim_planner[AXIS_X], sim_planner[AXIS_Y]) - before[AXIS_Z]) < 1e-5f);
+	CHECK(!memcmp(before, sim_machine, sizeof(before)));
+
+	// a failed settings read clears the map
+	CHECK(g29(origin, corner, bowl, 0) == STATUS_OK);
+	sim_load_error = STATUS_SETTING_READ_FAIL;
+	mesh_leveling_settings_load(NULL);
+	CHECK(correction(30, 70) == 0);
+	CHECK(gcode(EXTENDED_MCODE(420), GCODE_WORD_S, 0, 0, 0, 1) == STATUS_SETTING_DISABLED);
+
+	printf(failures ? "FAIL (%d)\n" : "PASS\n", failures);
+	return failures ? 1 : 0;
+}
@@ -43,6 +43,187 @@
  * @return bool 	a boolean that tells the handler if the event should continue to propagate through additional listeners or is handled by the current listener an should stop propagation
  */
 
+/**
+ * @brief	Edge interpolated homing
+ * 			The limit switch edge is timestamped in the input ISR together with the step time and step period of the homing axis
+ * 			The trip position is interpolated between steps and the steps done after the trip (ISR latency, stop and back-off) are discounted from the home position
+ * 			The limits don't have an ISR event available to modules so the switch must also be wired to one of the DIN0-DIN7 inputs (input_change event)
+ */
+#ifdef SINGLE_AXIS_HOMING_EDGE_INTERPOLATION
+#if !defined(ENABLE_RT_SYNC_MOTIONS) || !defined(ENABLE_IO_MODULES)
+#warning "Edge interpolated homing needs ENABLE_RT_SYNC_MOTIONS and ENABLE_IO_MODULES. Edge interpolation will be disabled."
+#undef SINGLE_AXIS_HOMING_EDGE_INTERPOLATION
+#endif
+#endif
+
+#ifdef SINGLE_AXIS_HOMING_EDGE_INTERPOLATION
+// the step times are recorded by the itp_rt_stepbits callback while seeking the switch
+// G33 only attaches it during the threading motion but the modules below keep it attached from startup
+#if defined(M62_M65_SYNC_OUTPUTS) || defined(M67_M68_SYNC_OUTPUTS) || defined(S_CLUSTER_RT_SYNC) || defined(ENABLE_LASER_RASTER)
+#error "SINGLE_AXIS_HOMING_EDGE_INTERPOLATION can't be used with other modules that use the itp_rt_stepbits hook"
+#endif
+#endif
+
+// DIN0-DIN7 input wired to each axis limit switch
+#ifdef SINGLE_AXIS_HOMING_X_EDGE_DIN
+#define SINGLE_AXIS_HOMING_X_EDGE_MASK (1 << SINGLE_AXIS_HOMING_X_EDGE_DIN)
+#else
+#define SINGLE_AXIS_HOMING_X_EDGE_MASK 0
+#endif
+#ifdef SINGLE_AXIS_HOMING_Y_EDGE_DIN
+#define SINGLE_AXIS_HOMING_Y_EDGE_MASK (1 << SINGLE_AXIS_HOMING_Y_EDGE_DIN)
+#else
+#define SINGLE_AXIS_HOMING_Y_EDGE_MASK 0
+#endif
+#ifdef SINGLE_AXIS_HOMING_Z_EDGE_DIN
+#define SINGLE_AXIS_HOMING_Z_EDGE_MASK (1 << SINGLE_AXIS_HOMING_Z_EDGE_DIN)
+#else
+#define SINGLE_AXIS_HOMING_Z_EDGE_MASK 0
+#endif
+#ifdef SINGLE_AXIS_HOMING_A_EDGE_DIN
+#define SINGLE_AXIS_HOMING_A_EDGE_MASK (1 << SINGLE_AXIS_HOMING_A_EDGE_DIN)
+#else
+#define SINGLE_AXIS_HOMING_A_EDGE_MASK 0
+#endif
+#ifdef SINGLE_AXIS_HOMING_B_EDGE_DIN
+#define SINGLE_AXIS_HOMING_B_EDGE_MASK (1 << SINGLE_AXIS_HOMING_B_EDGE_DIN)
+#else
+#define SINGLE_AXIS_HOMING_B_EDGE_MASK 0
+#endif
+#ifdef SINGLE_AXIS_HOMING_C_EDGE_DIN
+#define SINGLE_AXIS_HOMING_C_EDGE_MASK (1 << SINGLE_AXIS_HOMING_C_EDGE_DIN)
+#else
+#define SINGLE_AXIS_HOMING_C_EDGE_MASK 0
+#endif
+
+typedef struct
+{
+	char letter;
+	uint8_t axis;
+	uint8_t axis_mask;
+	uint8_t axis_limit;
+	uint8_t edge_mask;
+} single_axis_homing_axis_t;
+
+// axes that can be homed individually
+static const single_axis_homing_axis_t single_axis_homing_axes[] = {
+#if AXIS_X_HOMING_MASK != 0
+	{'X', AXIS_X, AXIS_X_HOMING_MASK, LINACT0_LIMIT_MASK, SINGLE_AXIS_HOMING_X_EDGE_MASK},
+#endif
+#if AXIS_Y_HOMING_MASK != 0
+	{'Y', AXIS_Y, AXIS_Y_HOMING_MASK, LINACT1_LIMIT_MASK, SINGLE_AXIS_HOMING_Y_EDGE_MASK},
+#endif
+#if AXIS_Z_HOMING_MASK != 0
+	{'Z', AXIS_Z, AXIS_Z_HOMING_MASK, LINACT2_LIMIT_MASK, SINGLE_AXIS_HOMING_Z_EDGE_MASK},
+#endif
+#if AXIS_A_HOMING_MASK != 0
+	{'A', AXIS_A, AXIS_A_HOMING_MASK, LINACT3_LIMIT_MASK, SINGLE_AXIS_HOMING_A_EDGE_MASK},
+#endif
+#if AXIS_B_HOMING_MASK != 0
+	{'B', AXIS_B, AXIS_B_HOMING_MASK, LINACT4_LIMIT_MASK, SINGLE_AXIS_HOMING_B_EDGE_MASK},
+#endif
+#if AXIS_C_HOMING_MASK != 0
+	{'C', AXIS_C, AXIS_C_HOMING_MASK, LINACT5_LIMIT_MASK, SINGLE_AXIS_HOMING_C_EDGE_MASK},
+#endif
+};
+
+#define SINGLE_AXIS_HOMING_AXES (sizeof(single_axis_homing_axes) / sizeof(single_axis_homing_axis_t))
+
+#ifdef SINGLE_AXIS_HOMING_EDGE_INTERPOLATION
+// axes (bits of the single_axis_homing_axes table) seeking the switch and axes with a latched edge
+static volatile uint8_t single_axis_homing_seeking;
+static volatile uint8_t single_axis_homing_edge_latched;
+// last step time and step period of each axis
+static uint32_t single_axis_homing_step_time[SINGLE_AXIS_HOMING_AXES];
+static uint32_t single_axis_homing_step_period[SINGLE_AXIS_HOMING_AXES];
+// time since the last step, step period and step position at the edge
+static uint32_t single_axis_homing_edge_dt[SINGLE_AXIS_HOMING_AXES];
+static uint32_t single_axis_homing_edge_period[SINGLE_AXIS_HOMING_AXES];
+static int32_t single_axis_homing_edge_position[SINGLE_AXIS_HOMING_AXES];
+
+void single_axis_homing_step_cb(uint8_t stepbits, uint8_t itp_flags)
+{
+	uint8_t seeking = single_axis_homing_seeking;
+	if (!seeking)
+	{
+		return;
+	}
+
+	uint32_t now = mcu_micros();
+	for (uint8_t i = 0; i < SINGLE_AXIS_HOMING_AXES; i++)
+	{
+		if ((seeking & (1 << i)) && (stepbits & single_axis_homing_axes[i].axis_mask))
+		{
+			single_axis_homing_step_period[i] = now - single_axis_homing_step_time[i];
+			single_axis_homing_step_time[i] = now;
+		}
+	}
+}
+
+MCU_CALLBACK bool single_axis_homing_input_change(void *args)
+{
+	uint8_t *inputs = (uint8_t *)args;
+	// inputs = {inputs, diff};
+	uint8_t seeking = single_axis_homing_seeking;
+	if (!seeking)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	uint32_t now = mcu_micros();
+	uint8_t limits = io_get_limits();
+	int32_t position[STEPPER_COUNT];
+	itp_get_rt_position(position);
+	for (uint8_t i = 0; i < SINGLE_AXIS_HOMING_AXES; i++)
+	{
+		// only the first edge that trips the switch is latched
+		// the switch bounce and the release edge of the back-off (the limits are inverted while backing off) are ignored
+		if ((seeking & (1 << i)) && !(single_axis_homing_edge_latched & (1 << i)) && (inputs[1] & single_axis_homing_axes[i].edge_mask) && (limits & single_axis_homing_axes[i].axis_limit))
+		{
+			single_axis_homing_edge_dt[i] = now - single_axis_homing_step_time[i];
+			single_axis_homing_edge_period[i] = single_axis_homing_step_period[i];
+			single_axis_homing_edge_position[i] = position[single_axis_homing_axes[i].axis];
+			single_axis_homing_edge_latched |= (1 << i);
+		}
+	}
+
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(input_change, single_axis_homing_input_change);
+
+// distance (mm) between the stop position and the interpolated trip position
+// must be called before the pull off motion
+static float single_axis_homing_edge_overtravel(uint8_t i)
+{
+	if (!(single_axis_homing_edge_latched & (1 << i)))
+	{
+		return 0;
+	}
+
+	// signed steps done after the edge (the overshoot of the seek minus the back-off)
+	// the seek moves in the negative direction unless the homing direction is inverted
+	uint8_t axis = single_axis_homing_axes[i].axis;
+	int32_t position[STEPPER_COUNT];
+	itp_get_rt_position(position);
+	int32_t steps = position[axis] - single_axis_homing_edge_position[i];
+	if (!(g_settings.homing_dir_invert_mask & (1 << axis)))
+	{
+		steps = -steps;
+	}
+
+	// the trip happened a fraction of a step after the last step before the edge
+	float fraction = 0;
+	if (single_axis_homing_edge_period[i])
+	{
+		fraction = MIN((float)single_axis_homing_edge_dt[i] / (float)single_axis_homing_edge_period[i], 1.0f);
+	}
+
+	// negative if the axis stopped before the trip position
+	return ((float)steps - fraction) / g_settings.step_per_mm[axis];
+}
+#endif
+
 static void FORCEINLINE single_axis_homing_finnish(uint8_t error)
 {
 	// sync's the motion control with the real time position
@@ -53,26 +234,85 @@ static void FORCEINLINE single_axis_homing_finnish(uint8_t error)
 	cnc_unlock((error == STATUS_OK));
 }
 
-static uint8_t single_axis_homing_motion(uint8_t axis, uint8_t axis_mask, uint8_t axis_limit)
+// homes the selected axes (bits of the single_axis_homing_axes table) at the same time
+static uint8_t single_axis_homing_motion(uint8_t selected)
 {
 	float target[AXIS_COUNT];
+#ifdef SINGLE_AXIS_HOMING_EDGE_INTERPOLATION
+	float overtravel[SINGLE_AXIS_HOMING_AXES] = {0};
+#endif
 
 	if (!g_settings.homing_enabled)
 	{
 		return STATUS_SETTING_DISABLED;
 	}
 
-	motion_data_t block_data = {0};
+	uint8_t pending_mask = 0;
+	uint8_t pending_limit = 0;
+	for (uint8_t i = 0; i < SINGLE_AXIS_HOMING_AXES; i++)
+	{
+		if (selected & (1 << i))
+		{
+			pending_mask |= single_axis_homing_axes[i].axis_mask;
+			pending_limit |= single_axis_homing_axes[i].axis_limit;
+		}
+	}
 
 	cnc_set_exec_state(EXEC_HOMING);
-	uint8_t error = mc_home_axis(axis_mask, axis_limit);
-	switch (error)
+	uint8_t error;
+	do
 	{
-	case STATUS_OK:
+#ifdef SINGLE_AXIS_HOMING_EDGE_INTERPOLATION
+		uint8_t seeking = 0;
+		for (uint8_t i = 0; i < SINGLE_AXIS_HOMING_AXES; i++)
+		{
+			if (single_axis_homing_axes[i].axis_mask & pending_mask)
+			{
+				seeking |= (1 << i);
+			}
+		}
+		single_axis_homing_edge_latched = 0;
+		single_axis_homing_seeking = seeking;
+		// the step times are only needed while seeking the switch
+		HOOK_ATTACH_CALLBACK(itp_rt_stepbits, single_axis_homing_step_cb);
+#endif
+		// all the axes that didn't reach the switch yet seek together
+		// the homing motion stops when the first switch trips and the remaining axes seek again from where they stopped
+		error = mc_home_axis(pending_mask, pending_limit);
+#ifdef SINGLE_AXIS_HOMING_EDGE_INTERPOLATION
+		single_axis_homing_seeking = 0;
+		HOOK_RELEASE(itp_rt_stepbits);
+#endif
+		if (error != STATUS_OK)
+		{
+			break;
+		}
+
+		uint8_t limits = io_get_limits() & pending_limit;
+		uint8_t homed_mask = 0;
+		uint8_t homed_limit = 0;
+		for (uint8_t i = 0; i < SINGLE_AXIS_HOMING_AXES; i++)
+		{
+			if ((single_axis_homing_axes[i].axis_mask & pending_mask) && (single_axis_homing_axes[i].axis_limit & limits))
+			{
+				homed_mask |= single_axis_homing_axes[i].axis_mask;
+				homed_limit |= single_axis_homing_axes[i].axis_limit;
+#ifdef SINGLE_AXIS_HOMING_EDGE_INTERPOLATION
+				overtravel[i] = single_axis_homing_edge_overtravel(i);
+#endif
+			}
+		}
+
+		if (!homed_mask)
+		{
+			error = STATUS_CRITICAL_FAIL;
+			break;
+		}
+
 // sync's the motion control with the real time position
 // this flushes the homing motion before returning from error or home success
 #ifndef ENABLE_GRBL_STYLE_HOMING
-		if (!mc_home_motion_pulloff(axis_mask, true))
+		if (!mc_home_motion_pulloff(homed_mask, true))
 		{
 			return STATUS_CRITICAL_FAIL;
 		}
@@ -80,13 +320,31 @@ static uint8_t single_axis_homing_motion(uint8_t axis, uint8_t axis_mask, uint8_
 
 		// Sync motion control with real time positon
 		mc_sync_position();
+		pending_mask &= ~homed_mask;
+		pending_limit &= ~homed_limit;
+	} while (pending_mask);
+
+	switch (error)
+	{
+	case STATUS_OK:
 		mc_get_position(target);
 
+		for (uint8_t i = 0; i < SINGLE_AXIS_HOMING_AXES; i++)
+		{
+			if (selected & (1 << i))
+			{
+				uint8_t axis = single_axis_homing_axes[i].axis;
 #ifdef SET_ORIGIN_AT_HOME_POS
-		target[axis] = 0;
+				target[axis] = 0;
 #else
-		target[axis] = (!(g_settings.homing_dir_invert_mask & (1 << axis)) ? 0 : g_settings.max_distance[axis]);
+				target[axis] = (!(g_settings.homing_dir_invert_mask & (1 << axis)) ? 0 : g_settings.max_distance[axis]);
+#endif
+#ifdef SINGLE_AXIS_HOMING_EDGE_INTERPOLATION
+				// the axis stopped past the switch trip position (the home position is referenced to the trip position)
+				target[axis] += (!(g_settings.homing_dir_invert_mask & (1 << axis)) ? -overtravel[i] : overtravel[i]);
 #endif
+			}
+		}
 
 		// reset position
 		itp_reset_rt_position(target);
@@ -110,51 +368,36 @@ bool single_axis_homing_system_cmd(void *args)
 	grbl_cmd_args_t *ptr = (grbl_cmd_args_t *)args;
 	strupr((char *)ptr->cmd);
 
-#if AXIS_X_HOMING_MASK != 0
-	if (!strcmp((char *)ptr->cmd, "HX"))
-	{
-		*(ptr->error) = single_axis_homing_motion(AXIS_X, AXIS_X_HOMING_MASK, LINACT0_LIMIT_MASK);
-		return EVENT_HANDLED;
-	}
-#endif
-#if AXIS_Y_HOMING_MASK != 0
-	if (!strcmp((char *)ptr->cmd, "HY"))
-	{
-		*(ptr->error) = single_axis_homing_motion(AXIS_Y, AXIS_Y_HOMING_MASK, LINACT1_LIMIT_MASK);
-		return EVENT_HANDLED;
-	}
-#endif
-#if AXIS_Z_HOMING_MASK != 0
-	if (!strcmp((char *)ptr->cmd, "HZ"))
-	{
-		*(ptr->error) = single_axis_homing_motion(AXIS_Z, AXIS_Z_HOMING_MASK, LINACT2_LIMIT_MASK);
-		return EVENT_HANDLED;
-	}
-#endif
-#if AXIS_A_HOMING_MASK != 0
-	if (!strcmp((char *)ptr->cmd, "HA"))
+	// $H<axis letters> (for example $HX or $HXYA)
+	if (ptr->cmd[0] != 'H' || !ptr->cmd[1])
 	{
-		*(ptr->error) = single_axis_homing_motion(AXIS_A, AXIS_A_HOMING_MASK, LINACT3_LIMIT_MASK);
-		return EVENT_HANDLED;
+		return EVENT_CONTINUE;
 	}
-#endif
-#if AXIS_B_HOMING_MASK != 0
-	if (!strcmp((char *)ptr->cmd, "HB"))
-	{
-		*(ptr->error) = single_axis_homing_motion(AXIS_B, AXIS_B_HOMING_MASK, LINACT4_LIMIT_MASK);
-		return EVENT_HANDLED;
-	}
-#endif
-#if AXIS_C_HOMING_MASK != 0
-	if (!strcmp((char *)ptr->cmd, "HC"))
+
+	uint8_t selected = 0;
+	for (unsigned char *c = &ptr->cmd[1]; *c; c++)
 	{
-		*(ptr->error) = single_axis_homing_motion(AXIS_C, AXIS_C_HOMING_MASK, LINACT5_LIMIT_MASK);
-		return EVENT_HANDLED;
+		uint8_t i = 0;
+		for (; i < SINGLE_AXIS_HOMING_AXES; i++)
+		{
+			if (single_axis_homing_axes[i].letter == *c)
+			{
+				break;
+			}
+		}
+
+		// unknown or repeated axis
+		if (i == SINGLE_AXIS_HOMING_AXES || (selected & (1 << i)))
+		{
+			// just return an error to the handler telling this is an invalid command
+			return EVENT_CONTINUE;
+		}
+
+		selected |= (1 << i);
 	}
-#endif
 
-	// just return an error to the handler telling this is an invalid command
-	return EVENT_CONTINUE;
+	*(ptr->error) = single_axis_homing_motion(selected);
+	return EVENT_HANDLED;
 }
 
 /**
@@ -176,6 +419,9 @@ DECL_MODULE(single_axis_homing)
 #ifdef ENABLE_PARSER_MODULES
 	// Makes the event handler 'mycustom_system_cmd' listen to the event 'grbl_cmd'
 	ADD_EVENT_LISTENER(grbl_cmd, single_axis_homing_system_cmd);
+#ifdef SINGLE_AXIS_HOMING_EDGE_INTERPOLATION
+	ADD_EVENT_LISTENER(input_change, single_axis_homing_input_change);
+#endif
 #else
 // just a warning in case you disabled the PARSER_MODULES option on build
 #warning "Parser extensions are not enabled. Single Axis Command code extension will not work."
@@ -0,0 +1,98 @@
+/*
+	Minimal host replacement of the µCNC core API used by single_axis_homing.c
+	Only what the module needs to build on the host. The motion functions are implemented by the simulation (test_edge_homing.c)
+*/
+
+#ifndef CNC_H
+#define CNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define UCNC_MODULE_VERSION 11600
+
+#define ENABLE_PARSER_MODULES
+#define ENABLE_IO_MODULES
+#define ENABLE_RT_SYNC_MOTIONS
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define FORCEINLINE inline
+#define MCU_CALLBACK
+#define __FALL_THROUGH__
+
+#define AXIS_COUNT 3
+#define STEPPER_COUNT 3
+#define AXIS_X 0
+#define AXIS_Y 1
+#define AXIS_Z 2
+#define AXIS_A 3
+#define AXIS_B 4
+#define AXIS_C 5
+#define AXIS_X_HOMING_MASK 1
+#define AXIS_Y_HOMING_MASK 2
+#define AXIS_Z_HOMING_MASK 4
+#define AXIS_A_HOMING_MASK 0
+#define AXIS_B_HOMING_MASK 0
+#define AXIS_C_HOMING_MASK 0
+#define LINACT0_LIMIT_MASK 1
+#define LINACT1_LIMIT_MASK 2
+#define LINACT2_LIMIT_MASK 4
+#define LINACT3_LIMIT_MASK 8
+#define LINACT4_LIMIT_MASK 16
+#define LINACT5_LIMIT_MASK 32
+
+#define STATUS_OK 0
+#define STATUS_SETTING_DISABLED 5
+#define STATUS_CRITICAL_FAIL 254
+#define STATUS_HARDLIMITS_DISABLED 255
+#define EXEC_HOMING 4
+
+// events and hooks
+#define EVENT_CONTINUE false
+#define EVENT_HANDLED true
+#define CREATE_EVENT_LISTENER(event, handler) void *event##_##handler##_listener = (void *)&handler
+#define ADD_EVENT_LISTENER(event, handler) (void)event##_##handler##_listener
+#define DECL_MODULE(name) void mod_##name##_hook(void)
+#define DECL_HOOK(name, ...)              \
+	typedef void (*name##_delegate_t)(__VA_ARGS__); \
+	extern name##_delegate_t name##_cb
+#define CREATE_HOOK(name) name##_delegate_t name##_cb
+#define HOOK_ATTACH_CALLBACK(name, cb) name##_cb = &cb
+#define HOOK_RELEASE(name) name##_cb = NULL
+
+DECL_HOOK(itp_rt_stepbits, uint8_t, uint8_t);
+
+typedef struct
+{
+	uint8_t *error;
+	unsigned char *cmd;
+	uint8_t len;
+	char next_char;
+} grbl_cmd_args_t;
+
+typedef struct
+{
+	float step_per_mm[AXIS_COUNT];
+	float max_distance[AXIS_COUNT];
+	uint8_t homing_dir_invert_mask;
+	bool homing_enabled;
+} settings_t;
+extern settings_t g_settings;
+
+char *strupr(char *str);
+uint32_t mcu_micros(void);
+uint8_t io_get_limits(void);
+void cnc_set_exec_state(uint8_t statemask);
+void cnc_clear_exec_state(uint8_t statemask);
+bool cnc_unlock(bool force);
+void itp_clear(void);
+void itp_get_rt_position(int32_t *position);
+void itp_reset_rt_position(float *origin);
+void planner_clear(void);
+void mc_get_position(float *target);
+void mc_sync_position(void);
+uint8_t mc_home_axis(uint8_t axis_mask, uint8_t axis_limit);
+uint8_t mc_home_motion_pulloff(uint8_t axis_mask, bool is_origin_search);
+
+#endif
@@ -0,0 +1,223 @@
+/*
+	Simulated switch test of the edge interpolated homing
+
+	Runs $HX through the module many times with the switch at a random position between steps.
+	The simulated mc_home_axis steps the axis and calls the module step hook and input change listener in time order:
+		- the carriage moves at constant speed (one step every step period) towards the switch
+		- the switch trips at a random continuous position
+		- the DIN input change ISR timestamps the edge with 0-3us jitter and 1us timer resolution
+		- the limit ISR stops the motion 2-22us after the trip
+		- the axis backs off at the slow feed with the limits inverted and the switch releases after a random hysteresis
+		- the release edge is also seen by the input change ISR (the inverted limit reads as tripped) and the motion stops 2-22us after it
+	The error is the distance between the home position set by the module and the real trip position
+
+	Build and run with make (see Makefile)
+*/
+
+#include "build/src/cnc.h"
+#include <stdio.h>
+#include <math.h>
+#include <ctype.h>
+
+#define TRIALS 20000
+#define SLOW_FEED 25
+
+settings_t g_settings;
+CREATE_HOOK(itp_rt_stepbits);
+
+bool single_axis_homing_system_cmd(void *args);
+bool single_axis_homing_input_change(void *args);
+void mod_single_axis_homing_hook(void);
+
+// simulation state
+static double sim_now;
+static uint8_t sim_limits;
+static float sim_home;
+static uint32_t sim_rng = 1;
+
+// the case being simulated
+static double sim_period;
+static double sim_trip;
+static bool sim_edge_wired;
+static int32_t sim_position;
+static bool sim_hook_missing;
+
+// deterministic on every libc
+static double sim_rand(void)
+{
+	sim_rng = sim_rng * 1664525UL + 1013904223UL;
+	return (double)(sim_rng >> 8) / 16777216.0;
+}
+
+char *strupr(char *str)
+{
+	for (char *c = str; *c; c++)
+	{
+		*c = toupper((unsigned char)*c);
+	}
+	return str;
+}
+
+uint32_t mcu_micros(void) { return (uint32_t)floor(sim_now); }
+uint8_t io_get_limits(void) { return sim_limits; }
+void cnc_set_exec_state(uint8_t statemask) {}
+void cnc_clear_exec_state(uint8_t statemask) {}
+bool cnc_unlock(bool force) { return true; }
+void itp_clear(void) {}
+void planner_clear(void) {}
+void mc_sync_position(void) {}
+uint8_t mc_home_motion_pulloff(uint8_t axis_mask, bool is_origin_search) { return true; }
+
+void mc_get_position(float *target)
+{
+	memset(target, 0, sizeof(float) * AXIS_COUNT);
+}
+
+void itp_get_rt_position(int32_t *position)
+{
+	memset(position, 0, sizeof(int32_t) * STEPPER_COUNT);
+	position[AXIS_X] = sim_position;
+}
+
+void itp_reset_rt_position(float *origin)
+{
+	sim_home = origin[AXIS_X];
+}
+
+static void sim_edge(double isr_time, uint8_t limits)
+{
+	uint8_t inputs[2] = {1, 1};
+	sim_now = isr_time;
+	sim_limits = limits;
+	single_axis_homing_input_change(inputs);
+}
+
+// moves X one step at a time from the current position (1 or -1 steps) and stops 2-22us after the position crosses edge_at
+// the input change ISR sees the edge 0-3us after the crossing (if wired), even if the motion already stopped
+static void sim_move(double period, int dir, double edge_at, uint8_t axis_mask, uint8_t limits_at_edge)
+{
+	double start = sim_now;
+	int32_t origin = sim_position;
+	double edge_time = start + fabs(edge_at - origin) * period;
+	double isr_time = edge_time + sim_rand() * 3;
+	double stop_time = edge_time + 2 + sim_rand() * 20;
+	bool edge_done = !sim_edge_wired;
+
+	for (long step = 1;; step++)
+	{
+		double step_time = start + step * period;
+		if (!edge_done && isr_time < step_time && isr_time < stop_time)
+		{
+			sim_edge(isr_time, limits_at_edge);
+			edge_done = true;
+		}
+
+		if (stop_time < step_time)
+		{
+			// the edge ISR can also run after the motion stopped
+			if (!edge_done)
+			{
+				sim_edge(isr_time, limits_at_edge);
+			}
+			sim_now = stop_time;
+			sim_limits = limits_at_edge;
+			return;
+		}
+
+		sim_now = step_time;
+		sim_position = origin + dir * step;
+		if (itp_rt_stepbits_cb)
+		{
+			itp_rt_stepbits_cb(axis_mask, 0);
+		}
+	}
+}
+
+// X seeks the switch in the negative direction and then backs off at the slow feed until the switch releases
+uint8_t mc_home_axis(uint8_t axis_mask, uint8_t axis_limit)
+{
+	// the step times are only recorded while seeking
+	if (!itp_rt_stepbits_cb)
+	{
+		sim_hook_missing = true;
+	}
+
+	double hysteresis = (0.02 + sim_rand() * 0.03) * g_settings.step_per_mm[AXIS_X];
+
+	sim_now = 0;
+	sim_position = 0;
+	sim_limits = 0;
+	sim_move(sim_period, -1, -sim_trip, axis_mask, axis_limit);
+	// the limits are inverted while backing off (the switch release reads as a trip)
+	sim_limits = 0;
+	sim_move(60e6 / (SLOW_FEED * g_settings.step_per_mm[AXIS_X]), 1, -sim_trip + hysteresis, axis_mask, axis_limit);
+	return STATUS_OK;
+}
+
+// returns the standard deviation (um) and fails if the hook is still attached after homing
+static bool run(const char *name, float feed, float steps_per_mm, bool edge_wired, double *sigma)
+{
+	double sum = 0, sum2 = 0, min = 1e9, max = -1e9;
+
+	g_settings.step_per_mm[AXIS_X] = steps_per_mm;
+	sim_period = 60e6 / (feed * steps_per_mm);
+	sim_edge_wired = edge_wired;
+	sim_hook_missing = false;
+
+	for (int i = 0; i < TRIALS; i++)
+	{
+		unsigned char cmd[] = "HX";
+		uint8_t error = 0xFF;
+		grbl_cmd_args_t args = {&error, cmd, 2, 0};
+
+		sim_trip = 100 + sim_rand();
+		if (!single_axis_homing_system_cmd(&args) || error != STATUS_OK || itp_rt_stepbits_cb)
+		{
+			printf("%s: homing failed or the step hook was left attached\n", name);
+			return false;
+		}
+
+		// the axis stopped (sim_position + sim_trip) steps from the trip position
+		double e = (sim_home - (sim_position + sim_trip) / steps_per_mm) * 1000.0;
+		sum += e;
+		sum2 += e * e;
+		min = fmin(min, e);
+		max = fmax(max, e);
+	}
+
+	if (sim_hook_missing)
+	{
+		printf("%s: the step hook was not attached while seeking\n", name);
+		return false;
+	}
+
+	double mean = sum / TRIALS;
+	*sigma = sqrt(fmax(sum2 / TRIALS - mean * mean, 0));
+	printf("%5.0f steps/mm, F%4.0f %-20s spread %6.2f um, sigma %5.2f um\n", steps_per_mm, feed, name, max - min, *sigma);
+	return true;
+}
+
+int main(void)
+{
+	double sigma;
+	bool ok = true;
+
+	g_settings.homing_enabled = true;
+	mod_single_axis_homing_hook();
+	if (itp_rt_stepbits_cb)
+	{
+		printf("the step hook is attached outside homing\n");
+		return 1;
+	}
+
+	ok &= run("step boundary", 100, 80, false, &sigma);
+	ok &= run("step boundary", 2000, 80, false, &sigma);
+	ok &= run("edge interpolated", 2000, 80, true, &sigma);
+	ok &= (sigma < 0.1);
+	ok &= run("step boundary", 2000, 800, false, &sigma);
+	ok &= run("edge interpolated", 2000, 800, true, &sigma);
+	ok &= (sigma < 0.1);
+
+	printf(ok ? "PASS\n" : "FAIL\n");
+	return ok ? 0 : 1;
+}
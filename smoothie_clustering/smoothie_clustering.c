@@ -29,8 +29,31 @@
 #define S_CLUSTER_SIZE 8
 #endif
 
+#if (S_CLUSTER_SIZE > 256)
+#error "S_CLUSTER_SIZE must be 256 or less"
+#endif
+
+// uncomment to switch the clustered power levels inside a single planner block (applied by the step ISR)
+// #define S_CLUSTER_RT_SYNC
+
+#ifdef S_CLUSTER_RT_SYNC
+#if !defined(ENABLE_MOTION_CONTROL_MODULES) || !defined(ENABLE_RT_SYNC_MOTIONS)
+#warning "S_CLUSTER_RT_SYNC needs ENABLE_MOTION_CONTROL_MODULES and ENABLE_RT_SYNC_MOTIONS. Each clustered line will be split in several planner blocks."
+#undef S_CLUSTER_RT_SYNC
+#endif
+#endif
+
+#ifdef S_CLUSTER_RT_SYNC
+// the levels are switched by the step callback, attached from startup, so no other itp_rt_stepbits user can be enabled
+#if defined(M62_M65_SYNC_OUTPUTS) || defined(M67_M68_SYNC_OUTPUTS) || defined(ENABLE_LASER_RASTER) || defined(G33_ENCODER) || defined(SINGLE_AXIS_HOMING_EDGE_INTERPOLATION)
+#error "S_CLUSTER_RT_SYNC can't be used with other modules that use the itp_rt_stepbits hook"
+#endif
+#endif
+
 static uint16_t s_cluster[(S_CLUSTER_SIZE - 1)];
 static uint8_t s_cluster_count;
+// laser dynamic power mode (M4) of the current line
+static bool s_cluster_dynamic;
 
 #ifdef ENABLE_SYSTEM_INFO
 bool smoothie_clustering_info(void *args)
@@ -56,7 +79,10 @@ bool smoothie_clustering_parse_token(void *args)
 			return EVENT_CONTINUE;
 		}
 
-		s_cluster[i++] = (uint16_t)(val * g_settings.spindle_max_rpm);
+		if (i < (S_CLUSTER_SIZE - 1))
+		{
+			s_cluster[i++] = (uint16_t)(val * g_settings.spindle_max_rpm);
+		}
 		c = serial_getc();
 		if (c == EOL)
 		{
@@ -75,6 +101,7 @@ bool smoothie_clustering_gcode_exec_modifier(void *args)
 	gcode_exec_args_t *gcode = (gcode_exec_args_t *)args;
 
 	gcode->words->s *= g_settings.spindle_max_rpm;
+	s_cluster_dynamic = (g_settings.laser_mode && gcode->new_state->groups.spindle_turning == M4);
 	return EVENT_CONTINUE;
 }
 
@@ -84,6 +111,291 @@ CREATE_EVENT_LISTENER(gcode_exec_modifier, smoothie_clustering_gcode_exec_modifi
 
 #ifdef ENABLE_MOTION_CONTROL_MODULES
 
+#ifdef S_CLUSTER_RT_SYNC
+// the clustered power levels are kept with each planner block and switched by the step ISR
+// each block is split in (clusters + 1) equal step intervals (the remainder steps go to the last level)
+// this way each clustered line takes a single planner block
+// every block that goes through the motion control is queued so that the ISR can follow the blocks by counting the main stepper steps
+// in laser dynamic power mode (M4) the levels are scaled by the ratio between the actual and the programmed velocity (like the interpolator does with the block power)
+typedef struct
+{
+	uint32_t steps;
+	uint32_t interval;
+	// expected time (us) of the velocity measurement steps at the programmed feed (0 in constant power mode)
+	uint32_t window;
+	uint16_t level;
+	int16_t base;
+	uint8_t main_stepper;
+	uint8_t count;
+} s_cluster_block_t;
+
+// blocks in the planner plus the blocks being executed by the interpolator
+#ifndef S_CLUSTER_BLOCKS
+#define S_CLUSTER_BLOCKS (PLANNER_BUFFER_SIZE + INTERPOLATOR_BUFFER_SIZE)
+#endif
+// power levels buffer shared by all the queued blocks
+#ifndef S_CLUSTER_LEVELS
+#define S_CLUSTER_LEVELS (4 * S_CLUSTER_SIZE)
+#endif
+// main stepper steps between velocity measurements in laser dynamic power mode (must be a power of 2)
+#ifndef S_CLUSTER_VELOCITY_STEPS
+#define S_CLUSTER_VELOCITY_STEPS 16
+#endif
+
+static s_cluster_block_t s_cluster_blocks[S_CLUSTER_BLOCKS];
+static int16_t s_cluster_levels[S_CLUSTER_LEVELS];
+static volatile uint8_t s_cluster_blocks_head;
+static volatile uint8_t s_cluster_blocks_tail;
+static volatile uint16_t s_cluster_levels_head;
+static volatile uint16_t s_cluster_levels_tail;
+// ISR step counter and next level index of the current block
+static volatile uint32_t s_cluster_step;
+static volatile uint32_t s_cluster_next_switch;
+static volatile uint8_t s_cluster_next_level;
+// ISR current level, velocity scale (256 is the programmed velocity) and scaled power in laser dynamic power mode
+static int16_t s_cluster_level;
+static uint32_t s_cluster_window_time;
+static volatile uint16_t s_cluster_scale;
+static int16_t s_cluster_power;
+
+static FORCEINLINE uint8_t s_cluster_blocks_free(void)
+{
+	uint8_t head = s_cluster_blocks_head;
+	uint8_t tail = s_cluster_blocks_tail;
+	return (S_CLUSTER_BLOCKS - 1) - ((head >= tail) ? (head - tail) : (S_CLUSTER_BLOCKS + head - tail));
+}
+
+static FORCEINLINE uint16_t s_cluster_levels_free(void)
+{
+	uint16_t head = s_cluster_levels_head;
+	uint16_t tail = s_cluster_levels_tail;
+	return (S_CLUSTER_LEVELS - 1) - ((head >= tail) ? (head - tail) : (S_CLUSTER_LEVELS + head - tail));
+}
+
+// ratio between the expected and the measured time of the velocity measurement steps (never above 256)
+static FORCEINLINE uint16_t s_cluster_velocity_scale(uint32_t window, uint32_t dt)
+{
+	if (dt <= window)
+	{
+		return 256;
+	}
+
+	return (dt < 256) ? (uint16_t)((window << 8) / dt) : (uint16_t)MIN(window / (dt >> 8), 256);
+}
+
+static FORCEINLINE void s_cluster_set_level(s_cluster_block_t *block, int16_t level)
+{
+	s_cluster_level = level;
+	if (block->window)
+	{
+		// the power is set at every step since the interpolator also updates the power during the acceleration
+		s_cluster_power = (int16_t)(((int32_t)level * s_cluster_scale) >> 8);
+		return;
+	}
+
+	tool_set_speed(level);
+}
+
+void smoothie_clustering_step_cb(uint8_t stepbits, uint8_t itp_flags)
+{
+#ifdef ITP_BACKLASH
+	// backlash compensation blocks are not queued
+	if (itp_flags & ITP_BACKLASH)
+	{
+		return;
+	}
+#endif
+
+	uint8_t tail = s_cluster_blocks_tail;
+	if (tail == s_cluster_blocks_head)
+	{
+		return;
+	}
+
+	s_cluster_block_t *block = &s_cluster_blocks[tail];
+	if (!(stepbits & (1 << block->main_stepper)))
+	{
+		return;
+	}
+
+	uint32_t step = ++s_cluster_step;
+	if (block->window)
+	{
+		if (step == 1)
+		{
+			// block started
+			s_cluster_window_time = mcu_micros();
+			s_cluster_set_level(block, block->base);
+		}
+		else if (!((step - 1) & (S_CLUSTER_VELOCITY_STEPS - 1)))
+		{
+			uint32_t now = mcu_micros();
+			s_cluster_scale = s_cluster_velocity_scale(block->window, now - s_cluster_window_time);
+			s_cluster_window_time = now;
+			s_cluster_set_level(block, s_cluster_level);
+		}
+	}
+
+	if (step >= block->steps)
+	{
+		// block ended
+		if (block->count)
+		{
+			// restores the block power (the interpolator only updates the tool when it changes)
+			if (block->window)
+			{
+				tool_set_speed((int16_t)(((int32_t)block->base * s_cluster_scale) >> 8));
+			}
+			else
+			{
+				tool_set_speed(block->base);
+			}
+			uint16_t levels_tail = block->level + block->count;
+			s_cluster_levels_tail = (levels_tail < S_CLUSTER_LEVELS) ? levels_tail : (levels_tail - S_CLUSTER_LEVELS);
+		}
+
+		if (++tail == S_CLUSTER_BLOCKS)
+		{
+			tail = 0;
+		}
+		s_cluster_blocks_tail = tail;
+		s_cluster_step = 0;
+		s_cluster_next_level = 0;
+		s_cluster_next_switch = s_cluster_blocks[tail].interval;
+		return;
+	}
+
+	if (step == s_cluster_next_switch && s_cluster_next_level < block->count)
+	{
+		uint16_t level = block->level + s_cluster_next_level++;
+		s_cluster_set_level(block, s_cluster_levels[(level < S_CLUSTER_LEVELS) ? level : (level - S_CLUSTER_LEVELS)]);
+		s_cluster_next_switch += block->interval;
+	}
+
+	if (block->window)
+	{
+		tool_set_speed(s_cluster_power);
+	}
+}
+
+// the planner and the interpolator are empty (the step ISR is not following any block)
+static FORCEINLINE bool s_cluster_motion_idle(void)
+{
+	return planner_buffer_is_empty() && !cnc_get_exec_state(EXEC_RUN);
+}
+
+// restarts the queue while the motion is stopped
+// this also drops the blocks left by a planner clear without a reset (probe, jog cancel, homing...)
+static void s_cluster_resync(void)
+{
+	s_cluster_blocks_head = s_cluster_blocks_tail = 0;
+	s_cluster_levels_head = s_cluster_levels_tail = 0;
+	s_cluster_step = 0;
+	s_cluster_next_level = 0;
+	// the motion starts from rest
+	s_cluster_scale = 0;
+}
+
+bool smoothie_clustering_mc_line_segment(void *args)
+{
+	motion_data_t *block_data = (motion_data_t *)args;
+	uint8_t clusters = s_cluster_count;
+	s_cluster_count = 0;
+
+	uint32_t steps = block_data->steps[block_data->main_stepper];
+	if (!steps)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	if (s_cluster_motion_idle())
+	{
+		s_cluster_resync();
+	}
+
+	clusters = (uint8_t)MIN(clusters, (S_CLUSTER_LEVELS - 1));
+	clusters = (uint8_t)MIN(clusters, (steps - 1));
+
+	// waits for space in the queue (only happens if the blocks are very short)
+	while (!s_cluster_blocks_free() || s_cluster_levels_free() < clusters)
+	{
+		if (s_cluster_motion_idle())
+		{
+			// the motion ended without the ISR releasing the queue
+			s_cluster_resync();
+			break;
+		}
+
+		if (!cnc_dotasks())
+		{
+			return EVENT_CONTINUE;
+		}
+	}
+
+	uint8_t head = s_cluster_blocks_head;
+	s_cluster_block_t *block = &s_cluster_blocks[head];
+	block->steps = steps;
+	block->main_stepper = block_data->main_stepper;
+	block->count = clusters;
+	block->interval = (clusters) ? (steps / (clusters + 1)) : 0;
+	block->base = tool_range_speed(block_data->spindle);
+	block->level = s_cluster_levels_head;
+	block->window = 0;
+
+	if (clusters && s_cluster_dynamic)
+	{
+		// feed (mm/min) times feed_conversion (main stepper steps/mm) is the main stepper step rate per minute
+		float rate = MIN(block_data->feed, block_data->max_feed) * block_data->feed_conversion;
+		if (rate > 0)
+		{
+			block->window = (uint32_t)MAX(MIN((60000000.0f * S_CLUSTER_VELOCITY_STEPS) / rate, (float)UINT32_MAX), 1);
+		}
+	}
+
+	uint16_t level = s_cluster_levels_head;
+	for (uint8_t i = 0; i < clusters; i++)
+	{
+		s_cluster_levels[level] = tool_range_speed(s_cluster[i]);
+		if (++level == S_CLUSTER_LEVELS)
+		{
+			level = 0;
+		}
+	}
+	s_cluster_levels_head = level;
+
+	// first block of an empty queue sets the ISR first switch
+	ATOMIC_CODEBLOCK
+	{
+		if (s_cluster_blocks_tail == head)
+		{
+			s_cluster_step = 0;
+			s_cluster_next_level = 0;
+			s_cluster_next_switch = block->interval;
+		}
+
+		if (++head == S_CLUSTER_BLOCKS)
+		{
+			head = 0;
+		}
+		s_cluster_blocks_head = head;
+	}
+
+	return EVENT_CONTINUE;
+}
+
+#ifdef ENABLE_MAIN_LOOP_MODULES
+// the planner is cleared on reset
+bool smoothie_clustering_reset(void *args)
+{
+	s_cluster_count = 0;
+	s_cluster_resync();
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(cnc_reset, smoothie_clustering_reset);
+#endif
+
+#else
 bool smoothie_clustering_mc_line_segment(void *args)
 {
 	uint8_t clusters = s_cluster_count;
@@ -131,6 +443,8 @@ bool smoothie_clustering_mc_line_segment(void *args)
 	return EVENT_CONTINUE;
 }
 
+#endif
+
 CREATE_EVENT_LISTENER(mc_line_segment, smoothie_clustering_mc_line_segment);
 
 #endif
@@ -145,6 +459,12 @@ DECL_MODULE(smoothie_clustering)
 #endif
 #ifdef ENABLE_MOTION_CONTROL_MODULES
 	ADD_EVENT_LISTENER(mc_line_segment, smoothie_clustering_mc_line_segment);
+#ifdef S_CLUSTER_RT_SYNC
+	HOOK_ATTACH_CALLBACK(itp_rt_stepbits, smoothie_clustering_step_cb);
+#ifdef ENABLE_MAIN_LOOP_MODULES
+	ADD_EVENT_LISTENER(cnc_reset, smoothie_clustering_reset);
+#endif
+#endif
 #else
 #warning "Motion control extensions are not enabled. Smoothieware S Cluster module will not work."
 #endif
@@ -0,0 +1,90 @@
+/*
+	Minimal host replacement of the µCNC core API used by tmc.c and tmc_driver.c
+	Only what the driver library and the module need to build on the host (without the parser extensions)
+	The planner and the motion control functions are implemented by the tests
+*/
+
+#ifndef CNC_H
+#define CNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#define UCNC_MODULE_VERSION 11600
+
+#define ENABLE_MAIN_LOOP_MODULES
+#define ENABLE_MOTION_CONTROL_MODULES
+
+#define DBGMSG(...)
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define ABS(a) (((a) < 0) ? -(a) : (a))
+#define CLAMP(a, b, c) (MIN((c), MAX((a), (b))))
+#define FORCEINLINE inline
+#define MCU_CALLBACK
+#define __ATOMIC__ for (int __a = 1; __a; __a = 0)
+#define MIN_SEC_MULT 0.0166666667f
+#define ASSERT_PIN(x) (x > 0)
+
+#define AXIS_COUNT 3
+#define STEPPER_COUNT 3
+#define AXIS_TO_STEPPERS 3
+#define PLANNER_BUFFER_SIZE 15
+#define F_STEP_MAX 30000
+#define EXEC_RUN 1
+#define EXEC_HOMING 4
+
+// events
+#define EVENT_CONTINUE false
+#define EVENT_HANDLED true
+#define CREATE_EVENT_LISTENER(event, handler) void *event##_##handler##_listener = (void *)&handler
+#define ADD_EVENT_LISTENER(event, handler) (void)event##_##handler##_listener
+#define DECL_MODULE(name) void mod_##name##_hook(void)
+#define CREATE_HOOK(name) name##_delegate_t name##_cb
+#define HOOK_INVOKE(name, ...)  \
+	if (name##_cb)              \
+	{                           \
+		name##_cb(__VA_ARGS__); \
+	}
+
+typedef struct
+{
+	float max_feed_rate[AXIS_COUNT];
+	float acceleration[AXIS_COUNT];
+	float step_per_mm[AXIS_COUNT];
+} settings_t;
+extern settings_t g_settings;
+
+typedef struct
+{
+	int32_t steps[STEPPER_COUNT];
+	uint8_t dirbits;
+	float feed;
+	float max_feed;
+	float max_accel;
+	float feed_conversion;
+	uint8_t main_stepper;
+	float dir_vect[AXIS_COUNT];
+} motion_data_t;
+
+typedef struct
+{
+	int32_t steps[STEPPER_COUNT];
+	uint32_t total_steps;
+} planner_block_t;
+
+uint32_t mcu_millis(void);
+uint32_t mcu_micros(void);
+uint8_t cnc_get_exec_state(uint8_t statemask);
+bool planner_buffer_is_empty(void);
+planner_block_t *planner_get_block(void);
+uint8_t itp_sync(void);
+void proto_print(const char *str);
+void proto_putc(char c);
+void proto_itoa(int32_t value);
+void proto_ftoa(float value);
+char *strupr(char *str);
+
+#endif
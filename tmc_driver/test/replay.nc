@@ -0,0 +1,18 @@
+; replay of the planner driven current scaling
+; rapids, cutting moves at several feeds, a Z plunge, a dwell and short segments
+G0 X10 Y10
+G0 Z-2
+G1 X60 F600
+G1 Y60 F1200
+G1 X10 Y10 F2400
+G4 P0.2
+G1 Z-5 F150
+G1 X12 Y10.5 F1800
+G1 X14 Y11.5
+G1 X16 Y13
+G1 X18 Y15
+G1 X20 Y17.5
+G1 X22 Y20.5
+G1 X24 Y24
+G0 Z5
+G0 X0 Y0
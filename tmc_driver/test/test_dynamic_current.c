@@ -0,0 +1,377 @@
+/*
+	G-code replay of the planner driven run current scaling (ENABLE_TMC_DYNAMIC_CURRENT)
+
+	Replays a G-code file (G0/G1 absolute moves, F and G4 dwells) through the module with 3 simulated TMC2209 drivers (TMC_SIM interface)
+	Each move is sent to the module motion control event and then to a simulated planner in the same order as mc_line
+	The blocks are executed in simulated time (each block starts and ends at rest) while the module main loop task runs every millisecond
+	For every block the run current (IRUN) of each driver model is printed at the middle of the block next to the current computed for the block
+
+	Checks that:
+		- every block runs with at least the current computed for it (the current is already set when the block starts)
+		- the current stays between TMC_DYNAMIC_CURRENT_MIN and TMC_DYNAMIC_CURRENT_MAX
+		- the drivers drop to the minimum current after the idle time
+
+	Build and run with make (see Makefile)
+*/
+
+#include "build/src/cnc.h"
+#include "tmc.h"
+#include "tmc_driver.h"
+#include "tmc_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#define AXIS_NAMES "XYZ"
+
+settings_t g_settings = {
+	.max_feed_rate = {3000, 3000, 600},
+	.acceleration = {500, 500, 100},
+	.step_per_mm = {80, 80, 400},
+};
+
+bool tmc_driver_config_all(void *args);
+bool tmc_dynamic_current_queue_block(void *args);
+bool tmc_dynamic_current_update(void *args);
+void mod_tmc_driver_hook(void);
+
+static int failures;
+
+#define CHECK(cond, ...)           \
+	if (!(cond))                   \
+	{                              \
+		printf("  FAIL: ");        \
+		printf(__VA_ARGS__);       \
+		printf("\n");              \
+		failures++;                \
+	}
+
+// simulated planner
+typedef struct
+{
+	planner_block_t block;
+	double duration;
+	uint8_t irun[STEPPER_COUNT];
+	int line;
+	char text[128];
+} sim_block_t;
+
+static sim_block_t sim_planner[PLANNER_BUFFER_SIZE];
+static uint8_t sim_tail;
+static uint8_t sim_count;
+static double sim_now;
+static double sim_block_start;
+static bool sim_block_reported;
+
+uint32_t mcu_millis(void) { return (uint32_t)sim_now; }
+uint32_t mcu_micros(void) { return (uint32_t)(sim_now * 1000.0); }
+uint8_t cnc_get_exec_state(uint8_t statemask) { return (sim_count) ? (statemask & EXEC_RUN) : 0; }
+bool planner_buffer_is_empty(void) { return !sim_count; }
+planner_block_t *planner_get_block(void) { return &sim_planner[sim_tail].block; }
+uint8_t itp_sync(void) { return 0; }
+void proto_print(const char *str) { printf("%s", str); }
+void proto_putc(char c) { putchar(c); }
+void proto_itoa(int32_t value) { printf("%ld", (long)value); }
+void proto_ftoa(float value) { printf("%g", value); }
+
+char *strupr(char *str)
+{
+	for (char *c = str; *c; c++)
+	{
+		*c = toupper((unsigned char)*c);
+	}
+	return str;
+}
+
+// IRUN of the driver for a current scale (same conversion as tmc_set_current_scale)
+static uint8_t expected_irun(uint8_t stepper, float scale)
+{
+	tmc_driver_t *driver = tmc_driver_get(stepper);
+	tmc_driver_setting_t *settings = tmc_driver_get_settings(stepper);
+	float vfs = (TMC_GET_FIELD(tmc_read_register(driver, CHOPCONF), CHOPCONF_VSENSE)) ? 0.180f : 0.325f;
+	float cs = roundf(32.0f * 1.41421f * settings->rms_current * scale / 1000.0f * (settings->rsense + 0.02f) / vfs) - 1;
+	return (uint8_t)CLAMP(0, cs, 31);
+}
+
+static uint8_t model_irun(uint8_t stepper)
+{
+	return (uint8_t)TMC_GET_FIELD(tmc_sim_peek(tmc_driver_get_sim(stepper), IHOLD_IRUN), IHOLD_IRUN_IRUN);
+}
+
+static uint32_t model_writes(void)
+{
+	uint32_t writes = 0;
+	for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+	{
+		writes += tmc_driver_get_sim(i)->stats.writes;
+	}
+	return writes;
+}
+
+// runs the main loop for one millisecond of simulated time
+static void sim_tick(void)
+{
+	tmc_dynamic_current_update(NULL);
+	sim_now += 1.0;
+
+	if (!sim_count)
+	{
+		return;
+	}
+
+	sim_block_t *b = &sim_planner[sim_tail];
+	double elapsed = sim_now - sim_block_start;
+
+	if (!sim_block_reported && elapsed >= b->duration * 0.5)
+	{
+		sim_block_reported = true;
+		printf("%4d  %-28s %7.0fms ", b->line, b->text, b->duration);
+		for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+		{
+			uint8_t irun = model_irun(i);
+			printf(" %c %2u/%2u", AXIS_NAMES[i], irun, b->irun[i]);
+			if (b->block.total_steps)
+			{
+				CHECK(irun >= b->irun[i], "line %d stepper %u runs at IRUN %u (needs %u)", b->line, i, irun, b->irun[i]);
+				CHECK(irun >= expected_irun(i, TMC_DYNAMIC_CURRENT_MIN) && irun <= expected_irun(i, TMC_DYNAMIC_CURRENT_MAX), "line %d stepper %u IRUN %u out of range", b->line, i, irun);
+			}
+		}
+		printf("\n");
+	}
+
+	if (elapsed >= b->duration)
+	{
+		sim_tail = (sim_tail + 1) % PLANNER_BUFFER_SIZE;
+		sim_count--;
+		sim_block_start = sim_now;
+		sim_block_reported = false;
+	}
+}
+
+static sim_block_t *sim_planner_push(void)
+{
+	while (sim_count == PLANNER_BUFFER_SIZE)
+	{
+		sim_tick();
+	}
+
+	if (!sim_count)
+	{
+		sim_block_start = sim_now;
+		sim_block_reported = false;
+	}
+
+	sim_block_t *b = &sim_planner[(sim_tail + sim_count) % PLANNER_BUFFER_SIZE];
+	memset(b, 0, sizeof(sim_block_t));
+	return b;
+}
+
+// sends a linear move to the module and to the planner in the same way as mc_line
+static void sim_line(const float *from, const float *to, float feed, bool rapid, int line, const char *text)
+{
+	motion_data_t block_data = {0};
+	float len = 0;
+	uint32_t max_steps = 0;
+
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+	{
+		float d = to[i] - from[i];
+		len += d * d;
+		block_data.steps[i] = abs((int32_t)lroundf(to[i] * g_settings.step_per_mm[i]) - (int32_t)lroundf(from[i] * g_settings.step_per_mm[i]));
+		if ((uint32_t)block_data.steps[i] > max_steps)
+		{
+			max_steps = block_data.steps[i];
+			block_data.main_stepper = i;
+		}
+	}
+
+	len = sqrtf(len);
+	if (!max_steps)
+	{
+		return;
+	}
+
+	block_data.max_feed = 1e9f;
+	block_data.max_accel = 1e9f;
+	for (uint8_t i = 0; i < AXIS_COUNT; i++)
+	{
+		block_data.dir_vect[i] = (to[i] - from[i]) / len;
+		float dir = fabsf(block_data.dir_vect[i]);
+		if (dir > 0)
+		{
+			block_data.max_feed = MIN(block_data.max_feed, g_settings.max_feed_rate[i] / dir);
+			block_data.max_accel = MIN(block_data.max_accel, g_settings.acceleration[i] / dir);
+		}
+	}
+	block_data.feed = (rapid) ? block_data.max_feed : feed;
+	block_data.feed_conversion = max_steps / len;
+
+	sim_block_t *b = sim_planner_push();
+	tmc_dynamic_current_queue_block(&block_data);
+
+	// the current computed for the block (the same formula with the gains of tmc_driver.h)
+	float v = MIN(block_data.feed, block_data.max_feed) / 60.0f;
+	for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+	{
+		float scale = TMC_DYNAMIC_CURRENT_MIN;
+		if (block_data.steps[i])
+		{
+			float dir = fabsf(block_data.dir_vect[i]);
+			scale += TMC_DYNAMIC_CURRENT_ACCEL_GAIN * MIN(block_data.max_accel * dir / g_settings.acceleration[i], 1.0f);
+			scale += TMC_DYNAMIC_CURRENT_FEED_GAIN * MIN(v * 60.0f * dir / g_settings.max_feed_rate[i], 1.0f);
+		}
+		// the module stores the value in 1/255 units
+		scale = CLAMP(TMC_DYNAMIC_CURRENT_MIN, scale, TMC_DYNAMIC_CURRENT_MAX);
+		b->irun[i] = expected_irun(i, (float)lroundf(scale * 255.0f) * (1.0f / 255.0f));
+		b->block.steps[i] = block_data.steps[i];
+	}
+
+	// trapezoid (or triangle) from and to rest
+	double a = block_data.max_accel;
+	b->duration = (len >= (v * v / a)) ? ((len / v + v / a) * 1000.0) : (2.0 * sqrt(len / a) * 1000.0);
+	b->block.total_steps = max_steps;
+	b->line = line;
+	snprintf(b->text, sizeof(b->text), "%s", text);
+	sim_count++;
+}
+
+// dwells are planner blocks without steps (the module has no entry for them)
+static void sim_dwell(float seconds, int line, const char *text)
+{
+	sim_block_t *b = sim_planner_push();
+	b->duration = seconds * 1000.0;
+	b->line = line;
+	snprintf(b->text, sizeof(b->text), "%s", text);
+	sim_count++;
+}
+
+static void sim_wait_idle(double ms)
+{
+	while (sim_count)
+	{
+		sim_tick();
+	}
+
+	double end = sim_now + ms;
+	while (sim_now < end)
+	{
+		sim_tick();
+	}
+}
+
+static bool replay(const char *file)
+{
+	FILE *f = fopen(file, "r");
+	if (!f)
+	{
+		printf("can't open %s\n", file);
+		return false;
+	}
+
+	float pos[AXIS_COUNT] = {0};
+	float feed = 0;
+	bool rapid = true;
+	char buf[128];
+	int line = 0;
+	uint32_t blocks = 0;
+
+	printf("line  block                          duration   IRUN model/needed\n");
+	while (fgets(buf, sizeof(buf), f))
+	{
+		line++;
+		buf[strcspn(buf, ";(\r\n")] = 0;
+		if (!buf[0])
+		{
+			continue;
+		}
+
+		float target[AXIS_COUNT];
+		memcpy(target, pos, sizeof(target));
+		float dwell = -1;
+		bool move = false;
+
+		for (char *c = buf; *c;)
+		{
+			char word = toupper((unsigned char)*c++);
+			if (!isalpha((unsigned char)word))
+			{
+				continue;
+			}
+
+			char *end;
+			float value = strtof(c, &end);
+			c = end;
+			switch (word)
+			{
+			case 'G':
+				if (value == 0 || value == 1)
+				{
+					rapid = (value == 0);
+				}
+				else if (value == 4)
+				{
+					dwell = 0;
+				}
+				break;
+			case 'F':
+				feed = value;
+				break;
+			case 'P':
+				dwell = value;
+				break;
+			default:
+				if (strchr(AXIS_NAMES, word))
+				{
+					target[strchr(AXIS_NAMES, word) - AXIS_NAMES] = value;
+					move = true;
+				}
+				break;
+			}
+		}
+
+		if (dwell >= 0)
+		{
+			sim_dwell(dwell, line, buf);
+			blocks++;
+		}
+		else if (move)
+		{
+			sim_line(pos, target, feed, rapid, line, buf);
+			memcpy(pos, target, sizeof(pos));
+			blocks++;
+		}
+	}
+	fclose(f);
+
+	sim_wait_idle(0);
+	printf("%lu blocks, %lu register writes in %.1fs\n", (unsigned long)blocks, (unsigned long)model_writes(), sim_now / 1000.0);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	const char *file = (argc > 1) ? argv[1] : "replay.nc";
+
+	mod_tmc_driver_hook();
+	tmc_driver_config_all(NULL);
+	for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+	{
+		tmc_sim_clear_stats(tmc_driver_get_sim(i));
+	}
+
+	if (!replay(file))
+	{
+		return 1;
+	}
+
+	// after the idle time all drivers run at the minimum current
+	sim_wait_idle(TMC_DYNAMIC_CURRENT_IDLE_MS + 2 * TMC_DYNAMIC_CURRENT_UPDATE_MS);
+	for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+	{
+		CHECK(model_irun(i) == expected_irun(i, TMC_DYNAMIC_CURRENT_MIN), "stepper %u IRUN %u after the idle time", i, model_irun(i));
+		CHECK(tmc_sim_peek(tmc_driver_get_sim(i), TPOWERDOWN) == (uint32_t)((float)TMC_DYNAMIC_CURRENT_IDLE_MS * 0.001f * (float)TMC_CLK_FREQ / 262144.0f), "stepper %u TPOWERDOWN not set to the idle time", i);
+	}
+
+	printf(failures ? "FAIL (%d)\n" : "PASS\n", failures);
+	return failures ? 1 : 0;
+}
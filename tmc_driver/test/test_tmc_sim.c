@@ -0,0 +1,197 @@
+/*
+	Host test of the TMC driver library (tmc.c) against the software driver model (tmc_sim.c)
+
+	Checks the UART (TMC2209) and SPI (TMC2130) protocols, the write batching and the recovery from injected faults.
+	The bus statistics of the model are printed for each operation.
+
+	Build and run with make (see Makefile)
+*/
+
+#include "build/src/cnc.h"
+#include "tmc.h"
+#include "tmc_sim.h"
+#include <stdio.h>
+
+static int failures;
+
+#define CHECK(cond)                                                    \
+	if (!(cond))                                                       \
+	{                                                                  \
+		printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);       \
+		failures++;                                                    \
+	}
+
+uint32_t mcu_millis(void) { return 0; }
+
+static tmc_sim_t uart_sim;
+static tmc_sim_t spi_sim;
+
+static void uart_rw(uint8_t *data, uint8_t wlen, uint8_t rlen) { tmc_sim_rw(&uart_sim, data, wlen, rlen); }
+static void spi_rw(uint8_t *data, uint8_t wlen, uint8_t rlen) { tmc_sim_rw(&spi_sim, data, wlen, rlen); }
+
+static tmc_driver_setting_t settings = {
+	.rms_current = 800,
+	.rsense = 0.11f,
+	.ihold_mul = 0.5f,
+	.ihold_delay = 5,
+	.mstep = 16,
+	.step_interpolation = true,
+	.stealthchop_threshold = 0,
+	.stallguard_threshold = 0,
+};
+
+// prints and clears the bus statistics of the last operation
+static tmc_sim_stats_t report(tmc_sim_t *sim, const char *name)
+{
+	tmc_sim_stats_t stats = sim->stats;
+	printf("  %-44s %3lu transactions (%lu reads, %lu writes, %lu bytes)\n", name, (unsigned long)stats.transactions, (unsigned long)stats.reads, (unsigned long)stats.writes, (unsigned long)(stats.tx_bytes + stats.rx_bytes));
+	tmc_sim_clear_stats(sim);
+	return stats;
+}
+
+// every register configured by the driver holds the value of the shadow register
+static bool matches(tmc_driver_t *driver, tmc_sim_t *sim, const uint8_t *regs, uint8_t count)
+{
+	bool ok = true;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		uint32_t shadow = tmc_read_register(driver, regs[i]);
+		if (shadow != tmc_sim_peek(sim, regs[i]))
+		{
+			printf("  register 0x%02X: driver 0x%08lX, model 0x%08lX\n", regs[i], (unsigned long)shadow, (unsigned long)tmc_sim_peek(sim, regs[i]));
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+static void test_uart(void)
+{
+	static const uint8_t regs[] = {GCONF, CHOPCONF, IHOLD_IRUN, TPOWERDOWN, TPWMTHRS, TCOOLTHRS, SGTHRS};
+	tmc_driver_t driver = {.type = 2209, .slave = 0, .rw = uart_rw};
+	tmc_sim_stats_t stats;
+
+	printf("TMC2209 (UART)\n");
+	tmc_sim_init(&uart_sim, 2209, 0);
+
+	tmc_init(&driver, &settings);
+	stats = report(&uart_sim, "configuration after power up");
+	CHECK(!stats.rejected);
+	CHECK(matches(&driver, &uart_sim, regs, sizeof(regs)));
+	CHECK(!TMC_GET_FIELD(tmc_sim_peek(&uart_sim, GSTAT), GSTAT_RESET));
+
+	// only the reset flag and the interface counter are read
+	tmc_init(&driver, &settings);
+	stats = report(&uart_sim, "configuration without changes");
+	CHECK(stats.transactions == 2 && !stats.writes);
+
+	// a single register change in a batch
+	settings.rms_current = 600;
+	tmc_init(&driver, &settings);
+	stats = report(&uart_sim, "configuration with a current change");
+	CHECK(stats.writes == 1);
+	CHECK(matches(&driver, &uart_sim, regs, sizeof(regs)));
+
+	// CRC checked replies
+	CHECK(tmc_read_register_forced(&driver, GCONF) == tmc_sim_peek(&uart_sim, GCONF));
+	report(&uart_sim, "forced GCONF read");
+
+	// requests to other slave addresses are ignored
+	driver.slave = 1;
+	CHECK(tmc_read_register_forced(&driver, GCONF) == TMC_READ_ERROR);
+	driver.slave = 0;
+	stats = report(&uart_sim, "read from another slave address");
+	CHECK(stats.rejected == 1);
+
+	// replies with a bad CRC and no replies are read errors and don't change the cache
+	uint32_t gconf = tmc_read_register(&driver, GCONF);
+	tmc_sim_fault(&uart_sim, TMC_SIM_FAULT_CRC, 1);
+	CHECK(tmc_read_register_forced(&driver, GCONF) == TMC_READ_ERROR);
+	tmc_sim_fault(&uart_sim, TMC_SIM_FAULT_TIMEOUT, 1);
+	CHECK(tmc_read_register_forced(&driver, GCONF) == TMC_READ_ERROR);
+	CHECK(tmc_read_register(&driver, GCONF) == gconf);
+	report(&uart_sim, "reads with bad CRC and timeout");
+
+	// a dropped write is detected by the interface counter and resent
+	tmc_sim_fault(&uart_sim, TMC_SIM_FAULT_DROP_WRITE, 1);
+	CHECK(tmc_write_register(&driver, TPOWERDOWN, 100) == 100);
+	CHECK(tmc_sim_peek(&uart_sim, TPOWERDOWN) == 100);
+	stats = report(&uart_sim, "write with a dropped datagram");
+	CHECK(stats.writes == 2);
+
+	// the write stays pending if the driver never acknowledges it and is sent with the next flush
+	tmc_sim_fault(&uart_sim, TMC_SIM_FAULT_DROP_WRITE, 255);
+	CHECK(tmc_write_register(&driver, TPOWERDOWN, 120) == TMC_WRITE_ERROR);
+	CHECK(driver.reg.dirty);
+	tmc_sim_fault(&uart_sim, 0, 0);
+	CHECK(tmc_flush(&driver));
+	CHECK(tmc_sim_peek(&uart_sim, TPOWERDOWN) == 120);
+	report(&uart_sim, "write dropped until the next flush");
+
+	// a power loss is detected by the reset flag and the whole configuration is sent again
+	tmc_sim_fault(&uart_sim, TMC_SIM_FAULT_RESET, 1);
+	tmc_init(&driver, &settings);
+	report(&uart_sim, "configuration after a driver reset");
+	CHECK(matches(&driver, &uart_sim, regs, sizeof(regs)));
+	CHECK(!TMC_GET_FIELD(tmc_sim_peek(&uart_sim, GSTAT), GSTAT_RESET));
+
+	// if the reset flag can't be read the driver may still hold the old values
+	// the reset values of the write only registers are sent even if they match the new settings
+	settings.stealthchop_threshold = 500;
+	tmc_init(&driver, &settings);
+	settings.stealthchop_threshold = 0;
+	tmc_sim_clear_stats(&uart_sim);
+	tmc_sim_fault(&uart_sim, TMC_SIM_FAULT_TIMEOUT, 1);
+	tmc_init(&driver, &settings);
+	report(&uart_sim, "configuration after a reset flag read error");
+	CHECK(matches(&driver, &uart_sim, regs, sizeof(regs)));
+}
+
+static void test_spi(void)
+{
+	static const uint8_t regs[] = {GCONF, CHOPCONF, PWMCONF, IHOLD_IRUN, TPOWERDOWN, TPWMTHRS, TCOOLTHRS, COOLCONF, THIGH};
+	tmc_driver_t driver = {.type = 2130, .rw = spi_rw};
+	tmc_sim_stats_t stats;
+
+	printf("TMC2130 (SPI)\n");
+	tmc_sim_init(&spi_sim, 2130, 0);
+	settings.rms_current = 800;
+
+	tmc_init(&driver, &settings);
+	report(&spi_sim, "configuration after power up");
+	CHECK(!(tmc_sim_peek(&spi_sim, GSTAT) & GSTAT_RESET_MASK));
+	CHECK(matches(&driver, &spi_sim, regs, sizeof(regs)));
+
+	// only the reset flag is read (the SPI reply comes with the second datagram)
+	tmc_init(&driver, &settings);
+	stats = report(&spi_sim, "configuration without changes");
+	CHECK(stats.transactions == 2 && !stats.writes);
+	CHECK(matches(&driver, &spi_sim, regs, sizeof(regs)));
+
+	// the reply of each datagram holds the value requested by the previous one
+	CHECK(tmc_read_register_forced(&driver, CHOPCONF) == tmc_sim_peek(&spi_sim, CHOPCONF));
+	CHECK(tmc_read_register_forced(&driver, GCONF) == tmc_sim_peek(&spi_sim, GCONF));
+	report(&spi_sim, "forced CHOPCONF and GCONF reads");
+
+	tmc_sim_fault(&spi_sim, TMC_SIM_FAULT_RESET, 1);
+	tmc_init(&driver, &settings);
+	report(&spi_sim, "configuration after a driver reset");
+	CHECK(matches(&driver, &spi_sim, regs, sizeof(regs)));
+	CHECK(!(tmc_sim_peek(&spi_sim, GSTAT) & GSTAT_RESET_MASK));
+
+	// a driver without a bus callback is left unconfigured
+	tmc_driver_t unwired = {.type = 2130};
+	tmc_init(&unwired, &settings);
+	unwired.type = 2209;
+	tmc_init(&unwired, &settings);
+	printf("  driver without a bus callback\n");
+}
+
+int main(void)
+{
+	test_uart();
+	test_spi();
+
+	printf(failures ? "FAIL (%d)\n" : "PASS\n", failures);
+	return failures ? 1 : 0;
+}
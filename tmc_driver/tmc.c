@@ -51,45 +51,93 @@ uint8_t tmc_crc8(uint8_t *data, uint8_t len)
 	return crc;
 }
 
-uint32_t tmc_read_register(tmc_driver_t *driver, uint8_t address)
+// returns the shadow copy of a register (if the register is cached for this type of driver)
+static uint32_t *tmc_shadow_register(tmc_driver_t *driver, uint8_t address, uint16_t *flag)
 {
-	if (!(driver->rw))
-	{
-		return TMC_READ_ERROR;
-	}
-
-	// write only registers
-	// return shadow register
 	switch (address)
 	{
+	case GCONF:
+		*flag = TMC_SHADOW_GCONF;
+		return &driver->reg.gconf;
+	case CHOPCONF:
+		*flag = TMC_SHADOW_CHOPCONF;
+		return &driver->reg.chopconf;
+	case PWMCONF:
+		*flag = TMC_SHADOW_PWMCONF;
+		return &driver->reg.pwmconf;
 	case IHOLD_IRUN:
-		return driver->reg.ihold_irun;
+		*flag = TMC_SHADOW_IHOLD_IRUN;
+		return &driver->reg.ihold_irun;
+	case TPOWERDOWN:
+		*flag = TMC_SHADOW_TPOWERDOWN;
+		return &driver->reg.tpowerdown;
 	case TPWMTHRS:
-		return driver->reg.tpwmthrs;
+		*flag = TMC_SHADOW_TPWMTHRS;
+		return &driver->reg.tpwmthrs;
 	case TCOOLTHRS:
-		return driver->reg.tcoolthrs;
+		*flag = TMC_SHADOW_TCOOLTHRS;
+		return &driver->reg.tcoolthrs;
 	case SGTHRS:
 		switch (driver->type)
 		{
 		case 2209:
 		case 2226:
-			return driver->reg.sgthrs;
-		default:
-			return 0;
+			*flag = TMC_SHADOW_SGTHRS;
+			return &driver->reg.sgthrs;
 		}
+		break;
 	case COOLCONF:
 		switch (driver->type)
 		{
 		case 2130:
-			return driver->reg.coolconf;
-		default:
-			return 0;
+			*flag = TMC_SHADOW_COOLCONF;
+			return &driver->reg.coolconf;
+		}
+		break;
+	case THIGH:
+		switch (driver->type)
+		{
+		case 2130:
+			*flag = TMC_SHADOW_THIGH;
+			return &driver->reg.thigh;
 		}
 		break;
-	case TPOWERDOWN:
-		return driver->reg.tpowerdown;
 	}
 
+	*flag = 0;
+	return NULL;
+}
+
+// registers that can't be read back from the driver
+static bool tmc_is_write_only(tmc_driver_t *driver, uint16_t flag)
+{
+	if (flag & TMC_SHADOW_WRITE_ONLY)
+	{
+		return true;
+	}
+
+	// TMC2130 PWMCONF is write only
+	return (driver->type == 2130 && flag == TMC_SHADOW_PWMCONF);
+}
+
+// SPI datagram (address plus 32bit value)
+static void tmc_spi_datagram(uint8_t *data, uint8_t address, uint32_t val)
+{
+	data[0] = address;
+	data[1] = (val >> 24) & 0xFF;
+	data[2] = (val >> 16) & 0xFF;
+	data[3] = (val >> 8) & 0xFF;
+	data[4] = (val) & 0xFF;
+}
+
+static uint32_t tmc_spi_value(uint8_t *data)
+{
+	return ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 8) | data[4];
+}
+
+// performs the actual bus read transaction
+static uint32_t tmc_bus_read(tmc_driver_t *driver, uint8_t address)
+{
 	uint8_t data[8];
 	uint8_t crc = 0;
 	uint32_t result = TMC_READ_ERROR;
@@ -133,163 +181,347 @@ uint32_t tmc_read_register(tmc_driver_t *driver, uint8_t address)
 		result = ((uint32_t)data[3] << 24) | ((uint32_t)data[4] << 16) | (data[5] << 8) | data[6];
 		break;
 	case 2130:
-		data[0] = address & 0x7F;
-		data[1] = 0;
-		data[2] = 0;
-		data[3] = 0;
-		data[4] = 0;
-		DBGMSG("MCU-R->TMC: %#5hX", data);
-		driver->rw(data, 5, 5);
-		DBGMSG("TMC-R->MCU: %#5hX", data);
-		result = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) | (data[3] << 8) | data[4];
+		// SPI replies are shifted out on the next datagram so the request is sent twice
+		for (uint8_t i = 2; i != 0; i--)
+		{
+			tmc_spi_datagram(data, address & 0x7F, 0);
+			DBGMSG("MCU-R->TMC: %#5hX", data);
+			driver->rw(data, 5, 5);
+			DBGMSG("TMC-R->MCU: %#5hX", data);
+		}
+		result = tmc_spi_value(data);
 	}
 
 	return result;
 }
 
-uint32_t tmc_write_register(tmc_driver_t *driver, uint8_t address, uint32_t val)
+// performs the actual bus write transaction (without any check)
+static bool tmc_bus_write(tmc_driver_t *driver, uint8_t address, uint32_t val)
+{
+	uint8_t data[8];
+	switch (driver->type)
+	{
+	case 2202:
+	case 2208:
+	case 2225:
+		driver->slave = 0;
+	case 2209:
+	case 2226:
+		/* code */
+		data[0] = 0x05;
+		data[1] = driver->slave;
+		data[2] = address | 0x80;
+		data[3] = (val >> 24) & 0xFF;
+		data[4] = (val >> 16) & 0xFF;
+		data[5] = (val >> 8) & 0xFF;
+		data[6] = (val) & 0xFF;
+		data[7] = tmc_crc8(data, 7);
+		DBGMSG("MCU-W->TMC: %#8hX", data);
+		driver->rw(data, 8, 0);
+		return true;
+	case 2130:
+		tmc_spi_datagram(data, address | 0x80, val);
+		DBGMSG("MCU-W->TMC: %#5hX", data);
+		driver->rw(data, 5, 5);
+		return true;
+	}
+
+	return false;
+}
+
+// checks if the driver acknowledged the amount of writes done since the last check
+static bool tmc_bus_check_writes(tmc_driver_t *driver, uint8_t writes)
+{
+	switch (driver->type)
+	{
+	case 2130:
+		// SPI has no interface counter
+		return true;
+	}
+
+	uint32_t cnt = tmc_bus_read(driver, IFCNT);
+	if (cnt == TMC_READ_ERROR)
+	{
+		return false;
+	}
+
+	// the counter wraps around at 255
+	uint8_t done = (uint8_t)cnt - driver->reg.ifcnt;
+	driver->reg.ifcnt = (uint8_t)cnt;
+	return (done == writes);
+}
+
+uint32_t tmc_read_register(tmc_driver_t *driver, uint8_t address)
 {
 	if (!(driver->rw))
 	{
-		return TMC_WRITE_ERROR;
+		return TMC_READ_ERROR;
 	}
 
-	switch (address)
+	uint16_t flag;
+	uint32_t *shadow = tmc_shadow_register(driver, address, &flag);
+
+	if (shadow)
 	{
-	case IHOLD_IRUN:
-		if (driver->reg.ihold_irun == val)
+		// write only registers or registers already cached
+		// return shadow register
+		if ((driver->reg.cached & flag) || tmc_is_write_only(driver, flag))
 		{
-			return val;
+			return *shadow;
 		}
-		break;
-	case TPWMTHRS:
-		if (driver->reg.tpwmthrs == val)
+	}
+	else
+	{
+		// write only registers not available on this driver
+		switch (address)
 		{
-			return val;
+		case SGTHRS:
+		case COOLCONF:
+		case THIGH:
+			return 0;
 		}
-		break;
-	case TCOOLTHRS:
-		if (driver->reg.tcoolthrs == val)
+	}
+
+	return tmc_read_register_forced(driver, address);
+}
+
+uint32_t tmc_read_register_forced(tmc_driver_t *driver, uint8_t address)
+{
+	if (!(driver->rw))
+	{
+		return TMC_READ_ERROR;
+	}
+
+	uint16_t flag;
+	uint32_t *shadow = tmc_shadow_register(driver, address, &flag);
+
+	if (shadow && tmc_is_write_only(driver, flag))
+	{
+		// can't be read from the driver
+		return *shadow;
+	}
+
+	uint32_t result = tmc_bus_read(driver, address);
+
+	// refresh the cache (unless a pending write exists)
+	if (shadow && result != TMC_READ_ERROR && !(driver->reg.dirty & flag))
+	{
+		*shadow = result;
+		driver->reg.cached |= flag;
+	}
+
+	return result;
+}
+
+uint32_t tmc_write_register(tmc_driver_t *driver, uint8_t address, uint32_t val)
+{
+	if (!(driver->rw))
+	{
+		return TMC_WRITE_ERROR;
+	}
+
+	uint16_t flag;
+	uint32_t *shadow = tmc_shadow_register(driver, address, &flag);
+
+	if (!shadow)
+	{
+		switch (address)
 		{
-			return val;
+		// write only registers not available on this driver
+		case SGTHRS:
+		case COOLCONF:
+			return TMC_WRITE_ERROR;
 		}
-		break;
-	case SGTHRS:
-		switch (driver->type)
+
+#ifndef TMC_UNSAFE_MODE
+		// restricts write commands build it on this driver (prevents write commands to other addresses)
+		return TMC_WRITE_ERROR;
+#else
+		// unsafe registers are not cached and are written immediately
+		int8_t retries = TMC_MAX_WRITE_RETRIES;
+		do
 		{
-		case 2209:
-		case 2226:
-			if (driver->reg.sgthrs == val)
+			if (!tmc_bus_write(driver, address, val))
 			{
-				return val;
+				return TMC_WRITE_ERROR;
 			}
-			break;
-		default:
-			return TMC_WRITE_ERROR;
-		}
-		break;
-	case COOLCONF:
-		switch (driver->type)
-		{
-		case 2130:
-			if (driver->reg.coolconf == val)
+			if (tmc_bus_check_writes(driver, 1))
 			{
 				return val;
 			}
-			break;
-		default:
-			return TMC_WRITE_ERROR;
-		}
-		break;
-	case TPOWERDOWN:
-		if (driver->reg.tpowerdown == val)
-		{
-			return val;
-		}
-		break;
-		// restricts write commands build it on this driver (prevents write commands to other addresses)
-#ifndef TMC_UNSAFE_MODE
-	case GCONF:
-	case CHOPCONF:
-	case PWMCONF:
-		break;
-	default:
+		} while (--retries > 0);
+
 		return TMC_WRITE_ERROR;
 #endif
 	}
 
+	// coalesces writes
+	// if the value is already set in the driver (or pending) there is nothing to do
+	if ((driver->reg.cached & flag) && *shadow == val)
+	{
+		return val;
+	}
+
+	*shadow = val;
+	driver->reg.cached |= flag;
+	driver->reg.dirty |= flag;
+
+	// the write will be sent with the rest of the batch
+	if (driver->reg.batch)
+	{
+		return val;
+	}
+
+	return (tmc_flush(driver)) ? val : TMC_WRITE_ERROR;
+}
+
+void tmc_batch_begin(tmc_driver_t *driver)
+{
+	driver->reg.batch = true;
+}
+
+// the order the registers are sent to the driver
+static const uint8_t tmc_flush_order[] = {GCONF, CHOPCONF, PWMCONF, IHOLD_IRUN, TPOWERDOWN, TPWMTHRS, TCOOLTHRS, SGTHRS, COOLCONF, THIGH};
+
+bool tmc_flush(tmc_driver_t *driver)
+{
+	driver->reg.batch = false;
+
+	if (!(driver->rw))
+	{
+		return false;
+	}
+
 	int8_t retries = TMC_MAX_WRITE_RETRIES;
 
-	do
+	while (driver->reg.dirty)
 	{
-		uint8_t data[8];
-		switch (driver->type)
+		uint8_t writes = 0;
+		for (uint8_t i = 0; i < sizeof(tmc_flush_order); i++)
+		{
+			uint16_t flag;
+			uint32_t *shadow = tmc_shadow_register(driver, tmc_flush_order[i], &flag);
+			if (shadow && (driver->reg.dirty & flag))
+			{
+				tmc_bus_write(driver, tmc_flush_order[i], *shadow);
+				writes++;
+			}
+		}
+
+		// checks if all writes were executed with a single read
+		// if not the whole batch is resent
+		if (tmc_bus_check_writes(driver, writes))
+		{
+			driver->reg.dirty = 0;
+			return true;
+		}
+
+		if (--retries <= 0)
 		{
-		case 2202:
-		case 2208:
-		case 2225:
-			driver->slave = 0;
-		case 2209:
-		case 2226:
-			/* code */
-			data[0] = 0x05;
-			data[1] = driver->slave;
-			data[2] = address | 0x80;
-			data[3] = (val >> 24) & 0xFF;
-			data[4] = (val >> 16) & 0xFF;
-			data[5] = (val >> 8) & 0xFF;
-			data[6] = (val) & 0xFF;
-			data[7] = tmc_crc8(data, 7);
-			DBGMSG("MCU-W->TMC: %#8hX", data);
-			driver->rw(data, 8, 0);
-			break;
-		case 2130:
-			data[0] = address | 0x80;
-			data[4] = (uint8_t)(val & 0xFF);
-			val >>= 8;
-			data[3] = (uint8_t)(val & 0xFF);
-			val >>= 8;
-			data[2] = (uint8_t)(val & 0xFF);
-			val >>= 8;
-			data[1] = (uint8_t)(val & 0xFF);
-			driver->rw(data, 5, 5);
 			break;
-		default:
-			return TMC_WRITE_ERROR;
 		}
+	}
+
+	// leaves the registers dirty
+	// this will be retried on the next flush
+	return (!driver->reg.dirty);
+}
 
-		// checks if write was executed
-		uint8_t cnt = tmc_read_register(driver, IFCNT);
-		if (driver->reg.ifcnt != cnt)
+// SPI daisy chain
+// the datagram of the driver at position 0 (connected to the MCU SDO pin) is the last one to be shifted out
+// a datagram filled with zeros is a GCONF read and is used as a NOP for the remaining drivers in the chain
+#define TMC_CHAIN_OFFSET(chain, pos) (((chain)->length - 1 - (pos)) * 5)
+
+void tmc_chain_rw(tmc_chain_t *chain, uint8_t pos, uint8_t *data)
+{
+	uint8_t buffer[TMC_CHAIN_MAX_LENGTH * 5];
+	uint16_t len = chain->length * 5;
+	uint16_t offset = TMC_CHAIN_OFFSET(chain, pos);
+
+	memset(buffer, 0, len);
+	memcpy(&buffer[offset], data, 5);
+	chain->xfer(buffer, len);
+	memcpy(data, &buffer[offset], 5);
+}
+
+bool tmc_chain_flush(tmc_chain_t *chain)
+{
+	uint8_t buffer[TMC_CHAIN_MAX_LENGTH * 5];
+	uint8_t next[TMC_CHAIN_MAX_LENGTH];
+	uint16_t len = chain->length * 5;
+
+	memset(next, 0, sizeof(next));
+
+	// each transfer sends the next dirty register of every driver in the chain
+	// the number of transfers is the maximum number of dirty registers of a single driver
+	for (;;)
+	{
+		bool pending = false;
+		memset(buffer, 0, len);
+		for (uint8_t i = 0; i < chain->count; i++)
 		{
-			driver->reg.ifcnt = cnt;
-			switch (address)
+			tmc_driver_t *driver = chain->drivers[i];
+			while (next[i] < sizeof(tmc_flush_order))
 			{
-			case IHOLD_IRUN:
-				driver->reg.ihold_irun = val;
-				break;
-			case TPWMTHRS:
-				driver->reg.tpwmthrs = val;
-				break;
-			case TCOOLTHRS:
-				driver->reg.tcoolthrs = val;
-				break;
-			case SGTHRS:
-				driver->reg.sgthrs = val;
-				break;
-			case COOLCONF:
-				driver->reg.coolconf = val;
-				break;
-			case TPOWERDOWN:
-				driver->reg.tpowerdown = val;
-				break;
+				uint8_t address = tmc_flush_order[next[i]++];
+				uint16_t flag;
+				uint32_t *shadow = tmc_shadow_register(driver, address, &flag);
+				if (shadow && (driver->reg.dirty & flag))
+				{
+					tmc_spi_datagram(&buffer[TMC_CHAIN_OFFSET(chain, driver->chain_pos)], address | 0x80, *shadow);
+					pending = true;
+					break;
+				}
 			}
+		}
 
-			return val;
+		if (!pending)
+		{
+			break;
 		}
-	} while (--retries > 0);
 
-	return TMC_WRITE_ERROR;
+		chain->xfer(buffer, len);
+	}
+
+	for (uint8_t i = 0; i < chain->count; i++)
+	{
+		chain->drivers[i]->reg.dirty = 0;
+		chain->drivers[i]->reg.batch = false;
+	}
+
+	return true;
+}
+
+void tmc_chain_read(tmc_chain_t *chain, uint8_t address, uint32_t *values)
+{
+	uint8_t buffer[TMC_CHAIN_MAX_LENGTH * 5];
+	uint16_t len = chain->length * 5;
+
+	// SPI replies are shifted out on the next datagram so the request is sent twice
+	for (uint8_t j = 2; j != 0; j--)
+	{
+		memset(buffer, 0, len);
+		for (uint8_t i = 0; i < chain->count; i++)
+		{
+			tmc_spi_datagram(&buffer[TMC_CHAIN_OFFSET(chain, chain->drivers[i]->chain_pos)], address & 0x7F, 0);
+		}
+		chain->xfer(buffer, len);
+	}
+
+	for (uint8_t i = 0; i < chain->count; i++)
+	{
+		tmc_driver_t *driver = chain->drivers[i];
+		values[i] = tmc_spi_value(&buffer[TMC_CHAIN_OFFSET(chain, driver->chain_pos)]);
+
+		// refresh the cache (unless a pending write exists)
+		uint16_t flag;
+		uint32_t *shadow = tmc_shadow_register(driver, address, &flag);
+		if (shadow && !tmc_is_write_only(driver, flag) && !(driver->reg.dirty & flag))
+		{
+			*shadow = values[i];
+			driver->reg.cached |= flag;
+		}
+	}
 }
 
 // specific initializations
@@ -335,7 +567,26 @@ static void tmc22xx_init(tmc_driver_t *driver)
 
 void tmc_init(tmc_driver_t *driver, tmc_driver_setting_t *settings)
 {
-	driver->reg.ifcnt = tmc_read_register(driver, IFCNT);
+	// if the shadow registers were never loaded treat it as a reset driver
+	bool reset = !(driver->reg.cached);
+
+	// the reset flag and the interface counter are accessed directly on the bus
+	if (driver->rw)
+	{
+		// checks if the driver was reset (power loss) since it was last configured
+		// if not, the shadow registers still match the driver and only the changes need to be sent
+		if (!reset)
+		{
+			uint32_t gstat = tmc_bus_read(driver, GSTAT);
+			reset = (gstat == TMC_READ_ERROR || TMC_GET_FIELD(gstat, GSTAT_RESET));
+		}
+		if (reset)
+		{
+			// clears the reset flag
+			tmc_bus_write(driver, GSTAT, GSTAT_RESET_MASK);
+		}
+	}
+
 	switch (driver->type)
 	{
 	case 2202:
@@ -343,11 +594,35 @@ void tmc_init(tmc_driver_t *driver, tmc_driver_setting_t *settings)
 	case 2225:
 	case 2209:
 	case 2226:
-		TMC22XX_DEFAULTS(driver->reg);
-		tmc22xx_init(driver);
+		if (reset)
+		{
+			TMC22XX_DEFAULTS(driver->reg);
+		}
+		if (driver->rw)
+		{
+			driver->reg.ifcnt = (uint8_t)tmc_bus_read(driver, IFCNT);
+		}
 		break;
 	case 2130:
-		TMC2130_DEFAULTS(driver->reg);
+		if (reset)
+		{
+			TMC2130_DEFAULTS(driver->reg);
+		}
+		break;
+	}
+
+	// all settings are stored in the shadow registers and sent in a single batch
+	// if a batch was already started by the caller, the caller is responsible to flush it
+	bool flush = !(driver->reg.batch);
+	tmc_batch_begin(driver);
+	switch (driver->type)
+	{
+	case 2202:
+	case 2208:
+	case 2225:
+	case 2209:
+	case 2226:
+		tmc22xx_init(driver);
 		break;
 	}
 
@@ -364,6 +639,11 @@ void tmc_init(tmc_driver_t *driver, tmc_driver_setting_t *settings)
 		break;
 	}
 
+	if (flush)
+	{
+		tmc_flush(driver);
+	}
+
 	if (driver->init)
 	{
 		driver->init();
@@ -419,6 +699,26 @@ void tmc_set_current(tmc_driver_t *driver, tmc_driver_setting_t *settings)
 	tmc_write_register(driver, IHOLD_IRUN, ihold_irun);
 }
 
+// scales the run current (IRUN) relative to the configured RMS current
+// the sense resistor range (VSENSE) and the hold current are kept so that only IHOLD_IRUN is changed
+void tmc_set_current_scale(tmc_driver_t *driver, tmc_driver_setting_t *settings, float scale)
+{
+	uint32_t chopconf = tmc_read_register(driver, CHOPCONF);
+
+	if (chopconf == TMC_READ_ERROR)
+	{
+		return;
+	}
+
+	float vfs = (TMC_GET_FIELD(chopconf, CHOPCONF_VSENSE)) ? 0.180f : 0.325f;
+	float cs = roundf(32.0f * 1.41421f * settings->rms_current * scale / 1000.0f * (settings->rsense + 0.02f) / vfs) - 1;
+	cs = CLAMP(0, cs, 31);
+
+	uint32_t ihold_irun = driver->reg.ihold_irun;
+	TMC_SET_FIELD(ihold_irun, IHOLD_IRUN_IRUN, (uint8_t)cs);
+	tmc_write_register(driver, IHOLD_IRUN, ihold_irun);
+}
+
 int32_t tmc_get_microstep(tmc_driver_t *driver)
 {
 	uint32_t chopconf = 0;
@@ -564,7 +864,6 @@ int32_t tmc_get_stealthchop(tmc_driver_t *driver)
 void tmc_set_stealthchop(tmc_driver_t *driver, tmc_driver_setting_t *settings)
 {
 	uint32_t gconf = 0;
-	gconf = tmc_read_register(driver, GCONF);
 	uint32_t pwmconf = {0};
 
 	gconf = tmc_read_register(driver, GCONF);
@@ -609,6 +908,95 @@ uint32_t tmc_get_status(tmc_driver_t *driver)
 	return tmc_read_register(driver, DRV_STATUS);
 }
 
+// converts a step rate (in microsteps per second at the current microstep resolution) to TSTEP units
+// TSTEP is the time between two 1/256 microsteps in driver clock cycles
+uint32_t tmc_get_tstep(tmc_driver_t *driver, float step_rate)
+{
+	int32_t mstep = tmc_get_microstep(driver);
+	if (mstep < 0 || step_rate <= 0)
+	{
+		return 0;
+	}
+
+	float tstep = ((float)TMC_CLK_FREQ * (float)MAX(mstep, 1)) / (256.0f * step_rate);
+	return (tstep < (float)TMC_TSTEP_MAX) ? (uint32_t)tstep : TMC_TSTEP_MAX;
+}
+
+// sets the coolStep/stallGuard lower velocity threshold (TCOOLTHRS) and the high velocity threshold (THIGH)
+// registers not supported by the driver are ignored
+void tmc_set_velocity_thresholds(tmc_driver_t *driver, uint32_t tcoolthrs, uint32_t thigh)
+{
+	switch (driver->type)
+	{
+	case 2130:
+		tmc_write_register(driver, THIGH, thigh);
+	case 2209:
+	case 2226:
+		tmc_write_register(driver, TCOOLTHRS, tcoolthrs);
+		break;
+	}
+}
+
+// samples the load, current scale and status flags of the driver
+// the DRV_STATUS layout of each driver type is normalized to the TMC_TELEMETRY_x flags
+bool tmc_get_telemetry(tmc_driver_t *driver, tmc_telemetry_t *sample)
+{
+	uint32_t status = tmc_read_register(driver, DRV_STATUS);
+	uint32_t sg = 0;
+
+	sample->timestamp = mcu_millis();
+	sample->sg_result = 0;
+	sample->cs_actual = 0;
+	sample->flags = TMC_TELEMETRY_ERROR;
+
+	if (status == TMC_READ_ERROR)
+	{
+		return false;
+	}
+
+	sample->cs_actual = (uint8_t)TMC_GET_FIELD(status, DRV_STATUS_CS_ACTUAL);
+	sample->flags = (TMC_GET_FIELD(status, DRV_STATUS_STST)) ? TMC_TELEMETRY_STST : 0;
+
+	switch (driver->type)
+	{
+	case 2208:
+	case 2225:
+	case 2209:
+	case 2226:
+		sample->flags |= (TMC_GET_FIELD(status, DRV_STATUS_OTPW)) ? TMC_TELEMETRY_OTPW : 0;
+		sample->flags |= (TMC_GET_FIELD(status, DRV_STATUS_OT)) ? TMC_TELEMETRY_OT : 0;
+		sample->flags |= (TMC_GET_FIELD(status, DRV_STATUS_S2G)) ? TMC_TELEMETRY_S2G : 0;
+		sample->flags |= (TMC_GET_FIELD(status, DRV_STATUS_OL)) ? TMC_TELEMETRY_OL : 0;
+		// only the TMC2209 and TMC2226 have stallGuard
+		if (driver->type == 2209 || driver->type == 2226)
+		{
+			sg = tmc_read_register(driver, SG_RESULT);
+			if (sg == TMC_READ_ERROR)
+			{
+				sample->flags |= TMC_TELEMETRY_ERROR;
+				return false;
+			}
+			sample->sg_result = (uint16_t)TMC_GET_FIELD(sg, SG_RESULT_SG_RESULT);
+			// the DIAG output triggers when SG_RESULT falls bellow twice the SGTHRS value
+			if (driver->reg.sgthrs && !(sample->flags & TMC_TELEMETRY_STST) && (sample->sg_result <= (driver->reg.sgthrs << 1)))
+			{
+				sample->flags |= TMC_TELEMETRY_STALL;
+			}
+		}
+		break;
+	case 2130:
+		sample->sg_result = (uint16_t)TMC_GET_FIELD(status, DRV_STATUS_SG_RESULT);
+		sample->flags |= (TMC_GET_FIELD(status, DRV_STATUS_STALLGUARD)) ? TMC_TELEMETRY_STALL : 0;
+		sample->flags |= (TMC_GET_FIELD(status, DRV_STATUS_OTPW_2130)) ? TMC_TELEMETRY_OTPW : 0;
+		sample->flags |= (TMC_GET_FIELD(status, DRV_STATUS_OT_2130)) ? TMC_TELEMETRY_OT : 0;
+		sample->flags |= (TMC_GET_FIELD(status, DRV_STATUS_S2G_2130)) ? TMC_TELEMETRY_S2G : 0;
+		sample->flags |= (TMC_GET_FIELD(status, DRV_STATUS_OL_2130)) ? TMC_TELEMETRY_OL : 0;
+		break;
+	}
+
+	return true;
+}
+
 int32_t tmc_get_stallguard(tmc_driver_t *driver)
 {
 	uint32_t coolconf = 0;
@@ -30,10 +30,12 @@ extern "C"
 #define TMC_READ_ERROR 0xFFFFFFFFUL
 #define TMC_WRITE_ERROR 0xFFFFFFFFUL
 #define GCONF 0x00			// RW
+#define GSTAT 0x01			// R+WC
 #define IFCNT 0x02			// R
 #define IHOLD_IRUN 0x10 // W
 #define TPWMTHRS 0X13		// W
 #define TCOOLTHRS 0x14	// W
+#define THIGH 0x15			// W
 #define SGTHRS 0x40			// W
 #define SG_RESULT 0x41	// R
 #define CHOPCONF 0x6C		// RW
@@ -56,6 +58,11 @@ extern "C"
 // TMC2130
 #define GCONF_EN_PWM_MODE_MASK 0x00000004
 #define GCONF_EN_PWM_MODE_SHIFT 2
+#define GCONF_DIAG1_STALL_MASK 0x00000100
+#define GCONF_DIAG1_STALL_SHIFT 8
+
+#define GSTAT_RESET_MASK 0x00000001
+#define GSTAT_RESET_SHIFT 0
 
 #define CHOPCONF_TBL_MASK 0x00018000
 #define CHOPCONF_TBL_SHIFT 15
@@ -115,12 +122,44 @@ extern "C"
 #define COOLCONF_SGT_MASK 0x007F0000
 #define COOLCONF_SGT_SHIFT 16
 
+#define SG_RESULT_SG_RESULT_MASK 0x000003FF
+#define SG_RESULT_SG_RESULT_SHIFT 0
+
+#define DRV_STATUS_OTPW_MASK 0x00000001
+#define DRV_STATUS_OTPW_SHIFT 0
+#define DRV_STATUS_OT_MASK 0x00000002
+#define DRV_STATUS_OT_SHIFT 1
+#define DRV_STATUS_S2G_MASK 0x0000000C
+#define DRV_STATUS_S2G_SHIFT 2
+#define DRV_STATUS_OL_MASK 0x000000C0
+#define DRV_STATUS_OL_SHIFT 6
+#define DRV_STATUS_CS_ACTUAL_MASK 0x001F0000
+#define DRV_STATUS_CS_ACTUAL_SHIFT 16
+#define DRV_STATUS_STST_MASK 0x80000000
+#define DRV_STATUS_STST_SHIFT 31
+// TMC2130
+#define DRV_STATUS_SG_RESULT_MASK 0x000003FF
+#define DRV_STATUS_SG_RESULT_SHIFT 0
+#define DRV_STATUS_STALLGUARD_MASK 0x01000000
+#define DRV_STATUS_STALLGUARD_SHIFT 24
+#define DRV_STATUS_OT_2130_MASK 0x02000000
+#define DRV_STATUS_OT_2130_SHIFT 25
+#define DRV_STATUS_OTPW_2130_MASK 0x04000000
+#define DRV_STATUS_OTPW_2130_SHIFT 26
+#define DRV_STATUS_S2G_2130_MASK 0x18000000
+#define DRV_STATUS_S2G_2130_SHIFT 27
+#define DRV_STATUS_OL_2130_MASK 0x60000000
+#define DRV_STATUS_OL_2130_SHIFT 29
+
 #define GCONF_PDN_DISABLE
 #define GCONF_MSTEP_REG_SELECT
 #define GCONF_I_SCALE_ANALOG
 #define GCONF_EN_SPREADCYCLE
 // TMC2130
 #define GCONF_EN_PWM_MODE
+#define GCONF_DIAG1_STALL
+
+#define GSTAT_RESET
 
 #define CHOPCONF_TBL
 #define CHOPCONF_TOFF
@@ -154,6 +193,22 @@ extern "C"
 // TMC2130
 #define COOLCONF_SGT
 
+#define SG_RESULT_SG_RESULT
+
+#define DRV_STATUS_OTPW
+#define DRV_STATUS_OT
+#define DRV_STATUS_S2G
+#define DRV_STATUS_OL
+#define DRV_STATUS_CS_ACTUAL
+#define DRV_STATUS_STST
+// TMC2130
+#define DRV_STATUS_SG_RESULT
+#define DRV_STATUS_STALLGUARD
+#define DRV_STATUS_OT_2130
+#define DRV_STATUS_OTPW_2130
+#define DRV_STATUS_S2G_2130
+#define DRV_STATUS_OL_2130
+
 #define TMC_SET_FIELD(reg, tmcreg, val) SET_FIELD(reg, tmcreg##_MASK, tmcreg##_SHIFT, val)
 #define TMC_GET_FIELD(reg, tmcreg) GET_FIELD(reg, tmcreg##_MASK, tmcreg##_SHIFT)
 
@@ -172,19 +227,44 @@ extern "C"
 		int32_t stallguard_threshold;
 	} tmc_driver_setting_t;
 
+// shadow register flags (one bit per cached register)
+#define TMC_SHADOW_GCONF (1 << 0)
+#define TMC_SHADOW_CHOPCONF (1 << 1)
+#define TMC_SHADOW_PWMCONF (1 << 2)
+#define TMC_SHADOW_IHOLD_IRUN (1 << 3)
+#define TMC_SHADOW_TPOWERDOWN (1 << 4)
+#define TMC_SHADOW_TPWMTHRS (1 << 5)
+#define TMC_SHADOW_TCOOLTHRS (1 << 6)
+#define TMC_SHADOW_SGTHRS (1 << 7)
+#define TMC_SHADOW_COOLCONF (1 << 8)
+#define TMC_SHADOW_THIGH (1 << 9)
+#define TMC_SHADOW_WRITE_ONLY (TMC_SHADOW_IHOLD_IRUN | TMC_SHADOW_TPOWERDOWN | TMC_SHADOW_TPWMTHRS | TMC_SHADOW_TCOOLTHRS | TMC_SHADOW_SGTHRS | TMC_SHADOW_COOLCONF | TMC_SHADOW_THIGH)
+
 	typedef struct
 	{
 		uint8_t ifcnt /*R2*/;
+		uint32_t gconf /*R0*/;
+		uint32_t chopconf /*R6C*/;
+		uint32_t pwmconf /*R70*/;
 		uint32_t ihold_irun /*R10*/;
-		uint8_t tpowerdown /*R11*/;
+		uint32_t tpowerdown /*R11*/;
 		uint32_t tpwmthrs /*R13*/;
 		uint32_t tcoolthrs /*R14*/;
-		uint8_t sgthrs /*R40*/;
+		uint32_t sgthrs /*R40*/;
 		uint32_t coolconf /*R6D*/;
+		uint32_t thigh /*R15*/;
+		// registers that hold a valid copy of the driver register
+		uint16_t cached;
+		// registers that were modified and are waiting to be written to the driver
+		uint16_t dirty;
+		// if set, writes are only stored in the shadow registers until tmc_flush is called
+		bool batch;
 	} tmc_driver_reg_t;
 
-#define TMC22XX_DEFAULTS(x) ({(x).ihold_irun = 0x00071703; (x).tpowerdown = 0x00000014;})
-#define TMC2130_DEFAULTS(x) ({(x).ihold_irun = 0x00071703;})
+// loads the reset values of the write only registers
+// the reset may be assumed (the reset flag could not be read) so nothing is cached and the write only registers are sent on the next flush
+#define TMC22XX_DEFAULTS(x) ({(x).ihold_irun = 0x00071703; (x).tpowerdown = 0x00000014; (x).tpwmthrs = 0; (x).tcoolthrs = 0; (x).sgthrs = 0; (x).cached = 0; (x).dirty = (TMC_SHADOW_IHOLD_IRUN | TMC_SHADOW_TPOWERDOWN | TMC_SHADOW_TPWMTHRS | TMC_SHADOW_TCOOLTHRS | TMC_SHADOW_SGTHRS); })
+#define TMC2130_DEFAULTS(x) ({(x).ihold_irun = 0x00071703; (x).tpowerdown = 0; (x).tpwmthrs = 0; (x).tcoolthrs = 0; (x).coolconf = 0; (x).thigh = 0; (x).pwmconf = 0x00050480; (x).cached = 0; (x).dirty = (TMC_SHADOW_IHOLD_IRUN | TMC_SHADOW_TPOWERDOWN | TMC_SHADOW_TPWMTHRS | TMC_SHADOW_TCOOLTHRS | TMC_SHADOW_COOLCONF | TMC_SHADOW_THIGH | TMC_SHADOW_PWMCONF); })
 
 	typedef struct
 	{
@@ -198,13 +278,59 @@ extern "C"
 		tmc_rw rw;
 		// internal driver write only registers
 		tmc_driver_reg_t reg;
+		// position of the driver in a SPI daisy chain (0 is the driver connected to the MCU SDO pin)
+		uint8_t chain_pos;
 	} tmc_driver_t;
 
+#ifndef TMC_CHAIN_MAX_LENGTH
+#define TMC_CHAIN_MAX_LENGTH 8
+#endif
+
+	// full chain SPI transfer (all datagrams are sent with a single chip select)
+	typedef void (*tmc_chain_xfer)(uint8_t *, uint16_t);
+
+	typedef struct
+	{
+		// number of drivers physically connected in the chain
+		uint8_t length;
+		// number of drivers controlled in the chain
+		uint8_t count;
+		tmc_driver_t **drivers;
+		tmc_chain_xfer xfer;
+	} tmc_chain_t;
+
+// telemetry flags (normalized from the DRV_STATUS register of each driver type)
+#define TMC_TELEMETRY_OTPW (1 << 0)
+#define TMC_TELEMETRY_OT (1 << 1)
+#define TMC_TELEMETRY_S2G (1 << 2)
+#define TMC_TELEMETRY_OL (1 << 3)
+#define TMC_TELEMETRY_STALL (1 << 4)
+#define TMC_TELEMETRY_STST (1 << 5)
+#define TMC_TELEMETRY_ERROR (1 << 7)
+
+	typedef struct
+	{
+		uint32_t timestamp;
+		// stallGuard load value (0 if not supported by the driver)
+		uint16_t sg_result;
+		// actual current scale (0-31)
+		uint8_t cs_actual;
+		uint8_t flags;
+	} tmc_telemetry_t;
+
+// driver internal clock frequency (used to convert step rates to TSTEP units)
+#ifndef TMC_CLK_FREQ
+#define TMC_CLK_FREQ 12000000UL
+#endif
+// TSTEP and the velocity thresholds are 20-bit values
+#define TMC_TSTEP_MAX 0x000FFFFFUL
+
 	typedef void (*tmc_set_param_callback)(tmc_driver_t *, tmc_driver_setting_t *);
 
 	void tmc_init(tmc_driver_t *driver, tmc_driver_setting_t *settings);
 	float tmc_get_current(tmc_driver_t *driver, tmc_driver_setting_t *settings);
 	void tmc_set_current(tmc_driver_t *driver, tmc_driver_setting_t *settings);
+	void tmc_set_current_scale(tmc_driver_t *driver, tmc_driver_setting_t *settings, float scale);
 	int32_t tmc_get_microstep(tmc_driver_t *driver);
 	void tmc_set_microstep(tmc_driver_t *driver, tmc_driver_setting_t *settings);
 	uint8_t tmc_get_stepinterpol(tmc_driver_t *driver);
@@ -214,8 +340,17 @@ extern "C"
 	int32_t tmc_get_stallguard(tmc_driver_t *driver);
 	void tmc_set_stallguard(tmc_driver_t *driver, tmc_driver_setting_t *settings);
 	uint32_t tmc_get_status(tmc_driver_t *driver);
+	bool tmc_get_telemetry(tmc_driver_t *driver, tmc_telemetry_t *sample);
+	uint32_t tmc_get_tstep(tmc_driver_t *driver, float step_rate);
+	void tmc_set_velocity_thresholds(tmc_driver_t *driver, uint32_t tcoolthrs, uint32_t thigh);
 	uint32_t tmc_read_register(tmc_driver_t *driver, uint8_t address);
+	uint32_t tmc_read_register_forced(tmc_driver_t *driver, uint8_t address);
 	uint32_t tmc_write_register(tmc_driver_t *driver, uint8_t address, uint32_t val);
+	void tmc_batch_begin(tmc_driver_t *driver);
+	bool tmc_flush(tmc_driver_t *driver);
+	void tmc_chain_rw(tmc_chain_t *chain, uint8_t pos, uint8_t *data);
+	bool tmc_chain_flush(tmc_chain_t *chain);
+	void tmc_chain_read(tmc_chain_t *chain, uint8_t address, uint32_t *values);
 
 #ifdef __cplusplus
 }
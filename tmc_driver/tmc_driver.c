@@ -127,6 +127,19 @@
 #define TMC5_STEPPER_RW(CHANNEL) TMCSPI_STEPPER_RW(CHANNEL)
 // SPI2 HW
 #define TMC6_STEPPER_RW(CHANNEL) TMCSPI_STEPPER_RW(CHANNEL)
+// SPI CHAIN
+#define TMC7_STEPPER_RW(CHANNEL)                                           \
+	static void tmc##CHANNEL##_rw(uint8_t *data, uint8_t wlen, uint8_t rlen) \
+	{                                                                        \
+		tmc_chain_rw(&tmc_chain, STEPPER##CHANNEL##_SPI_CHAIN_POS, data);      \
+	}
+
+// SIM
+#define TMC8_STEPPER_RW(CHANNEL)                                           \
+	static void tmc##CHANNEL##_rw(uint8_t *data, uint8_t wlen, uint8_t rlen) \
+	{                                                                        \
+		tmc_sim_rw(&tmc##CHANNEL##_sim, data, wlen, rlen);                     \
+	}
 
 #define _TMC_STEPPER_RW(TYPE, CHANNEL) TMC##TYPE##_STEPPER_RW(CHANNEL)
 
@@ -143,118 +156,1560 @@
 #define TMC5_STEPPER_DECL(CHANNEL) HARDSPI(tmc##CHANNEL##_spi, 1000000UL, 0, mcu_spi_port);
 // SPI2_HW
 #define TMC6_STEPPER_DECL(CHANNEL) HARDSPI(tmc##CHANNEL##_spi, 1000000UL, 0, mcu_spi2_port);
+// SPI_CHAIN (uses the shared chain bus)
+#define TMC7_STEPPER_DECL(CHANNEL)
+// SIM (software driver model)
+#define TMC8_STEPPER_DECL(CHANNEL) static tmc_sim_t tmc##CHANNEL##_sim;
+
+#ifdef ENABLE_TMC_SPI_CHAIN
+#if (TMC_SPI_CHAIN_INTERFACE == TMC_SPI)
+SOFTSPI(tmc_chain_spi, 1000000UL, 0, TMC_SPI_CHAIN_SDO, TMC_SPI_CHAIN_SDI, TMC_SPI_CHAIN_CLK);
+#elif (TMC_SPI_CHAIN_INTERFACE == TMC_SPI_HW)
+HARDSPI(tmc_chain_spi, 1000000UL, 0, mcu_spi_port);
+#elif (TMC_SPI_CHAIN_INTERFACE == TMC_SPI2_HW)
+HARDSPI(tmc_chain_spi, 1000000UL, 0, mcu_spi2_port);
+#else
+#error "Invalid TMC SPI chain interface"
+#endif
+
+static void tmc_chain_spi_xfer(uint8_t *data, uint16_t len)
+{
+	io_clear_output(TMC_SPI_CHAIN_CS);
+	// the SPI clock is driven by the MCU so the transfer can be split in atomic blocks of one datagram
+	// this keeps the same interrupt latency of a single driver transfer
+	for (uint16_t j = 0; j < len; j += 5)
+	{
+		__ATOMIC__
+		{
+			for (uint8_t i = 0; i < 5; i++)
+			{
+				data[j + i] = softspi_xmit(&tmc_chain_spi, data[j + i]);
+			}
+		}
+	}
+	io_set_output(TMC_SPI_CHAIN_CS);
+}
+
+static tmc_driver_t *tmc_chain_drivers[TMC_SPI_CHAIN_LENGTH];
+static tmc_chain_t tmc_chain = {.length = TMC_SPI_CHAIN_LENGTH, .count = 0, .drivers = tmc_chain_drivers, .xfer = &tmc_chain_spi_xfer};
+#endif
 
 #define _TMC_STEPPER_DECL(TYPE, CHANNEL) TMC##TYPE##_STEPPER_DECL(CHANNEL) TMC##TYPE##_STEPPER_RW(CHANNEL)
 #define TMC_STEPPER_DECL(TYPE, CHANNEL) _TMC_STEPPER_DECL(TYPE, CHANNEL)
 
 #ifdef STEPPER0_HAS_TMC
-TMC_STEPPER_DECL(STEPPER0_TMC_INTERFACE, 0);
-tmc_driver_t tmc0_driver;
-tmc_driver_setting_t tmc0_settings;
+TMC_STEPPER_DECL(STEPPER0_TMC_INTERFACE, 0);
+tmc_driver_t tmc0_driver;
+tmc_driver_setting_t tmc0_settings;
+#endif
+#ifdef STEPPER1_HAS_TMC
+TMC_STEPPER_DECL(STEPPER1_TMC_INTERFACE, 1);
+tmc_driver_t tmc1_driver;
+tmc_driver_setting_t tmc1_settings;
+#endif
+#ifdef STEPPER2_HAS_TMC
+TMC_STEPPER_DECL(STEPPER2_TMC_INTERFACE, 2);
+tmc_driver_t tmc2_driver;
+tmc_driver_setting_t tmc2_settings;
+#endif
+#ifdef STEPPER3_HAS_TMC
+TMC_STEPPER_DECL(STEPPER3_TMC_INTERFACE, 3);
+tmc_driver_t tmc3_driver;
+tmc_driver_setting_t tmc3_settings;
+#endif
+#ifdef STEPPER4_HAS_TMC
+TMC_STEPPER_DECL(STEPPER4_TMC_INTERFACE, 4);
+tmc_driver_t tmc4_driver;
+tmc_driver_setting_t tmc4_settings;
+#endif
+#ifdef STEPPER5_HAS_TMC
+TMC_STEPPER_DECL(STEPPER5_TMC_INTERFACE, 5);
+tmc_driver_t tmc5_driver;
+tmc_driver_setting_t tmc5_settings;
+#endif
+#ifdef STEPPER6_HAS_TMC
+TMC_STEPPER_DECL(STEPPER6_TMC_INTERFACE, 6);
+tmc_driver_t tmc6_driver;
+tmc_driver_setting_t tmc6_settings;
+#endif
+#ifdef STEPPER7_HAS_TMC
+TMC_STEPPER_DECL(STEPPER7_TMC_INTERFACE, 7);
+tmc_driver_t tmc7_driver;
+tmc_driver_setting_t tmc7_settings;
+#endif
+
+#define TMC_STEPPER_PORT(PORT) &tmc##PORT
+
+void tmc_driver_update(tmc_driver_t *driver, tmc_driver_setting_t *settings, tmc_set_param_callback cb)
+{
+	// register changes are coalesced and sent in a single batch
+	tmc_batch_begin(driver);
+	cb(driver, settings);
+	tmc_flush(driver);
+}
+
+// drivers in the SPI chain only store the changes in the shadow registers
+// the chain is flushed at the end with a single transfer per register
+#define TMC_DRIVER_UPDATE(CHANNEL, CB)                                         \
+	if (STEPPER##CHANNEL##_TMC_INTERFACE == TMC_SPI_CHAIN)                       \
+	{                                                                          \
+		tmc_batch_begin(&tmc##CHANNEL##_driver);                                 \
+		CB(&tmc##CHANNEL##_driver, &tmc##CHANNEL##_settings);                    \
+	}                                                                          \
+	else                                                                       \
+	{                                                                          \
+		tmc_driver_update(&tmc##CHANNEL##_driver, &tmc##CHANNEL##_settings, CB); \
+	}
+
+void tmc_driver_update_all(tmc_set_param_callback cb)
+{
+#ifdef STEPPER0_HAS_TMC
+	TMC_DRIVER_UPDATE(0, cb);
+#endif
+#ifdef STEPPER1_HAS_TMC
+	TMC_DRIVER_UPDATE(1, cb);
+#endif
+#ifdef STEPPER2_HAS_TMC
+	TMC_DRIVER_UPDATE(2, cb);
+#endif
+#ifdef STEPPER3_HAS_TMC
+	TMC_DRIVER_UPDATE(3, cb);
+#endif
+#ifdef STEPPER4_HAS_TMC
+	TMC_DRIVER_UPDATE(4, cb);
+#endif
+#ifdef STEPPER5_HAS_TMC
+	TMC_DRIVER_UPDATE(5, cb);
+#endif
+#ifdef STEPPER6_HAS_TMC
+	TMC_DRIVER_UPDATE(6, cb);
+#endif
+#ifdef STEPPER7_HAS_TMC
+	TMC_DRIVER_UPDATE(7, cb);
+#endif
+#ifdef ENABLE_TMC_SPI_CHAIN
+	tmc_chain_flush(&tmc_chain);
+#endif
+}
+
+#if defined(ENABLE_TMC_DYNAMIC_CURRENT) || defined(ENABLE_TMC_TELEMETRY)
+// the UART interfaces hold the interrupts and wait for the reply (the step generation stalls)
+// these drivers must not be accessed while the machine is moving
+#define TMC_DRIVER_BLOCKING(CHANNEL) ((STEPPER##CHANNEL##_TMC_INTERFACE == TMC_UART) || (STEPPER##CHANNEL##_TMC_INTERFACE == TMC_ONEWIRE) || (STEPPER##CHANNEL##_TMC_INTERFACE == TMC_UART2_HW))
+static bool tmc_driver_is_blocking(uint8_t stepper)
+{
+	switch (stepper)
+	{
+#ifdef STEPPER0_HAS_TMC
+	case 0:
+		return TMC_DRIVER_BLOCKING(0);
+#endif
+#ifdef STEPPER1_HAS_TMC
+	case 1:
+		return TMC_DRIVER_BLOCKING(1);
+#endif
+#ifdef STEPPER2_HAS_TMC
+	case 2:
+		return TMC_DRIVER_BLOCKING(2);
+#endif
+#ifdef STEPPER3_HAS_TMC
+	case 3:
+		return TMC_DRIVER_BLOCKING(3);
+#endif
+#ifdef STEPPER4_HAS_TMC
+	case 4:
+		return TMC_DRIVER_BLOCKING(4);
+#endif
+#ifdef STEPPER5_HAS_TMC
+	case 5:
+		return TMC_DRIVER_BLOCKING(5);
+#endif
+#ifdef STEPPER6_HAS_TMC
+	case 6:
+		return TMC_DRIVER_BLOCKING(6);
+#endif
+#ifdef STEPPER7_HAS_TMC
+	case 7:
+		return TMC_DRIVER_BLOCKING(7);
+#endif
+	}
+
+	return false;
+}
+#endif
+
+#if defined(ENABLE_TMC_AUTO_MICROSTEP) || defined(ENABLE_TMC_DYNAMIC_CURRENT) || defined(ENABLE_TMC_VELOCITY_SCHEDULING)
+// max feed (mm/min) of the axis moved by the stepper
+// the steps per mm are set per stepper but the max feed rates are set per axis
+// with cartesian kinematics each stepper moves the axis with the same index
+// other kinematics combine the axes in each stepper so the fastest linear axis is used
+static float tmc_stepper_max_feed(uint8_t stepper)
+{
+#if (KINEMATIC == KINEMATIC_CARTESIAN)
+	if (stepper < AXIS_COUNT)
+	{
+		return g_settings.max_feed_rate[stepper];
+	}
+#endif
+	float feed = 0;
+	for (uint8_t i = 0; i < MIN(AXIS_COUNT, 3); i++)
+	{
+		feed = MAX(feed, g_settings.max_feed_rate[i]);
+	}
+	return feed;
+}
+#endif
+
+#ifdef ENABLE_TMC_VELOCITY_SCHEDULING
+// steppers with a stealthChop threshold set by M913 (not scheduled)
+static uint8_t tmc_velocity_user_mask;
+
+// converts a feed (mm/min) of the stepper axis to TSTEP units
+// a feed of 0 is taken as a fraction of the axis max feed and a negative feed disables the threshold
+static uint32_t tmc_feed_to_tstep(tmc_driver_t *driver, uint8_t stepper, float feed, float fraction)
+{
+	if (!feed)
+	{
+		feed = fraction * tmc_stepper_max_feed(stepper);
+	}
+
+	if (feed <= 0 || stepper >= AXIS_TO_STEPPERS)
+	{
+		return 0;
+	}
+
+	return tmc_get_tstep(driver, feed * g_settings.step_per_mm[stepper] * MIN_SEC_MULT);
+}
+
+// programs the chopper mode and coolStep velocity thresholds of the stepper driver
+// values are written through the shadow registers so nothing is sent to the driver unless the steps per mm or microstepping changed
+static void tmc_velocity_schedule(uint8_t stepper)
+{
+	tmc_driver_t *driver = tmc_driver_get(stepper);
+	tmc_driver_setting_t *settings = tmc_driver_get_settings(stepper);
+	float feeds[3] = {0, 0, 0};
+
+	if (!driver || stepper >= AXIS_TO_STEPPERS)
+	{
+		return;
+	}
+
+	switch (stepper)
+	{
+#ifdef STEPPER0_HAS_TMC
+	case 0:
+		feeds[0] = STEPPER0_STEALTHCHOP_MAX_FEED;
+		feeds[1] = STEPPER0_COOLSTEP_MIN_FEED;
+		feeds[2] = STEPPER0_HIGH_FEED;
+		break;
+#endif
+#ifdef STEPPER1_HAS_TMC
+	case 1:
+		feeds[0] = STEPPER1_STEALTHCHOP_MAX_FEED;
+		feeds[1] = STEPPER1_COOLSTEP_MIN_FEED;
+		feeds[2] = STEPPER1_HIGH_FEED;
+		break;
+#endif
+#ifdef STEPPER2_HAS_TMC
+	case 2:
+		feeds[0] = STEPPER2_STEALTHCHOP_MAX_FEED;
+		feeds[1] = STEPPER2_COOLSTEP_MIN_FEED;
+		feeds[2] = STEPPER2_HIGH_FEED;
+		break;
+#endif
+#ifdef STEPPER3_HAS_TMC
+	case 3:
+		feeds[0] = STEPPER3_STEALTHCHOP_MAX_FEED;
+		feeds[1] = STEPPER3_COOLSTEP_MIN_FEED;
+		feeds[2] = STEPPER3_HIGH_FEED;
+		break;
+#endif
+#ifdef STEPPER4_HAS_TMC
+	case 4:
+		feeds[0] = STEPPER4_STEALTHCHOP_MAX_FEED;
+		feeds[1] = STEPPER4_COOLSTEP_MIN_FEED;
+		feeds[2] = STEPPER4_HIGH_FEED;
+		break;
+#endif
+#ifdef STEPPER5_HAS_TMC
+	case 5:
+		feeds[0] = STEPPER5_STEALTHCHOP_MAX_FEED;
+		feeds[1] = STEPPER5_COOLSTEP_MIN_FEED;
+		feeds[2] = STEPPER5_HIGH_FEED;
+		break;
+#endif
+#ifdef STEPPER6_HAS_TMC
+	case 6:
+		feeds[0] = STEPPER6_STEALTHCHOP_MAX_FEED;
+		feeds[1] = STEPPER6_COOLSTEP_MIN_FEED;
+		feeds[2] = STEPPER6_HIGH_FEED;
+		break;
+#endif
+#ifdef STEPPER7_HAS_TMC
+	case 7:
+		feeds[0] = STEPPER7_STEALTHCHOP_MAX_FEED;
+		feeds[1] = STEPPER7_COOLSTEP_MIN_FEED;
+		feeds[2] = STEPPER7_HIGH_FEED;
+		break;
+#endif
+	}
+
+	bool flush = !driver->reg.batch;
+	tmc_batch_begin(driver);
+	// the scheduled threshold is written from a copy so the user settings are kept
+	uint32_t tpwmthrs = tmc_feed_to_tstep(driver, stepper, feeds[0], TMC_VELOCITY_STEALTHCHOP_FEED);
+	if (tpwmthrs && !(tmc_velocity_user_mask & (1 << stepper)))
+	{
+		tmc_driver_setting_t scheduled = *settings;
+		scheduled.stealthchop_threshold = tpwmthrs;
+		tmc_set_stealthchop(driver, &scheduled);
+	}
+	tmc_set_velocity_thresholds(driver, tmc_feed_to_tstep(driver, stepper, feeds[1], TMC_VELOCITY_COOLSTEP_FEED), tmc_feed_to_tstep(driver, stepper, feeds[2], TMC_VELOCITY_HIGH_FEED));
+	if (flush)
+	{
+		tmc_flush(driver);
+	}
+}
+
+static void tmc_velocity_schedule_all(void)
+{
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		tmc_velocity_schedule(i);
+	}
+}
+
+// rechecks one driver at a time and never while the machine is running
+bool tmc_velocity_update(void *args)
+{
+	static uint32_t next_update = 0;
+	static uint8_t stepper = 0;
+
+	if (cnc_get_exec_state(EXEC_RUN | EXEC_HOMING))
+	{
+		return EVENT_CONTINUE;
+	}
+
+	uint32_t now = mcu_millis();
+	if ((int32_t)(now - next_update) < 0)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	next_update = now + TMC_VELOCITY_UPDATE_MS;
+	tmc_velocity_schedule(stepper);
+	stepper = (stepper + 1) & 0x07;
+
+	return EVENT_CONTINUE;
+}
+
+#ifdef ENABLE_MAIN_LOOP_MODULES
+CREATE_EVENT_LISTENER(cnc_dotasks, tmc_velocity_update);
+#endif
+
+#ifdef ENABLE_SETTINGS_MODULES
+bool tmc_velocity_settings_erase(void *args)
+{
+	settings_args_t *set = (settings_args_t *)args;
+	// resetting the main settings returns all steppers to the scheduled thresholds
+	if (set->address == SETTINGS_ADDRESS_OFFSET)
+	{
+		tmc_velocity_user_mask = 0;
+	}
+
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(settings_extended_erase, tmc_velocity_settings_erase);
+#endif
+#endif
+
+#ifdef ENABLE_TMC_DYNAMIC_CURRENT
+// standstill time until the driver drops to the hold current (TPOWERDOWN is set in 2^18 clock cycles units)
+#define TMC_DYNAMIC_CURRENT_TPOWERDOWN ((uint32_t)CLAMP(0, ((float)TMC_DYNAMIC_CURRENT_IDLE_MS * 0.001f * (float)TMC_CLK_FREQ / 262144.0f), 255))
+
+// marks the homing state in place of the last block
+#define TMC_DYNAMIC_CURRENT_HOMING ((planner_block_t *)1)
+
+// run current of each stepper for a queued motion block (in 1/255 units of the configured RMS current)
+// the blocks are matched to the planner blocks by the main stepper step count
+typedef struct
+{
+	uint32_t steps;
+	uint8_t scale[STEPPER_COUNT];
+} tmc_dynamic_current_block_t;
+
+static tmc_dynamic_current_block_t tmc_dynamic_current_queue[PLANNER_BUFFER_SIZE];
+static uint8_t tmc_dynamic_current_tail;
+static uint8_t tmc_dynamic_current_count;
+
+// max acceleration (mm/s^2) of the axis moved by the stepper (same mapping as the max feed)
+static float tmc_stepper_max_accel(uint8_t stepper)
+{
+#if (KINEMATIC == KINEMATIC_CARTESIAN)
+	if (stepper < AXIS_COUNT)
+	{
+		return g_settings.acceleration[stepper];
+	}
+#endif
+	float accel = 0;
+	for (uint8_t i = 0; i < MIN(AXIS_COUNT, 3); i++)
+	{
+		accel = MAX(accel, g_settings.acceleration[i]);
+	}
+	return accel;
+}
+
+// fraction of the block motion done by the stepper
+static float tmc_stepper_motion_share(motion_data_t *block_data, uint8_t stepper)
+{
+#if (KINEMATIC == KINEMATIC_CARTESIAN)
+	if (stepper < AXIS_COUNT)
+	{
+		return ABS(block_data->dir_vect[stepper]);
+	}
+#endif
+	return (float)block_data->steps[stepper] / (float)block_data->steps[block_data->main_stepper];
+}
+
+// the current is written at each block start while moving
+// the drivers on UART interfaces would stall the step generation so they are left at the configured current
+static tmc_driver_t *tmc_dynamic_current_driver(uint8_t stepper)
+{
+	return (tmc_driver_is_blocking(stepper)) ? NULL : tmc_driver_get(stepper);
+}
+
+// sets the run current of all drivers
+// steppers without a value are set to the minimum current
+static void tmc_dynamic_current_block(const uint8_t *scale)
+{
+	for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+	{
+		tmc_driver_t *driver = tmc_dynamic_current_driver(i);
+		if (!driver)
+		{
+			continue;
+		}
+
+		// unchanged values are filtered by the shadow registers
+		float value = (scale) ? ((float)scale[i] * (1.0f / 255.0f)) : TMC_DYNAMIC_CURRENT_MIN;
+		tmc_set_current_scale(driver, tmc_driver_get_settings(i), value);
+	}
+}
+
+// sets the hold current delay of all drivers
+static void tmc_dynamic_current_idle(void)
+{
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		tmc_driver_t *driver = tmc_dynamic_current_driver(i);
+		if (driver)
+		{
+			tmc_write_register(driver, TPOWERDOWN, TMC_DYNAMIC_CURRENT_TPOWERDOWN);
+		}
+	}
+}
+
+static void tmc_dynamic_current_clear(void)
+{
+	tmc_dynamic_current_tail = 0;
+	tmc_dynamic_current_count = 0;
+}
+
+// computes the run current of each stepper when the block is sent to the planner
+// each moving stepper current is scaled by its acceleration and feed relative to the limits of its axis
+bool tmc_dynamic_current_queue_block(void *args)
+{
+	motion_data_t *block_data = (motion_data_t *)args;
+	uint32_t steps = block_data->steps[block_data->main_stepper];
+
+	if (!steps)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	// the entries left by a planner clear (stop, probe, jog cancel...) are dropped
+	if (planner_buffer_is_empty() && !cnc_get_exec_state(EXEC_RUN))
+	{
+		tmc_dynamic_current_clear();
+	}
+
+	// a planner block without an entry (backlash compensation...) may leave the queue full
+	// the oldest entry is dropped
+	if (tmc_dynamic_current_count == PLANNER_BUFFER_SIZE)
+	{
+		tmc_dynamic_current_tail = (tmc_dynamic_current_tail < (PLANNER_BUFFER_SIZE - 1)) ? (tmc_dynamic_current_tail + 1) : 0;
+		tmc_dynamic_current_count--;
+	}
+
+	uint8_t head = tmc_dynamic_current_tail + tmc_dynamic_current_count;
+	head = (head < PLANNER_BUFFER_SIZE) ? head : (head - PLANNER_BUFFER_SIZE);
+	tmc_dynamic_current_block_t *entry = &tmc_dynamic_current_queue[head];
+	entry->steps = steps;
+
+	float feed = MIN(block_data->feed, block_data->max_feed) * MIN_SEC_MULT;
+	for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+	{
+		float scale = TMC_DYNAMIC_CURRENT_MIN;
+		if (block_data->steps[i])
+		{
+			float share = tmc_stepper_motion_share(block_data, i);
+			float max_accel = tmc_stepper_max_accel(i);
+			float max_feed = tmc_stepper_max_feed(i) * MIN_SEC_MULT;
+			if (max_accel > 0)
+			{
+				scale += TMC_DYNAMIC_CURRENT_ACCEL_GAIN * MIN(block_data->max_accel * share / max_accel, 1.0f);
+			}
+			if (max_feed > 0)
+			{
+				scale += TMC_DYNAMIC_CURRENT_FEED_GAIN * MIN(feed * share / max_feed, 1.0f);
+			}
+		}
+
+		scale = CLAMP(TMC_DYNAMIC_CURRENT_MIN, scale, TMC_DYNAMIC_CURRENT_MAX);
+		entry->scale[i] = (uint8_t)CLAMP(0, lroundf(scale * 255.0f), 255);
+	}
+
+	tmc_dynamic_current_count++;
+
+	return EVENT_CONTINUE;
+}
+
+CREATE_EVENT_LISTENER(mc_line_segment, tmc_dynamic_current_queue_block);
+
+// sets the run currents when a new block starts
+// the next block current is applied at the same time (the larger of both) so that the driver never runs a block with less current than computed
+// the current only drops one block later but a block never waits for the bus write
+bool tmc_dynamic_current_update(void *args)
+{
+	static uint32_t next_update = 0;
+	static uint32_t idle_since = 0;
+	static planner_block_t *last_block = NULL;
+	static uint32_t last_steps = 0;
+
+	uint32_t now = mcu_millis();
+	if ((int32_t)(now - next_update) < 0)
+	{
+		return EVENT_CONTINUE;
+	}
+	next_update = now + TMC_DYNAMIC_CURRENT_UPDATE_MS;
+
+	// homing runs at the maximum current
+	if (cnc_get_exec_state(EXEC_HOMING))
+	{
+		if (last_block != TMC_DYNAMIC_CURRENT_HOMING)
+		{
+			last_block = TMC_DYNAMIC_CURRENT_HOMING;
+			for (uint8_t i = 0; i < 8; i++)
+			{
+				tmc_driver_t *driver = tmc_dynamic_current_driver(i);
+				if (driver)
+				{
+					tmc_set_current_scale(driver, tmc_driver_get_settings(i), TMC_DYNAMIC_CURRENT_MAX);
+				}
+			}
+		}
+		return EVENT_CONTINUE;
+	}
+
+	if (planner_buffer_is_empty())
+	{
+		// drops the run current after the idle time (the driver already uses the hold current at standstill)
+		if (last_block && (now - idle_since) >= TMC_DYNAMIC_CURRENT_IDLE_MS)
+		{
+			last_block = NULL;
+			tmc_dynamic_current_block(NULL);
+		}
+		return EVENT_CONTINUE;
+	}
+
+	idle_since = now;
+	planner_block_t *block = planner_get_block();
+	if (block == last_block && block->total_steps == last_steps)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	last_block = block;
+	last_steps = block->total_steps;
+
+	// the blocks without an entry keep the current of the previous block
+	uint8_t tail = tmc_dynamic_current_tail;
+	if (!tmc_dynamic_current_count || tmc_dynamic_current_queue[tail].steps != block->total_steps)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	uint8_t scale[STEPPER_COUNT];
+	memcpy(scale, tmc_dynamic_current_queue[tail].scale, STEPPER_COUNT);
+	tail = (tail < (PLANNER_BUFFER_SIZE - 1)) ? (tail + 1) : 0;
+	tmc_dynamic_current_tail = tail;
+	tmc_dynamic_current_count--;
+
+	if (tmc_dynamic_current_count)
+	{
+		for (uint8_t i = 0; i < STEPPER_COUNT; i++)
+		{
+			scale[i] = MAX(scale[i], tmc_dynamic_current_queue[tail].scale[i]);
+		}
+	}
+
+	tmc_dynamic_current_block(scale);
+
+	return EVENT_CONTINUE;
+}
+
+#ifdef ENABLE_MAIN_LOOP_MODULES
+CREATE_EVENT_LISTENER(cnc_dotasks, tmc_dynamic_current_update);
+#endif
+#endif
+
+#ifdef ENABLE_TMC_SENSORLESS_HOMING
+typedef struct
+{
+	uint32_t stealthchop_threshold;
+	int32_t stallguard_threshold;
+	uint32_t tcoolthrs;
+	uint32_t thigh;
+	uint32_t gconf;
+} tmc_sensorless_backup_t;
+
+static tmc_sensorless_backup_t tmc_sensorless_backup[8];
+static bool tmc_sensorless_armed;
+
+// returns the homing stallGuard threshold of the stepper (or INT32_MIN if the stepper is not set for sensorless homing)
+static int32_t tmc_sensorless_sensitivity(uint8_t stepper)
+{
+	switch (stepper)
+	{
+#if defined(STEPPER0_HAS_TMC) && defined(STEPPER0_SENSORLESS_HOMING)
+	case 0:
+		return STEPPER0_HOMING_SENSITIVITY;
+#endif
+#if defined(STEPPER1_HAS_TMC) && defined(STEPPER1_SENSORLESS_HOMING)
+	case 1:
+		return STEPPER1_HOMING_SENSITIVITY;
+#endif
+#if defined(STEPPER2_HAS_TMC) && defined(STEPPER2_SENSORLESS_HOMING)
+	case 2:
+		return STEPPER2_HOMING_SENSITIVITY;
+#endif
+#if defined(STEPPER3_HAS_TMC) && defined(STEPPER3_SENSORLESS_HOMING)
+	case 3:
+		return STEPPER3_HOMING_SENSITIVITY;
+#endif
+#if defined(STEPPER4_HAS_TMC) && defined(STEPPER4_SENSORLESS_HOMING)
+	case 4:
+		return STEPPER4_HOMING_SENSITIVITY;
+#endif
+#if defined(STEPPER5_HAS_TMC) && defined(STEPPER5_SENSORLESS_HOMING)
+	case 5:
+		return STEPPER5_HOMING_SENSITIVITY;
+#endif
+#if defined(STEPPER6_HAS_TMC) && defined(STEPPER6_SENSORLESS_HOMING)
+	case 6:
+		return STEPPER6_HOMING_SENSITIVITY;
+#endif
+#if defined(STEPPER7_HAS_TMC) && defined(STEPPER7_SENSORLESS_HOMING)
+	case 7:
+		return STEPPER7_HOMING_SENSITIVITY;
+#endif
+	}
+
+	return INT32_MIN;
+}
+
+// configures the stepper driver for stall detection
+// TMC2209/2226 stallGuard4 works in stealthChop and TMC2130 stallGuard2 works in spreadCycle
+static void tmc_sensorless_arm(uint8_t stepper)
+{
+	tmc_driver_t *driver = tmc_driver_get(stepper);
+	tmc_driver_setting_t *settings = tmc_driver_get_settings(stepper);
+	int32_t sensitivity = tmc_sensorless_sensitivity(stepper);
+	tmc_sensorless_backup_t *backup = &tmc_sensorless_backup[stepper];
+
+	if (!driver || sensitivity == INT32_MIN || stepper >= AXIS_TO_STEPPERS)
+	{
+		return;
+	}
+
+	backup->stealthchop_threshold = settings->stealthchop_threshold;
+	backup->stallguard_threshold = settings->stallguard_threshold;
+	backup->tcoolthrs = driver->reg.tcoolthrs;
+	backup->thigh = driver->reg.thigh;
+
+	// stall detection is enabled above this velocity
+	float feed = g_settings.homing_slow_feed_rate * TMC_SENSORLESS_VELOCITY_FACTOR;
+	uint32_t tcoolthrs = tmc_get_tstep(driver, feed * g_settings.step_per_mm[stepper] * MIN_SEC_MULT);
+
+	bool flush = !driver->reg.batch;
+	tmc_batch_begin(driver);
+	// always home at the full configured current for repeatable results
+	tmc_set_current(driver, settings);
+	settings->stallguard_threshold = sensitivity;
+	switch (driver->type)
+	{
+	case 2209:
+	case 2226:
+		// stealthChop at all velocities
+		settings->stealthchop_threshold = 1;
+		break;
+	case 2130:
+		settings->stealthchop_threshold = 0;
+		break;
+	}
+	tmc_set_stealthchop(driver, settings);
+	tmc_set_stallguard(driver, settings);
+	tmc_set_velocity_thresholds(driver, tcoolthrs, 0);
+	if (driver->type == 2130)
+	{
+		// stall output on the DIAG1 pin
+		uint32_t gconf = tmc_read_register(driver, GCONF);
+		backup->gconf = gconf;
+		TMC_SET_FIELD(gconf, GCONF_DIAG1_STALL, 1);
+		tmc_write_register(driver, GCONF, gconf);
+	}
+	if (flush)
+	{
+		tmc_flush(driver);
+	}
+}
+
+// restores the stepper driver chopper and stallGuard settings
+static void tmc_sensorless_disarm(uint8_t stepper)
+{
+	tmc_driver_t *driver = tmc_driver_get(stepper);
+	tmc_driver_setting_t *settings = tmc_driver_get_settings(stepper);
+	tmc_sensorless_backup_t *backup = &tmc_sensorless_backup[stepper];
+
+	if (!driver || tmc_sensorless_sensitivity(stepper) == INT32_MIN || stepper >= AXIS_TO_STEPPERS)
+	{
+		return;
+	}
+
+	settings->stealthchop_threshold = backup->stealthchop_threshold;
+	settings->stallguard_threshold = backup->stallguard_threshold;
+
+	bool flush = !driver->reg.batch;
+	tmc_batch_begin(driver);
+	if (driver->type == 2130)
+	{
+		uint32_t gconf = tmc_read_register(driver, GCONF);
+		TMC_SET_FIELD(gconf, GCONF_DIAG1_STALL, TMC_GET_FIELD(backup->gconf, GCONF_DIAG1_STALL));
+		tmc_write_register(driver, GCONF, gconf);
+	}
+	tmc_set_stealthchop(driver, settings);
+	tmc_set_stallguard(driver, settings);
+	tmc_set_velocity_thresholds(driver, backup->tcoolthrs, backup->thigh);
+	if (flush)
+	{
+		tmc_flush(driver);
+	}
+}
+
+// arms or disarms stall detection on all sensorless steppers
+static void tmc_sensorless_set(bool armed)
+{
+	if (armed == tmc_sensorless_armed)
+	{
+		return;
+	}
+
+	tmc_sensorless_armed = armed;
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		if (armed)
+		{
+			tmc_sensorless_arm(i);
+		}
+		else
+		{
+			tmc_sensorless_disarm(i);
+		}
+	}
+}
+
+// arms stall detection before each homing motion starts (the drivers are configured with the motion stopped)
+bool tmc_sensorless_start(void *args)
+{
+	tmc_sensorless_set(true);
+	return EVENT_CONTINUE;
+}
+CREATE_EVENT_LISTENER(mc_home_axis_start, tmc_sensorless_start);
+
+// restores the drivers after each homing motion (also on homing errors)
+bool tmc_sensorless_finish(void *args)
+{
+	tmc_sensorless_set(false);
+	return EVENT_CONTINUE;
+}
+CREATE_EVENT_LISTENER(mc_home_axis_finish, tmc_sensorless_finish);
+#endif
+
+#ifdef ENABLE_TMC_AUTO_MICROSTEP
+// steps per mm at the configured microstepping (STEPPERx_MICROSTEP) and the value after scaling
+static float tmc_auto_microstep_base_spm[AXIS_TO_STEPPERS];
+static float tmc_auto_microstep_spm[AXIS_TO_STEPPERS];
+
+static int16_t tmc_auto_microstep_base(uint8_t stepper)
+{
+	switch (stepper)
+	{
+#ifdef STEPPER0_HAS_TMC
+	case 0:
+		return STEPPER0_MICROSTEP;
+#endif
+#ifdef STEPPER1_HAS_TMC
+	case 1:
+		return STEPPER1_MICROSTEP;
+#endif
+#ifdef STEPPER2_HAS_TMC
+	case 2:
+		return STEPPER2_MICROSTEP;
+#endif
+#ifdef STEPPER3_HAS_TMC
+	case 3:
+		return STEPPER3_MICROSTEP;
+#endif
+#ifdef STEPPER4_HAS_TMC
+	case 4:
+		return STEPPER4_MICROSTEP;
+#endif
+#ifdef STEPPER5_HAS_TMC
+	case 5:
+		return STEPPER5_MICROSTEP;
+#endif
+#ifdef STEPPER6_HAS_TMC
+	case 6:
+		return STEPPER6_MICROSTEP;
+#endif
+#ifdef STEPPER7_HAS_TMC
+	case 7:
+		return STEPPER7_MICROSTEP;
+#endif
+	}
+
+	return 0;
+}
+
+// highest microstepping that keeps the axis max feed step rate bellow the controller step rate limit
+static int16_t tmc_auto_microstep_select(uint8_t stepper)
+{
+	int16_t base = tmc_auto_microstep_base(stepper);
+	// full steps per second at max feed
+	float full_rate = tmc_stepper_max_feed(stepper) * MIN_SEC_MULT * tmc_auto_microstep_base_spm[stepper] / (float)MAX(base, 1);
+	float max_rate = (float)F_STEP_MAX * TMC_AUTO_MICROSTEP_MARGIN;
+
+	for (int16_t mstep = TMC_AUTO_MICROSTEP_MAX; mstep > 1; mstep >>= 1)
+	{
+		if ((full_rate * mstep) <= max_rate)
+		{
+			return mstep;
+		}
+	}
+
+	return 1;
+}
+
+// rescales the steps per mm of the stepper to the microstepping of the driver
+static bool tmc_auto_microstep_rescale(uint8_t stepper, int16_t mstep)
+{
+	// steps per mm changed (settings loaded or modified) since the last scaling
+	if (g_settings.step_per_mm[stepper] != tmc_auto_microstep_spm[stepper])
+	{
+		tmc_auto_microstep_base_spm[stepper] = g_settings.step_per_mm[stepper];
+	}
+
+	tmc_auto_microstep_spm[stepper] = tmc_auto_microstep_base_spm[stepper] * (float)MAX(mstep, 1) / (float)MAX(tmc_auto_microstep_base(stepper), 1);
+	if (g_settings.step_per_mm[stepper] != tmc_auto_microstep_spm[stepper])
+	{
+		g_settings.step_per_mm[stepper] = tmc_auto_microstep_spm[stepper];
+		return true;
+	}
+
+	return false;
+}
+
+// rescales the steps per mm of all drivers (and selects the microstepping if select is set)
+// the microstep interpolation is always enabled to keep the motion smooth at lower resolutions
+static void tmc_auto_microstep_update(bool select)
+{
+	float pos[AXIS_COUNT];
+	bool changed = false;
+
+	mc_get_position(pos);
+
+	for (uint8_t i = 0; i < AXIS_TO_STEPPERS; i++)
+	{
+		tmc_driver_setting_t *settings = tmc_driver_get_settings(i);
+		if (!settings)
+		{
+			continue;
+		}
+
+		if (select)
+		{
+			// the steps per mm at the configured microstepping are needed to select the microstepping
+			if (g_settings.step_per_mm[i] != tmc_auto_microstep_spm[i])
+			{
+				tmc_auto_microstep_base_spm[i] = g_settings.step_per_mm[i];
+			}
+			settings->mstep = tmc_auto_microstep_select(i);
+			settings->step_interpolation = true;
+		}
+
+		changed |= tmc_auto_microstep_rescale(i, settings->mstep);
+	}
+
+	if (changed)
+	{
+		// keeps the same position in the new step units
+		itp_reset_rt_position(pos);
+		mc_sync_position();
+	}
+}
+
+#ifdef ENABLE_SETTINGS_MODULES
+static bool tmc_auto_microstep_restored;
+
+// the steps per mm are stored at the configured microstepping (STEPPERx_MICROSTEP)
+// they are restored before the settings are saved and scaled again right after (on the next main loop run)
+bool tmc_auto_microstep_save(void *args)
+{
+	for (uint8_t i = 0; i < AXIS_TO_STEPPERS; i++)
+	{
+		if (tmc_driver_get_settings(i) && g_settings.step_per_mm[i] == tmc_auto_microstep_spm[i])
+		{
+			g_settings.step_per_mm[i] = tmc_auto_microstep_base_spm[i];
+			tmc_auto_microstep_restored = true;
+		}
+	}
+
+	return EVENT_CONTINUE;
+}
+CREATE_EVENT_LISTENER(settings_extended_save, tmc_auto_microstep_save);
+
+bool tmc_auto_microstep_resume(void *args)
+{
+	if (tmc_auto_microstep_restored)
+	{
+		tmc_auto_microstep_restored = false;
+		tmc_auto_microstep_update(false);
+	}
+
+	return EVENT_CONTINUE;
+}
+
+#ifdef ENABLE_MAIN_LOOP_MODULES
+CREATE_EVENT_LISTENER(cnc_dotasks, tmc_auto_microstep_resume);
+#endif
+#endif
+
+#ifdef ENABLE_PARSER_MODULES
+// $TMCMS prints the microstepping table as [TMCMS<stepper>:<microsteps>,<steps per mm>,<max feed step rate>]
+bool tmc_auto_microstep_cmd(void *args)
+{
+	grbl_cmd_args_t *ptr = (grbl_cmd_args_t *)args;
+	strupr((char *)ptr->cmd);
+
+	if (strcmp((char *)ptr->cmd, "TMCMS"))
+	{
+		return EVENT_CONTINUE;
+	}
+
+	for (uint8_t i = 0; i < AXIS_TO_STEPPERS; i++)
+	{
+		tmc_driver_setting_t *settings = tmc_driver_get_settings(i);
+		if (!settings)
+		{
+			continue;
+		}
+
+		proto_print("[TMCMS");
+		proto_itoa(i);
+		proto_putc(':');
+		proto_itoa(settings->mstep);
+		proto_putc(',');
+		proto_ftoa(g_settings.step_per_mm[i]);
+		proto_putc(',');
+		proto_ftoa(tmc_stepper_max_feed(i) * MIN_SEC_MULT * g_settings.step_per_mm[i]);
+		proto_putc(']');
+		proto_putc('\n');
+		proto_putc('\r');
+	}
+
+	*(ptr->error) = STATUS_OK;
+	return EVENT_HANDLED;
+}
+CREATE_EVENT_LISTENER(grbl_cmd, tmc_auto_microstep_cmd);
+#endif
+#endif
+
+static void tmc_driver_config_cb(tmc_driver_t *driver, tmc_driver_setting_t *settings)
+{
+	tmc_init(driver, settings);
+}
+
+bool tmc_driver_config_all(void *args)
+{
+#ifdef ENABLE_TMC_SENSORLESS_HOMING
+	// an aborted homing motion leaves the homing settings loaded
+	tmc_sensorless_set(false);
+#endif
+#ifdef ENABLE_TMC_AUTO_MICROSTEP
+	tmc_auto_microstep_update(true);
+#endif
+#ifdef STEPPER0_HAS_TMC
+	TMC_DRIVER_UPDATE(0, tmc_driver_config_cb);
+#endif
+#ifdef STEPPER1_HAS_TMC
+	TMC_DRIVER_UPDATE(1, tmc_driver_config_cb);
+#endif
+#ifdef STEPPER2_HAS_TMC
+	TMC_DRIVER_UPDATE(2, tmc_driver_config_cb);
+#endif
+#ifdef STEPPER3_HAS_TMC
+	TMC_DRIVER_UPDATE(3, tmc_driver_config_cb);
+#endif
+#ifdef STEPPER4_HAS_TMC
+	TMC_DRIVER_UPDATE(4, tmc_driver_config_cb);
+#endif
+#ifdef STEPPER5_HAS_TMC
+	TMC_DRIVER_UPDATE(5, tmc_driver_config_cb);
+#endif
+#ifdef STEPPER6_HAS_TMC
+	TMC_DRIVER_UPDATE(6, tmc_driver_config_cb);
+#endif
+#ifdef STEPPER7_HAS_TMC
+	TMC_DRIVER_UPDATE(7, tmc_driver_config_cb);
+#endif
+#ifdef ENABLE_TMC_SPI_CHAIN
+	tmc_chain_flush(&tmc_chain);
+#endif
+#ifdef ENABLE_TMC_VELOCITY_SCHEDULING
+	tmc_velocity_schedule_all();
+#endif
+#ifdef ENABLE_TMC_DYNAMIC_CURRENT
+	tmc_dynamic_current_clear();
+	tmc_dynamic_current_idle();
+	tmc_dynamic_current_block(NULL);
+#endif
+	return EVENT_CONTINUE;
+}
+
+// reads the same register from all drivers
+// drivers in the SPI chain are read with a single transfer
+void tmc_driver_read_all(uint8_t address, uint32_t *values)
+{
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		values[i] = TMC_READ_ERROR;
+	}
+
+#ifdef ENABLE_TMC_SPI_CHAIN
+	uint32_t chain_values[TMC_SPI_CHAIN_LENGTH];
+	tmc_chain_read(&tmc_chain, address, chain_values);
+#endif
+
+#ifdef STEPPER0_HAS_TMC
+#if (STEPPER0_TMC_INTERFACE == TMC_SPI_CHAIN)
+	for (uint8_t i = 0; i < tmc_chain.count; i++)
+	{
+		if (tmc_chain.drivers[i] == &tmc0_driver)
+		{
+			values[0] = chain_values[i];
+		}
+	}
+#else
+	values[0] = tmc_read_register(&tmc0_driver, address);
+#endif
+#endif
+#ifdef STEPPER1_HAS_TMC
+#if (STEPPER1_TMC_INTERFACE == TMC_SPI_CHAIN)
+	for (uint8_t i = 0; i < tmc_chain.count; i++)
+	{
+		if (tmc_chain.drivers[i] == &tmc1_driver)
+		{
+			values[1] = chain_values[i];
+		}
+	}
+#else
+	values[1] = tmc_read_register(&tmc1_driver, address);
+#endif
+#endif
+#ifdef STEPPER2_HAS_TMC
+#if (STEPPER2_TMC_INTERFACE == TMC_SPI_CHAIN)
+	for (uint8_t i = 0; i < tmc_chain.count; i++)
+	{
+		if (tmc_chain.drivers[i] == &tmc2_driver)
+		{
+			values[2] = chain_values[i];
+		}
+	}
+#else
+	values[2] = tmc_read_register(&tmc2_driver, address);
+#endif
+#endif
+#ifdef STEPPER3_HAS_TMC
+#if (STEPPER3_TMC_INTERFACE == TMC_SPI_CHAIN)
+	for (uint8_t i = 0; i < tmc_chain.count; i++)
+	{
+		if (tmc_chain.drivers[i] == &tmc3_driver)
+		{
+			values[3] = chain_values[i];
+		}
+	}
+#else
+	values[3] = tmc_read_register(&tmc3_driver, address);
+#endif
+#endif
+#ifdef STEPPER4_HAS_TMC
+#if (STEPPER4_TMC_INTERFACE == TMC_SPI_CHAIN)
+	for (uint8_t i = 0; i < tmc_chain.count; i++)
+	{
+		if (tmc_chain.drivers[i] == &tmc4_driver)
+		{
+			values[4] = chain_values[i];
+		}
+	}
+#else
+	values[4] = tmc_read_register(&tmc4_driver, address);
+#endif
+#endif
+#ifdef STEPPER5_HAS_TMC
+#if (STEPPER5_TMC_INTERFACE == TMC_SPI_CHAIN)
+	for (uint8_t i = 0; i < tmc_chain.count; i++)
+	{
+		if (tmc_chain.drivers[i] == &tmc5_driver)
+		{
+			values[5] = chain_values[i];
+		}
+	}
+#else
+	values[5] = tmc_read_register(&tmc5_driver, address);
+#endif
+#endif
+#ifdef STEPPER6_HAS_TMC
+#if (STEPPER6_TMC_INTERFACE == TMC_SPI_CHAIN)
+	for (uint8_t i = 0; i < tmc_chain.count; i++)
+	{
+		if (tmc_chain.drivers[i] == &tmc6_driver)
+		{
+			values[6] = chain_values[i];
+		}
+	}
+#else
+	values[6] = tmc_read_register(&tmc6_driver, address);
+#endif
+#endif
+#ifdef STEPPER7_HAS_TMC
+#if (STEPPER7_TMC_INTERFACE == TMC_SPI_CHAIN)
+	for (uint8_t i = 0; i < tmc_chain.count; i++)
+	{
+		if (tmc_chain.drivers[i] == &tmc7_driver)
+		{
+			values[7] = chain_values[i];
+		}
+	}
+#else
+	values[7] = tmc_read_register(&tmc7_driver, address);
+#endif
+#endif
+}
+
+// returns the driver of the stepper (or NULL if the stepper has no TMC driver)
+tmc_driver_t *tmc_driver_get(uint8_t stepper)
+{
+	switch (stepper)
+	{
+#ifdef STEPPER0_HAS_TMC
+	case 0:
+		return &tmc0_driver;
 #endif
 #ifdef STEPPER1_HAS_TMC
-TMC_STEPPER_DECL(STEPPER1_TMC_INTERFACE, 1);
-tmc_driver_t tmc1_driver;
-tmc_driver_setting_t tmc1_settings;
+	case 1:
+		return &tmc1_driver;
 #endif
 #ifdef STEPPER2_HAS_TMC
-TMC_STEPPER_DECL(STEPPER2_TMC_INTERFACE, 2);
-tmc_driver_t tmc2_driver;
-tmc_driver_setting_t tmc2_settings;
+	case 2:
+		return &tmc2_driver;
 #endif
 #ifdef STEPPER3_HAS_TMC
-TMC_STEPPER_DECL(STEPPER3_TMC_INTERFACE, 3);
-tmc_driver_t tmc3_driver;
-tmc_driver_setting_t tmc3_settings;
+	case 3:
+		return &tmc3_driver;
 #endif
 #ifdef STEPPER4_HAS_TMC
-TMC_STEPPER_DECL(STEPPER4_TMC_INTERFACE, 4);
-tmc_driver_t tmc4_driver;
-tmc_driver_setting_t tmc4_settings;
+	case 4:
+		return &tmc4_driver;
 #endif
 #ifdef STEPPER5_HAS_TMC
-TMC_STEPPER_DECL(STEPPER5_TMC_INTERFACE, 5);
-tmc_driver_t tmc5_driver;
-tmc_driver_setting_t tmc5_settings;
+	case 5:
+		return &tmc5_driver;
 #endif
 #ifdef STEPPER6_HAS_TMC
-TMC_STEPPER_DECL(STEPPER6_TMC_INTERFACE, 6);
-tmc_driver_t tmc6_driver;
-tmc_driver_setting_t tmc6_settings;
+	case 6:
+		return &tmc6_driver;
 #endif
 #ifdef STEPPER7_HAS_TMC
-TMC_STEPPER_DECL(STEPPER7_TMC_INTERFACE, 7);
-tmc_driver_t tmc7_driver;
-tmc_driver_setting_t tmc7_settings;
+	case 7:
+		return &tmc7_driver;
 #endif
+	}
 
-#define TMC_STEPPER_PORT(PORT) &tmc##PORT
-
-void tmc_driver_update(tmc_driver_t *driver, tmc_driver_setting_t *settings, tmc_set_param_callback cb)
-{
-	cb(driver, settings);
+	return NULL;
 }
 
-void tmc_driver_update_all(tmc_set_param_callback cb)
+// returns the settings of the stepper driver (or NULL if the stepper has no TMC driver)
+tmc_driver_setting_t *tmc_driver_get_settings(uint8_t stepper)
 {
+	switch (stepper)
+	{
 #ifdef STEPPER0_HAS_TMC
-	tmc_driver_update(&tmc0_driver, &tmc0_settings, cb);
+	case 0:
+		return &tmc0_settings;
 #endif
 #ifdef STEPPER1_HAS_TMC
-	tmc_driver_update(&tmc1_driver, &tmc1_settings, cb);
+	case 1:
+		return &tmc1_settings;
 #endif
 #ifdef STEPPER2_HAS_TMC
-	tmc_driver_update(&tmc2_driver, &tmc2_settings, cb);
+	case 2:
+		return &tmc2_settings;
 #endif
 #ifdef STEPPER3_HAS_TMC
-	tmc_driver_update(&tmc3_driver, &tmc3_settings, cb);
+	case 3:
+		return &tmc3_settings;
 #endif
 #ifdef STEPPER4_HAS_TMC
-	tmc_driver_update(&tmc4_driver, &tmc4_settings, cb);
+	case 4:
+		return &tmc4_settings;
 #endif
 #ifdef STEPPER5_HAS_TMC
-	tmc_driver_update(&tmc5_driver, &tmc5_settings, cb);
+	case 5:
+		return &tmc5_settings;
 #endif
 #ifdef STEPPER6_HAS_TMC
-	tmc_driver_update(&tmc6_driver, &tmc6_settings, cb);
+	case 6:
+		return &tmc6_settings;
 #endif
 #ifdef STEPPER7_HAS_TMC
-	tmc_driver_update(&tmc7_driver, &tmc7_settings, cb);
+	case 7:
+		return &tmc7_settings;
 #endif
+	}
+
+	return NULL;
 }
 
-bool tmc_driver_config_all(void *args)
+#ifdef ENABLE_TMC_SIM
+// returns the driver model of the stepper (or NULL if the stepper does not use the TMC_SIM interface)
+tmc_sim_t *tmc_driver_get_sim(uint8_t stepper)
 {
+	switch (stepper)
+	{
+#if (defined(STEPPER0_HAS_TMC) && (STEPPER0_TMC_INTERFACE == TMC_SIM))
+	case 0:
+		return &tmc0_sim;
+#endif
+#if (defined(STEPPER1_HAS_TMC) && (STEPPER1_TMC_INTERFACE == TMC_SIM))
+	case 1:
+		return &tmc1_sim;
+#endif
+#if (defined(STEPPER2_HAS_TMC) && (STEPPER2_TMC_INTERFACE == TMC_SIM))
+	case 2:
+		return &tmc2_sim;
+#endif
+#if (defined(STEPPER3_HAS_TMC) && (STEPPER3_TMC_INTERFACE == TMC_SIM))
+	case 3:
+		return &tmc3_sim;
+#endif
+#if (defined(STEPPER4_HAS_TMC) && (STEPPER4_TMC_INTERFACE == TMC_SIM))
+	case 4:
+		return &tmc4_sim;
+#endif
+#if (defined(STEPPER5_HAS_TMC) && (STEPPER5_TMC_INTERFACE == TMC_SIM))
+	case 5:
+		return &tmc5_sim;
+#endif
+#if (defined(STEPPER6_HAS_TMC) && (STEPPER6_TMC_INTERFACE == TMC_SIM))
+	case 6:
+		return &tmc6_sim;
+#endif
+#if (defined(STEPPER7_HAS_TMC) && (STEPPER7_TMC_INTERFACE == TMC_SIM))
+	case 7:
+		return &tmc7_sim;
+#endif
+	}
+
+	return NULL;
+}
+
+#ifdef ENABLE_PARSER_MODULES
+// $TMCSIM prints and clears the bus statistics of each simulated driver
+// [TMCSIM<stepper>:<transactions>,<reads>,<writes>,<tx bytes>,<rx bytes>,<rejected>]
+bool tmc_sim_cmd(void *args)
+{
+	grbl_cmd_args_t *ptr = (grbl_cmd_args_t *)args;
+	strupr((char *)ptr->cmd);
+
+	if (strcmp((char *)ptr->cmd, "TMCSIM"))
+	{
+		return EVENT_CONTINUE;
+	}
+
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		tmc_sim_t *sim = tmc_driver_get_sim(i);
+		if (!sim)
+		{
+			continue;
+		}
+
+		proto_print("[TMCSIM");
+		proto_itoa(i);
+		proto_putc(':');
+		proto_itoa(sim->stats.transactions);
+		proto_putc(',');
+		proto_itoa(sim->stats.reads);
+		proto_putc(',');
+		proto_itoa(sim->stats.writes);
+		proto_putc(',');
+		proto_itoa(sim->stats.tx_bytes);
+		proto_putc(',');
+		proto_itoa(sim->stats.rx_bytes);
+		proto_putc(',');
+		proto_itoa(sim->stats.rejected);
+		proto_putc(']');
+		proto_putc('\n');
+		proto_putc('\r');
+		tmc_sim_clear_stats(sim);
+	}
+
+	*(ptr->error) = STATUS_OK;
+	return EVENT_HANDLED;
+}
+CREATE_EVENT_LISTENER(grbl_cmd, tmc_sim_cmd);
+#endif
+#endif
+
+#ifdef ENABLE_MAIN_LOOP_MODULES
+CREATE_EVENT_LISTENER(cnc_reset, tmc_driver_config_all);
+#endif
+
+#ifdef ENABLE_TMC_TELEMETRY
+// steppers with a TMC driver (each one gets a telemetry channel)
+static const uint8_t tmc_telemetry_steppers[] = {
 #ifdef STEPPER0_HAS_TMC
-	tmc_init(&tmc0_driver, &tmc0_settings);
+		0,
 #endif
 #ifdef STEPPER1_HAS_TMC
-	tmc_init(&tmc1_driver, &tmc1_settings);
+		1,
 #endif
 #ifdef STEPPER2_HAS_TMC
-	tmc_init(&tmc2_driver, &tmc2_settings);
+		2,
 #endif
 #ifdef STEPPER3_HAS_TMC
-	tmc_init(&tmc3_driver, &tmc3_settings);
+		3,
 #endif
 #ifdef STEPPER4_HAS_TMC
-	tmc_init(&tmc4_driver, &tmc4_settings);
+		4,
 #endif
 #ifdef STEPPER5_HAS_TMC
-	tmc_init(&tmc5_driver, &tmc5_settings);
+		5,
 #endif
 #ifdef STEPPER6_HAS_TMC
-	tmc_init(&tmc6_driver, &tmc6_settings);
+		6,
 #endif
 #ifdef STEPPER7_HAS_TMC
-	tmc_init(&tmc7_driver, &tmc7_settings);
+		7,
 #endif
+};
+#define TMC_TELEMETRY_CHANNELS sizeof(tmc_telemetry_steppers)
+
+
+// per channel sample ring buffer
+static tmc_telemetry_t tmc_telemetry_buffer[TMC_TELEMETRY_CHANNELS][TMC_TELEMETRY_BUFFER_SIZE];
+static uint8_t tmc_telemetry_head[TMC_TELEMETRY_CHANNELS];
+static uint8_t tmc_telemetry_count[TMC_TELEMETRY_CHANNELS];
+static uint8_t tmc_telemetry_channel;
+static uint32_t tmc_telemetry_next;
+// sampling overhead (in microseconds)
+static uint32_t tmc_telemetry_last_us;
+static uint32_t tmc_telemetry_max_us;
+static bool tmc_telemetry_busy;
+
+CREATE_HOOK(tmc_telemetry_alarm);
+
+// returns the most recent sample of a channel
+static tmc_telemetry_t *tmc_telemetry_last(uint8_t channel)
+{
+	uint8_t i = tmc_telemetry_head[channel];
+	i = (!i) ? (TMC_TELEMETRY_BUFFER_SIZE - 1) : (i - 1);
+	return &tmc_telemetry_buffer[channel][i];
+}
+
+// samples one driver per call (round robin) to keep the main loop overhead bounded
+bool tmc_telemetry_sample(void *args)
+{
+	if (tmc_telemetry_busy)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	uint32_t now = mcu_millis();
+	if ((int32_t)(now - tmc_telemetry_next) < 0)
+	{
+		return EVENT_CONTINUE;
+	}
+
+	tmc_telemetry_busy = true;
+	tmc_telemetry_next = now + TMC_TELEMETRY_INTERVAL_MS;
+
+	// while running skip the drivers that would stall the step generation
+	bool running = (cnc_get_exec_state(EXEC_RUN) != 0);
+	uint8_t channel = tmc_telemetry_channel;
+	for (uint8_t i = TMC_TELEMETRY_CHANNELS;; i--)
+	{
+		if (!i)
+		{
+			tmc_telemetry_busy = false;
+			return EVENT_CONTINUE;
+		}
+
+		channel = tmc_telemetry_channel;
+		tmc_telemetry_channel = (channel < (TMC_TELEMETRY_CHANNELS - 1)) ? (channel + 1) : 0;
+		if (!running || !tmc_driver_is_blocking(tmc_telemetry_steppers[channel]))
+		{
+			break;
+		}
+	}
+
+	uint8_t head = tmc_telemetry_head[channel];
+	tmc_telemetry_t *sample = &tmc_telemetry_buffer[channel][head];
+	uint32_t t = mcu_micros();
+	tmc_get_telemetry(tmc_driver_get(tmc_telemetry_steppers[channel]), sample);
+	t = mcu_micros() - t;
+	tmc_telemetry_last_us = t;
+	tmc_telemetry_max_us = MAX(tmc_telemetry_max_us, t);
+
+	head++;
+	tmc_telemetry_head[channel] = (head < TMC_TELEMETRY_BUFFER_SIZE) ? head : 0;
+	if (tmc_telemetry_count[channel] < TMC_TELEMETRY_BUFFER_SIZE)
+	{
+		tmc_telemetry_count[channel]++;
+	}
+
+	if (!(sample->flags & TMC_TELEMETRY_ERROR))
+	{
+		if ((sample->flags & TMC_TELEMETRY_FLAGS_ALARM) || (sample->sg_result < TMC_TELEMETRY_SG_ALARM && !(sample->flags & TMC_TELEMETRY_STST)))
+		{
+			HOOK_INVOKE(tmc_telemetry_alarm, tmc_telemetry_steppers[channel], sample);
+		}
+	}
+
+	tmc_telemetry_busy = false;
 	return EVENT_CONTINUE;
 }
 
+// copies the most recent sample of the stepper
+bool tmc_telemetry_get(uint8_t stepper, tmc_telemetry_t *sample)
+{
+	for (uint8_t i = 0; i < TMC_TELEMETRY_CHANNELS; i++)
+	{
+		if (tmc_telemetry_steppers[i] == stepper && tmc_telemetry_count[i])
+		{
+			*sample = *tmc_telemetry_last(i);
+			return true;
+		}
+	}
+
+	return false;
+}
+
 #ifdef ENABLE_MAIN_LOOP_MODULES
-CREATE_EVENT_LISTENER(cnc_reset, tmc_driver_config_all);
+CREATE_EVENT_LISTENER(cnc_dotasks, tmc_telemetry_sample);
+
+// appends the last stallGuard value of each driver to the status report (* marks an active alarm flag)
+bool tmc_telemetry_status(void *args)
+{
+	proto_print("|Tmc:");
+	for (uint8_t i = 0; i < TMC_TELEMETRY_CHANNELS; i++)
+	{
+		if (i)
+		{
+			proto_putc(',');
+		}
+		if (tmc_telemetry_count[i])
+		{
+			tmc_telemetry_t *sample = tmc_telemetry_last(i);
+			proto_itoa(sample->sg_result);
+			if (sample->flags & (TMC_TELEMETRY_FLAGS_ALARM | TMC_TELEMETRY_ERROR))
+			{
+				proto_putc('*');
+			}
+		}
+	}
+
+	return EVENT_CONTINUE;
+}
+CREATE_EVENT_LISTENER(proto_status, tmc_telemetry_status);
+#endif
+
+#ifdef ENABLE_PARSER_MODULES
+// $TMC dumps the sample buffers (oldest first) as [TMC<stepper>:<ms>,<sg_result>,<cs_actual>,<flags>]
+// followed by the sampling overhead [TMCT:<last us>,<max us>]
+bool tmc_telemetry_cmd(void *args)
+{
+	grbl_cmd_args_t *ptr = (grbl_cmd_args_t *)args;
+	strupr((char *)ptr->cmd);
+
+	if (strcmp((char *)ptr->cmd, "TMC"))
+	{
+		return EVENT_CONTINUE;
+	}
+
+	for (uint8_t i = 0; i < TMC_TELEMETRY_CHANNELS; i++)
+	{
+		uint8_t count = tmc_telemetry_count[i];
+		uint8_t j = tmc_telemetry_head[i];
+		j = (j >= count) ? (j - count) : (TMC_TELEMETRY_BUFFER_SIZE + j - count);
+		while (count--)
+		{
+			tmc_telemetry_t *sample = &tmc_telemetry_buffer[i][j];
+			proto_print("[TMC");
+			proto_itoa(tmc_telemetry_steppers[i]);
+			proto_putc(':');
+			proto_itoa(sample->timestamp);
+			proto_putc(',');
+			proto_itoa(sample->sg_result);
+			proto_putc(',');
+			proto_itoa(sample->cs_actual);
+			proto_putc(',');
+			proto_itoa(sample->flags);
+			proto_putc(']');
+			proto_putc('\n');
+			proto_putc('\r');
+			j++;
+			j = (j < TMC_TELEMETRY_BUFFER_SIZE) ? j : 0;
+		}
+	}
+
+	proto_print("[TMCT:");
+	proto_itoa(tmc_telemetry_last_us);
+	proto_putc(',');
+	proto_itoa(tmc_telemetry_max_us);
+	proto_putc(']');
+	proto_putc('\n');
+	proto_putc('\r');
+	tmc_telemetry_max_us = 0;
+
+	*(ptr->error) = STATUS_OK;
+	return EVENT_HANDLED;
+}
+CREATE_EVENT_LISTENER(grbl_cmd, tmc_telemetry_cmd);
 #endif
+#endif
+
 
 /*custom gcode commands*/
 #if defined(ENABLE_PARSER_MODULES)
@@ -446,53 +1901,61 @@ bool m350_exec(void *args)
 			if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_X))
 			{
 #ifdef STEPPER0_HAS_TMC
-				tmc0_settings.mstep = (uint8_t)ptr->words->xyzabc[0];
+				tmc0_settings.mstep = (int16_t)ptr->words->xyzabc[0];
 #endif
 			}
 			if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_Y))
 			{
 #ifdef STEPPER1_HAS_TMC
-				tmc1_settings.mstep = (uint8_t)ptr->words->xyzabc[1];
+				tmc1_settings.mstep = (int16_t)ptr->words->xyzabc[1];
 #endif
 			}
 			if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_Z))
 			{
 #ifdef STEPPER2_HAS_TMC
-				tmc2_settings.mstep = (uint8_t)ptr->words->xyzabc[2];
+				tmc2_settings.mstep = (int16_t)ptr->words->xyzabc[2];
 #endif
 			}
 			if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_A))
 			{
 #ifdef STEPPER3_HAS_TMC
-				tmc3_settings.mstep = (uint8_t)ptr->words->xyzabc[3];
+				tmc3_settings.mstep = (int16_t)ptr->words->xyzabc[3];
 #endif
 			}
 			if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_B))
 			{
 #ifdef STEPPER4_HAS_TMC
-				tmc4_settings.mstep = (uint8_t)ptr->words->xyzabc[4];
+				tmc4_settings.mstep = (int16_t)ptr->words->xyzabc[4];
 #endif
 			}
 			if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_C))
 			{
 #ifdef STEPPER5_HAS_TMC
-				tmc5_settings.mstep = (uint8_t)ptr->words->xyzabc[5];
+				tmc5_settings.mstep = (int16_t)ptr->words->xyzabc[5];
 #endif
 			}
 			if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_I))
 			{
 #ifdef STEPPER6_HAS_TMC
-				tmc6_settings.mstep = (uint8_t)ptr->words->ijk[0];
+				tmc6_settings.mstep = (int16_t)ptr->words->ijk[0];
 #endif
 			}
 			if (CHECKFLAG(ptr->cmd->words, GCODE_WORD_J))
 			{
 #ifdef STEPPER7_HAS_TMC
-				tmc7_settings.mstep = (uint8_t)ptr->words->ijk[1];
+				tmc7_settings.mstep = (int16_t)ptr->words->ijk[1];
 #endif
 			}
 
 			tmc_driver_update_all(&tmc_set_microstep);
+#ifdef ENABLE_TMC_AUTO_MICROSTEP
+			// the steps per mm follow the new microstepping
+			tmc_auto_microstep_update(false);
+#endif
+#ifdef ENABLE_TMC_VELOCITY_SCHEDULING
+			// thresholds depend on the microstepping
+			tmc_velocity_schedule_all();
+#endif
 		}
 
 		*(ptr->error) = STATUS_OK;
@@ -815,7 +2278,33 @@ bool m913_exec(void *args)
 #endif
 			}
 
+#ifdef ENABLE_TMC_VELOCITY_SCHEDULING
+			uint8_t words = (uint8_t)(ptr->cmd->words & GCODE_ALL_AXIS);
+			words |= (CHECKFLAG(ptr->cmd->words, GCODE_WORD_I)) ? 0x40 : 0;
+			words |= (CHECKFLAG(ptr->cmd->words, GCODE_WORD_J)) ? 0x80 : 0;
+			// these steppers keep the user threshold and a threshold of 0 returns them to the scheduled threshold
+			for (uint8_t i = 0; i < 8; i++)
+			{
+				tmc_driver_setting_t *settings = tmc_driver_get_settings(i);
+				if (!settings || !(words & (1 << i)))
+				{
+					continue;
+				}
+
+				if (settings->stealthchop_threshold)
+				{
+					tmc_velocity_user_mask |= (1 << i);
+				}
+				else
+				{
+					tmc_velocity_user_mask &= ~(1 << i);
+				}
+			}
+#endif
 			tmc_driver_update_all(&tmc_set_stealthchop);
+#ifdef ENABLE_TMC_VELOCITY_SCHEDULING
+			tmc_velocity_schedule_all();
+#endif
 		}
 		*(ptr->error) = STATUS_OK;
 		return EVENT_HANDLED;
@@ -1065,7 +2554,7 @@ bool m920_exec(void *args)
 				}
 				tmc_write_register(&tmc0_driver, (uint8_t)ptr->words->xyzabc[0], reg);
 			}
-			reg = tmc_read_register(&tmc0_driver, (uint8_t)ptr->words->xyzabc[0]);
+			reg = tmc_read_register_forced(&tmc0_driver, (uint8_t)ptr->words->xyzabc[0]);
 #else
 			reg = 0xFFFFFFFFUL;
 #endif
@@ -1098,7 +2587,7 @@ bool m920_exec(void *args)
 				}
 				tmc_write_register(&tmc1_driver, (uint8_t)ptr->words->xyzabc[1], reg);
 			}
-			reg = tmc_read_register(&tmc1_driver, (uint8_t)ptr->words->xyzabc[1]);
+			reg = tmc_read_register_forced(&tmc1_driver, (uint8_t)ptr->words->xyzabc[1]);
 #else
 			reg = 0xFFFFFFFFUL;
 #endif
@@ -1131,7 +2620,7 @@ bool m920_exec(void *args)
 				}
 				tmc_write_register(&tmc2_driver, (uint8_t)ptr->words->xyzabc[2], reg);
 			}
-			reg = tmc_read_register(&tmc2_driver, (uint8_t)ptr->words->xyzabc[2]);
+			reg = tmc_read_register_forced(&tmc2_driver, (uint8_t)ptr->words->xyzabc[2]);
 #else
 			reg = 0xFFFFFFFFUL;
 #endif
@@ -1164,7 +2653,7 @@ bool m920_exec(void *args)
 				}
 				tmc_write_register(&tmc3_driver, (uint8_t)ptr->words->xyzabc[3], reg);
 			}
-			reg = tmc_read_register(&tmc3_driver, (uint8_t)ptr->words->xyzabc[3]);
+			reg = tmc_read_register_forced(&tmc3_driver, (uint8_t)ptr->words->xyzabc[3]);
 #else
 			reg = 0xFFFFFFFFUL;
 #endif
@@ -1197,7 +2686,7 @@ bool m920_exec(void *args)
 				}
 				tmc_write_register(&tmc4_driver, (uint8_t)ptr->words->xyzabc[4], reg);
 			}
-			reg = tmc_read_register(&tmc4_driver, (uint8_t)ptr->words->xyzabc[4]);
+			reg = tmc_read_register_forced(&tmc4_driver, (uint8_t)ptr->words->xyzabc[4]);
 #else
 			reg = 0xFFFFFFFFUL;
 #endif
@@ -1230,7 +2719,7 @@ bool m920_exec(void *args)
 				}
 				tmc_write_register(&tmc5_driver, (uint8_t)ptr->words->xyzabc[5], reg);
 			}
-			reg = tmc_read_register(&tmc5_driver, (uint8_t)ptr->words->xyzabc[5]);
+			reg = tmc_read_register_forced(&tmc5_driver, (uint8_t)ptr->words->xyzabc[5]);
 #else
 			reg = 0xFFFFFFFFUL;
 #endif
@@ -1263,7 +2752,7 @@ bool m920_exec(void *args)
 				}
 				tmc_write_register(&tmc6_driver, (uint8_t)ptr->words->ijk[0], reg);
 			}
-			reg = tmc_read_register(&tmc6_driver, (uint8_t)ptr->words->ijk[0]);
+			reg = tmc_read_register_forced(&tmc6_driver, (uint8_t)ptr->words->ijk[0]);
 #else
 			reg = 0xFFFFFFFFUL;
 #endif
@@ -1296,7 +2785,7 @@ bool m920_exec(void *args)
 				}
 				tmc_write_register(&tmc7_driver, (uint8_t)ptr->words->ijk[1], reg);
 			}
-			reg = tmc_read_register(&tmc7_driver, (uint8_t)ptr->words->ijk[1]);
+			reg = tmc_read_register_forced(&tmc7_driver, (uint8_t)ptr->words->ijk[1]);
 #else
 			reg = 0xFFFFFFFFUL;
 #endif
@@ -1341,9 +2830,38 @@ DECL_MODULE(tmc_driver)
 #if ASSERT_PIN(STEPPER7_SPI_CS)
 	io_set_output(STEPPER7_SPI_CS);
 #endif
+#ifdef ENABLE_TMC_SPI_CHAIN
+	io_set_output(TMC_SPI_CHAIN_CS);
+#endif
 
+#ifdef ENABLE_TMC_SENSORLESS_HOMING
+	ADD_EVENT_LISTENER(mc_home_axis_start, tmc_sensorless_start);
+	ADD_EVENT_LISTENER(mc_home_axis_finish, tmc_sensorless_finish);
+#endif
+#ifdef ENABLE_TMC_DYNAMIC_CURRENT
+	ADD_EVENT_LISTENER(mc_line_segment, tmc_dynamic_current_queue_block);
+#endif
+#if defined(ENABLE_TMC_AUTO_MICROSTEP) && defined(ENABLE_SETTINGS_MODULES)
+	ADD_EVENT_LISTENER(settings_extended_save, tmc_auto_microstep_save);
+#ifdef ENABLE_MAIN_LOOP_MODULES
+	ADD_EVENT_LISTENER(cnc_dotasks, tmc_auto_microstep_resume);
+#endif
+#endif
 #ifdef ENABLE_MAIN_LOOP_MODULES
 	ADD_EVENT_LISTENER(cnc_reset, tmc_driver_config_all);
+#ifdef ENABLE_TMC_VELOCITY_SCHEDULING
+	ADD_EVENT_LISTENER(cnc_dotasks, tmc_velocity_update);
+#endif
+#if defined(ENABLE_TMC_VELOCITY_SCHEDULING) && defined(ENABLE_SETTINGS_MODULES)
+	ADD_EVENT_LISTENER(settings_extended_erase, tmc_velocity_settings_erase);
+#endif
+#ifdef ENABLE_TMC_DYNAMIC_CURRENT
+	ADD_EVENT_LISTENER(cnc_dotasks, tmc_dynamic_current_update);
+#endif
+#ifdef ENABLE_TMC_TELEMETRY
+	ADD_EVENT_LISTENER(cnc_dotasks, tmc_telemetry_sample);
+	ADD_EVENT_LISTENER(proto_status, tmc_telemetry_status);
+#endif
 #else
 #error "Main loop extensions are not enabled. TMC configurations will not work."
 #endif
@@ -1358,6 +2876,15 @@ DECL_MODULE(tmc_driver)
 	ADD_EVENT_LISTENER(gcode_exec, m914_exec);
 	ADD_EVENT_LISTENER(gcode_parse, m920_parse);
 	ADD_EVENT_LISTENER(gcode_exec, m920_exec);
+#ifdef ENABLE_TMC_TELEMETRY
+	ADD_EVENT_LISTENER(grbl_cmd, tmc_telemetry_cmd);
+#endif
+#ifdef ENABLE_TMC_SIM
+	ADD_EVENT_LISTENER(grbl_cmd, tmc_sim_cmd);
+#endif
+#ifdef ENABLE_TMC_AUTO_MICROSTEP
+	ADD_EVENT_LISTENER(grbl_cmd, tmc_auto_microstep_cmd);
+#endif
 #else
 #warning "Parser extensions are not enabled. M350, M906, M913, M914 and M920 code extensions will not work."
 #endif
@@ -1367,6 +2894,13 @@ DECL_MODULE(tmc_driver)
 	tmc0_driver.slave = STEPPER0_UART_ADDRESS;
 	tmc0_driver.init = NULL;
 	tmc0_driver.rw = &tmc0_rw;
+#if (STEPPER0_TMC_INTERFACE == TMC_SIM)
+	tmc_sim_init(&tmc0_sim, STEPPER0_DRIVER_TYPE, STEPPER0_UART_ADDRESS);
+#endif
+#if (STEPPER0_TMC_INTERFACE == TMC_SPI_CHAIN)
+	tmc0_driver.chain_pos = STEPPER0_SPI_CHAIN_POS;
+	tmc_chain_drivers[tmc_chain.count++] = &tmc0_driver;
+#endif
 	tmc0_settings.rms_current = STEPPER0_CURRENT_MA;
 	tmc0_settings.rsense = STEPPER0_RSENSE;
 	tmc0_settings.ihold_mul = STEPPER0_HOLD_MULT;
@@ -1389,6 +2923,13 @@ DECL_MODULE(tmc_driver)
 	tmc1_driver.slave = STEPPER1_UART_ADDRESS;
 	tmc1_driver.init = NULL;
 	tmc1_driver.rw = &tmc1_rw;
+#if (STEPPER1_TMC_INTERFACE == TMC_SIM)
+	tmc_sim_init(&tmc1_sim, STEPPER1_DRIVER_TYPE, STEPPER1_UART_ADDRESS);
+#endif
+#if (STEPPER1_TMC_INTERFACE == TMC_SPI_CHAIN)
+	tmc1_driver.chain_pos = STEPPER1_SPI_CHAIN_POS;
+	tmc_chain_drivers[tmc_chain.count++] = &tmc1_driver;
+#endif
 	tmc1_settings.rms_current = STEPPER1_CURRENT_MA;
 	tmc1_settings.rsense = STEPPER1_RSENSE;
 	tmc1_settings.ihold_mul = STEPPER1_HOLD_MULT;
@@ -1411,6 +2952,13 @@ DECL_MODULE(tmc_driver)
 	tmc2_driver.slave = STEPPER2_UART_ADDRESS;
 	tmc2_driver.init = NULL;
 	tmc2_driver.rw = &tmc2_rw;
+#if (STEPPER2_TMC_INTERFACE == TMC_SIM)
+	tmc_sim_init(&tmc2_sim, STEPPER2_DRIVER_TYPE, STEPPER2_UART_ADDRESS);
+#endif
+#if (STEPPER2_TMC_INTERFACE == TMC_SPI_CHAIN)
+	tmc2_driver.chain_pos = STEPPER2_SPI_CHAIN_POS;
+	tmc_chain_drivers[tmc_chain.count++] = &tmc2_driver;
+#endif
 	tmc2_settings.rms_current = STEPPER2_CURRENT_MA;
 	tmc2_settings.rsense = STEPPER2_RSENSE;
 	tmc2_settings.ihold_mul = STEPPER2_HOLD_MULT;
@@ -1433,6 +2981,13 @@ DECL_MODULE(tmc_driver)
 	tmc3_driver.slave = STEPPER3_UART_ADDRESS;
 	tmc3_driver.init = NULL;
 	tmc3_driver.rw = &tmc3_rw;
+#if (STEPPER3_TMC_INTERFACE == TMC_SIM)
+	tmc_sim_init(&tmc3_sim, STEPPER3_DRIVER_TYPE, STEPPER3_UART_ADDRESS);
+#endif
+#if (STEPPER3_TMC_INTERFACE == TMC_SPI_CHAIN)
+	tmc3_driver.chain_pos = STEPPER3_SPI_CHAIN_POS;
+	tmc_chain_drivers[tmc_chain.count++] = &tmc3_driver;
+#endif
 	tmc3_settings.rms_current = STEPPER3_CURRENT_MA;
 	tmc3_settings.rsense = STEPPER3_RSENSE;
 	tmc3_settings.ihold_mul = STEPPER3_HOLD_MULT;
@@ -1455,6 +3010,13 @@ DECL_MODULE(tmc_driver)
 	tmc4_driver.slave = STEPPER4_UART_ADDRESS;
 	tmc4_driver.init = NULL;
 	tmc4_driver.rw = &tmc4_rw;
+#if (STEPPER4_TMC_INTERFACE == TMC_SIM)
+	tmc_sim_init(&tmc4_sim, STEPPER4_DRIVER_TYPE, STEPPER4_UART_ADDRESS);
+#endif
+#if (STEPPER4_TMC_INTERFACE == TMC_SPI_CHAIN)
+	tmc4_driver.chain_pos = STEPPER4_SPI_CHAIN_POS;
+	tmc_chain_drivers[tmc_chain.count++] = &tmc4_driver;
+#endif
 	tmc4_settings.rms_current = STEPPER4_CURRENT_MA;
 	tmc4_settings.rsense = STEPPER4_RSENSE;
 	tmc4_settings.ihold_mul = STEPPER4_HOLD_MULT;
@@ -1477,6 +3039,13 @@ DECL_MODULE(tmc_driver)
 	tmc5_driver.slave = STEPPER5_UART_ADDRESS;
 	tmc5_driver.init = NULL;
 	tmc5_driver.rw = &tmc5_rw;
+#if (STEPPER5_TMC_INTERFACE == TMC_SIM)
+	tmc_sim_init(&tmc5_sim, STEPPER5_DRIVER_TYPE, STEPPER5_UART_ADDRESS);
+#endif
+#if (STEPPER5_TMC_INTERFACE == TMC_SPI_CHAIN)
+	tmc5_driver.chain_pos = STEPPER5_SPI_CHAIN_POS;
+	tmc_chain_drivers[tmc_chain.count++] = &tmc5_driver;
+#endif
 	tmc5_settings.rms_current = STEPPER5_CURRENT_MA;
 	tmc5_settings.rsense = STEPPER5_RSENSE;
 	tmc5_settings.ihold_mul = STEPPER5_HOLD_MULT;
@@ -1499,6 +3068,13 @@ DECL_MODULE(tmc_driver)
 	tmc6_driver.slave = STEPPER6_UART_ADDRESS;
 	tmc6_driver.init = NULL;
 	tmc6_driver.rw = &tmc6_rw;
+#if (STEPPER6_TMC_INTERFACE == TMC_SIM)
+	tmc_sim_init(&tmc6_sim, STEPPER6_DRIVER_TYPE, STEPPER6_UART_ADDRESS);
+#endif
+#if (STEPPER6_TMC_INTERFACE == TMC_SPI_CHAIN)
+	tmc6_driver.chain_pos = STEPPER6_SPI_CHAIN_POS;
+	tmc_chain_drivers[tmc_chain.count++] = &tmc6_driver;
+#endif
 	tmc6_settings.rms_current = STEPPER6_CURRENT_MA;
 	tmc6_settings.rsense = STEPPER6_RSENSE;
 	tmc6_settings.ihold_mul = STEPPER6_HOLD_MULT;
@@ -1521,6 +3097,13 @@ DECL_MODULE(tmc_driver)
 	tmc7_driver.slave = STEPPER7_UART_ADDRESS;
 	tmc7_driver.init = NULL;
 	tmc7_driver.rw = &tmc7_rw;
+#if (STEPPER7_TMC_INTERFACE == TMC_SIM)
+	tmc_sim_init(&tmc7_sim, STEPPER7_DRIVER_TYPE, STEPPER7_UART_ADDRESS);
+#endif
+#if (STEPPER7_TMC_INTERFACE == TMC_SPI_CHAIN)
+	tmc7_driver.chain_pos = STEPPER7_SPI_CHAIN_POS;
+	tmc_chain_drivers[tmc_chain.count++] = &tmc7_driver;
+#endif
 	tmc7_settings.rms_current = STEPPER7_CURRENT_MA;
 	tmc7_settings.rsense = STEPPER7_RSENSE;
 	tmc7_settings.ihold_mul = STEPPER7_HOLD_MULT;
@@ -24,11 +24,43 @@ extern "C"
 {
 #endif
 
+#include "tmc.h"
+
 #define TMC_UART 1
 #define TMC_SPI 2
 #define TMC_ONEWIRE 3
 #define TMC_UART2_HW 4
 #define TMC_SPI_HW 5
+#define TMC_SPI2_HW 6
+#define TMC_SPI_CHAIN 7
+// software driver model (no hardware required)
+#define TMC_SIM 8
+
+// SPI daisy chain
+// all drivers set with the TMC_SPI_CHAIN interface share the same SPI bus and chip select
+// and are addressed in a single (40 x TMC_SPI_CHAIN_LENGTH)-bit transfer
+// TMC_SPI_CHAIN_LENGTH must match the number of drivers physically connected in the chain
+// #define TMC_SPI_CHAIN_LENGTH 3
+#ifdef TMC_SPI_CHAIN_LENGTH
+// the chain bus can be software SPI (TMC_SPI), SPI HW (TMC_SPI_HW) or SPI2 HW (TMC_SPI2_HW)
+#ifndef TMC_SPI_CHAIN_INTERFACE
+#define TMC_SPI_CHAIN_INTERFACE TMC_SPI
+#endif
+#if (TMC_SPI_CHAIN_INTERFACE == TMC_SPI)
+#ifndef TMC_SPI_CHAIN_SDO
+#define TMC_SPI_CHAIN_SDO DOUT29
+#endif
+#ifndef TMC_SPI_CHAIN_SDI
+#define TMC_SPI_CHAIN_SDI DIN29
+#endif
+#ifndef TMC_SPI_CHAIN_CLK
+#define TMC_SPI_CHAIN_CLK DOUT30
+#endif
+#endif
+#ifndef TMC_SPI_CHAIN_CS
+#define TMC_SPI_CHAIN_CS DOUT12
+#endif
+#endif
 
 #ifdef STEPPER0_HAS_TMC
 #ifndef STEPPER0_DRIVER_TYPE
@@ -74,6 +106,11 @@ extern "C"
 #ifndef STEPPER0_SPI_CS
 #define STEPPER0_SPI_CS DOUT12
 #endif 
+#elif (STEPPER0_TMC_INTERFACE == TMC_SPI_CHAIN)
+// position of the driver in the chain (0 is the driver connected to the MCU SDO pin)
+#ifndef STEPPER0_SPI_CHAIN_POS
+#define STEPPER0_SPI_CHAIN_POS 0
+#endif
 #endif
 // basic parameters
 #ifndef STEPPER0_CURRENT_MA
@@ -91,6 +128,21 @@ extern "C"
 #ifndef STEPPER0_STEALTHCHOP_THERSHOLD
 #define STEPPER0_STEALTHCHOP_THERSHOLD 0
 #endif
+#ifndef STEPPER0_STEALTHCHOP_MAX_FEED
+// feed (mm/min) above which the driver switches from stealthChop to spreadCycle (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_STEALTHCHOP_FEED of the axis max feed and a negative value keeps the STEALTHCHOP_THERSHOLD value
+#define STEPPER0_STEALTHCHOP_MAX_FEED 0
+#endif
+#ifndef STEPPER0_COOLSTEP_MIN_FEED
+// feed (mm/min) above which coolStep and stallGuard are active (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_COOLSTEP_FEED of the axis max feed and a negative value disables it
+#define STEPPER0_COOLSTEP_MIN_FEED 0
+#endif
+#ifndef STEPPER0_HIGH_FEED
+// feed (mm/min) above which the driver switches to high velocity mode (TMC2130 only and requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_HIGH_FEED of the axis max feed and a negative value disables it
+#define STEPPER0_HIGH_FEED 0
+#endif
 #ifndef STEPPER0_ENABLE_INTERPLATION
 #define STEPPER0_ENABLE_INTERPLATION true
 #endif
@@ -99,6 +151,12 @@ extern "C"
 // if driver does not support stallGuard this will be ignored
 #define STEPPER0_STALL_SENSITIVITY 10
 #endif
+// uncomment to home this stepper with stallGuard (the driver DIAG output must be wired to the axis limit input)
+// #define STEPPER0_SENSORLESS_HOMING
+#ifndef STEPPER0_HOMING_SENSITIVITY
+// stallGuard threshold used while homing
+#define STEPPER0_HOMING_SENSITIVITY STEPPER0_STALL_SENSITIVITY
+#endif
 #ifndef STEPPER0_UART_ADDRESS
 #define STEPPER0_UART_ADDRESS 0
 #endif
@@ -147,6 +205,11 @@ extern "C"
 #ifndef STEPPER1_SPI_CS
 #define STEPPER1_SPI_CS DOUT13
 #endif 
+#elif (STEPPER1_TMC_INTERFACE == TMC_SPI_CHAIN)
+// position of the driver in the chain (0 is the driver connected to the MCU SDO pin)
+#ifndef STEPPER1_SPI_CHAIN_POS
+#define STEPPER1_SPI_CHAIN_POS 1
+#endif
 #endif
 // basic parameters
 #ifndef STEPPER1_CURRENT_MA
@@ -164,6 +227,21 @@ extern "C"
 #ifndef STEPPER1_STEALTHCHOP_THERSHOLD
 #define STEPPER1_STEALTHCHOP_THERSHOLD 0
 #endif
+#ifndef STEPPER1_STEALTHCHOP_MAX_FEED
+// feed (mm/min) above which the driver switches from stealthChop to spreadCycle (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_STEALTHCHOP_FEED of the axis max feed and a negative value keeps the STEALTHCHOP_THERSHOLD value
+#define STEPPER1_STEALTHCHOP_MAX_FEED 0
+#endif
+#ifndef STEPPER1_COOLSTEP_MIN_FEED
+// feed (mm/min) above which coolStep and stallGuard are active (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_COOLSTEP_FEED of the axis max feed and a negative value disables it
+#define STEPPER1_COOLSTEP_MIN_FEED 0
+#endif
+#ifndef STEPPER1_HIGH_FEED
+// feed (mm/min) above which the driver switches to high velocity mode (TMC2130 only and requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_HIGH_FEED of the axis max feed and a negative value disables it
+#define STEPPER1_HIGH_FEED 0
+#endif
 #ifndef STEPPER1_ENABLE_INTERPLATION
 #define STEPPER1_ENABLE_INTERPLATION true
 #endif
@@ -172,6 +250,12 @@ extern "C"
 // if driver does not support stallGuard this will be ignored
 #define STEPPER1_STALL_SENSITIVITY 10
 #endif
+// uncomment to home this stepper with stallGuard (the driver DIAG output must be wired to the axis limit input)
+// #define STEPPER1_SENSORLESS_HOMING
+#ifndef STEPPER1_HOMING_SENSITIVITY
+// stallGuard threshold used while homing
+#define STEPPER1_HOMING_SENSITIVITY STEPPER1_STALL_SENSITIVITY
+#endif
 #ifndef STEPPER1_UART_ADDRESS
 #define STEPPER1_UART_ADDRESS 0
 #endif
@@ -220,6 +304,11 @@ extern "C"
 #ifndef STEPPER2_SPI_CS
 #define STEPPER2_SPI_CS DOUT14
 #endif 
+#elif (STEPPER2_TMC_INTERFACE == TMC_SPI_CHAIN)
+// position of the driver in the chain (0 is the driver connected to the MCU SDO pin)
+#ifndef STEPPER2_SPI_CHAIN_POS
+#define STEPPER2_SPI_CHAIN_POS 2
+#endif
 #endif
 // basic parameters
 #ifndef STEPPER2_CURRENT_MA
@@ -237,6 +326,21 @@ extern "C"
 #ifndef STEPPER2_STEALTHCHOP_THERSHOLD
 #define STEPPER2_STEALTHCHOP_THERSHOLD 0
 #endif
+#ifndef STEPPER2_STEALTHCHOP_MAX_FEED
+// feed (mm/min) above which the driver switches from stealthChop to spreadCycle (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_STEALTHCHOP_FEED of the axis max feed and a negative value keeps the STEALTHCHOP_THERSHOLD value
+#define STEPPER2_STEALTHCHOP_MAX_FEED 0
+#endif
+#ifndef STEPPER2_COOLSTEP_MIN_FEED
+// feed (mm/min) above which coolStep and stallGuard are active (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_COOLSTEP_FEED of the axis max feed and a negative value disables it
+#define STEPPER2_COOLSTEP_MIN_FEED 0
+#endif
+#ifndef STEPPER2_HIGH_FEED
+// feed (mm/min) above which the driver switches to high velocity mode (TMC2130 only and requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_HIGH_FEED of the axis max feed and a negative value disables it
+#define STEPPER2_HIGH_FEED 0
+#endif
 #ifndef STEPPER2_ENABLE_INTERPLATION
 #define STEPPER2_ENABLE_INTERPLATION true
 #endif
@@ -245,6 +349,12 @@ extern "C"
 // if driver does not support stallGuard this will be ignored
 #define STEPPER2_STALL_SENSITIVITY 10
 #endif
+// uncomment to home this stepper with stallGuard (the driver DIAG output must be wired to the axis limit input)
+// #define STEPPER2_SENSORLESS_HOMING
+#ifndef STEPPER2_HOMING_SENSITIVITY
+// stallGuard threshold used while homing
+#define STEPPER2_HOMING_SENSITIVITY STEPPER2_STALL_SENSITIVITY
+#endif
 #ifndef STEPPER2_UART_ADDRESS
 #define STEPPER2_UART_ADDRESS 0
 #endif
@@ -293,6 +403,11 @@ extern "C"
 #ifndef STEPPER3_SPI_CS
 #define STEPPER3_SPI_CS DOUT15
 #endif 
+#elif (STEPPER3_TMC_INTERFACE == TMC_SPI_CHAIN)
+// position of the driver in the chain (0 is the driver connected to the MCU SDO pin)
+#ifndef STEPPER3_SPI_CHAIN_POS
+#define STEPPER3_SPI_CHAIN_POS 3
+#endif
 #endif
 // basic parameters
 #ifndef STEPPER3_CURRENT_MA
@@ -310,6 +425,21 @@ extern "C"
 #ifndef STEPPER3_STEALTHCHOP_THERSHOLD
 #define STEPPER3_STEALTHCHOP_THERSHOLD 0
 #endif
+#ifndef STEPPER3_STEALTHCHOP_MAX_FEED
+// feed (mm/min) above which the driver switches from stealthChop to spreadCycle (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_STEALTHCHOP_FEED of the axis max feed and a negative value keeps the STEALTHCHOP_THERSHOLD value
+#define STEPPER3_STEALTHCHOP_MAX_FEED 0
+#endif
+#ifndef STEPPER3_COOLSTEP_MIN_FEED
+// feed (mm/min) above which coolStep and stallGuard are active (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_COOLSTEP_FEED of the axis max feed and a negative value disables it
+#define STEPPER3_COOLSTEP_MIN_FEED 0
+#endif
+#ifndef STEPPER3_HIGH_FEED
+// feed (mm/min) above which the driver switches to high velocity mode (TMC2130 only and requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_HIGH_FEED of the axis max feed and a negative value disables it
+#define STEPPER3_HIGH_FEED 0
+#endif
 #ifndef STEPPER3_ENABLE_INTERPLATION
 #define STEPPER3_ENABLE_INTERPLATION true
 #endif
@@ -318,6 +448,12 @@ extern "C"
 // if driver does not support stallGuard this will be ignored
 #define STEPPER3_STALL_SENSITIVITY 10
 #endif
+// uncomment to home this stepper with stallGuard (the driver DIAG output must be wired to the axis limit input)
+// #define STEPPER3_SENSORLESS_HOMING
+#ifndef STEPPER3_HOMING_SENSITIVITY
+// stallGuard threshold used while homing
+#define STEPPER3_HOMING_SENSITIVITY STEPPER3_STALL_SENSITIVITY
+#endif
 #ifndef STEPPER3_UART_ADDRESS
 #define STEPPER3_UART_ADDRESS 0
 #endif
@@ -366,6 +502,11 @@ extern "C"
 #ifndef STEPPER4_SPI_CS
 #define STEPPER4_SPI_CS DOUT16
 #endif 
+#elif (STEPPER4_TMC_INTERFACE == TMC_SPI_CHAIN)
+// position of the driver in the chain (0 is the driver connected to the MCU SDO pin)
+#ifndef STEPPER4_SPI_CHAIN_POS
+#define STEPPER4_SPI_CHAIN_POS 4
+#endif
 #endif
 // basic parameters
 #ifndef STEPPER4_CURRENT_MA
@@ -383,6 +524,21 @@ extern "C"
 #ifndef STEPPER4_STEALTHCHOP_THERSHOLD
 #define STEPPER4_STEALTHCHOP_THERSHOLD 0
 #endif
+#ifndef STEPPER4_STEALTHCHOP_MAX_FEED
+// feed (mm/min) above which the driver switches from stealthChop to spreadCycle (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_STEALTHCHOP_FEED of the axis max feed and a negative value keeps the STEALTHCHOP_THERSHOLD value
+#define STEPPER4_STEALTHCHOP_MAX_FEED 0
+#endif
+#ifndef STEPPER4_COOLSTEP_MIN_FEED
+// feed (mm/min) above which coolStep and stallGuard are active (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_COOLSTEP_FEED of the axis max feed and a negative value disables it
+#define STEPPER4_COOLSTEP_MIN_FEED 0
+#endif
+#ifndef STEPPER4_HIGH_FEED
+// feed (mm/min) above which the driver switches to high velocity mode (TMC2130 only and requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_HIGH_FEED of the axis max feed and a negative value disables it
+#define STEPPER4_HIGH_FEED 0
+#endif
 #ifndef STEPPER4_ENABLE_INTERPLATION
 #define STEPPER4_ENABLE_INTERPLATION true
 #endif
@@ -391,6 +547,12 @@ extern "C"
 // if driver does not support stallGuard this will be ignored
 #define STEPPER4_STALL_SENSITIVITY 10
 #endif
+// uncomment to home this stepper with stallGuard (the driver DIAG output must be wired to the axis limit input)
+// #define STEPPER4_SENSORLESS_HOMING
+#ifndef STEPPER4_HOMING_SENSITIVITY
+// stallGuard threshold used while homing
+#define STEPPER4_HOMING_SENSITIVITY STEPPER4_STALL_SENSITIVITY
+#endif
 #ifndef STEPPER4_UART_ADDRESS
 #define STEPPER4_UART_ADDRESS 0
 #endif
@@ -439,6 +601,11 @@ extern "C"
 #ifndef STEPPER5_SPI_CS
 #define STEPPER5_SPI_CS DOUT17
 #endif 
+#elif (STEPPER5_TMC_INTERFACE == TMC_SPI_CHAIN)
+// position of the driver in the chain (0 is the driver connected to the MCU SDO pin)
+#ifndef STEPPER5_SPI_CHAIN_POS
+#define STEPPER5_SPI_CHAIN_POS 5
+#endif
 #endif
 // basic parameters
 #ifndef STEPPER5_CURRENT_MA
@@ -456,6 +623,21 @@ extern "C"
 #ifndef STEPPER5_STEALTHCHOP_THERSHOLD
 #define STEPPER5_STEALTHCHOP_THERSHOLD 0
 #endif
+#ifndef STEPPER5_STEALTHCHOP_MAX_FEED
+// feed (mm/min) above which the driver switches from stealthChop to spreadCycle (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_STEALTHCHOP_FEED of the axis max feed and a negative value keeps the STEALTHCHOP_THERSHOLD value
+#define STEPPER5_STEALTHCHOP_MAX_FEED 0
+#endif
+#ifndef STEPPER5_COOLSTEP_MIN_FEED
+// feed (mm/min) above which coolStep and stallGuard are active (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_COOLSTEP_FEED of the axis max feed and a negative value disables it
+#define STEPPER5_COOLSTEP_MIN_FEED 0
+#endif
+#ifndef STEPPER5_HIGH_FEED
+// feed (mm/min) above which the driver switches to high velocity mode (TMC2130 only and requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_HIGH_FEED of the axis max feed and a negative value disables it
+#define STEPPER5_HIGH_FEED 0
+#endif
 #ifndef STEPPER5_ENABLE_INTERPLATION
 #define STEPPER5_ENABLE_INTERPLATION true
 #endif
@@ -464,6 +646,12 @@ extern "C"
 // if driver does not support stallGuard this will be ignored
 #define STEPPER5_STALL_SENSITIVITY 10
 #endif
+// uncomment to home this stepper with stallGuard (the driver DIAG output must be wired to the axis limit input)
+// #define STEPPER5_SENSORLESS_HOMING
+#ifndef STEPPER5_HOMING_SENSITIVITY
+// stallGuard threshold used while homing
+#define STEPPER5_HOMING_SENSITIVITY STEPPER5_STALL_SENSITIVITY
+#endif
 #ifndef STEPPER5_UART_ADDRESS
 #define STEPPER5_UART_ADDRESS 0
 #endif
@@ -512,6 +700,11 @@ extern "C"
 #ifndef STEPPER6_SPI_CS
 #define STEPPER6_SPI_CS DOUT18
 #endif 
+#elif (STEPPER6_TMC_INTERFACE == TMC_SPI_CHAIN)
+// position of the driver in the chain (0 is the driver connected to the MCU SDO pin)
+#ifndef STEPPER6_SPI_CHAIN_POS
+#define STEPPER6_SPI_CHAIN_POS 6
+#endif
 #endif
 // basic parameters
 #ifndef STEPPER6_CURRENT_MA
@@ -529,6 +722,21 @@ extern "C"
 #ifndef STEPPER6_STEALTHCHOP_THERSHOLD
 #define STEPPER6_STEALTHCHOP_THERSHOLD 0
 #endif
+#ifndef STEPPER6_STEALTHCHOP_MAX_FEED
+// feed (mm/min) above which the driver switches from stealthChop to spreadCycle (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_STEALTHCHOP_FEED of the axis max feed and a negative value keeps the STEALTHCHOP_THERSHOLD value
+#define STEPPER6_STEALTHCHOP_MAX_FEED 0
+#endif
+#ifndef STEPPER6_COOLSTEP_MIN_FEED
+// feed (mm/min) above which coolStep and stallGuard are active (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_COOLSTEP_FEED of the axis max feed and a negative value disables it
+#define STEPPER6_COOLSTEP_MIN_FEED 0
+#endif
+#ifndef STEPPER6_HIGH_FEED
+// feed (mm/min) above which the driver switches to high velocity mode (TMC2130 only and requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_HIGH_FEED of the axis max feed and a negative value disables it
+#define STEPPER6_HIGH_FEED 0
+#endif
 #ifndef STEPPER6_ENABLE_INTERPLATION
 #define STEPPER6_ENABLE_INTERPLATION true
 #endif
@@ -537,6 +745,12 @@ extern "C"
 // if driver does not support stallGuard this will be ignored
 #define STEPPER6_STALL_SENSITIVITY 10
 #endif
+// uncomment to home this stepper with stallGuard (the driver DIAG output must be wired to the axis limit input)
+// #define STEPPER6_SENSORLESS_HOMING
+#ifndef STEPPER6_HOMING_SENSITIVITY
+// stallGuard threshold used while homing
+#define STEPPER6_HOMING_SENSITIVITY STEPPER6_STALL_SENSITIVITY
+#endif
 #ifndef STEPPER6_UART_ADDRESS
 #define STEPPER6_UART_ADDRESS 0
 #endif
@@ -585,6 +799,11 @@ extern "C"
 #ifndef STEPPER7_SPI_CS
 #define STEPPER7_SPI_CS DOUT19
 #endif 
+#elif (STEPPER7_TMC_INTERFACE == TMC_SPI_CHAIN)
+// position of the driver in the chain (0 is the driver connected to the MCU SDO pin)
+#ifndef STEPPER7_SPI_CHAIN_POS
+#define STEPPER7_SPI_CHAIN_POS 7
+#endif
 #endif
 // basic parameters
 #ifndef STEPPER7_CURRENT_MA
@@ -602,6 +821,21 @@ extern "C"
 #ifndef STEPPER7_STEALTHCHOP_THERSHOLD
 #define STEPPER7_STEALTHCHOP_THERSHOLD 0
 #endif
+#ifndef STEPPER7_STEALTHCHOP_MAX_FEED
+// feed (mm/min) above which the driver switches from stealthChop to spreadCycle (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_STEALTHCHOP_FEED of the axis max feed and a negative value keeps the STEALTHCHOP_THERSHOLD value
+#define STEPPER7_STEALTHCHOP_MAX_FEED 0
+#endif
+#ifndef STEPPER7_COOLSTEP_MIN_FEED
+// feed (mm/min) above which coolStep and stallGuard are active (requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_COOLSTEP_FEED of the axis max feed and a negative value disables it
+#define STEPPER7_COOLSTEP_MIN_FEED 0
+#endif
+#ifndef STEPPER7_HIGH_FEED
+// feed (mm/min) above which the driver switches to high velocity mode (TMC2130 only and requires ENABLE_TMC_VELOCITY_SCHEDULING)
+// 0 uses TMC_VELOCITY_HIGH_FEED of the axis max feed and a negative value disables it
+#define STEPPER7_HIGH_FEED 0
+#endif
 #ifndef STEPPER7_ENABLE_INTERPLATION
 #define STEPPER7_ENABLE_INTERPLATION true
 #endif
@@ -610,6 +844,12 @@ extern "C"
 // if driver does not support stallGuard this will be ignored
 #define STEPPER7_STALL_SENSITIVITY 10
 #endif
+// uncomment to home this stepper with stallGuard (the driver DIAG output must be wired to the axis limit input)
+// #define STEPPER7_SENSORLESS_HOMING
+#ifndef STEPPER7_HOMING_SENSITIVITY
+// stallGuard threshold used while homing
+#define STEPPER7_HOMING_SENSITIVITY STEPPER7_STALL_SENSITIVITY
+#endif
 #ifndef STEPPER7_UART_ADDRESS
 #define STEPPER7_UART_ADDRESS 0
 #endif
@@ -619,6 +859,137 @@ extern "C"
 #define ENABLE_TMC_DRIVER_MODULE
 #endif
 
+// sensorless homing
+// while homing, stallGuard is armed on the steppers with STEPPERx_SENSORLESS_HOMING and the chopper settings are restored after homing
+// stall detection is only active above a fraction of the homing slow feed rate (TCOOLTHRS) so the acceleration phase is ignored
+#if (defined(STEPPER0_HAS_TMC) && defined(STEPPER0_SENSORLESS_HOMING)) || (defined(STEPPER1_HAS_TMC) && defined(STEPPER1_SENSORLESS_HOMING)) || (defined(STEPPER2_HAS_TMC) && defined(STEPPER2_SENSORLESS_HOMING)) || (defined(STEPPER3_HAS_TMC) && defined(STEPPER3_SENSORLESS_HOMING)) || (defined(STEPPER4_HAS_TMC) && defined(STEPPER4_SENSORLESS_HOMING)) || (defined(STEPPER5_HAS_TMC) && defined(STEPPER5_SENSORLESS_HOMING)) || (defined(STEPPER6_HAS_TMC) && defined(STEPPER6_SENSORLESS_HOMING)) || (defined(STEPPER7_HAS_TMC) && defined(STEPPER7_SENSORLESS_HOMING))
+#define ENABLE_TMC_SENSORLESS_HOMING
+#ifndef TMC_SENSORLESS_VELOCITY_FACTOR
+#define TMC_SENSORLESS_VELOCITY_FACTOR 0.8f
+#endif
+#endif
+// the drivers are configured from the homing motion start and finish events
+#if defined(ENABLE_TMC_SENSORLESS_HOMING) && !defined(ENABLE_MOTION_CONTROL_MODULES)
+#warning "Sensorless homing needs ENABLE_MOTION_CONTROL_MODULES. Sensorless homing will be disabled."
+#undef ENABLE_TMC_SENSORLESS_HOMING
+#endif
+
+// automatic microstepping
+// selects the highest microstepping of each axis that keeps the max feed step rate bellow F_STEP_MAX
+// the axis steps per mm settings must be set for the STEPPERx_MICROSTEP resolution and are rescaled to the selected microstepping
+// #define ENABLE_TMC_AUTO_MICROSTEP
+#ifdef ENABLE_TMC_AUTO_MICROSTEP
+#ifndef TMC_AUTO_MICROSTEP_MAX
+#define TMC_AUTO_MICROSTEP_MAX 256
+#endif
+// fraction of F_STEP_MAX available at max feed
+#ifndef TMC_AUTO_MICROSTEP_MARGIN
+#define TMC_AUTO_MICROSTEP_MARGIN 0.9f
+#endif
+#endif
+
+// velocity based chopper mode and coolStep scheduling
+// converts the STEPPERx_STEALTHCHOP_MAX_FEED, STEPPERx_COOLSTEP_MIN_FEED and STEPPERx_HIGH_FEED velocities to TSTEP units
+// using the axis steps per mm and the driver microstepping and keeps TPWMTHRS, TCOOLTHRS and THIGH updated
+// the stealthChop threshold set with M913 takes precedence over the scheduled one
+// #define ENABLE_TMC_VELOCITY_SCHEDULING
+#ifdef ENABLE_TMC_VELOCITY_SCHEDULING
+// minimum time between threshold updates (one driver is checked per update)
+#ifndef TMC_VELOCITY_UPDATE_MS
+#define TMC_VELOCITY_UPDATE_MS 250
+#endif
+// default feeds as a fraction of the axis max feed ($110-$11x) for the steppers without a STEPPERx feed value (0 disables it)
+#ifndef TMC_VELOCITY_STEALTHCHOP_FEED
+#define TMC_VELOCITY_STEALTHCHOP_FEED 0.3f
+#endif
+// coolStep and stallGuard change the motor current and the stall output so TCOOLTHRS is only set when enabled (for example 0.3f)
+#ifndef TMC_VELOCITY_COOLSTEP_FEED
+#define TMC_VELOCITY_COOLSTEP_FEED 0
+#endif
+#ifndef TMC_VELOCITY_HIGH_FEED
+#define TMC_VELOCITY_HIGH_FEED 0
+#endif
+#endif
+
+// planner driven run current scaling
+// the run current of each driver is computed when the block is queued from the stepper acceleration and feed relative to the limits of its axis
+// and is set when the block starts (the larger of the current and the next block)
+// the result is always clamped between TMC_DYNAMIC_CURRENT_MIN and TMC_DYNAMIC_CURRENT_MAX of the configured RMS current
+// only SPI drivers are scaled (UART drivers would stall the step generation and are left at the configured current)
+// #define ENABLE_TMC_DYNAMIC_CURRENT
+#if defined(ENABLE_TMC_DYNAMIC_CURRENT) && !defined(ENABLE_MOTION_CONTROL_MODULES)
+#warning "Dynamic current needs ENABLE_MOTION_CONTROL_MODULES. Dynamic current will be disabled."
+#undef ENABLE_TMC_DYNAMIC_CURRENT
+#endif
+#ifdef ENABLE_TMC_DYNAMIC_CURRENT
+#ifndef TMC_DYNAMIC_CURRENT_UPDATE_MS
+#define TMC_DYNAMIC_CURRENT_UPDATE_MS 5
+#endif
+// time without motion before dropping to the minimum run current and the hold current
+#ifndef TMC_DYNAMIC_CURRENT_IDLE_MS
+#define TMC_DYNAMIC_CURRENT_IDLE_MS 500
+#endif
+#ifndef TMC_DYNAMIC_CURRENT_MIN
+#define TMC_DYNAMIC_CURRENT_MIN 0.6f
+#endif
+#ifndef TMC_DYNAMIC_CURRENT_MAX
+#define TMC_DYNAMIC_CURRENT_MAX 1.0f
+#endif
+#ifndef TMC_DYNAMIC_CURRENT_ACCEL_GAIN
+#define TMC_DYNAMIC_CURRENT_ACCEL_GAIN 0.3f
+#endif
+#ifndef TMC_DYNAMIC_CURRENT_FEED_GAIN
+#define TMC_DYNAMIC_CURRENT_FEED_GAIN 0.1f
+#endif
+#endif
+
+// continuous telemetry (stallGuard load, actual current scale and status flags)
+// drivers are sampled one at a time in the main loop
+// drivers on a UART interface are only sampled while the machine is not moving (the transfer blocks the interrupts)
+// #define ENABLE_TMC_TELEMETRY
+#ifdef ENABLE_TMC_TELEMETRY
+// time between consecutive samples (each sample reads a single driver)
+#ifndef TMC_TELEMETRY_INTERVAL_MS
+#define TMC_TELEMETRY_INTERVAL_MS 10
+#endif
+// number of samples stored per driver
+#ifndef TMC_TELEMETRY_BUFFER_SIZE
+#define TMC_TELEMETRY_BUFFER_SIZE 8
+#endif
+// the alarm hook is called if SG_RESULT drops bellow this value while the motor is moving (0 disables)
+#ifndef TMC_TELEMETRY_SG_ALARM
+#define TMC_TELEMETRY_SG_ALARM 0
+#endif
+// the alarm hook is called if any of these flags is set
+#ifndef TMC_TELEMETRY_FLAGS_ALARM
+#define TMC_TELEMETRY_FLAGS_ALARM (TMC_TELEMETRY_OT | TMC_TELEMETRY_S2G | TMC_TELEMETRY_STALL)
+#endif
+#endif
+
+#if (defined(STEPPER0_HAS_TMC) && (STEPPER0_TMC_INTERFACE == TMC_SIM)) || (defined(STEPPER1_HAS_TMC) && (STEPPER1_TMC_INTERFACE == TMC_SIM)) || (defined(STEPPER2_HAS_TMC) && (STEPPER2_TMC_INTERFACE == TMC_SIM)) || (defined(STEPPER3_HAS_TMC) && (STEPPER3_TMC_INTERFACE == TMC_SIM)) || (defined(STEPPER4_HAS_TMC) && (STEPPER4_TMC_INTERFACE == TMC_SIM)) || (defined(STEPPER5_HAS_TMC) && (STEPPER5_TMC_INTERFACE == TMC_SIM)) || (defined(STEPPER6_HAS_TMC) && (STEPPER6_TMC_INTERFACE == TMC_SIM)) || (defined(STEPPER7_HAS_TMC) && (STEPPER7_TMC_INTERFACE == TMC_SIM))
+#define ENABLE_TMC_SIM
+#endif
+
+#ifdef ENABLE_TMC_SIM
+#include "tmc_sim.h"
+#endif
+
+#if (defined(STEPPER0_HAS_TMC) && (STEPPER0_TMC_INTERFACE == TMC_SPI_CHAIN)) || (defined(STEPPER1_HAS_TMC) && (STEPPER1_TMC_INTERFACE == TMC_SPI_CHAIN)) || (defined(STEPPER2_HAS_TMC) && (STEPPER2_TMC_INTERFACE == TMC_SPI_CHAIN)) || (defined(STEPPER3_HAS_TMC) && (STEPPER3_TMC_INTERFACE == TMC_SPI_CHAIN)) || (defined(STEPPER4_HAS_TMC) && (STEPPER4_TMC_INTERFACE == TMC_SPI_CHAIN)) || (defined(STEPPER5_HAS_TMC) && (STEPPER5_TMC_INTERFACE == TMC_SPI_CHAIN)) || (defined(STEPPER6_HAS_TMC) && (STEPPER6_TMC_INTERFACE == TMC_SPI_CHAIN)) || (defined(STEPPER7_HAS_TMC) && (STEPPER7_TMC_INTERFACE == TMC_SPI_CHAIN))
+#define ENABLE_TMC_SPI_CHAIN
+#ifndef TMC_SPI_CHAIN_LENGTH
+#error "TMC_SPI_CHAIN_LENGTH must be set to the number of drivers in the SPI daisy chain"
+#elif (TMC_SPI_CHAIN_LENGTH > TMC_CHAIN_MAX_LENGTH)
+#error "TMC_SPI_CHAIN_LENGTH exceeds the maximum chain length"
+#endif
+#if (TMC_SPI_CHAIN_INTERFACE == TMC_SPI)
+#if (!ASSERT_PIN(TMC_SPI_CHAIN_SDO) || !ASSERT_PIN(TMC_SPI_CHAIN_SDI) || !ASSERT_PIN(TMC_SPI_CHAIN_CLK) || !ASSERT_PIN(TMC_SPI_CHAIN_CS))
+#error "TMC SPI chain undefined SPI pins"
+#endif
+#elif (!ASSERT_PIN(TMC_SPI_CHAIN_CS))
+#error "TMC SPI chain undefined CS pin"
+#endif
+#endif
+
 #ifdef STEPPER0_HAS_TMC
 #if (STEPPER0_TMC_INTERFACE == TMC_UART)
 // if driver uses uart set pins
@@ -836,6 +1207,21 @@ extern "C"
 #endif
 #endif
 
+#ifdef ENABLE_TMC_DRIVER_MODULE
+	void tmc_driver_update_all(tmc_set_param_callback cb);
+	void tmc_driver_read_all(uint8_t address, uint32_t *values);
+	tmc_driver_t *tmc_driver_get(uint8_t stepper);
+	tmc_driver_setting_t *tmc_driver_get_settings(uint8_t stepper);
+#ifdef ENABLE_TMC_SIM
+	tmc_sim_t *tmc_driver_get_sim(uint8_t stepper);
+#endif
+#ifdef ENABLE_TMC_TELEMETRY
+	// called with the stepper index and sample that triggered the alarm
+	DECL_HOOK(tmc_telemetry_alarm, uint8_t, tmc_telemetry_t *);
+	bool tmc_telemetry_get(uint8_t stepper, tmc_telemetry_t *sample);
+#endif
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,322 @@
+/*
+	Name: tmc_sim.c
+	Description: Software model of Trinamic stepper drivers for testing the TMC driver without hardware.
+		The model replaces the driver rw callback and implements the UART (TMC22xx) and SPI (TMC2130) datagrams,
+		register access rules, the interface counter and the GSTAT reset flag.
+		Bus statistics can be used to measure the number of transactions and bytes of each operation.
+
+	Copyright: Copyright (c) João Martins
+	Author: João Martins
+	Date: 19-10-2026
+
+	µCNC is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version. Please see <http://www.gnu.org/licenses/>
+
+	µCNC is distributed WITHOUT ANY WARRANTY;
+	Also without the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the	GNU General Public License for more details.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "tmc.h"
+#include "tmc_sim.h"
+
+#define TSTEP 0x12 // R
+
+#define TMC_SIM_READ 1
+#define TMC_SIM_WRITE 2
+
+// SPI status byte
+#define TMC_SIM_SPI_RESET_FLAG (1 << 0)
+#define TMC_SIM_SPI_DRIVER_ERROR (1 << 1)
+#define TMC_SIM_SPI_SG2 (1 << 2)
+#define TMC_SIM_SPI_STANDSTILL (1 << 3)
+
+uint8_t tmc_crc8(uint8_t *data, uint8_t len);
+
+// register access rules of each driver type
+static uint8_t tmc_sim_access(tmc_sim_t *sim, uint8_t address)
+{
+	switch (address)
+	{
+	case GCONF:
+	case CHOPCONF:
+		return (TMC_SIM_READ | TMC_SIM_WRITE);
+	case GSTAT:
+		// write clears the flags
+		return (TMC_SIM_READ | TMC_SIM_WRITE);
+	case PWMCONF:
+		return (sim->type == 2130) ? TMC_SIM_WRITE : (TMC_SIM_READ | TMC_SIM_WRITE);
+	case IFCNT:
+		return (sim->type == 2130) ? 0 : TMC_SIM_READ;
+	case IHOLD_IRUN:
+	case TPOWERDOWN:
+	case TPWMTHRS:
+		return TMC_SIM_WRITE;
+	case TSTEP:
+	case DRV_STATUS:
+		return TMC_SIM_READ;
+	case TCOOLTHRS:
+		return (sim->type == 2209 || sim->type == 2226 || sim->type == 2130) ? TMC_SIM_WRITE : 0;
+	case SGTHRS:
+		return (sim->type == 2209 || sim->type == 2226) ? TMC_SIM_WRITE : 0;
+	case SG_RESULT:
+		return (sim->type == 2209 || sim->type == 2226) ? TMC_SIM_READ : 0;
+	case THIGH:
+	case COOLCONF:
+		return (sim->type == 2130) ? TMC_SIM_WRITE : 0;
+	}
+
+	return 0;
+}
+
+// value returned by a bus read
+static uint32_t tmc_sim_read(tmc_sim_t *sim, uint8_t address)
+{
+	if (!(tmc_sim_access(sim, address) & TMC_SIM_READ))
+	{
+		// write only or unimplemented registers read as 0
+		return 0;
+	}
+
+	uint32_t val = sim->regs[address];
+	if (address == DRV_STATUS)
+	{
+		// the actual current scale follows IRUN
+		TMC_SET_FIELD(val, DRV_STATUS_CS_ACTUAL, TMC_GET_FIELD(sim->regs[IHOLD_IRUN], IHOLD_IRUN_IRUN));
+	}
+
+	return val;
+}
+
+static void tmc_sim_write(tmc_sim_t *sim, uint8_t address, uint32_t val)
+{
+	if (!(tmc_sim_access(sim, address) & TMC_SIM_WRITE))
+	{
+		return;
+	}
+
+	if (address == GSTAT)
+	{
+		sim->regs[GSTAT] &= ~val;
+		return;
+	}
+
+	sim->regs[address] = val;
+}
+
+void tmc_sim_reset(tmc_sim_t *sim)
+{
+	memset(sim->regs, 0, sizeof(sim->regs));
+	sim->spi_next = 0;
+
+	switch (sim->type)
+	{
+	case 2130:
+		sim->regs[PWMCONF] = 0x00050480;
+		sim->regs[DRV_STATUS] = DRV_STATUS_STST_MASK;
+		break;
+	default:
+		sim->regs[GCONF] = 0x00000041;
+		sim->regs[PWMCONF] = 0xC10D0024;
+		sim->regs[TPOWERDOWN] = 0x00000014;
+		sim->regs[DRV_STATUS] = DRV_STATUS_STST_MASK;
+		break;
+	}
+
+	sim->regs[CHOPCONF] = 0x10000053;
+	sim->regs[IHOLD_IRUN] = 0x00071703;
+	sim->regs[GSTAT] = GSTAT_RESET_MASK;
+}
+
+void tmc_sim_init(tmc_sim_t *sim, uint16_t type, uint8_t slave)
+{
+	memset(sim, 0, sizeof(tmc_sim_t));
+	sim->type = type;
+	sim->slave = slave;
+	tmc_sim_reset(sim);
+}
+
+uint32_t tmc_sim_peek(tmc_sim_t *sim, uint8_t address)
+{
+	return sim->regs[address & 0x7F];
+}
+
+void tmc_sim_poke(tmc_sim_t *sim, uint8_t address, uint32_t val)
+{
+	sim->regs[address & 0x7F] = val;
+}
+
+void tmc_sim_fault(tmc_sim_t *sim, uint8_t faults, uint8_t count)
+{
+	sim->faults = faults;
+	sim->fault_count = count;
+}
+
+void tmc_sim_clear_stats(tmc_sim_t *sim)
+{
+	memset(&sim->stats, 0, sizeof(tmc_sim_stats_t));
+}
+
+static void tmc_sim_uart(tmc_sim_t *sim, uint8_t *data, uint8_t wlen, uint8_t rlen, uint8_t faults)
+{
+	uint8_t request[8];
+	memcpy(request, data, (wlen < 8) ? wlen : 8);
+	// nothing answers by default (idle line)
+	memset(data, 0xFF, rlen);
+
+	if (faults & TMC_SIM_FAULT_TIMEOUT)
+	{
+		return;
+	}
+
+	// 2208 and 2225 have no slave address and respond to any address
+	bool addressed = (request[1] == sim->slave) || (sim->type == 2208 || sim->type == 2225 || sim->type == 2202);
+
+	if (wlen == 8 && (request[2] & 0x80))
+	{
+		sim->stats.writes++;
+		if ((request[0] & 0x0F) != 0x05 || !addressed || tmc_crc8(request, 7) != request[7])
+		{
+			sim->stats.rejected++;
+			return;
+		}
+
+		if (faults & TMC_SIM_FAULT_DROP_WRITE)
+		{
+			return;
+		}
+
+		uint32_t val = ((uint32_t)request[3] << 24) | ((uint32_t)request[4] << 16) | ((uint32_t)request[5] << 8) | request[6];
+		tmc_sim_write(sim, request[2] & 0x7F, val);
+		// every successful write increments the interface counter
+		sim->regs[IFCNT] = (sim->regs[IFCNT] + 1) & 0xFF;
+		return;
+	}
+
+	if (wlen == 4)
+	{
+		sim->stats.reads++;
+		if ((request[0] & 0x0F) != 0x05 || !addressed || tmc_crc8(request, 3) != request[3])
+		{
+			sim->stats.rejected++;
+			return;
+		}
+
+		if (rlen < 8)
+		{
+			return;
+		}
+
+		uint32_t val = tmc_sim_read(sim, request[2] & 0x7F);
+		data[0] = 0x05;
+		data[1] = 0xFF;
+		data[2] = request[2] & 0x7F;
+		data[3] = (val >> 24) & 0xFF;
+		data[4] = (val >> 16) & 0xFF;
+		data[5] = (val >> 8) & 0xFF;
+		data[6] = (val) & 0xFF;
+		data[7] = tmc_crc8(data, 7);
+		if (faults & TMC_SIM_FAULT_CRC)
+		{
+			data[7] ^= 0xFF;
+		}
+		return;
+	}
+
+	sim->stats.rejected++;
+}
+
+static void tmc_sim_spi(tmc_sim_t *sim, uint8_t *data, uint8_t wlen, uint8_t rlen, uint8_t faults)
+{
+	if (wlen != 5)
+	{
+		sim->stats.rejected++;
+		return;
+	}
+
+	if (faults & TMC_SIM_FAULT_TIMEOUT)
+	{
+		// no device on the bus
+		memset(data, 0xFF, 5);
+		return;
+	}
+
+	uint8_t address = data[0];
+	uint32_t val = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 8) | data[4];
+
+	// the reply holds the value addressed by the previous datagram
+	uint32_t reply = tmc_sim_read(sim, sim->spi_next);
+	uint32_t drv_status = sim->regs[DRV_STATUS];
+	uint8_t status = 0;
+	status |= (sim->regs[GSTAT] & GSTAT_RESET_MASK) ? TMC_SIM_SPI_RESET_FLAG : 0;
+	status |= (sim->regs[GSTAT] & 0x02) ? TMC_SIM_SPI_DRIVER_ERROR : 0;
+	status |= (TMC_GET_FIELD(drv_status, DRV_STATUS_STALLGUARD)) ? TMC_SIM_SPI_SG2 : 0;
+	status |= (TMC_GET_FIELD(drv_status, DRV_STATUS_STST)) ? TMC_SIM_SPI_STANDSTILL : 0;
+
+	if (address & 0x80)
+	{
+		sim->stats.writes++;
+		if (!(faults & TMC_SIM_FAULT_DROP_WRITE))
+		{
+			tmc_sim_write(sim, address & 0x7F, val);
+		}
+	}
+	else
+	{
+		sim->stats.reads++;
+	}
+	sim->spi_next = address & 0x7F;
+
+	if (faults & TMC_SIM_FAULT_CRC)
+	{
+		// SPI has no CRC so the reply data is corrupted instead
+		reply ^= 0x00000001;
+	}
+
+	if (rlen >= 5)
+	{
+		data[0] = status;
+		data[1] = (reply >> 24) & 0xFF;
+		data[2] = (reply >> 16) & 0xFF;
+		data[3] = (reply >> 8) & 0xFF;
+		data[4] = (reply) & 0xFF;
+	}
+}
+
+void tmc_sim_rw(tmc_sim_t *sim, uint8_t *data, uint8_t wlen, uint8_t rlen)
+{
+	uint8_t faults = 0;
+
+	if (sim->fault_count)
+	{
+		faults = sim->faults;
+		if (!(--sim->fault_count))
+		{
+			sim->faults = 0;
+		}
+	}
+
+	if (faults & TMC_SIM_FAULT_RESET)
+	{
+		tmc_sim_reset(sim);
+	}
+
+	sim->stats.transactions++;
+	sim->stats.tx_bytes += wlen;
+	sim->stats.rx_bytes += rlen;
+
+	switch (sim->type)
+	{
+	case 2130:
+		tmc_sim_spi(sim, data, wlen, rlen, faults);
+		break;
+	default:
+		tmc_sim_uart(sim, data, wlen, rlen, faults);
+		break;
+	}
+}
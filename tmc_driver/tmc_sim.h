@@ -0,0 +1,85 @@
+/*
+	Name: tmc_sim.h
+	Description: Software model of Trinamic stepper drivers for testing the TMC driver without hardware.
+
+	Copyright: Copyright (c) João Martins
+	Author: João Martins
+	Date: 19-10-2026
+
+	µCNC is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version. Please see <http://www.gnu.org/licenses/>
+
+	µCNC is distributed WITHOUT ANY WARRANTY;
+	Also without the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+	See the	GNU General Public License for more details.
+*/
+
+#ifndef TMC_SIM_H
+#define TMC_SIM_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "tmc.h"
+
+// fault injection flags
+// corrupts the CRC of the next replies
+#define TMC_SIM_FAULT_CRC (1 << 0)
+// the next requests get no reply (the bus reads as idle 0xFF)
+#define TMC_SIM_FAULT_TIMEOUT (1 << 1)
+// the next writes are discarded (IFCNT does not increment)
+#define TMC_SIM_FAULT_DROP_WRITE (1 << 2)
+// the driver resets (power loss) before the next request
+#define TMC_SIM_FAULT_RESET (1 << 3)
+
+	typedef struct
+	{
+		// number of rw callback calls
+		uint32_t transactions;
+		uint32_t reads;
+		uint32_t writes;
+		// bytes sent by the MCU and received from the driver
+		uint32_t tx_bytes;
+		uint32_t rx_bytes;
+		// requests rejected by the driver (bad CRC, sync or slave address)
+		uint32_t rejected;
+	} tmc_sim_stats_t;
+
+	typedef struct
+	{
+		// identifies the type of driver (2208, 2209, 2225, 2226 or 2130)
+		uint16_t type;
+		uint8_t slave;
+		// register file (write only registers keep the written value and can be inspected with tmc_sim_peek)
+		uint32_t regs[128];
+		// SPI replies return the value requested in the previous datagram
+		uint8_t spi_next;
+		// active fault injection flags and number of transactions they apply to
+		uint8_t faults;
+		uint8_t fault_count;
+		tmc_sim_stats_t stats;
+	} tmc_sim_t;
+
+	void tmc_sim_init(tmc_sim_t *sim, uint16_t type, uint8_t slave);
+	void tmc_sim_reset(tmc_sim_t *sim);
+	// rw callback implementation (same arguments as tmc_rw)
+	void tmc_sim_rw(tmc_sim_t *sim, uint8_t *data, uint8_t wlen, uint8_t rlen);
+	// register value as stored by the model (including write only registers)
+	uint32_t tmc_sim_peek(tmc_sim_t *sim, uint8_t address);
+	// sets a register value bypassing the bus (to simulate load, status flags, etc...)
+	void tmc_sim_poke(tmc_sim_t *sim, uint8_t address, uint32_t val);
+	// applies the fault flags to the next count transactions
+	void tmc_sim_fault(tmc_sim_t *sim, uint8_t faults, uint8_t count);
+	void tmc_sim_clear_stats(tmc_sim_t *sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif